@@ -23,8 +23,7 @@ static LRUNode* tail = NULL;
 /* Current number of entries in cache */
 static int current_size = 0;
 
-/* Hash table mapping keys to nodes for O(1) access */
-#define HASH_SIZE 103  /* A small prime number for decent distribution */
+/* Hash table mapping keys to nodes for O(1) access (HASH_SIZE in cache.h) */
 static LRUNode* hash_table[HASH_SIZE];
 
 /* Cache hit/miss statistics */
@@ -34,7 +33,19 @@ static CacheStats stats;
  * Simple hash function for mapping keys to indices.
  */
 static int hash(int key) {
-    return key % HASH_SIZE;
+    return (int)((unsigned)key % HASH_SIZE);
+}
+
+/**
+ * Linear probing: the slot holding key, or the empty slot where it
+ * would go.
+ */
+static int find_slot(int key) {
+    int h = hash(key);
+    while (hash_table[h] && hash_table[h]->key != key) {
+        h = (h + 1) % HASH_SIZE;
+    }
+    return h;
 }
 
 /****************************************************
@@ -89,12 +100,18 @@ static void evict_if_needed() {
 
     remove_node(lru);
 
-    // Remove from hash table
-    int h = hash(lru->key);
-    while (hash_table[h] && hash_table[h]->key != lru->key) {
-        h = (h + 1) % HASH_SIZE;
-    }
+    // Remove from hash table, then pull later entries of the probe run
+    // back over the hole so that lookups never stop short of them
+    int h = find_slot(lru->key);
     hash_table[h] = NULL;
+    for (int j = (h + 1) % HASH_SIZE; hash_table[j]; j = (j + 1) % HASH_SIZE) {
+        int home = hash(hash_table[j]->key);
+        int stays = (h <= j) ? (h < home && home <= j) : (h < home || home <= j);
+        if (stays) continue;
+        hash_table[h] = hash_table[j];
+        hash_table[j] = NULL;
+        h = j;
+    }
 
     // Free message and node
     if (lru->value) free(lru->value);
@@ -102,20 +119,34 @@ static void evict_if_needed() {
     current_size--;
 }
 
+/**
+ * Inserts msg (taking ownership) at the MRU position, evicting the
+ * LRU entry first if the cache is full.  key must not be cached.
+ */
+static void insert_node(Message* msg) {
+    evict_if_needed();
+
+    LRUNode* new_node = (LRUNode*)malloc(sizeof(LRUNode));
+    new_node->key = msg->id;
+    new_node->value = msg;
+
+    add_node_to_tail(new_node);
+    hash_table[find_slot(msg->id)] = new_node;
+    current_size++;
+}
+
 /****************************************************
  * get_msg_from_cache_or_disk
  * 
  * Retrieves a message from cache if available, updating its
  * position in the LRU list. If not cached, loads from disk,
- * inserts it into the cache, and returns it.
+ * inserts it into the cache, and returns it.  The file was just
+ * read, so it is not written back.
  ****************************************************/
 Message* get_msg_from_cache_or_disk(int msg_id) {
-    int h = hash(msg_id);
-    while (hash_table[h] && hash_table[h]->key != msg_id) {
-        h = (h + 1) % HASH_SIZE;
-    }
+    int h = find_slot(msg_id);
 
-    if (hash_table[h] && hash_table[h]->key == msg_id) {
+    if (hash_table[h]) {
         // Cache hit
         stats.hits++;
         LRUNode* node = hash_table[h];
@@ -129,7 +160,7 @@ Message* get_msg_from_cache_or_disk(int msg_id) {
     Message* msg = retrieve_msg(msg_id);
     if (!msg) return NULL;
 
-    put_msg(msg);  // Add to cache and store to disk
+    insert_node(msg);  // the cache owns it from here
     return msg;
 }
 
@@ -139,13 +170,14 @@ Message* get_msg_from_cache_or_disk(int msg_id) {
  * Stores a message into the cache. If the message is already
  * cached, it updates the content and moves it to the MRU position.
  * If it's a new message, it inserts it, evicting the LRU if needed.
- * Also calls store_msg() for write-through persistence.
+ * Writes through with store_msg() first, so a message that failed
+ * to reach the disk is never served from the cache.
  ****************************************************/
-void put_msg(const Message* msg) {
-    int h = hash(msg->id);
-    while (hash_table[h] && hash_table[h]->key != msg->id) {
-        h = (h + 1) % HASH_SIZE;
-    }
+int put_msg(const Message* msg) {
+    int rc = store_msg(msg);  // write-through to disk
+    if (rc != 0) return rc;
+
+    int h = find_slot(msg->id);
 
     if (hash_table[h]) {
         // Update existing
@@ -155,24 +187,11 @@ void put_msg(const Message* msg) {
         add_node_to_tail(node);
     } else {
         // Insert new
-        evict_if_needed();
-
         Message* new_msg = (Message*)malloc(sizeof(Message));
         memcpy(new_msg, msg, sizeof(Message));
-
-        LRUNode* new_node = (LRUNode*)malloc(sizeof(LRUNode));
-        new_node->key = msg->id;
-        new_node->value = new_msg;
-
-        add_node_to_tail(new_node);
-
-        // Insert into hash table
-        while (hash_table[h]) h = (h + 1) % HASH_SIZE;
-        hash_table[h] = new_node;
-        current_size++;
+        insert_node(new_msg);
     }
-
-    store_msg(msg);  // write-through to disk
+    return 0;
 }
 
 /****************************************************
@@ -190,6 +209,17 @@ void test_cache(int total_accesses, int num_messages, CacheStats* out_stats) {
     if (out_stats) *out_stats = stats;
 }
 
+/****************************************************
+ * get_cache_stats
+ * 
+ * Copies the hit/miss counters for callers that report
+ * them elsewhere (e.g. over the network).
+ ****************************************************/
+int get_cache_stats(CacheStats* out_stats) {
+    if (out_stats) *out_stats = stats;
+    return current_size;
+}
+
 /****************************************************
  * print_cache_stats
  * 
@@ -197,9 +227,9 @@ void test_cache(int total_accesses, int num_messages, CacheStats* out_stats) {
  * to standard output.
  ****************************************************/
 void print_cache_stats(const CacheStats* stats) {
-    int total = stats->hits + stats->misses;
+    unsigned long long total = stats->hits + stats->misses;
     double ratio = total ? (100.0 * stats->hits / total) : 0.0;
-    printf("Cache Hits: %d\n", stats->hits);
-    printf("Cache Misses: %d\n", stats->misses);
+    printf("Cache Hits: %llu\n", stats->hits);
+    printf("Cache Misses: %llu\n", stats->misses);
     printf("Hit Ratio: %.2f%%\n", ratio);
 }
@@ -10,12 +10,18 @@
  
  #include "message.h"
  
+ /* Both may be set on the compiler command line; HASH_SIZE must stay
+  * well above CACHE_CAPACITY (open addressing) */
+ #ifndef CACHE_CAPACITY
  #define CACHE_CAPACITY 16
+ #endif
+ #ifndef HASH_SIZE
  #define HASH_SIZE 103  // Prime number for better hash distribution
+ #endif
  
  typedef struct CacheStats {
-     int hits;
-     int misses;
+     unsigned long long hits;
+     unsigned long long misses;
  } CacheStats;
  
  /**
@@ -26,16 +32,20 @@
  /**
   * Looks up a message in the cache or retrieves it from disk.
   * Updates the cache to mark it as most recently used.
+  * Not thread-safe: callers sharing the cache must serialize.
   * @param msg_id the message ID to retrieve
-  * @return pointer to message (do not free externally), or NULL on error
+  * @return pointer to message (do not free externally; valid until the
+  *         next cache call), or NULL on error
   */
  Message* get_msg_from_cache_or_disk(int msg_id);
  
  /**
-  * Inserts a message into the cache and writes it to disk.
+  * Writes a message to disk, then inserts it into the cache.
   * Evicts the least recently used message if cache is full.
+  * @return 0 on success, non-zero if the disk write failed
+  *         (the cache is then left as it was)
   */
- void put_msg(const Message* msg);
+ int put_msg(const Message* msg);
  
  /**
   * Tests cache performance with simulated message access patterns.
@@ -45,6 +55,13 @@
   */
  void test_cache(int total_accesses, int num_messages, CacheStats* out_stats);
  
+ /**
+  * Copies the hit/miss counts since init_cache() (or the last test_cache()).
+  * @param out_stats pointer to stats struct to populate
+  * @return number of messages currently cached
+  */
+ int get_cache_stats(CacheStats* out_stats);
+ 
  /**
   * Prints hit/miss stats and hit ratio.
   */
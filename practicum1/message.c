@@ -8,6 +8,7 @@
  #include <stdlib.h>
  #include <string.h>
  #include <time.h>
+ #include <unistd.h>
  
  Message* create_msg(int id,
                      const char* sender,
@@ -46,10 +47,13 @@
      }
  
      /* Construct filename. You should ensure "messages/" directory exists. */
-     char filename[64];
+     char filename[64], tmpname[80];
      snprintf(filename, sizeof(filename), "messages/%d.msg", msg->id);
+     /* written beside it and renamed over it, so that a concurrent
+      * retrieve_msg() sees the old message or the new one, never half */
+     snprintf(tmpname, sizeof(tmpname), "%s.%d.tmp", filename, (int)getpid());
  
-     FILE* fp = fopen(filename, "wb");
+     FILE* fp = fopen(tmpname, "wb");
      if (!fp) {
          perror("store_msg: Failed to open file for writing");
          return -1;
@@ -57,10 +61,11 @@
  
      /* Write entire message struct in binary */
      size_t written = fwrite(msg, sizeof(Message), 1, fp);
-     fclose(fp);
+     int closed = fclose(fp);
  
-     if (written != 1) {
+     if (written != 1 || closed != 0 || rename(tmpname, filename) != 0) {
          fprintf(stderr, "store_msg: Error writing file.\n");
+         remove(tmpname);
          return -1;
      }
  
@@ -0,0 +1,187 @@
+/* --------------------------------------------------------------------
+ *  admit.c  –  connection / byte / rate limits and the BUSY bouncer
+ * ------------------------------------------------------------------ */
+#include "admit.h"
+#include "proto.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+
+/* per-address token buckets: open addressing on the address; a slot
+ * idle for RATE_IDLE_SECS is free for another address */
+#define RATE_SLOTS     4096
+#define RATE_IDLE_SECS 60
+/* refused sockets waiting for their peer to read BUSY and hang up */
+#define BOUNCE_MAX     1024
+#define BOUNCE_SECS    2
+
+typedef struct {
+    uint32_t ip;
+    double   tokens;
+    double   last;
+} bucket_t;
+
+static unsigned           g_max_conns;
+static unsigned long long g_max_bytes;
+static double             g_rate;
+
+static unsigned           g_conns;
+static unsigned long long g_bytes;
+static unsigned long long g_refused_conns, g_refused_rate, g_refused_bytes;
+
+static bucket_t        g_buckets[RATE_SLOTS];
+static pthread_mutex_t g_rate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct { int fd; time_t until; } g_bounce[BOUNCE_MAX];
+static int             g_nbounce;
+static pthread_mutex_t g_bounce_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_bounce_more = PTHREAD_COND_INITIALIZER;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* drain what the refused peers send and close them at EOF or timeout */
+static void *bouncer(void *unused)
+{
+    (void)unused;
+    struct pollfd p[BOUNCE_MAX];
+    char sink[4096];
+    for (;;) {
+        pthread_mutex_lock(&g_bounce_lock);
+        while (g_nbounce == 0) pthread_cond_wait(&g_bounce_more, &g_bounce_lock);
+        int n = g_nbounce;
+        for (int i = 0; i < n; ++i) p[i] = (struct pollfd){ g_bounce[i].fd, POLLIN, 0 };
+        pthread_mutex_unlock(&g_bounce_lock);
+
+        poll(p, (nfds_t)n, 100);
+
+        pthread_mutex_lock(&g_bounce_lock);
+        time_t now = time(NULL);
+        /* entries 0..n-1 are the ones polled; later ones were added
+         * meanwhile and stay for the next round */
+        for (int i = n - 1; i >= 0; --i) {
+            int done = now >= g_bounce[i].until;
+            if (!done && p[i].revents) {
+                ssize_t k = recv(p[i].fd, sink, sizeof(sink), MSG_DONTWAIT);
+                done = k == 0 || (k < 0 && errno != EAGAIN && errno != EINTR);
+            }
+            if (done) {
+                close(g_bounce[i].fd);
+                g_bounce[i] = g_bounce[--g_nbounce];
+            }
+        }
+        pthread_mutex_unlock(&g_bounce_lock);
+    }
+    return NULL;
+}
+
+void admit_init(unsigned max_conns, unsigned long long max_bytes, double rate)
+{
+    g_max_conns = max_conns;
+    g_max_bytes = max_bytes;
+    g_rate      = rate;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, bouncer, NULL) == 0) pthread_detach(tid);
+}
+
+int admit_conn(unsigned *retry_ms)
+{
+    unsigned n = __atomic_add_fetch(&g_conns, 1, __ATOMIC_RELAXED);
+    if (g_max_conns == 0 || n <= g_max_conns) return 1;
+    __atomic_sub_fetch(&g_conns, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_refused_conns, 1, __ATOMIC_RELAXED);
+    *retry_ms = ADMIT_RETRY_MS;
+    return 0;
+}
+
+void admit_conn_done(void)
+{
+    __atomic_sub_fetch(&g_conns, 1, __ATOMIC_RELAXED);
+}
+
+void admit_refuse(int s, unsigned retry_ms)
+{
+    /* fits in an empty socket buffer: never blocks */
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+    send_line(s, "BUSY retry_after_ms=%u close=1", retry_ms);
+    shutdown(s, SHUT_WR);
+    /* closing now would reset the connection if the request is
+     * already here, and a reset can discard the BUSY line unread */
+    pthread_mutex_lock(&g_bounce_lock);
+    if (g_nbounce == BOUNCE_MAX) {
+        pthread_mutex_unlock(&g_bounce_lock);
+        close(s);
+        return;
+    }
+    g_bounce[g_nbounce].fd    = s;
+    g_bounce[g_nbounce].until = time(NULL) + BOUNCE_SECS;
+    ++g_nbounce;
+    pthread_cond_signal(&g_bounce_more);
+    pthread_mutex_unlock(&g_bounce_lock);
+}
+
+int admit_request(uint32_t ip, unsigned *retry_ms)
+{
+    if (g_rate <= 0) return 1;
+    double now = now_sec();
+    pthread_mutex_lock(&g_rate_lock);
+    uint32_t h = ip * 2654435761u, i = h % RATE_SLOTS;
+    bucket_t *b = NULL;
+    for (unsigned probe = 0; probe < 8; ++probe, i = (i + 1) % RATE_SLOTS) {
+        bucket_t *s = &g_buckets[i];
+        if (s->ip == ip && s->last > 0) { b = s; break; }
+        if (!b && (s->last == 0 || now - s->last > RATE_IDLE_SECS)) b = s;
+    }
+    if (!b) b = &g_buckets[h % RATE_SLOTS];  /* crowded: share a bucket */
+    if (b->ip != ip || b->last == 0) {
+        b->ip = ip;
+        b->tokens = g_rate;                  /* one second of burst */
+        b->last = now;
+    }
+    b->tokens += (now - b->last) * g_rate;
+    if (b->tokens > g_rate) b->tokens = g_rate;
+    b->last = now;
+    int ok = b->tokens >= 1;
+    if (ok) b->tokens -= 1;
+    else    *retry_ms = (unsigned)((1 - b->tokens) / g_rate * 1000) + 1;
+    pthread_mutex_unlock(&g_rate_lock);
+    if (!ok) __atomic_add_fetch(&g_refused_rate, 1, __ATOMIC_RELAXED);
+    return ok;
+}
+
+int admit_bytes(unsigned long long n, unsigned *retry_ms)
+{
+    if (g_max_bytes == 0) return 1;
+    unsigned long long cur = __atomic_load_n(&g_bytes, __ATOMIC_RELAXED);
+    do {
+        if (cur > 0 && cur + n > g_max_bytes) {
+            __atomic_add_fetch(&g_refused_bytes, 1, __ATOMIC_RELAXED);
+            *retry_ms = ADMIT_RETRY_MS;
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&g_bytes, &cur, cur + n, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return 1;
+}
+
+void admit_bytes_done(unsigned long long n)
+{
+    if (g_max_bytes) __atomic_sub_fetch(&g_bytes, n, __ATOMIC_RELAXED);
+}
+
+void admit_get_stats(admit_stats_t *st)
+{
+    st->conns         = __atomic_load_n(&g_conns, __ATOMIC_RELAXED);
+    st->max_conns     = g_max_conns;
+    st->bytes         = __atomic_load_n(&g_bytes, __ATOMIC_RELAXED);
+    st->max_bytes     = g_max_bytes;
+    st->rate          = g_rate;
+    st->refused_conns = __atomic_load_n(&g_refused_conns, __ATOMIC_RELAXED);
+    st->refused_rate  = __atomic_load_n(&g_refused_rate, __ATOMIC_RELAXED);
+    st->refused_bytes = __atomic_load_n(&g_refused_bytes, __ATOMIC_RELAXED);
+}
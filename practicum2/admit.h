@@ -0,0 +1,51 @@
+/* --------------------------------------------------------------------
+ *  admit.h  –  admission control: how much work rfserver takes on
+ *
+ *  Three limits, each answered with "BUSY retry_after_ms=<n>" instead
+ *  of queueing the work:
+ *    connections      open client connections (-m); the accept loop
+ *                     turns extra ones away without a thread
+ *    in-flight bytes  payload of WRITE/APPEND/PUT_PART and GET bodies
+ *                     being moved right now (-b)
+ *    request rate     requests per second per client address (-r),
+ *                     a token bucket with one second of burst
+ *  Requests that get in therefore see a server that is not
+ *  overcommitted, and the rest learn at once when to come back.  A
+ *  BUSY that ends the connection says so with " close=1".
+ * ------------------------------------------------------------------ */
+#ifndef ADMIT_H
+#define ADMIT_H
+
+#include <stdint.h>
+
+typedef struct {
+    unsigned           conns, max_conns;
+    unsigned long long bytes, max_bytes;
+    double             rate;
+    unsigned long long refused_conns, refused_rate, refused_bytes;
+} admit_stats_t;
+
+/* 0 = no limit */
+void admit_init(unsigned max_conns, unsigned long long max_bytes, double rate);
+
+/* Accept loop: take one more connection, or 0 is returned and
+ * *retry_ms says when to come back.  Pair with admit_conn_done(). */
+int  admit_conn(unsigned *retry_ms);
+void admit_conn_done(void);
+
+/* Send the BUSY line on a connection we will not serve and close it
+ * once the peer has read it (a separate thread waits; never blocks). */
+void admit_refuse(int s, unsigned retry_ms);
+
+/* One request from ip (network order): 1 to serve it. */
+int  admit_request(uint32_t ip, unsigned *retry_ms);
+
+/* Reserve n payload bytes, 1 on success.  A transfer is always let in
+ * when nothing else is moving, so no single file is refused forever.
+ * Pair with admit_bytes_done(). */
+int  admit_bytes(unsigned long long n, unsigned *retry_ms);
+void admit_bytes_done(unsigned long long n);
+
+void admit_get_stats(admit_stats_t *st);
+
+#endif // ADMIT_H
@@ -0,0 +1,188 @@
+/* --------------------------------------------------------------------
+ *  cachebench.c  –  skewed GET workload: disk path vs. filecache
+ *
+ *  Creates <files> files of <size> bytes under a scratch directory and
+ *  lets <threads> readers fetch Zipf-distributed paths, first the way
+ *  handle_get() did before the cache (open + flock(SH) + read + close)
+ *  and then through filecache with fill-on-miss.
+ *
+ *  usage: cachebench [-t threads] [-n files] [-s size] [-z skew]
+ *                    [-o ops/thread] [-b budget_MB]
+ * ------------------------------------------------------------------ */
+#include "filecache.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <sys/file.h>
+#include <time.h>
+
+#define BENCH_DIR "cachebench_data"
+
+static int     g_threads = 4;
+static int     g_files   = 1000;
+static size_t  g_size    = 4096;
+static double  g_skew    = 1.0;
+static long    g_ops     = 200000;
+static size_t  g_budget  = 16u << 20;
+static double *g_cdf;                   /* Zipf CDF over file ranks */
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+    *s ^= *s << 13; *s ^= *s >> 7; *s ^= *s << 17;
+    return *s;
+}
+
+static int zipf_pick(uint64_t *rng)
+{
+    double u = (xorshift(rng) >> 11) * (1.0 / 9007199254740992.0);
+    int lo = 0, hi = g_files - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (g_cdf[mid] < u) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+/* the pre-cache handle_get() read path */
+static size_t disk_read(const char *path, char *buf, size_t cap)
+{
+    char full[BUF_SIZE];
+    snprintf(full, sizeof(full), "%s/%s", BENCH_DIR, path);
+    int fd = open(full, O_RDONLY);
+    if (fd < 0) return 0;
+    flock(fd, LOCK_SH);
+    size_t got = 0;
+    ssize_t n;
+    while (got < cap && (n = read(fd, buf + got, cap - got)) > 0)
+        got += (size_t)n;
+    flock(fd, LOCK_UN);
+    close(fd);
+    return got;
+}
+
+typedef struct { int use_cache; uint64_t seed; } worker_arg_t;
+
+static void *worker(void *arg)
+{
+    worker_arg_t *w = arg;
+    char  *buf = malloc(g_size);
+    char   path[64];
+    uint64_t rng = w->seed;
+    volatile char sink = 0;
+
+    for (long i = 0; i < g_ops; ++i) {
+        snprintf(path, sizeof(path), "f%d", zipf_pick(&rng));
+        if (!w->use_cache) {
+            sink ^= buf[disk_read(path, buf, g_size) / 2];
+            continue;
+        }
+        fc_buf_t *b = filecache_get(path);
+        if (b) {
+            sink ^= b->data[b->len / 2];
+            filecache_release(b);
+        } else {
+            uint64_t gen = filecache_generation(path);
+            size_t n = disk_read(path, buf, g_size);
+            filecache_put(path, buf, n, gen, NULL, 0);
+            sink ^= buf[n / 2];
+        }
+    }
+    (void)sink;
+    free(buf);
+    return NULL;
+}
+
+static double run(int use_cache)
+{
+    pthread_t    tid[g_threads];
+    worker_arg_t args[g_threads];
+    double t0 = now_sec();
+    for (int i = 0; i < g_threads; ++i) {
+        args[i] = (worker_arg_t){ use_cache, 0x9e3779b97f4a7c15ULL * (i + 1) };
+        pthread_create(&tid[i], NULL, worker, &args[i]);
+    }
+    for (int i = 0; i < g_threads; ++i)
+        pthread_join(tid[i], NULL);
+    return g_threads * g_ops / (now_sec() - t0);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:s:z:o:b:")) != -1) {
+        switch (opt) {
+        case 't': g_threads = atoi(optarg);                    break;
+        case 'n': g_files   = atoi(optarg);                    break;
+        case 's': g_size    = strtoul(optarg, NULL, 10);       break;
+        case 'z': g_skew    = atof(optarg);                    break;
+        case 'o': g_ops     = atol(optarg);                    break;
+        case 'b': g_budget  = strtoul(optarg, NULL, 10) << 20; break;
+        default:
+            fprintf(stderr, "usage: %s [-t threads] [-n files] [-s size] "
+                            "[-z skew] [-o ops] [-b budget_MB]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (g_threads < 1 || g_files < 1 || g_size < 1) return 1;
+
+    /* Zipf(s) CDF: P(rank k) ~ 1 / k^s */
+    g_cdf = malloc(sizeof(double) * g_files);
+    double sum = 0;
+    for (int k = 0; k < g_files; ++k)
+        sum += 1.0 / pow(k + 1, g_skew);
+    double acc = 0;
+    for (int k = 0; k < g_files; ++k) {
+        acc += 1.0 / pow(k + 1, g_skew) / sum;
+        g_cdf[k] = acc;
+    }
+
+    mkdir(BENCH_DIR, 0777);
+    char *blob = malloc(g_size);
+    memset(blob, 'x', g_size);
+    for (int k = 0; k < g_files; ++k) {
+        char full[BUF_SIZE];
+        snprintf(full, sizeof(full), "%s/f%d", BENCH_DIR, k);
+        FILE *fp = fopen(full, "wb");
+        if (!fp) { perror("fopen"); return 1; }
+        fwrite(blob, 1, g_size, fp);
+        fclose(fp);
+    }
+    free(blob);
+
+    printf("threads=%d files=%d size=%zu skew=%.2f ops/thread=%ld "
+           "budget=%zuMB\n", g_threads, g_files, g_size, g_skew, g_ops,
+           g_budget >> 20);
+
+    double disk = run(0);
+    printf("disk  (open+flock+read): %10.0f GET/s\n", disk);
+
+    filecache_init(g_budget, g_size);
+    double cached = run(1);
+    printf("cache (filecache)      : %10.0f GET/s  (x%.1f)\n",
+           cached, cached / disk);
+
+    fc_stats_t st;
+    filecache_get_stats(&st);
+    printf("hits=%llu misses=%llu hit_ratio=%.2f%% evictions=%llu "
+           "entries=%llu bytes=%llu\n",
+           (unsigned long long)st.hits, (unsigned long long)st.misses,
+           100.0 * st.hits / (st.hits + st.misses ? st.hits + st.misses : 1),
+           (unsigned long long)st.evictions,
+           (unsigned long long)st.entries, (unsigned long long)st.bytes);
+
+    for (int k = 0; k < g_files; ++k) {
+        char full[BUF_SIZE];
+        snprintf(full, sizeof(full), "%s/f%d", BENCH_DIR, k);
+        unlink(full);
+    }
+    rmdir(BENCH_DIR);
+    free(g_cdf);
+    return 0;
+}
@@ -0,0 +1,40 @@
+/* --------------------------------------------------------------------
+ *  cdc.c  –  gear-hash content-defined chunker
+ * ------------------------------------------------------------------ */
+#include "cdc.h"
+
+static uint64_t g_gear[256];
+
+/* harder to cut before the average size, easier after it */
+#define MASK_S 0xFFFE000000000000ULL        /* top 15 bits */
+#define MASK_L 0xFFE0000000000000ULL        /* top 11 bits */
+
+void cdc_init(void)
+{
+    uint64_t x = 0x5254465344454455ULL;     /* fixed: both ends agree */
+    for (int i = 0; i < 256; ++i) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);        /* splitmix64 */
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        g_gear[i] = z ^ (z >> 31);
+    }
+}
+
+size_t cdc_cut(const uint8_t *p, size_t n)
+{
+    if (n <= CDC_MIN) return n;
+    size_t   limit = n < CDC_MAX ? n : CDC_MAX;
+    size_t   mid   = limit < CDC_AVG ? limit : CDC_AVG;
+    uint64_t h     = 0;
+    size_t   i     = CDC_MIN;
+
+    for (; i < mid; ++i) {
+        h = (h << 1) + g_gear[p[i]];
+        if (!(h & MASK_S)) return i + 1;
+    }
+    for (; i < limit; ++i) {
+        h = (h << 1) + g_gear[p[i]];
+        if (!(h & MASK_L)) return i + 1;
+    }
+    return limit;
+}
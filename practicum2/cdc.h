@@ -0,0 +1,27 @@
+/* --------------------------------------------------------------------
+ *  cdc.h  –  content-defined chunking (gear hash, FastCDC-style
+ *            normalised cut points) shared by rfs and rfserver
+ *
+ *  Cut points depend only on the bytes themselves, so an insertion
+ *  near the start of a file shifts at most a chunk or two and every
+ *  later chunk hashes the same as before.
+ * ------------------------------------------------------------------ */
+#ifndef CDC_H
+#define CDC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CDC_MIN   (2 * 1024)
+#define CDC_AVG   (8 * 1024)
+#define CDC_MAX   (64 * 1024)
+
+/* Build the gear table; call once before cdc_cut(). */
+void cdc_init(void);
+
+/* Length of the first chunk of p[0..n).  Returns n when no cut point
+ * lies within it and n < CDC_MAX (the caller needs more input, or this
+ * is the final chunk). */
+size_t cdc_cut(const uint8_t *p, size_t n);
+
+#endif // CDC_H
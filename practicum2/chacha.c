@@ -0,0 +1,148 @@
+/* --------------------------------------------------------------------
+ *  chacha.c  –  ChaCha20, scalar reference and CHACHA_LANES-wide
+ *               vector version
+ * ------------------------------------------------------------------ */
+#include "chacha.h"
+
+#include <string.h>
+
+#define ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QR(a, b, c, d)                      \
+    a += b; d ^= a; d = ROTL(d, 16);        \
+    c += d; b ^= c; b = ROTL(b, 12);        \
+    a += b; d ^= a; d = ROTL(d, 8);         \
+    c += d; b ^= c; b = ROTL(b, 7)
+
+#define DOUBLE_ROUND(x)                     \
+    QR(x[0], x[4], x[8],  x[12]);           \
+    QR(x[1], x[5], x[9],  x[13]);           \
+    QR(x[2], x[6], x[10], x[14]);           \
+    QR(x[3], x[7], x[11], x[15]);           \
+    QR(x[0], x[5], x[10], x[15]);           \
+    QR(x[1], x[6], x[11], x[12]);           \
+    QR(x[2], x[7], x[8],  x[13]);           \
+    QR(x[3], x[4], x[9],  x[14])
+
+static const uint32_t SIGMA[4] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+
+static inline uint32_t load32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+           (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void store32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+}
+
+/* the 16 input words of block ctr */
+static void setup(uint32_t in[16], const uint8_t *key, const uint8_t *nonce, uint64_t ctr)
+{
+    for (int i = 0; i < 4; ++i) in[i] = SIGMA[i];
+    for (int i = 0; i < 8; ++i) in[4 + i] = load32(key + 4 * i);
+    in[12] = (uint32_t)ctr;
+    in[13] = (uint32_t)(ctr >> 32);
+    in[14] = load32(nonce);
+    in[15] = load32(nonce + 4);
+}
+
+/* buf ^= ks, n bytes, a word at a time where possible */
+static void xor_bytes(uint8_t *buf, const uint8_t *ks, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, buf + i, 8);
+        memcpy(&b, ks + i, 8);
+        a ^= b;
+        memcpy(buf + i, &a, 8);
+    }
+    for (; i < n; ++i) buf[i] ^= ks[i];
+}
+
+static void block_ref(const uint8_t *key, const uint8_t *nonce, uint64_t ctr,
+                      uint8_t out[64])
+{
+    uint32_t in[16], x[16];
+    setup(in, key, nonce, ctr);
+    memcpy(x, in, sizeof(x));
+    for (int r = 0; r < 10; ++r) { DOUBLE_ROUND(x); }
+    for (int i = 0; i < 16; ++i) store32(out + 4 * i, x[i] + in[i]);
+}
+
+/* CHACHA_LANES consecutive blocks from ctr: lane j of every word
+ * vector belongs to block ctr + j */
+typedef uint32_t vec_t __attribute__((vector_size(4 * CHACHA_LANES)));
+
+/* one 256-bit register per word where the CPU has AVX2, two 128-bit
+ * ones otherwise; picked once at load time */
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target_clones("avx2", "default")))
+#endif
+static void blocks_vec(const uint8_t *key, const uint8_t *nonce, uint64_t ctr,
+                       uint8_t out[64 * CHACHA_LANES])
+{
+    uint32_t in[16];
+    setup(in, key, nonce, ctr);
+    vec_t x[16], orig[16];
+    for (int i = 0; i < 16; ++i)
+        for (int j = 0; j < CHACHA_LANES; ++j) x[i][j] = in[i];
+    for (int j = 0; j < CHACHA_LANES; ++j) {
+        x[12][j] = (uint32_t)(ctr + (uint64_t)j);
+        x[13][j] = (uint32_t)((ctr + (uint64_t)j) >> 32);
+    }
+    memcpy(orig, x, sizeof(x));
+    for (int r = 0; r < 10; ++r) { DOUBLE_ROUND(x); }
+    for (int i = 0; i < 16; ++i) x[i] += orig[i];
+
+    /* transpose: block j is word 0..15 of lane j */
+    uint32_t w[16][CHACHA_LANES];
+    memcpy(w, x, sizeof(w));
+    for (int j = 0; j < CHACHA_LANES; ++j)
+        for (int i = 0; i < 16; ++i)
+            store32(out + 64 * j + 4 * i, w[i][j]);
+}
+
+void chacha_xor(const uint8_t key[CHACHA_KEY], const uint8_t nonce[CHACHA_NONCE],
+                uint64_t off, void *buf_, size_t len)
+{
+    uint8_t *buf  = buf_;
+    uint64_t ctr  = off / 64;
+    size_t   skip = (size_t)(off % 64);
+    uint8_t  ks[64 * CHACHA_LANES];
+    while (len > 0) {
+        size_t n;
+        if (skip + len <= 64) {             /* short tail: one block will do */
+            block_ref(key, nonce, ctr, ks);
+            n = len;
+        } else {
+            blocks_vec(key, nonce, ctr, ks);
+            n = sizeof(ks) - skip < len ? sizeof(ks) - skip : len;
+        }
+        xor_bytes(buf, ks + skip, n);
+        buf += n;
+        len -= n;
+        ctr += CHACHA_LANES;
+        skip = 0;
+    }
+}
+
+void chacha_xor_ref(const uint8_t key[CHACHA_KEY], const uint8_t nonce[CHACHA_NONCE],
+                    uint64_t off, void *buf_, size_t len)
+{
+    uint8_t *buf  = buf_;
+    uint64_t ctr  = off / 64;
+    size_t   skip = (size_t)(off % 64);
+    uint8_t  ks[64];
+    while (len > 0) {
+        block_ref(key, nonce, ctr++, ks);
+        size_t n = 64 - skip < len ? 64 - skip : len;
+        xor_bytes(buf, ks + skip, n);
+        buf += n;
+        len -= n;
+        skip = 0;
+    }
+}
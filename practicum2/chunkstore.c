@@ -0,0 +1,321 @@
+/* --------------------------------------------------------------------
+ *  chunkstore.c  –  reference-counted chunk files + manifests
+ * ------------------------------------------------------------------ */
+#define _XOPEN_SOURCE 700
+#include "chunkstore.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+
+#define MANIFEST_MAGIC     "RFSMANIFEST "
+#define MANIFEST_MAGIC_LEN 12
+
+/* ----------  in-memory index: digest -> refcount  ----------------- */
+typedef struct cs_entry {
+    uint8_t          hash[SHA256_LEN];
+    uint32_t         len;
+    unsigned long    refs;
+    struct cs_entry *next;
+} cs_entry_t;
+
+static cs_entry_t     **g_buckets;
+static size_t           g_nbuckets;
+static cs_stats_t       g_stats;
+static char             g_store[BUF_SIZE];
+static pthread_mutex_t  g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t cs_bucket(const uint8_t *h, size_t nb)
+{
+    uint64_t x;
+    memcpy(&x, h, sizeof(x));               /* digests are uniform */
+    return (size_t)(x % nb);
+}
+
+static cs_entry_t **cs_find(const uint8_t *h)
+{
+    cs_entry_t **pp = &g_buckets[cs_bucket(h, g_nbuckets)];
+    while (*pp && memcmp((*pp)->hash, h, SHA256_LEN) != 0)
+        pp = &(*pp)->next;
+    return pp;
+}
+
+static void cs_grow(void)
+{
+    size_t       nb    = g_nbuckets * 2;
+    cs_entry_t **fresh = calloc(nb, sizeof(*fresh));
+    if (!fresh) return;
+    for (size_t i = 0; i < g_nbuckets; ++i)
+        for (cs_entry_t *e = g_buckets[i], *nx; e; e = nx) {
+            nx = e->next;
+            size_t b = cs_bucket(e->hash, nb);
+            e->next = fresh[b];
+            fresh[b] = e;
+        }
+    free(g_buckets);
+    g_buckets  = fresh;
+    g_nbuckets = nb;
+}
+
+/* caller holds g_lock */
+static cs_entry_t *cs_insert(const uint8_t *h, uint32_t len)
+{
+    if (g_stats.chunks + 1 > g_nbuckets) cs_grow();
+    cs_entry_t *e = calloc(1, sizeof(*e));
+    if (!e) return NULL;
+    memcpy(e->hash, h, SHA256_LEN);
+    e->len = len;
+    cs_entry_t **slot = &g_buckets[cs_bucket(h, g_nbuckets)];
+    e->next = *slot;
+    *slot = e;
+    ++g_stats.chunks;
+    g_stats.physical += len;
+    return e;
+}
+
+static void chunk_path(const uint8_t *h, char *out, size_t cap)
+{
+    char hex[SHA256_HEX];
+    sha256_hex(h, hex);
+    snprintf(out, cap, "%s/%.2s/%s", g_store, hex, hex);
+}
+
+/* ----------  manifests  -------------------------------------------- */
+int manifest_add(manifest_t *m, const uint8_t hash[SHA256_LEN], uint32_t len)
+{
+    if (m->n == 0 || (m->n >= 16 && (m->n & (m->n - 1)) == 0)) {
+        size_t cap = m->n ? m->n * 2 : 16;
+        chunk_ref_t        *c = realloc(m->chunks, cap * sizeof(*c));
+        unsigned long long *o = c ? realloc(m->offs, cap * sizeof(*o)) : NULL;
+        if (c) m->chunks = c;
+        if (!o) return -1;
+        m->offs = o;
+    }
+    memcpy(m->chunks[m->n].hash, hash, SHA256_LEN);
+    m->chunks[m->n].len = len;
+    m->offs[m->n] = m->size;
+    m->size += len;
+    ++m->n;
+    return 0;
+}
+
+void manifest_free(manifest_t *m)
+{
+    free(m->chunks);
+    free(m->offs);
+    memset(m, 0, sizeof(*m));
+}
+
+int manifest_read(int fd, manifest_t *m)
+{
+    memset(m, 0, sizeof(*m));
+    char magic[MANIFEST_MAGIC_LEN];
+    if (pread(fd, magic, sizeof(magic), 0) != (ssize_t)sizeof(magic) ||
+        memcmp(magic, MANIFEST_MAGIC, MANIFEST_MAGIC_LEN) != 0)
+        return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) return -1;
+    char *text = malloc((size_t)st.st_size + 1);
+    if (!text) return -1;
+    ssize_t got = pread(fd, text, (size_t)st.st_size, 0);
+    if (got < 0) { free(text); return -1; }
+    text[got] = '\0';
+
+    unsigned long long size = 0, n = 0;
+    char *line = strchr(text, '\n');
+    if (!line || sscanf(text, "RFSMANIFEST 1 size=%llu chunks=%llu", &size, &n) != 2) {
+        free(text);
+        return -1;
+    }
+    for (unsigned long long i = 0; i < n; ++i) {
+        char     hex[SHA256_HEX];
+        unsigned len;
+        uint8_t  h[SHA256_LEN];
+        if (sscanf(line + 1, "%64s %u", hex, &len) != 2 ||
+            sha256_from_hex(hex, h) < 0 || manifest_add(m, h, len) < 0)
+            break;
+        line = strchr(line + 1, '\n');
+        if (!line) break;
+    }
+    free(text);
+    if (m->n != n || m->size != size) { manifest_free(m); return -1; }
+    return 1;
+}
+
+int manifest_write(int fd, const manifest_t *m)
+{
+    FILE *fp = fdopen(dup(fd), "w");
+    if (!fp) return -1;
+    if (ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+        fclose(fp);
+        return -1;
+    }
+    fprintf(fp, "RFSMANIFEST 1 size=%llu chunks=%zu\n", m->size, m->n);
+    for (size_t i = 0; i < m->n; ++i) {
+        char hex[SHA256_HEX];
+        sha256_hex(m->chunks[i].hash, hex);
+        fprintf(fp, "%s %u\n", hex, m->chunks[i].len);
+    }
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+ssize_t manifest_pread(const manifest_t *m, void *buf, size_t len,
+                       unsigned long long off)
+{
+    if (off >= m->size || m->n == 0) return 0;
+
+    /* binary search for the chunk holding off */
+    size_t lo = 0, hi = m->n - 1;
+    while (lo < hi) {
+        size_t mid = (lo + hi + 1) / 2;
+        if (m->offs[mid] <= off) lo = mid; else hi = mid - 1;
+    }
+
+    size_t done = 0;
+    for (size_t i = lo; i < m->n && done < len; ++i) {
+        unsigned long long in = off + done - m->offs[i];
+        size_t want = m->chunks[i].len - (size_t)in;
+        if (want > len - done) want = len - done;
+
+        char path[BUF_SIZE];
+        chunk_path(m->chunks[i].hash, path, sizeof(path));
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return -1;
+        ssize_t n = pread(fd, (char *)buf + done, want, (off_t)in);
+        close(fd);
+        if (n != (ssize_t)want) return -1;
+        done += want;
+    }
+    return (ssize_t)done;
+}
+
+/* ----------  reference counting  ---------------------------------- */
+int chunkstore_ref(const uint8_t hash[SHA256_LEN])
+{
+    pthread_mutex_lock(&g_lock);
+    cs_entry_t *e = *cs_find(hash);
+    if (e) ++e->refs;
+    pthread_mutex_unlock(&g_lock);
+    return e != NULL;
+}
+
+int chunkstore_put(const uint8_t hash[SHA256_LEN], const void *data, size_t len)
+{
+    uint8_t check[SHA256_LEN];
+    sha256(data, len, check);
+    if (memcmp(check, hash, SHA256_LEN) != 0) return -1;
+
+    char path[BUF_SIZE], tmp[BUF_SIZE + 32];
+    chunk_path(hash, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%lx", path, (unsigned long)pthread_self());
+
+    /* write outside the lock; publishing (rename) happens under it so
+     * it cannot interleave with the unlink of a dying chunk */
+    char dir[BUF_SIZE];
+    snprintf(dir, sizeof(dir), "%.*s", (int)(strrchr(path, '/') - path), path);
+    mkdir(dir, 0777);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { perror("chunkstore: open"); return -1; }
+    int ok = write(fd, data, len) == (ssize_t)len;
+    close(fd);
+    if (!ok) { unlink(tmp); return -1; }
+
+    pthread_mutex_lock(&g_lock);
+    cs_entry_t *e = *cs_find(hash);
+    if (e) {
+        unlink(tmp);                        /* someone beat us to it */
+        ++e->refs;
+    } else if (rename(tmp, path) == 0 && (e = cs_insert(hash, (uint32_t)len))) {
+        e->refs = 1;
+    } else {
+        unlink(tmp);
+        ok = 0;
+    }
+    pthread_mutex_unlock(&g_lock);
+    return ok ? 0 : -1;
+}
+
+void chunkstore_unref(const uint8_t hash[SHA256_LEN])
+{
+    pthread_mutex_lock(&g_lock);
+    cs_entry_t **slot = cs_find(hash);
+    cs_entry_t  *e    = *slot;
+    if (e && --e->refs == 0) {
+        char path[BUF_SIZE];
+        chunk_path(hash, path, sizeof(path));
+        unlink(path);
+        *slot = e->next;
+        --g_stats.chunks;
+        g_stats.physical -= e->len;
+        free(e);
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+void chunkstore_account(long long logical_delta)
+{
+    pthread_mutex_lock(&g_lock);
+    g_stats.logical += (unsigned long long)logical_delta;
+    pthread_mutex_unlock(&g_lock);
+}
+
+void chunkstore_get_stats(cs_stats_t *out)
+{
+    pthread_mutex_lock(&g_lock);
+    *out = g_stats;
+    pthread_mutex_unlock(&g_lock);
+}
+
+/* ----------  start-up scan  ---------------------------------------- */
+static int scan_manifest(const char *path, const struct stat *sb,
+                         int type, struct FTW *ftw)
+{
+    (void)sb; (void)ftw;
+    if (type != FTW_F) return 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    manifest_t m;
+    int rc = manifest_read(fd, &m);
+    close(fd);
+    if (rc < 0) fprintf(stderr, "chunkstore: bad manifest '%s'\n", path);
+    if (rc != 1) return 0;
+
+    for (size_t i = 0; i < m.n; ++i) {
+        cs_entry_t *e = *cs_find(m.chunks[i].hash);
+        if (!e) e = cs_insert(m.chunks[i].hash, m.chunks[i].len);
+        if (e) ++e->refs;
+    }
+    g_stats.logical += m.size;
+    manifest_free(&m);
+    return 0;
+}
+
+/* remove chunk files (and stale temp files) nobody references */
+static int sweep_chunk(const char *path, const struct stat *sb,
+                       int type, struct FTW *ftw)
+{
+    (void)sb; (void)ftw;
+    if (type != FTW_F) return 0;
+    const char *base = strrchr(path, '/') + 1;
+    uint8_t     h[SHA256_LEN];
+    if (sha256_from_hex(base, h) == 0 && *cs_find(h)) return 0;
+    unlink(path);
+    return 0;
+}
+
+int chunkstore_init(const char *store_dir, const char *data_dir)
+{
+    snprintf(g_store, sizeof(g_store), "%s", store_dir);
+    mkdir(store_dir, 0777);
+    g_nbuckets = 1024;
+    g_buckets  = calloc(g_nbuckets, sizeof(*g_buckets));
+    if (!g_buckets) return -1;
+
+    nftw(data_dir, scan_manifest, 32, FTW_PHYS);
+    nftw(store_dir, sweep_chunk, 32, FTW_PHYS);
+    printf("[Server] Chunk store '%s': %llu chunks, %llu bytes for %llu "
+           "logical bytes\n", store_dir, g_stats.chunks, g_stats.physical,
+           g_stats.logical);
+    return 0;
+}
@@ -0,0 +1,73 @@
+/* --------------------------------------------------------------------
+ *  chunkstore.h  –  content-addressed chunk storage with dedup
+ *
+ *  In chunked mode (rfserver -C) a file under SERVER_DATA_DIR holds a
+ *  small text manifest instead of its bytes:
+ *
+ *      RFSMANIFEST 1 size=<bytes> chunks=<n>
+ *      <sha256 hex> <len>          (n lines, in file order)
+ *
+ *  Each unique chunk is stored once under CHUNK_STORE_DIR/ab/<hex> and
+ *  reference counted across all manifests, so identical or mostly
+ *  identical uploads cost only their new chunks.
+ * ------------------------------------------------------------------ */
+#ifndef CHUNKSTORE_H
+#define CHUNKSTORE_H
+
+#include "common.h"
+#include "sha256.h"
+
+typedef struct {
+    uint8_t  hash[SHA256_LEN];
+    uint32_t len;
+} chunk_ref_t;
+
+typedef struct {
+    unsigned long long  size;
+    size_t              n;
+    chunk_ref_t        *chunks;
+    unsigned long long *offs;       /* offs[i] = file offset of chunk i */
+} manifest_t;
+
+typedef struct {
+    unsigned long long chunks;      /* unique chunks stored */
+    unsigned long long physical;    /* bytes of unique chunks */
+    unsigned long long logical;     /* bytes of all chunked files */
+} cs_stats_t;
+
+/* Rebuild reference counts by scanning every manifest below data_dir
+ * and delete chunks nobody references.  Returns 0 on success. */
+int chunkstore_init(const char *store_dir, const char *data_dir);
+
+/* Take a reference on a stored chunk: 1 if present, 0 if absent. */
+int chunkstore_ref(const uint8_t hash[SHA256_LEN]);
+
+/* Store a chunk (after checking its hash) and take a reference.
+ * Returns 0, or -1 on hash mismatch / I/O error. */
+int chunkstore_put(const uint8_t hash[SHA256_LEN], const void *data, size_t len);
+
+/* Drop a reference; the chunk is deleted with its last one. */
+void chunkstore_unref(const uint8_t hash[SHA256_LEN]);
+
+/* Adjust the logical byte count when manifests appear or vanish. */
+void chunkstore_account(long long logical_delta);
+
+void chunkstore_get_stats(cs_stats_t *out);
+
+/* 1 if fd holds a manifest (parsed into *m), 0 if it is a plain file,
+ * -1 on a malformed manifest. */
+int  manifest_read(int fd, manifest_t *m);
+
+/* Replace fd's contents with m. */
+int  manifest_write(int fd, const manifest_t *m);
+
+/* Append one chunk while building a manifest. */
+int  manifest_add(manifest_t *m, const uint8_t hash[SHA256_LEN], uint32_t len);
+
+void manifest_free(manifest_t *m);
+
+/* pread() through a manifest. */
+ssize_t manifest_pread(const manifest_t *m, void *buf, size_t len,
+                       unsigned long long off);
+
+#endif // CHUNKSTORE_H
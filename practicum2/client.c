@@ -1,83 +1,300 @@
 #include "client.h"
+#include "proto.h"
+#include "cdc.h"
+#include "sha256.h"
+#include "delta.h"
+#include "crc32c.h"
+#include "message.h"
+
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+// Files smaller than this per stream are not worth another connection
+#define MIN_STREAM_BYTES (1024 * 1024)
+#define MAX_STREAMS      64
+
+// Connections "rfs batch" runs operations over unless -j says otherwise
+#define BATCH_CONNS      4
+
+// Optional flags shared by the commands
+typedef struct {
+    unsigned long long offset;   // -o: byte offset of the transfer
+    unsigned long long length;   // -n: bytes to fetch (GET only)
+    int has_offset;
+    int has_length;
+    int resume;                  // -c: continue an interrupted transfer
+    int dedup;                   // -d: upload only chunks the server lacks
+    int delta;                   // -D: upload only what differs from the server's copy
+    int streams;                 // -j: parallel connections for whole files
+    int compress;                // -z: ask for compressed payloads
+} xfer_opts_t;
 
 // Forward declarations of client-side helpers
-static int do_write(int sock, char *localFile, char *remoteFile, char *permStr);
-static int do_get(int sock, char *remoteFile, char *localFile);
-static int do_rm(int sock, char *remoteFile);
+static int do_write(conn_t *c, char *localFile, char *remoteFile,
+                    char *permStr, int append, xfer_opts_t *o);
+static int do_dwrite(conn_t *c, char *localFile, char *remoteFile, char *permStr);
+static int do_delta(conn_t *c, char *localFile, char *remoteFile,
+                    char *permStr, xfer_opts_t *o);
+static int do_get(conn_t *c, char *remoteFile, char *localFile, xfer_opts_t *o);
+static int cache_lookup(const char *remoteFile, const char *localFile, char *ver);
+static void cache_record(const char *remoteFile, const char *localFile, const char *ver);
+static int do_rm(conn_t *c, char *remoteFile);
+static int do_stats(conn_t *c);
+static int do_ls(conn_t *c, char *remoteDir);
+static int do_stat(conn_t *c, char *remotePath);
+static int remote_sum(conn_t *c, char *remoteFile, unsigned long long *size,
+                      uint32_t *crc);
+static int connect_server(void);
+static void negotiate(conn_t *c);
+static int do_pwrite(conn_t *c, char *localFile, char *remoteFile,
+                     char *permStr, int streams);
+static int do_pget(conn_t *c, char *remoteFile, char *localFile, int streams);
+static int do_mget(conn_t *c, char *localDir, char **remote, int n);
+static int do_mput(conn_t *c, char *permStr, char *remoteDir, char **local, int n);
+static char **batch_names(char **argv, int argc, int *n);
+static int do_putmsg(conn_t *c, char *id, char *sender, char *receiver, char *text);
+static int do_getmsg(conn_t *c, char **ids, int n);
+static int run_command(int argc, char *argv[]);
+static int read_reply(conn_t *c, char *buf, size_t cap);
+
+// Where requests go.  RFS_SERVER=[host:]port names the server
+// (default 127.0.0.1 and PORT).  With RFS_REPLICAS=[host:]port,...
+// every read-only command (GET, MGET, LS, STAT) picks one of the
+// server and its followers at random, and falls back to the server
+// when the pick cannot be reached
+static struct sockaddr_in g_primary, g_server;
+static int parse_addr(const char *spec, struct sockaddr_in *out);
+static void pick_server(const char *cmd);
+
+// Set when the server answered "BUSY retry_after_ms=N": main() waits
+// that long and runs the whole command again (nothing was moved yet).
+// Per thread, as each batch worker retries its own operations
+static __thread unsigned g_busy_ms;
+
+// The last reply read, and whether progress lines (and refusals the
+// reply already names) are printed: batch workers stay quiet and
+// report each operation in one line instead
+static __thread char g_reply[MAX_LINE];
+static __thread int  g_quiet;
+static void say(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static int run_batch(int argc, char *argv[]);
 
 int main(int argc, char *argv[])
 {
     // Example usage:
-    //   rfs WRITE localFile remoteFile [RO|RW]
-    //   rfs GET   remoteFile localFile
-    //   rfs RM    remoteFile
+    //   rfs WRITE  localFile remoteFile [RO|RW] [-o offset] [-c] [-d|-D] [-j streams] [-z]
+    //   rfs APPEND localFile remoteFile
+    //   rfs GET    remoteFile localFile [-o offset] [-n length] [-c] [-j streams] [-z]
+    //   rfs RM     remoteFile
+    //   rfs MGET   localDir remoteFile... (or - to read names from stdin)
+    //   rfs MPUT   [RO|RW] remoteDir localFile... (or -)
+    //   rfs LS     [remoteDir]
+    //   rfs STAT   remotePath
+    //   rfs STATS
+    //   rfs PUTMSG id sender receiver text (or - to read it from stdin)
+    //   rfs GETMSG id...
+    //   rfs batch  manifest (or -) [-j connections] [-z]
     if (argc < 2) {
         fprintf(stderr, "Usage:\n");
-        fprintf(stderr, "  %s WRITE <localFile> <remoteFile> [RO|RW]\n", argv[0]);
-        fprintf(stderr, "  %s GET   <remoteFile> <localFile>\n", argv[0]);
-        fprintf(stderr, "  %s RM    <remoteFile>\n", argv[0]);
+        fprintf(stderr, "  %s WRITE  <localFile> <remoteFile> [RO|RW] [-o offset] [-c] [-d|-D] [-j streams] [-z]\n", argv[0]);
+        fprintf(stderr, "  %s APPEND <localFile> <remoteFile>\n", argv[0]);
+        fprintf(stderr, "  %s GET    <remoteFile> <localFile> [-o offset] [-n length] [-c] [-j streams] [-z]\n", argv[0]);
+        fprintf(stderr, "  %s RM     <remoteFile>\n", argv[0]);
+        fprintf(stderr, "  %s MGET   <localDir> <remoteFile>...|-\n", argv[0]);
+        fprintf(stderr, "  %s MPUT   [RO|RW] <remoteDir> <localFile>...|-\n", argv[0]);
+        fprintf(stderr, "  %s LS     [remoteDir]\n", argv[0]);
+        fprintf(stderr, "  %s STAT   <remotePath>\n", argv[0]);
+        fprintf(stderr, "  %s STATS\n", argv[0]);
+        fprintf(stderr, "  %s PUTMSG <id> <sender> <receiver> <text>|-\n", argv[0]);
+        fprintf(stderr, "  %s GETMSG <id>...\n", argv[0]);
+        fprintf(stderr, "  %s batch  <manifest>|- [-j connections] [-z]\n", argv[0]);
+        fprintf(stderr, "  -o  start the transfer at this byte offset\n");
+        fprintf(stderr, "  -n  fetch at most this many bytes\n");
+        fprintf(stderr, "  -c  resume: continue from where the destination ends\n");
+        fprintf(stderr, "      (WRITE: only if the remote file matches the start of\n");
+        fprintf(stderr, "      the local one by CRC32C; otherwise the whole file is sent)\n");
+        fprintf(stderr, "  -d  dedup upload: send only chunks the server lacks (rfserver -C)\n");
+        fprintf(stderr, "  -D  delta upload: send only what differs from the server's copy\n");
+        fprintf(stderr, "  -j  move a whole file over this many parallel connections\n");
+        fprintf(stderr, "      (batch: run this many operations at once, default %d)\n",
+                BATCH_CONNS);
+        fprintf(stderr, "  -z  compress GET/WRITE payloads on the wire (if the server agrees)\n");
+        fprintf(stderr, "Environment:\n");
+        fprintf(stderr, "  RFS_SERVER=[host:]port          server (default 127.0.0.1:%d)\n", PORT);
+        fprintf(stderr, "  RFS_REPLICAS=[host:]port,...    followers to spread reads over\n");
         return 1;
     }
-
-    // 1. Create socket
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        perror("socket");
+    const char *server = getenv("RFS_SERVER");
+    if (parse_addr(server ? server : "127.0.0.1", &g_primary) < 0) {
+        fprintf(stderr, "RFS_SERVER=%s: expected [host:]port\n", server);
         return 1;
     }
+    if (strcasecmp(argv[1], "batch") == 0) return run_batch(argc, argv);
 
-    // 2. Setup server address
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port   = htons(PORT);
-
-    // Connect to localhost (127.0.0.1)
-    if (inet_pton(AF_INET, "127.0.0.1", &server_addr.sin_addr) <= 0) {
-        perror("inet_pton");
-        close(sock);
-        return 1;
+    // An overloaded server turns requests away with a time to come
+    // back; a little jitter keeps the retries from arriving together
+    int status;
+    srand((unsigned)getpid());
+    for (int attempt = 0; ; ++attempt) {
+        g_busy_ms = 0;
+        status = run_command(argc, argv);
+        if (!g_busy_ms || attempt == BUSY_RETRIES) break;
+        unsigned ms = g_busy_ms + (unsigned)rand() % (g_busy_ms / 2 + 1);
+        printf("[Client] Server busy, retrying in %u ms.\n", ms);
+        usleep(ms * 1000);
     }
+    return status;
+}
 
-    // 3. Connect
-    if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        perror("connect");
-        close(sock);
-        return 1;
+// One connection, one command
+static int run_command(int argc, char *argv[])
+{
+    // Split flags from positional arguments
+    xfer_opts_t opts = {0};
+    char *pos[4] = {0};
+    int npos = 0;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "-c") == 0) {
+            opts.resume = 1;
+        } else if (strcmp(argv[i], "-d") == 0) {
+            opts.dedup = 1;
+        } else if (strcmp(argv[i], "-D") == 0) {
+            opts.delta = 1;
+        } else if (strcmp(argv[i], "-z") == 0) {
+            opts.compress = 1;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            opts.streams = atoi(argv[++i]);
+            if (opts.streams > MAX_STREAMS) opts.streams = MAX_STREAMS;
+        } else if ((strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "-n") == 0)
+                   && i + 1 < argc) {
+            unsigned long long v = strtoull(argv[i + 1], NULL, 10);
+            if (argv[i][1] == 'o') { opts.offset = v; opts.has_offset = 1; }
+            else                   { opts.length = v; opts.has_length = 1; }
+            ++i;
+        } else if (npos < 4) {
+            pos[npos++] = argv[i];
+        }
     }
-    printf("[Client] Connected to server on port %d.\n", PORT);
 
-    // 4. Dispatch command
+    // 1. Connect
+    pick_server(argv[1]);
+    int sock = connect_server();
+    if (sock < 0) return 1;
+    printf("[Client] Connected to server on port %d.\n", ntohs(g_server.sin_port));
+
+    conn_t conn;
+    conn_init(&conn, sock);
+    if (opts.compress) negotiate(&conn);
+
+    // 2. Dispatch command
     int status = 0;
-    if (strcasecmp(argv[1], "WRITE") == 0) {
-        // Need at least 4 args in total: "WRITE localFile remoteFile [RO|RW]"
-        if (argc < 4) {
-            fprintf(stderr, "Not enough args for WRITE.\n");
+    if (strcasecmp(argv[1], "WRITE") == 0 || strcasecmp(argv[1], "APPEND") == 0) {
+        // Need at least "WRITE localFile remoteFile [RO|RW]"
+        if (npos < 2) {
+            fprintf(stderr, "Not enough args for %s.\n", argv[1]);
             status = 1;
         } else {
-            char *localFile  = argv[2];
-            char *remoteFile = argv[3];
-            char *permStr    = (argc >= 5) ? argv[4] : NULL;
-            status = do_write(sock, localFile, remoteFile, permStr);
+            char *localFile  = pos[0];
+            char *remoteFile = pos[1];
+            char *permStr    = (npos >= 3) ? pos[2] : NULL;
+            int   append     = strcasecmp(argv[1], "APPEND") == 0;
+            if ((opts.dedup || opts.delta || opts.streams > 1) &&
+                (append || opts.has_offset || opts.resume)) {
+                fprintf(stderr, "-d, -D and -j upload whole files only.\n");
+                status = 1;
+            } else if (opts.delta && (opts.dedup || opts.streams > 1)) {
+                fprintf(stderr, "-D does not combine with -d or -j.\n");
+                status = 1;
+            } else if (opts.delta) {
+                status = do_delta(&conn, localFile, remoteFile, permStr, &opts);
+            } else if (opts.streams > 1 && !opts.dedup) {
+                status = do_pwrite(&conn, localFile, remoteFile, permStr, opts.streams);
+            } else if (opts.dedup) {
+                status = do_dwrite(&conn, localFile, remoteFile, permStr);
+            } else {
+                status = do_write(&conn, localFile, remoteFile, permStr, append, &opts);
+            }
         }
     }
     else if (strcasecmp(argv[1], "GET") == 0) {
-        if (argc < 4) {
+        if (npos < 2) {
             fprintf(stderr, "Not enough args for GET.\n");
             status = 1;
         } else {
-            char *remoteFile = argv[2];
-            char *localFile  = argv[3];
-            status = do_get(sock, remoteFile, localFile);
+            char *remoteFile = pos[0];
+            char *localFile  = pos[1];
+            if (opts.streams > 1 && (opts.has_offset || opts.has_length || opts.resume)) {
+                fprintf(stderr, "-j downloads whole files only.\n");
+                status = 1;
+            } else if (opts.streams > 1) {
+                status = do_pget(&conn, remoteFile, localFile, opts.streams);
+            } else {
+                status = do_get(&conn, remoteFile, localFile, &opts);
+            }
         }
     }
     else if (strcasecmp(argv[1], "RM") == 0) {
-        if (argc < 3) {
+        if (npos < 1) {
             fprintf(stderr, "Not enough args for RM.\n");
             status = 1;
         } else {
-            char *remoteFile = argv[2];
-            status = do_rm(sock, remoteFile);
+            char *remoteFile = pos[0];
+            status = do_rm(&conn, remoteFile);
+        }
+    }
+    else if (strcasecmp(argv[1], "MGET") == 0 || strcasecmp(argv[1], "MPUT") == 0) {
+        // Batches take any number of names, so they read argv directly
+        int   mput    = strcasecmp(argv[1], "MPUT") == 0;
+        int   first   = 2;
+        char *permStr = NULL;
+        if (mput && argc > 2 && (strcmp(argv[2], "RO") == 0 ||
+                                 strcmp(argv[2], "RW") == 0))
+            permStr = argv[first++];
+        // read once: a retry must not go back to an empty stdin
+        static int    n     = 0;
+        static char **names = NULL;
+        if (!names && argc > first + 1)
+            names = batch_names(argv + first + 1, argc - first - 1, &n);
+        if (n == 0) {
+            fprintf(stderr, "Not enough args for %s.\n", argv[1]);
+            status = 1;
+        } else if (mput) {
+            status = do_mput(&conn, permStr, argv[first], names, n);
+        } else {
+            status = do_mget(&conn, argv[first], names, n);
+        }
+    }
+    else if (strcasecmp(argv[1], "LS") == 0) {
+        status = do_ls(&conn, npos >= 1 ? pos[0] : ".");
+    }
+    else if (strcasecmp(argv[1], "STAT") == 0) {
+        if (npos < 1) {
+            fprintf(stderr, "Not enough args for STAT.\n");
+            status = 1;
+        } else {
+            status = do_stat(&conn, pos[0]);
+        }
+    }
+    else if (strcasecmp(argv[1], "STATS") == 0) {
+        status = do_stats(&conn);
+    }
+    else if (strcasecmp(argv[1], "PUTMSG") == 0) {
+        if (npos < 4) {
+            fprintf(stderr, "Not enough args for PUTMSG.\n");
+            status = 1;
+        } else {
+            status = do_putmsg(&conn, pos[0], pos[1], pos[2], pos[3]);
+        }
+    }
+    else if (strcasecmp(argv[1], "GETMSG") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Not enough args for GETMSG.\n");
+            status = 1;
+        } else {
+            status = do_getmsg(&conn, argv + 2, argc - 2);
         }
     }
     else {
@@ -86,6 +303,7 @@ int main(int argc, char *argv[])
     }
 
     close(sock);
+    conn_release(&conn);
     return status;
 }
 
@@ -93,140 +311,1725 @@ int main(int argc, char *argv[])
 // Implementation details
 // ---------------------------------------------------------------------
 
-// For a "WRITE localFile remoteFile [RO|RW]" command
-static int do_write(int sock, char *localFile, char *remoteFile, char *permStr)
+// conn_read_line() for a reply; notes a BUSY for main() to retry and
+// hands it on, so the caller reports it as the server error it is
+static int read_reply(conn_t *c, char *buf, size_t cap)
+{
+    int n = conn_read_line(c, buf, cap);
+    unsigned ms;
+    if (n >= 0) snprintf(g_reply, sizeof(g_reply), "%s", buf);
+    if (n >= 0 && sscanf(buf, "BUSY retry_after_ms=%u", &ms) == 1)
+        g_busy_ms = ms ? ms : 1;
+    return n;
+}
+
+// printf() unless this thread runs batch operations
+static void say(const char *fmt, ...)
 {
-    // Construct the command string
-    // e.g. "WRITE localFile remoteFile RO"
-    char cmd_buf[BUF_SIZE];
-    memset(cmd_buf, 0, sizeof(cmd_buf));
+    if (g_quiet) return;
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+}
 
-    if (permStr) {
-        snprintf(cmd_buf, sizeof(cmd_buf), "WRITE %s %s %s", localFile, remoteFile, permStr);
+// "[host:]port" (or just a host) into *out; the defaults fill the rest
+static int parse_addr(const char *spec, struct sockaddr_in *out)
+{
+    char host[64] = "127.0.0.1";
+    int  port = PORT;
+    const char *colon = strrchr(spec, ':');
+    if (colon) {
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - spec), spec);
+        port = atoi(colon + 1);
+    } else if (isdigit((unsigned char)spec[0]) && !strchr(spec, '.')) {
+        port = atoi(spec);
     } else {
-        snprintf(cmd_buf, sizeof(cmd_buf), "WRITE %s %s", localFile, remoteFile);
+        snprintf(host, sizeof(host), "%s", spec);
+    }
+    memset(out, 0, sizeof(*out));
+    out->sin_family = AF_INET;
+    out->sin_port   = htons(port);
+    if (port <= 0 || port > 65535 || inet_pton(AF_INET, host, &out->sin_addr) <= 0)
+        return -1;
+    return 0;
+}
+
+// Reads may go to any replica; everything else goes to the server
+static void pick_server(const char *cmd)
+{
+    g_server = g_primary;
+    const char *list = getenv("RFS_REPLICAS");
+    if (!list || !(strcasecmp(cmd, "GET") == 0 || strcasecmp(cmd, "MGET") == 0 ||
+                   strcasecmp(cmd, "LS") == 0 || strcasecmp(cmd, "STAT") == 0))
+        return;
+
+    char copy[BUF_SIZE];
+    char *spec[16];
+    int n = 0;
+    snprintf(copy, sizeof(copy), "%s", list);
+    for (char *t = strtok(copy, ","); t && n < 16; t = strtok(NULL, ","))
+        spec[n++] = t;
+    int k = rand() % (n + 1);               // n + 1: the server itself
+    if (k < n && parse_addr(spec[k], &g_server) < 0) {
+        fprintf(stderr, "RFS_REPLICAS: ignoring '%s'\n", spec[k]);
+        g_server = g_primary;
+    }
+}
+
+static int dial(const struct sockaddr_in *addr)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return -1;
     }
+    if (connect(sock, (const struct sockaddr*)addr, sizeof(*addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    // The CRC line trails the payload: without this it waits for the
+    // ACK of the last segment, which the server delays ~40 ms
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
+
+// Open a connection to the server (or the replica picked for this
+// command); returns the socket or -1
+static int connect_server(void)
+{
+    int sock = dial(&g_server);
+    if (sock >= 0) return sock;
+    if (g_server.sin_port != g_primary.sin_port ||
+        g_server.sin_addr.s_addr != g_primary.sin_addr.s_addr) {
+        fprintf(stderr, "[Client] Replica on port %d unreachable; using the server.\n",
+                ntohs(g_server.sin_port));
+        g_server = g_primary;
+        if ((sock = dial(&g_server)) >= 0) return sock;
+    }
+    perror("connect");
+    return -1;
+}
 
-    // Send the command
-    if (send(sock, cmd_buf, strlen(cmd_buf), 0) < 0) {
+// -z: offer compression; payloads are framed only if the server agrees
+// (an older server answers ERR_BAD_ARGS and everything stays plain)
+static void negotiate(conn_t *c)
+{
+    char response[MAX_LINE];
+    if (send_line(c->fd, "HELLO compress=lz") < 0 ||
+        read_reply(c, response, sizeof(response)) < 0)
+        return;
+    request_t r;
+    parse_request(response, &r);
+    const char *z = req_opt(&r, "compress");
+    if (r.cmd && strcmp(r.cmd, "HELLO_OK") == 0 && z && strcmp(z, "lz") == 0 &&
+        conn_compress(c) == 0)
+        say("[Client] Compressing payloads (lz).\n");
+    else
+        say("[Client] Server declined compression.\n");
+}
+
+// Size and CRC32C of a remote file via STAT crc=1 (size 0 if missing)
+static int remote_sum(conn_t *c, char *remoteFile, unsigned long long *size,
+                      uint32_t *crc)
+{
+    if (send_line(c->fd, "STAT %s crc=1", remoteFile) < 0) {
         perror("send");
         return 1;
     }
-
-    // Wait for "OK_READY_TO_RECEIVE" or some error
-    char response[BUF_SIZE] = {0};
-    int recvd = recv(sock, response, sizeof(response) - 1, 0);
-    if (recvd <= 0) {
+    char response[MAX_LINE];
+    if (read_reply(c, response, sizeof(response)) < 0) {
         fprintf(stderr, "Server closed connection unexpectedly.\n");
         return 1;
     }
-    response[recvd] = '\0';
+    *size = 0;
+    *crc = 0;
+    request_t r;
+    parse_request(response, &r);
+    const char *sum = req_opt(&r, "crc");
+    if (r.cmd && strcmp(r.cmd, "STAT_OK") == 0 && sum &&
+        req_opt_u64(&r, "size", size))
+        *crc = (uint32_t)strtoul(sum, NULL, 16);
+    else
+        *size = 0;
+    return 0;
+}
+
+// CRC32C of the first len bytes of fd; -1 if it has fewer
+static int local_sum(int fd, unsigned long long len, uint32_t *crc)
+{
+    char buf[XFER_BUF];
+    unsigned long long done = 0;
+    uint32_t sum = 0;
+    while (done < len) {
+        size_t want = len - done < sizeof(buf) ? (size_t)(len - done) : sizeof(buf);
+        ssize_t got = pread(fd, buf, want, (off_t)done);
+        if (got <= 0) return -1;
+        sum = crc32c(sum, buf, (size_t)got);
+        done += (unsigned long long)got;
+    }
+    *crc = sum;
+    return 0;
+}
 
-    if (strncmp(response, "OK_READY_TO_RECEIVE", 19) != 0) {
-        fprintf(stderr, "Server error: %s\n", response);
+// For a "WRITE/APPEND localFile remoteFile [RO|RW]" command
+static int do_write(conn_t *c, char *localFile, char *remoteFile,
+                    char *permStr, int append, xfer_opts_t *o)
+{
+    int fd = open(localFile, O_RDONLY);
+    if (fd < 0) {
+        perror("open (localFile)");
         return 1;
     }
+    struct stat st;
+    fstat(fd, &st);
+    unsigned long long fsize = (unsigned long long)st.st_size;
 
-    // Now send the file data
-    FILE *fp = fopen(localFile, "rb");
-    if (!fp) {
-        perror("fopen (localFile)");
+    // Resume: an interrupted full WRITE leaves the old copy in place,
+    // not a prefix of this one, so continue only where the remote file
+    // sums the same as our first bytes; otherwise send it all
+    if (o->resume && !append) {
+        unsigned long long have;
+        uint32_t rsum, lsum;
+        if (remote_sum(c, remoteFile, &have, &rsum) != 0) { close(fd); return 1; }
+        if (have > 0 && have <= fsize && local_sum(fd, have, &lsum) == 0 &&
+            lsum == rsum) {
+            o->offset = have;
+            o->has_offset = 1;
+            say("[Client] Resuming upload at byte %llu\n", o->offset);
+        } else {
+            o->offset = 0;
+            o->has_offset = 0;
+            if (have > 0)
+                say("[Client] Remote copy is not a prefix of %s; sending all of it\n",
+                    localFile);
+        }
+    }
+    if (o->offset > fsize) o->offset = fsize;
+    unsigned long long size = fsize - o->offset;
+
+    // Construct the command line
+    // e.g. "WRITE localFile remoteFile RO size=1234 offset=0"
+    char cmd_buf[MAX_LINE];
+    int n = snprintf(cmd_buf, sizeof(cmd_buf), "%s %s %s",
+                     append ? "APPEND" : "WRITE", localFile, remoteFile);
+    if (permStr)
+        n += snprintf(cmd_buf + n, sizeof(cmd_buf) - n, " %s", permStr);
+    n += snprintf(cmd_buf + n, sizeof(cmd_buf) - n, " size=%llu crc=1", size);
+    if (o->has_offset)
+        snprintf(cmd_buf + n, sizeof(cmd_buf) - n, " offset=%llu", o->offset);
+
+    if (send_line(c->fd, "%s", cmd_buf) < 0) {
+        perror("send");
+        close(fd);
         return 1;
     }
 
-    char file_buf[BUF_SIZE];
-    int bytes_read = fread(file_buf, 1, BUF_SIZE, fp);
-    fclose(fp);
+    // Wait for "OK_READY_TO_RECEIVE" or some error
+    char response[MAX_LINE];
+    if (read_reply(c, response, sizeof(response)) < 0) {
+        fprintf(stderr, "Server closed connection unexpectedly.\n");
+        close(fd);
+        return 1;
+    }
+    if (strncmp(response, "OK_READY_TO_RECEIVE", 19) != 0) {
+        if (!g_quiet) fprintf(stderr, "Server error: %s\n", response);
+        close(fd);
+        return 1;
+    }
 
-    if (bytes_read > 0) {
-        if (send(sock, file_buf, bytes_read, 0) < 0) {
+    // Now stream exactly `size` bytes of the file, then their CRC32C
+    char file_buf[XFER_BUF];
+    unsigned long long sent = 0;
+    uint32_t sum = 0;
+    while (sent < size) {
+        size_t want = (size - sent < sizeof(file_buf)) ? (size_t)(size - sent)
+                                                       : sizeof(file_buf);
+        ssize_t got = pread(fd, file_buf, want, (off_t)(o->offset + sent));
+        if (got <= 0) {
+            fprintf(stderr, "Local file shrank while uploading.\n");
+            close(fd);
+            return 1;
+        }
+        sum = crc32c(sum, file_buf, (size_t)got);
+        if (send_payload(c, file_buf, (size_t)got) < 0) {
             perror("send file data");
+            close(fd);
             return 1;
         }
+        sent += (unsigned long long)got;
+    }
+    close(fd);
+    if (send_line(c->fd, "CRC %08x", sum) < 0) {
+        perror("send");
+        return 1;
     }
 
     // Wait for final "WRITE_OK" or error
-    memset(response, 0, sizeof(response));
-    recvd = recv(sock, response, sizeof(response) - 1, 0);
-    if (recvd <= 0) {
+    if (read_reply(c, response, sizeof(response)) < 0) {
+        fprintf(stderr, "No final response from server.\n");
+        return 1;
+    }
+    say("[Client] Server final response: %s\n", response);
+
+    return strncmp(response, "WRITE_OK", 8) == 0 ? 0 : 1;
+}
+
+// For a "WRITE localFile remoteFile [RO|RW] -d" command: announce the
+// file's content-defined chunks, then send only the ones the server lacks
+static int do_dwrite(conn_t *c, char *localFile, char *remoteFile, char *permStr)
+{
+    int fd = open(localFile, O_RDONLY);
+    if (fd < 0) {
+        perror("open (localFile)");
+        return 1;
+    }
+
+    // 1. Cut the file into chunks and hash them
+    cdc_init();
+    size_t   n = 0, cap = 0;
+    uint8_t (*hashes)[SHA256_LEN] = NULL;
+    unsigned long long *offs = NULL;
+    uint32_t *lens = NULL;
+    uint8_t  *buf  = malloc(2 * CDC_MAX);
+    size_t    have = 0;
+    unsigned long long size = 0;
+    int eof = 0;
+    while (buf && (!eof || have > 0)) {
+        if (!eof && have < CDC_MAX) {
+            ssize_t got = read(fd, buf + have, 2 * CDC_MAX - have);
+            if (got <= 0) eof = 1; else have += (size_t)got;
+            continue;
+        }
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            hashes = realloc(hashes, cap * sizeof(*hashes));
+            offs   = realloc(offs, cap * sizeof(*offs));
+            lens   = realloc(lens, cap * sizeof(*lens));
+            if (!hashes || !offs || !lens) break;
+        }
+        size_t cut = cdc_cut(buf, have);
+        sha256(buf, cut, hashes[n]);
+        offs[n] = size;
+        lens[n] = (uint32_t)cut;
+        size += cut;
+        ++n;
+        memmove(buf, buf + cut, have - cut);
+        have -= cut;
+    }
+    free(buf);
+    if (!hashes || !offs || !lens || !eof) {
+        fprintf(stderr, "Out of memory while chunking.\n");
+        close(fd);
+        return 1;
+    }
+
+    // 2. "DWRITE local remote [RO|RW] chunks=N size=S" + one line per chunk
+    char out[XFER_BUF];
+    size_t used = (size_t)snprintf(out, sizeof(out), "DWRITE %s %s%s%s chunks=%zu size=%llu\n",
+                                   localFile, remoteFile, permStr ? " " : "",
+                                   permStr ? permStr : "", n, size);
+    int rc = 0;
+    for (size_t i = 0; i < n && rc == 0; ++i) {
+        if (used + SHA256_HEX + 16 > sizeof(out)) {
+            rc = send_all(c->fd, out, used);
+            used = 0;
+        }
+        char hex[SHA256_HEX];
+        sha256_hex(hashes[i], hex);
+        used += (size_t)snprintf(out + used, sizeof(out) - used, "%s %u\n", hex, lens[i]);
+    }
+    if (rc == 0) rc = send_all(c->fd, out, used);
+    free(hashes);
+
+    // 3. "NEED k" + k chunk indices
+    char response[MAX_LINE];
+    unsigned long long k = 0;
+    if (rc < 0 || read_reply(c, response, sizeof(response)) < 0) {
+        fprintf(stderr, "Server closed connection unexpectedly.\n");
+        close(fd); free(offs); free(lens);
+        return 1;
+    }
+    if (sscanf(response, "NEED %llu", &k) != 1) {
+        fprintf(stderr, "Server error: %s\n", response);
+        close(fd); free(offs); free(lens);
+        return 1;
+    }
+
+    // 4. Send just those chunks
+    char chunk[CDC_MAX];
+    unsigned long long sent = 0;
+    for (unsigned long long j = 0; j < k; ++j) {
+        size_t i;
+        if (read_reply(c, response, sizeof(response)) < 0 ||
+            sscanf(response, "%zu", &i) != 1 || i >= n ||
+            pread(fd, chunk, lens[i], (off_t)offs[i]) != (ssize_t)lens[i] ||
+            send_all(c->fd, chunk, lens[i]) < 0) {
+            fprintf(stderr, "Chunk transfer failed.\n");
+            close(fd); free(offs); free(lens);
+            return 1;
+        }
+        sent += lens[i];
+    }
+    close(fd);
+    free(offs);
+    free(lens);
+    printf("[Client] Sent %llu of %zu chunks (%llu of %llu bytes)\n",
+           k, n, sent, size);
+
+    // 5. Final "WRITE_OK ... dedup=<ratio>" or error
+    if (read_reply(c, response, sizeof(response)) < 0) {
         fprintf(stderr, "No final response from server.\n");
         return 1;
     }
-    response[recvd] = '\0';
     printf("[Client] Server final response: %s\n", response);
 
+    return strncmp(response, "WRITE_OK", 8) == 0 ? 0 : 1;
+}
+
+// Delta ops gathered into payload-sized sends, with the pending run
+// of copied blocks kept open so consecutive blocks become one op
+typedef struct {
+    conn_t  *c;
+    size_t   used;
+    long     first, count;               // pending copy run, count 0 = none
+    unsigned long long literal, copied;
+    uint8_t  buf[XFER_BUF];
+} opbuf_t;
+
+static int ob_put(opbuf_t *ob, const void *data, size_t len)
+{
+    if (ob->used + len > sizeof(ob->buf)) {
+        if (ob->used && send_payload(ob->c, ob->buf, ob->used) < 0) return -1;
+        ob->used = 0;
+    }
+    if (len >= sizeof(ob->buf)) return send_payload(ob->c, data, len);
+    memcpy(ob->buf + ob->used, data, len);
+    ob->used += len;
+    return 0;
+}
+
+static int ob_copy_flush(opbuf_t *ob, size_t blk)
+{
+    if (ob->count == 0) return 0;
+    uint8_t op[9] = { DELTA_COPY };
+    delta_put_u32(op + 1, (uint32_t)ob->first);
+    delta_put_u32(op + 5, (uint32_t)ob->count);
+    ob->copied += (unsigned long long)ob->count * blk;
+    ob->count = 0;
+    return ob_put(ob, op, sizeof(op));
+}
+
+static int ob_literal(opbuf_t *ob, const uint8_t *p, size_t n, size_t blk)
+{
+    if (n == 0) return 0;
+    if (ob_copy_flush(ob, blk) < 0) return -1;
+    while (n > 0) {
+        size_t  k = n < (1u << 30) ? n : (1u << 30);
+        uint8_t op[5] = { DELTA_LITERAL };
+        delta_put_u32(op + 1, (uint32_t)k);
+        if (ob_put(ob, op, sizeof(op)) < 0 || ob_put(ob, p, k) < 0) return -1;
+        ob->literal += k;
+        p += k; n -= k;
+    }
+    return 0;
+}
+
+static int ob_copy(opbuf_t *ob, long b, size_t blk)
+{
+    if (ob->count && b == ob->first + ob->count) { ++ob->count; return 0; }
+    if (ob_copy_flush(ob, blk) < 0) return -1;
+    ob->first = b;
+    ob->count = 1;
     return 0;
 }
 
+// Slide a block-sized window over p[0..size) and send it as ops:
+// block references where the window matches a block of the server's
+// copy, literals in between
+static int send_delta(conn_t *c, const uint8_t *p, size_t size, size_t blk,
+                      const delta_sig_t *sig, size_t nsig,
+                      unsigned long long *literal, unsigned long long *copied)
+{
+    delta_index_t ix;
+    opbuf_t *ob = calloc(1, sizeof(*ob));
+    if (!ob || delta_index_init(&ix, sig, nsig) < 0) { free(ob); return -1; }
+    ob->c = c;
+
+    size_t   lit = 0, i = 0;
+    long     prefer = -1;
+    uint32_t w = 0;
+    int      fresh = 1, rc = 0;
+    while (nsig > 0 && i + blk <= size && rc == 0) {
+        if (fresh) { w = delta_weak(p + i, blk); fresh = 0; }
+        long b = delta_index_find(&ix, w, p + i, blk, prefer);
+        if (b >= 0) {
+            rc = ob_literal(ob, p + lit, i - lit, blk);
+            if (rc == 0) rc = ob_copy(ob, b, blk);
+            prefer = b + 1;
+            i += blk;
+            lit = i;
+            fresh = 1;
+            continue;
+        }
+        if (i + blk < size) w = delta_roll(w, p[i], p[i + blk], blk);
+        ++i;
+    }
+    uint8_t end = DELTA_END;
+    if (rc == 0) rc = ob_literal(ob, p + lit, size - lit, blk);
+    if (rc == 0) rc = ob_copy_flush(ob, blk);
+    if (rc == 0) rc = ob_put(ob, &end, 1);
+    if (rc == 0 && ob->used) rc = send_payload(c, ob->buf, ob->used);
+    *literal = ob->literal;
+    *copied  = ob->copied;
+    delta_index_free(&ix);
+    free(ob);
+    return rc;
+}
+
+// For a "WRITE localFile remoteFile [RO|RW] -D" command: fetch block
+// signatures of the server's copy and send only what differs from it.
+// Without a copy to diff against, or if it changed meanwhile, this
+// falls back to a plain WRITE
+static int do_delta(conn_t *c, char *localFile, char *remoteFile,
+                    char *permStr, xfer_opts_t *o)
+{
+    int fd = open(localFile, O_RDONLY);
+    if (fd < 0) {
+        perror("open (localFile)");
+        return 1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    size_t size = (size_t)st.st_size;
+
+    // 1. "SIGS_OK k size= block= ver=" + k signatures
+    char response[MAX_LINE];
+    if (send_line(c->fd, "SIGS %s", remoteFile) < 0 ||
+        read_reply(c, response, sizeof(response)) < 0) {
+        fprintf(stderr, "Server closed connection unexpectedly.\n");
+        close(fd);
+        return 1;
+    }
+    request_t r;
+    char line[MAX_LINE];
+    strcpy(line, response);
+    parse_request(line, &r);
+    unsigned long long nsig = 0, blk = 0;
+    const char *ver = req_opt(&r, "ver");
+    if (!r.cmd || strcmp(r.cmd, "SIGS_OK") != 0 || r.nargs < 1 || !ver ||
+        !req_opt_u64(&r, "block", &blk) || blk < DELTA_MIN_BLOCK ||
+        blk > DELTA_MAX_BLOCK) {
+        printf("[Client] No remote copy to diff against (%s), sending it whole.\n",
+               response);
+        close(fd);
+        return do_write(c, localFile, remoteFile, permStr, 0, o);
+    }
+    nsig = strtoull(r.args[0], NULL, 10);
+    char base[VER_LEN];
+    snprintf(base, sizeof(base), "%s", ver);
+
+    delta_sig_t *sig = malloc((nsig ? nsig : 1) * sizeof(*sig));
+    uint8_t rec[DELTA_SIG];
+    for (unsigned long long i = 0; sig && i < nsig; ++i) {
+        if (conn_read_full(c, rec, sizeof(rec)) < 0) {
+            fprintf(stderr, "Server closed connection unexpectedly.\n");
+            free(sig); close(fd);
+            return 1;
+        }
+        delta_sig_unpack(rec, &sig[i]);
+    }
+    const uint8_t *p = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (!sig || p == MAP_FAILED) {
+        fprintf(stderr, "Out of memory while diffing.\n");
+        free(sig);
+        return 1;      // the unread signatures leave the connection unusable
+    }
+
+    // 2. Announce the result by size and hash, so the server can check
+    //    what it rebuilds
+    uint8_t digest[SHA256_LEN];
+    char    hex[SHA256_HEX];
+    sha256(p, size, digest);
+    sha256_hex(digest, hex);
+    int rc = send_line(c->fd, "DELTA %s %s%s%s size=%zu block=%llu base=%s sha=%s",
+                       localFile, remoteFile, permStr ? " " : "",
+                       permStr ? permStr : "", size, blk, base, hex);
+    if (rc < 0 || read_reply(c, response, sizeof(response)) < 0) {
+        fprintf(stderr, "Server closed connection unexpectedly.\n");
+        rc = -1;
+    } else if (strncmp(response, "OK_READY_TO_RECEIVE", 19) != 0) {
+        rc = strncmp(response, "ERR_BASE_CHANGED", 16) == 0 ? 1 : -1;
+        if (rc < 0) fprintf(stderr, "Server error: %s\n", response);
+    } else {
+        // 3. The ops, then "WRITE_OK S size=S literal=L copied=C"
+        unsigned long long literal, copied, in0, out0, in1, out1;
+        proto_bytes(&in0, &out0);
+        rc = send_delta(c, p, size, (size_t)blk, sig, (size_t)nsig, &literal, &copied);
+        proto_bytes(&in1, &out1);
+        if (rc == 0) {
+            printf("[Client] Delta: %llu literal bytes, %llu bytes from %llu-byte "
+                   "blocks (%llu bytes sent)\n", literal, copied, blk, out1 - out0);
+            if (read_reply(c, response, sizeof(response)) < 0) {
+                fprintf(stderr, "No final response from server.\n");
+                rc = -1;
+            } else {
+                printf("[Client] Server final response: %s\n", response);
+                rc = strncmp(response, "WRITE_OK", 8) == 0 ? 0 :
+                     strncmp(response, "ERR_DELTA_MISMATCH", 18) == 0 ? 1 : -1;
+            }
+        } else {
+            perror("send");
+        }
+    }
+    if (p) munmap((void *)p, size);
+    free(sig);
+
+    // The server's copy moved under us: a plain upload is always right
+    if (rc == 1) {
+        printf("[Client] Remote copy changed (%s), sending it whole.\n", response);
+        return do_write(c, localFile, remoteFile, permStr, 0, o);
+    }
+    return rc == 0 ? 0 : 1;
+}
+
 // For a "GET remoteFile localFile" command
-static int do_get(int sock, char *remoteFile, char *localFile)
+static int do_get(conn_t *c, char *remoteFile, char *localFile, xfer_opts_t *o)
 {
-    // e.g. "GET folder/remote.txt downloaded.txt"
-    char cmd_buf[BUF_SIZE];
-    snprintf(cmd_buf, sizeof(cmd_buf), "GET %s %s", remoteFile, localFile);
+    // Resume: fetch only what the local copy is missing
+    if (o->resume) {
+        struct stat st;
+        o->offset = (stat(localFile, &st) == 0) ? (unsigned long long)st.st_size : 0;
+        o->has_offset = 1;
+        say("[Client] Resuming download at byte %llu\n", o->offset);
+    }
 
-    if (send(sock, cmd_buf, strlen(cmd_buf), 0) < 0) {
+    // A whole-file GET of a copy we fetched before only asks whether
+    // it changed; see cache_lookup()
+    int  whole = !o->has_offset && !o->has_length;
+    char ver[VER_LEN];
+    int  cached = whole && cache_lookup(remoteFile, localFile, ver);
+
+    // e.g. "GET folder/remote.txt downloaded.txt offset=0 length=100"
+    char cmd_buf[MAX_LINE];
+    int n = snprintf(cmd_buf, sizeof(cmd_buf), "GET %s %s", remoteFile, localFile);
+    if (o->has_offset)
+        n += snprintf(cmd_buf + n, sizeof(cmd_buf) - n, " offset=%llu", o->offset);
+    if (o->has_length)
+        n += snprintf(cmd_buf + n, sizeof(cmd_buf) - n, " length=%llu", o->length);
+    if (cached)
+        n += snprintf(cmd_buf + n, sizeof(cmd_buf) - n, " if_none_match=%s", ver);
+    snprintf(cmd_buf + n, sizeof(cmd_buf) - n, " crc=1");
+
+    if (send_line(c->fd, "%s", cmd_buf) < 0) {
         perror("send");
         return 1;
     }
 
-    // Wait for response (e.g., "OK_SENDING_FILE" or "ERR_FILE_NOT_FOUND")
-    char response[BUF_SIZE] = {0};
-    int recvd = recv(sock, response, sizeof(response) - 1, 0);
-    if (recvd <= 0) {
+    // Wait for response (e.g., "OK_SENDING_FILE <n>" or "ERR_FILE_NOT_FOUND")
+    char response[MAX_LINE];
+    if (read_reply(c, response, sizeof(response)) < 0) {
         fprintf(stderr, "Server closed connection unexpectedly.\n");
         return 1;
     }
-    response[recvd] = '\0';
 
     if (strncmp(response, "ERR_FILE_NOT_FOUND", 18) == 0) {
-        fprintf(stderr, "Server error: File not found.\n");
+        if (!g_quiet) fprintf(stderr, "Server error: File not found.\n");
         return 1;
     }
+    if (strncmp(response, "NOT_MODIFIED", 12) == 0) {
+        say("[Client] '%s' is up to date (not modified)\n", localFile);
+        return 0;
+    }
     if (strncmp(response, "OK_SENDING_FILE", 15) != 0) {
-        fprintf(stderr, "Server error: %s\n", response);
+        if (!g_quiet) fprintf(stderr, "Server error: %s\n", response);
         return 1;
     }
+    request_t r;
+    parse_request(response, &r);
+    unsigned long long len = (r.nargs > 0) ? strtoull(r.args[0], NULL, 10) : 0;
+    const char *new_ver = req_opt(&r, "ver");
 
-    // Now server should send file data
-    // Minimal approach: single recv (not robust for big files)
-    char file_buf[BUF_SIZE] = {0};
-    recvd = recv(sock, file_buf, sizeof(file_buf), 0);
-    if (recvd > 0) {
-        FILE *fp = fopen(localFile, "wb");
-        if (!fp) {
-            perror("fopen (localFile)");
+    // A ranged GET patches the local file in place; a full GET replaces it
+    int flags = O_WRONLY | O_CREAT | (o->has_offset ? 0 : O_TRUNC);
+    int fd = open(localFile, flags, 0666);
+    if (fd < 0) {
+        perror("open (localFile)");
+        return 1;
+    }
+
+    char file_buf[XFER_BUF];
+    unsigned long long total = 0;
+    uint32_t sum = 0;
+    while (total < len) {
+        size_t want = (len - total < sizeof(file_buf)) ? (size_t)(len - total)
+                                                       : sizeof(file_buf);
+        ssize_t got = conn_read_payload(c, file_buf, want);
+        if (got <= 0) {
+            fprintf(stderr, "Connection lost after %llu of %llu bytes "
+                            "(rerun with -c to resume).\n", total, len);
+            close(fd);
             return 1;
         }
-        fwrite(file_buf, 1, recvd, fp);
-        fclose(fp);
-        printf("[Client] File received, written to '%s'\n", localFile);
+        sum = crc32c(sum, file_buf, (size_t)got);
+        if (pwrite(fd, file_buf, (size_t)got, (off_t)(o->offset + total)) != got) {
+            perror("write (localFile)");
+            close(fd);
+            return 1;
+        }
+        total += (unsigned long long)got;
+    }
+    close(fd);
+
+    // The server's CRC32C of those bytes follows them
+    unsigned expect;
+    if (read_reply(c, response, sizeof(response)) < 0 ||
+        sscanf(response, "CRC %8x", &expect) != 1) {
+        fprintf(stderr, "No checksum from server after the file.\n");
+        return 1;
+    }
+    if (expect != sum) {
+        fprintf(stderr, "Checksum mismatch: received %08x, server has %08x; "
+                        "'%s' is not a good copy.\n", sum, expect, localFile);
+        return 1;
+    }
+    if (whole && new_ver) cache_record(remoteFile, localFile, new_ver);
+
+    if (total > 0) {
+        say("[Client] File received (%llu bytes), written to '%s'\n",
+            total, localFile);
     } else {
-        printf("[Client] File is empty or server didn't send data.\n");
+        say("[Client] File is empty or server didn't send data.\n");
+    }
+
+    return 0;
+}
+
+// ---------------------------------------------------------------------
+// Local cache index (CLIENT_CACHE_INDEX in the working directory): one
+// line "<ver>\t<size>\t<mtime_ns>\t<remote>\t<local>" per downloaded
+// file, naming the server version the local copy holds and the local
+// copy's size and mtime right after the download.  If the local file
+// still matches, a later GET sends if_none_match=<ver> and an
+// unchanged remote file costs one short reply instead of its bytes.
+// ---------------------------------------------------------------------
+static long long mtime_ns(const struct stat *st)
+{
+    return (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+// Split an index line in place; 0 if malformed
+static int cache_parse(char *line, char **f)
+{
+    line[strcspn(line, "\n")] = '\0';
+    for (int i = 0; i < 5; ++i) {
+        f[i] = line;
+        line = strchr(line, '\t');
+        if (i < 4) {
+            if (!line) return 0;
+            *line++ = '\0';
+        }
+    }
+    return 1;
+}
+
+// 1 and the version held if localFile is an untouched download of
+// remoteFile
+static int cache_lookup(const char *remoteFile, const char *localFile, char *ver)
+{
+    struct stat st;
+    FILE *fp = fopen(CLIENT_CACHE_INDEX, "r");
+    if (!fp) return 0;
+    if (stat(localFile, &st) < 0) { fclose(fp); return 0; }
+
+    char line[3 * BUF_SIZE];
+    char *f[5];
+    int found = 0;
+    while (!found && fgets(line, sizeof(line), fp)) {
+        if (!cache_parse(line, f)) continue;
+        found = strcmp(f[3], remoteFile) == 0 && strcmp(f[4], localFile) == 0 &&
+                strtoull(f[1], NULL, 10) == (unsigned long long)st.st_size &&
+                strtoll(f[2], NULL, 10) == mtime_ns(&st);
+        if (found) snprintf(ver, VER_LEN, "%s", f[0]);
+    }
+    fclose(fp);
+    return found;
+}
+
+// Remember that localFile now holds version ver of remoteFile
+static void cache_record(const char *remoteFile, const char *localFile, const char *ver)
+{
+    // batch workers share the index: one rewrite at a time, so none
+    // of them drops another's entry
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    struct stat st;
+    if (stat(localFile, &st) < 0) return;
+
+    pthread_mutex_lock(&lock);
+    char tmp[] = CLIENT_CACHE_INDEX ".XXXXXX";
+    int fd = mkstemp(tmp);
+    FILE *out = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!out) {
+        if (fd >= 0) { close(fd); unlink(tmp); }
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    // copy every other entry, then add this one
+    FILE *in = fopen(CLIENT_CACHE_INDEX, "r");
+    char line[3 * BUF_SIZE], copy[3 * BUF_SIZE];
+    char *f[5];
+    while (in && fgets(line, sizeof(line), in)) {
+        memcpy(copy, line, sizeof(line));
+        if (cache_parse(copy, f) &&
+            !(strcmp(f[3], remoteFile) == 0 && strcmp(f[4], localFile) == 0))
+            fputs(line, out);
+    }
+    if (in) fclose(in);
+    fprintf(out, "%s\t%llu\t%lld\t%s\t%s\n", ver,
+            (unsigned long long)st.st_size, mtime_ns(&st), remoteFile, localFile);
+    if (fclose(out) != 0 || rename(tmp, CLIENT_CACHE_INDEX) < 0) unlink(tmp);
+    pthread_mutex_unlock(&lock);
+}
+
+// ---------------------------------------------------------------------
+// Parallel transfers (-j N): one range per stream, one connection per
+// stream.  Uploads land in a server-side temp file that PUT_COMMIT
+// renames into place; downloads land in "<localFile>.part" locally.
+// ---------------------------------------------------------------------
+typedef struct {
+    char              *remoteFile;
+    char              *upload;      // upload id (NULL for a download)
+    const char        *ver;         // download: version every range must come from
+    int                fd;          // local file
+    unsigned long long offset;
+    unsigned long long length;
+    int                status;      // 0 on success
+} stream_t;
+
+static double now_sec(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Split size bytes into at most `streams` ranges of >= MIN_STREAM_BYTES
+static int plan_streams(stream_t *s, int streams, unsigned long long size)
+{
+    unsigned long long most = (size + MIN_STREAM_BYTES - 1) / MIN_STREAM_BYTES;
+    if (most < 1) most = 1;
+    if ((unsigned long long)streams > most) streams = (int)most;
+    unsigned long long per = (size / streams + XFER_BUF - 1) / XFER_BUF * XFER_BUF;
+    unsigned long long off = 0;
+    for (int i = 0; i < streams; ++i) {
+        s[i].offset = off;
+        s[i].length = (size - off < per || i == streams - 1) ? size - off : per;
+        off += s[i].length;
+    }
+    return streams;
+}
+
+// Upload one range as "PUT_PART id=<id> offset=M size=N" + N bytes
+static void *put_stream(void *arg)
+{
+    stream_t *s = arg;
+    s->status = 1;
+    int sock = connect_server();
+    if (sock < 0) return NULL;
+    conn_t conn;
+    conn_init(&conn, sock);
+
+    char file_buf[XFER_BUF];
+    unsigned long long sent = 0;
+    uint32_t sum = 0;
+    int rc = send_line(sock, "PUT_PART id=%s offset=%llu size=%llu crc=1",
+                       s->upload, s->offset, s->length);
+    while (rc == 0 && sent < s->length) {
+        size_t want = (s->length - sent < sizeof(file_buf)) ? (size_t)(s->length - sent)
+                                                            : sizeof(file_buf);
+        ssize_t got = pread(s->fd, file_buf, want, (off_t)(s->offset + sent));
+        if (got <= 0) break;
+        sum = crc32c(sum, file_buf, (size_t)got);
+        rc = send_all(sock, file_buf, (size_t)got);
+        sent += (unsigned long long)got;
+    }
+    if (rc == 0 && sent == s->length) rc = send_line(sock, "CRC %08x", sum);
+
+    char response[MAX_LINE];
+    if (sent == s->length && read_reply(&conn, response, sizeof(response)) >= 0) {
+        if (strncmp(response, "PART_OK", 7) == 0) s->status = 0;
+        else fprintf(stderr, "Server error: %s\n", response);
+    }
+    close(sock);
+    return NULL;
+}
+
+// Download one range with a ranged GET, written in place
+static void *get_stream(void *arg)
+{
+    stream_t *s = arg;
+    s->status = 1;
+    int sock = connect_server();
+    if (sock < 0) return NULL;
+    conn_t conn;
+    conn_init(&conn, sock);
+
+    char response[MAX_LINE];
+    unsigned long long len = 0, total = 0;
+    if (send_line(sock, "GET %s - offset=%llu length=%llu if_match=%s crc=1",
+                  s->remoteFile, s->offset, s->length, s->ver) < 0 ||
+        read_reply(&conn, response, sizeof(response)) < 0 ||
+        sscanf(response, "OK_SENDING_FILE %llu", &len) != 1 || len != s->length) {
+        if (strncmp(response, "ERR_VERSION_CHANGED", 19) == 0)
+            fprintf(stderr, "Range %llu+%llu: file changed during the download.\n",
+                    s->offset, s->length);
+        else
+            fprintf(stderr, "Range %llu+%llu failed.\n", s->offset, s->length);
+        close(sock);
+        return NULL;
+    }
+
+    char file_buf[XFER_BUF];
+    uint32_t sum = 0;
+    while (total < len) {
+        size_t want = (len - total < sizeof(file_buf)) ? (size_t)(len - total)
+                                                       : sizeof(file_buf);
+        ssize_t got = conn_read(&conn, file_buf, want);
+        if (got <= 0 ||
+            pwrite(s->fd, file_buf, (size_t)got, (off_t)(s->offset + total)) != got)
+            break;
+        sum = crc32c(sum, file_buf, (size_t)got);
+        total += (unsigned long long)got;
+    }
+    unsigned expect;
+    if (total == len && read_reply(&conn, response, sizeof(response)) >= 0 &&
+        sscanf(response, "CRC %8x", &expect) == 1) {
+        if (expect == sum) s->status = 0;
+        else fprintf(stderr, "Range %llu+%llu: checksum mismatch.\n", s->offset, s->length);
+    }
+    close(sock);
+    return NULL;
+}
+
+// Run one thread per stream; returns the number that failed
+static int run_streams(stream_t *s, int n, void *(*fn)(void *))
+{
+    pthread_t tids[MAX_STREAMS];
+    int failed = 0;
+    for (int i = 0; i < n; ++i)
+        if (pthread_create(&tids[i], NULL, fn, &s[i]) != 0) {
+            s[i].status = 1;
+            tids[i] = 0;
+        }
+    for (int i = 0; i < n; ++i) {
+        if (tids[i]) pthread_join(tids[i], NULL);
+        failed += s[i].status != 0;
+    }
+    return failed;
+}
+
+// For a "WRITE localFile remoteFile [RO|RW] -j N" command
+static int do_pwrite(conn_t *c, char *localFile, char *remoteFile,
+                     char *permStr, int streams)
+{
+    int fd = open(localFile, O_RDONLY);
+    if (fd < 0) {
+        perror("open (localFile)");
+        return 1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    unsigned long long size = (unsigned long long)st.st_size;
+
+    // 1. "PUT_BEGIN local remote [RO|RW] size=S" -> "UPLOAD_ID <id>"
+    char response[MAX_LINE];
+    if (send_line(c->fd, "PUT_BEGIN %s %s%s%s size=%llu", localFile, remoteFile,
+                  permStr ? " " : "", permStr ? permStr : "", size) < 0 ||
+        read_reply(c, response, sizeof(response)) < 0) {
+        fprintf(stderr, "Server closed connection unexpectedly.\n");
+        close(fd);
+        return 1;
+    }
+    if (strncmp(response, "ERR_CHUNKED_MODE", 16) == 0) {
+        // a chunked server stores whole files only; use one stream
+        printf("[Client] Server is in chunked mode, using a single stream\n");
+        xfer_opts_t o = {0};
+        close(fd);
+        return do_write(c, localFile, remoteFile, permStr, 0, &o);
+    }
+    char id[32];
+    if (sscanf(response, "UPLOAD_ID %31s", id) != 1) {
+        fprintf(stderr, "Server error: %s\n", response);
+        close(fd);
+        return 1;
+    }
+
+    // 2. Each stream sends its range on its own connection
+    stream_t s[MAX_STREAMS];
+    memset(s, 0, sizeof(s));
+    int n = plan_streams(s, streams, size);
+    for (int i = 0; i < n; ++i) {
+        s[i].upload = id;
+        s[i].fd     = fd;
+    }
+    double t0 = now_sec();
+    int failed = run_streams(s, n, put_stream);
+    double secs = now_sec() - t0;
+    close(fd);
+
+    // 3. Commit (atomic rename on the server) or abort
+    if (send_line(c->fd, "%s id=%s", failed ? "PUT_ABORT" : "PUT_COMMIT", id) < 0 ||
+        read_reply(c, response, sizeof(response)) < 0) {
+        fprintf(stderr, "No final response from server.\n");
+        return 1;
+    }
+    if (failed) {
+        fprintf(stderr, "%d of %d streams failed; upload aborted.\n", failed, n);
+        return 1;
+    }
+    printf("[Client] Sent %llu bytes over %d streams in %.3f s (%.1f MB/s)\n",
+           size, n, secs, secs > 0 ? size / secs / 1e6 : 0.0);
+    printf("[Client] Server final response: %s\n", response);
+
+    return strncmp(response, "WRITE_OK", 8) == 0 ? 0 : 1;
+}
+
+// For a "GET remoteFile localFile -j N" command
+static int do_pget(conn_t *c, char *remoteFile, char *localFile, int streams)
+{
+    // 1. Learn the size and version (and that the file exists)
+    char response[MAX_LINE];
+    unsigned long long size = 0;
+    if (send_line(c->fd, "GET %s - offset=0 length=0", remoteFile) < 0 ||
+        read_reply(c, response, sizeof(response)) < 0) {
+        fprintf(stderr, "Server closed connection unexpectedly.\n");
+        return 1;
+    }
+    if (strncmp(response, "OK_SENDING_FILE", 15) != 0) {
+        fprintf(stderr, "Server error: %s\n", response);
+        return 1;
+    }
+    request_t r;
+    parse_request(response, &r);
+    req_opt_u64(&r, "size", &size);
+    const char *ver = req_opt(&r, "ver");
+    if (!ver || !*ver || strchr(ver, '~')) {
+        // just modified: a later in-place write could keep this token,
+        // so no range could prove it matches; one GET reads it whole
+        say("[Client] File changed within the last second; using a single stream\n");
+        xfer_opts_t o = {0};
+        return do_get(c, remoteFile, localFile, &o);
+    }
+
+    // 2. Fetch the ranges, each only from version ver, into
+    //    "<localFile>.part", then rename it over localFile so a failed
+    //    download never leaves a torn file behind
+    char part[BUF_SIZE];
+    snprintf(part, sizeof(part), "%s.part", localFile);
+    int fd = open(part, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0 || ftruncate(fd, (off_t)size) < 0) {
+        perror("open (localFile)");
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+
+    stream_t s[MAX_STREAMS];
+    memset(s, 0, sizeof(s));
+    int n = plan_streams(s, streams, size);
+    for (int i = 0; i < n; ++i) {
+        s[i].remoteFile = remoteFile;
+        s[i].ver        = ver;
+        s[i].fd         = fd;
     }
+    double t0 = now_sec();
+    int failed = size ? run_streams(s, n, get_stream) : 0;
+    double secs = now_sec() - t0;
+    close(fd);
 
+    if (failed || rename(part, localFile) < 0) {
+        fprintf(stderr, "%d of %d streams failed; download incomplete.\n", failed, n);
+        unlink(part);
+        return 1;
+    }
+    printf("[Client] File received (%llu bytes over %d streams in %.3f s, "
+           "%.1f MB/s), written to '%s'\n",
+           size, n, secs, secs > 0 ? size / secs / 1e6 : 0.0, localFile);
     return 0;
 }
 
 // For a "RM remoteFile" command
-static int do_rm(int sock, char *remoteFile)
+static int do_rm(conn_t *c, char *remoteFile)
 {
-    char cmd_buf[BUF_SIZE];
-    snprintf(cmd_buf, sizeof(cmd_buf), "RM %s", remoteFile);
+    if (send_line(c->fd, "RM %s", remoteFile) < 0) {
+        perror("send");
+        return 1;
+    }
+
+    char response[MAX_LINE];
+    if (read_reply(c, response, sizeof(response)) < 0) {
+        fprintf(stderr, "Server closed connection unexpectedly.\n");
+        return 1;
+    }
+    say("[Client] Server response: %s\n", response);
+
+    return strncmp(response, "RM_OK", 5) == 0 ? 0 : 1;
+}
 
-    if (send(sock, cmd_buf, strlen(cmd_buf), 0) < 0) {
+// For an "LS [remoteDir]" command: print one line per entry,
+// "<f|d> <size> <mtime> <name>"
+static int do_ls(conn_t *c, char *remoteDir)
+{
+    if (send_line(c->fd, "LS %s", remoteDir) < 0) {
         perror("send");
         return 1;
     }
 
-    char response[BUF_SIZE] = {0};
-    int recvd = recv(sock, response, sizeof(response) - 1, 0);
-    if (recvd <= 0) {
+    char response[MAX_LINE];
+    if (read_reply(c, response, sizeof(response)) < 0) {
+        fprintf(stderr, "Server closed connection unexpectedly.\n");
+        return 1;
+    }
+    request_t r;
+    unsigned long long len;
+    parse_request(response, &r);
+    if (!r.cmd || strcmp(r.cmd, "OK_LISTING") != 0 || !req_opt_u64(&r, "bytes", &len)) {
+        fprintf(stderr, "Server error: %s\n", response);
+        return 1;
+    }
+    char buf[XFER_BUF];
+    while (len > 0) {
+        ssize_t got = conn_read(c, buf, len < sizeof(buf) ? (size_t)len : sizeof(buf));
+        if (got <= 0) {
+            fprintf(stderr, "Connection lost while reading the listing.\n");
+            return 1;
+        }
+        fwrite(buf, 1, (size_t)got, stdout);
+        len -= (unsigned long long)got;
+    }
+    return 0;
+}
+
+// For a "STAT remotePath" command
+static int do_stat(conn_t *c, char *remotePath)
+{
+    if (send_line(c->fd, "STAT %s", remotePath) < 0) {
+        perror("send");
+        return 1;
+    }
+    char response[MAX_LINE];
+    if (read_reply(c, response, sizeof(response)) < 0) {
         fprintf(stderr, "Server closed connection unexpectedly.\n");
         return 1;
     }
-    response[recvd] = '\0';
     printf("[Client] Server response: %s\n", response);
+    return strncmp(response, "STAT_OK", 7) == 0 ? 0 : 1;
+}
+
+// For a "STATS" command: print the server's metrics
+static int do_stats(conn_t *c)
+{
+    if (send_line(c->fd, "STATS") < 0) {
+        perror("send");
+        return 1;
+    }
+
+    char response[MAX_LINE];
+    unsigned long long len;
+    if (read_reply(c, response, sizeof(response)) < 0 ||
+        sscanf(response, "OK_STATS %llu", &len) != 1) {
+        fprintf(stderr, "Server error: no statistics.\n");
+        return 1;
+    }
+    char *text = malloc(len + 1);
+    if (!text || conn_read_full(c, text, len) < 0) {
+        fprintf(stderr, "Connection lost while reading statistics.\n");
+        free(text);
+        return 1;
+    }
+    fwrite(text, 1, len, stdout);
+    free(text);
+    return 0;
+}
+
+// ---------------------------------------------------------------------
+// Batches: many small files in one request
+// ---------------------------------------------------------------------
+
+// Names from the command line, or one per line from stdin for "-".
+// The array (and any names read) live until the program exits.
+static char **batch_names(char **argv, int argc, int *n)
+{
+    if (argc == 1 && strcmp(argv[0], "-") == 0) {
+        char **names = NULL;
+        size_t cap = 0;
+        char *line = NULL;
+        size_t len = 0;
+        ssize_t got;
+        *n = 0;
+        while ((got = getline(&line, &len, stdin)) > 0) {
+            while (got > 0 && (line[got - 1] == '\n' || line[got - 1] == '\r'))
+                line[--got] = '\0';
+            if (got == 0) continue;
+            if ((size_t)*n == cap) {
+                cap = cap ? cap * 2 : 256;
+                char **grown = realloc(names, cap * sizeof(*names));
+                if (!grown) break;
+                names = grown;
+            }
+            names[(*n)++] = strdup(line);
+        }
+        free(line);
+        return names;
+    }
+    char **names = malloc((size_t)argc * sizeof(*names));
+    if (!names) { *n = 0; return NULL; }
+    memcpy(names, argv, (size_t)argc * sizeof(*names));
+    *n = argc;
+    return names;
+}
+
+// Create the missing parent directories of path
+static void make_parents(char *path)
+{
+    for (char *p = path + 1; *p; ++p) {
+        if (*p != '/') continue;
+        *p = '\0';
+        mkdir(path, 0777);
+        *p = '/';
+    }
+}
+
+// Outgoing bytes gathered into large sends: one batch is many small
+// files, and a send() per header would leave most packets half empty
+typedef struct {
+    int    fd;
+    size_t used;
+    char   buf[XFER_BUF];
+} sendbuf_t;
+
+static int sb_flush(sendbuf_t *sb)
+{
+    int rc = sb->used ? send_all(sb->fd, sb->buf, sb->used) : 0;
+    sb->used = 0;
+    return rc;
+}
 
+static int sb_put(sendbuf_t *sb, const void *data, size_t len)
+{
+    if (sb->used + len > sizeof(sb->buf) && sb_flush(sb) < 0) return -1;
+    if (len >= sizeof(sb->buf)) return send_all(sb->fd, data, len);
+    memcpy(sb->buf + sb->used, data, len);
+    sb->used += len;
     return 0;
 }
+
+// For an "MGET localDir remote..." command: fetch every file into
+// localDir/<remote>; the server loads them in parallel
+static int do_mget(conn_t *c, char *localDir, char **remote, int n)
+{
+    sendbuf_t *sb = malloc(sizeof(*sb));
+    if (!sb) return 1;
+    sb->fd   = c->fd;
+    sb->used = (size_t)snprintf(sb->buf, sizeof(sb->buf), "MGET count=%d\n", n);
+    int rc = 0;
+    for (int i = 0; i < n && rc == 0; ++i) {
+        rc = sb_put(sb, remote[i], strlen(remote[i]));
+        if (rc == 0) rc = sb_put(sb, "\n", 1);
+    }
+    if (rc == 0) rc = sb_flush(sb);
+    free(sb);
+    if (rc < 0) {
+        perror("send");
+        return 1;
+    }
+
+    double t0 = now_sec();
+    char response[MAX_LINE];
+    char buf[XFER_BUF];
+    int  fetched = 0, missing = 0;
+    unsigned long long total = 0;
+    for (;;) {
+        if (read_reply(c, response, sizeof(response)) < 0) {
+            fprintf(stderr, "Server closed connection unexpectedly.\n");
+            return 1;
+        }
+        if (strncmp(response, "MGET_OK", 7) == 0) break;
+        if (strncmp(response, "MISS ", 5) == 0) {
+            printf("[Client] %s\n", response);
+            ++missing;
+            continue;
+        }
+        // "FILE <remote> <size>"
+        char *size_str = strrchr(response, ' ');
+        if (strncmp(response, "FILE ", 5) != 0 || !size_str || size_str < response + 5) {
+            fprintf(stderr, "Server error: %s\n", response);
+            return 1;
+        }
+        *size_str++ = '\0';
+        unsigned long long left = strtoull(size_str, NULL, 10);
+        char path[BUF_SIZE * 2];
+        snprintf(path, sizeof(path), "%s/%s", localDir, response + 5);
+        make_parents(path);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) perror(path);
+        total += left;
+        while (left > 0) {
+            size_t want = left < sizeof(buf) ? (size_t)left : sizeof(buf);
+            ssize_t got = conn_read(c, buf, want);
+            if (got <= 0) {
+                fprintf(stderr, "Connection lost during MGET.\n");
+                if (fd >= 0) close(fd);
+                return 1;
+            }
+            if (fd >= 0 && write(fd, buf, (size_t)got) != got) perror(path);
+            left -= (unsigned long long)got;
+        }
+        if (fd >= 0) close(fd);
+        ++fetched;
+    }
+    double dt = now_sec() - t0;
+    printf("[Client] MGET: %d files, %llu bytes in %.3f s (%d missing)\n",
+           fetched, total, dt, missing);
+    return missing ? 1 : 0;
+}
+
+// For an "MPUT [RO|RW] remoteDir local..." command: upload every file
+// as remoteDir/<basename> ("." for the top level) in one stream
+static int do_mput(conn_t *c, char *permStr, char *remoteDir, char **local, int n)
+{
+    // Every file must be readable before the batch starts: the count
+    // and sizes go out ahead of the data.  The ones that are not are
+    // left out and reported, never sent as empty files
+    char **names = malloc((size_t)(n ? n : 1) * sizeof(*names));
+    unsigned long long *sizes = malloc((size_t)(n ? n : 1) * sizeof(*sizes));
+    if (!names || !sizes) { free(names); free(sizes); return 1; }
+    int k = 0, skipped = 0;
+    for (int i = 0; i < n; ++i) {
+        int fd = open(local[i], O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+            if (fd >= 0) fprintf(stderr, "%s: not a regular file\n", local[i]);
+            else perror(local[i]);
+            printf("[Client] Skipping %s\n", local[i]);
+            ++skipped;
+        } else {
+            names[k] = local[i];
+            sizes[k++] = (unsigned long long)st.st_size;
+        }
+        if (fd >= 0) close(fd);
+    }
+    if (k == 0) {
+        fprintf(stderr, "No readable files to send.\n");
+        free(names); free(sizes);
+        return 1;
+    }
+
+    if (send_line(c->fd, "MPUT count=%d%s%s", k, permStr ? " " : "",
+                  permStr ? permStr : "") < 0) {
+        perror("send");
+        free(names); free(sizes);
+        return 1;
+    }
+    char response[MAX_LINE];
+    if (read_reply(c, response, sizeof(response)) < 0) {
+        fprintf(stderr, "Server closed connection unexpectedly.\n");
+        free(names); free(sizes);
+        return 1;
+    }
+    if (strncmp(response, "OK_READY_TO_RECEIVE", 19) != 0) {
+        fprintf(stderr, "Server error: %s\n", response);
+        free(names); free(sizes);
+        return 1;
+    }
+
+    double t0 = now_sec();
+    sendbuf_t *sb = malloc(sizeof(*sb));
+    char *file_buf = malloc(XFER_BUF);
+    if (!sb || !file_buf) { free(sb); free(file_buf); free(names); free(sizes); return 1; }
+    sb->fd   = c->fd;
+    sb->used = 0;
+    unsigned long long total = 0;
+    int rc = 0, shrunk = 0;
+    for (int i = 0; i < k && rc == 0 && !shrunk; ++i) {
+        unsigned long long size = sizes[i];
+        int fd = open(names[i], O_RDONLY);
+        const char *base = strrchr(names[i], '/');
+        base = base ? base + 1 : names[i];
+        char header[MAX_LINE];
+        int hl = strcmp(remoteDir, ".") == 0
+            ? snprintf(header, sizeof(header), "%s size=%llu\n", base, size)
+            : snprintf(header, sizeof(header), "%s/%s size=%llu\n", remoteDir, base, size);
+        rc = sb_put(sb, header, (size_t)hl);
+
+        // The header promised `size` bytes.  If the file went away or
+        // shrank meanwhile there is nothing honest to send: give up on
+        // the whole batch, and the server, seeing the stream break
+        // off, publishes none of it
+        for (unsigned long long sent = 0; rc == 0 && sent < size; ) {
+            size_t want = size - sent < XFER_BUF ? (size_t)(size - sent) : XFER_BUF;
+            ssize_t got = fd < 0 ? -1 : read(fd, file_buf, want);
+            if (got <= 0) {
+                fprintf(stderr, "%s: changed while being sent (%llu of %llu bytes); "
+                        "MPUT aborted, nothing stored.\n", names[i], sent, size);
+                shrunk = 1;
+                break;
+            }
+            rc = sb_put(sb, file_buf, (size_t)got);
+            sent += (unsigned long long)got;
+        }
+        if (fd >= 0) close(fd);
+        total += size;
+    }
+    if (rc == 0 && !shrunk) rc = sb_flush(sb);
+    free(sb);
+    free(file_buf);
+    free(names);
+    free(sizes);
+    if (shrunk) return 1;                   // caller closes the connection
+    if (rc < 0) {
+        perror("send");
+        return 1;
+    }
+
+    // One line per file, then the summary
+    int failed = 0;
+    for (;;) {
+        if (read_reply(c, response, sizeof(response)) < 0) {
+            fprintf(stderr, "Server closed connection unexpectedly.\n");
+            return 1;
+        }
+        if (strncmp(response, "MPUT_OK", 7) == 0) break;
+        if (strncmp(response, "FAILED ", 7) == 0) {
+            printf("[Client] %s\n", response);
+            ++failed;
+        }
+    }
+    double dt = now_sec() - t0;
+    printf("[Client] MPUT: %d files, %llu bytes in %.3f s (%d failed, %d skipped)\n",
+           k - failed, total, dt, failed, skipped);
+    return failed || skipped ? 1 : 0;
+}
+
+// ---------------------------------------------------------------------
+// Messages: practicum1's message store, served from the server's cache
+// ---------------------------------------------------------------------
+
+// For a "PUTMSG id sender receiver text" command; "-" reads the text
+// from stdin
+static int do_putmsg(conn_t *c, char *id, char *sender, char *receiver, char *text)
+{
+    // read once: a retry must not go back to an empty stdin
+    static char   stdin_text[MAX_CONTENT_LEN];
+    static size_t stdin_len;
+    static int    have_stdin;
+    size_t len;
+    if (strcmp(text, "-") == 0) {
+        if (!have_stdin) {
+            stdin_len  = fread(stdin_text, 1, sizeof(stdin_text), stdin);
+            have_stdin = 1;
+        }
+        text = stdin_text;
+        len  = stdin_len;
+    } else {
+        len = strlen(text);
+    }
+    if (len >= MAX_CONTENT_LEN) {
+        fprintf(stderr, "Message text is longer than %d bytes.\n", MAX_CONTENT_LEN - 1);
+        return 1;
+    }
+    if (send_line(c->fd, "PUTMSG %s from=%s to=%s size=%zu", id, sender, receiver, len) < 0 ||
+        send_all(c->fd, text, len) < 0) {
+        perror("send");
+        return 1;
+    }
+
+    char response[MAX_LINE];
+    if (read_reply(c, response, sizeof(response)) < 0) {
+        fprintf(stderr, "Server closed connection unexpectedly.\n");
+        return 1;
+    }
+    say("[Client] Server response: %s\n", response);
+    return strncmp(response, "PUTMSG_OK", 9) == 0 ? 0 : 1;
+}
+
+// One "MSG <id> ts= from= to= delivered= size=" reply and its text,
+// printed; 1 if the server had no such message
+static int print_msg(conn_t *c, const char *line)
+{
+    request_t r;
+    char copy[MAX_LINE], text[MAX_CONTENT_LEN];
+    snprintf(copy, sizeof(copy), "%s", line);
+    parse_request(copy, &r);
+    unsigned long long ts, size;
+    if (!r.cmd || strcmp(r.cmd, "MSG") != 0 || r.nargs < 1 ||
+        !req_opt_u64(&r, "ts", &ts) || !req_opt_u64(&r, "size", &size) ||
+        size >= sizeof(text)) {
+        printf("[Client] %s\n", line);
+        return 1;
+    }
+    if (conn_read_full(c, text, (size_t)size) < 0) return -1;
+    text[size] = '\0';
+    time_t sent = (time_t)ts;
+    char when[32];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&sent));
+    const char *from = req_opt(&r, "from"), *to = req_opt(&r, "to");
+    const char *delivered = req_opt(&r, "delivered");
+    printf("[Client] Message %s from %s to %s, %s%s:\n%s\n", r.args[0],
+           from ? from : "?", to ? to : "?", when,
+           delivered && strcmp(delivered, "1") == 0 ? " (delivered)" : "", text);
+    return 0;
+}
+
+// For a "GETMSG id..." command: one GETMSG, or one MGETMSG for several
+static int do_getmsg(conn_t *c, char **ids, int n)
+{
+    int rc = 0;
+    if (n == 1) {
+        rc = send_line(c->fd, "GETMSG %s", ids[0]);
+    } else {
+        sendbuf_t *sb = malloc(sizeof(*sb));
+        if (!sb) return 1;
+        sb->fd   = c->fd;
+        sb->used = (size_t)snprintf(sb->buf, sizeof(sb->buf), "MGETMSG count=%d\n", n);
+        for (int i = 0; i < n && rc == 0; ++i) {
+            rc = sb_put(sb, ids[i], strlen(ids[i]));
+            if (rc == 0) rc = sb_put(sb, "\n", 1);
+        }
+        if (rc == 0) rc = sb_flush(sb);
+        free(sb);
+    }
+    if (rc < 0) {
+        perror("send");
+        return 1;
+    }
+
+    int status = 0;
+    char response[MAX_LINE];
+    for (int i = 0; i < n; ++i) {
+        if (read_reply(c, response, sizeof(response)) < 0 ||
+            (rc = print_msg(c, response)) < 0) {
+            fprintf(stderr, "Server closed connection unexpectedly.\n");
+            return 1;
+        }
+        if (rc) status = 1;
+        if (g_busy_ms) return 1;
+    }
+    if (n > 1) {
+        if (read_reply(c, response, sizeof(response)) < 0) {
+            fprintf(stderr, "Server closed connection unexpectedly.\n");
+            return 1;
+        }
+        say("[Client] Server response: %s\n", response);
+    }
+    return status;
+}
+
+// ---------------------------------------------------------------------
+// Manifests ("rfs batch file"): one operation per line, written like
+// the command that would run it alone,
+//     WRITE local remote [RO|RW]
+//     APPEND local remote
+//     GET remote local
+//     RM remote
+// with blank lines and "#" comments skipped.  A pool of -j connections
+// works through the list, each worker taking the next operation as it
+// finishes the last, so lines run in no particular order.  Every
+// operation gets one result line as it completes; a summary with the
+// aggregate throughput comes last.
+// ---------------------------------------------------------------------
+typedef struct {
+    int   line;                  // in the manifest, for the report
+    char *cmd, *a, *b, *perm;    // as on the command line
+} batch_op_t;
+
+typedef struct {
+    batch_op_t *ops;
+    int         n;
+    int         next;            // the next operation to take
+    int         compress;        // -z on every connection
+    int         failed;
+    unsigned long long bytes;    // moved by the operations that succeeded
+} batch_t;
+
+// Parse the manifest (or stdin for "-"); NULL after reporting an error
+static batch_op_t *load_manifest(const char *path, int *n)
+{
+    FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return NULL;
+    }
+    batch_op_t *ops = NULL;
+    int cap = 0, bad = 0;
+    char line[BUF_SIZE];
+    *n = 0;
+    for (int no = 1; fgets(line, sizeof(line), fp); ++no) {
+        char *f[5] = {0};
+        int nf = 0;
+        for (char *t = strtok(line, " \t\r\n"); t && nf < 5; t = strtok(NULL, " \t\r\n"))
+            f[nf++] = t;
+        if (nf == 0 || f[0][0] == '#') continue;
+
+        int ok = (strcasecmp(f[0], "WRITE") == 0 && (nf == 3 || nf == 4)) ||
+                 (strcasecmp(f[0], "APPEND") == 0 && nf == 3) ||
+                 (strcasecmp(f[0], "GET") == 0 && nf == 3) ||
+                 (strcasecmp(f[0], "RM") == 0 && nf == 2);
+        if (ok && nf == 4 && strcmp(f[3], "RO") != 0 && strcmp(f[3], "RW") != 0)
+            ok = 0;
+        if (!ok) {
+            fprintf(stderr, "%s:%d: expected WRITE local remote [RO|RW], "
+                            "APPEND local remote, GET remote local or RM remote\n",
+                    path, no);
+            ++bad;
+            continue;
+        }
+        if (*n == cap) {
+            cap = cap ? 2 * cap : 64;
+            batch_op_t *grown = realloc(ops, (size_t)cap * sizeof(*ops));
+            if (!grown) { perror("realloc"); bad = 1; break; }
+            ops = grown;
+        }
+        batch_op_t *op = &ops[(*n)++];
+        op->line = no;
+        op->cmd  = strdup(f[0]);
+        op->a    = strdup(f[1]);
+        op->b    = nf > 2 ? strdup(f[2]) : NULL;
+        op->perm = nf > 3 ? strdup(f[3]) : NULL;
+        for (char *p = op->cmd; *p; ++p) *p = (char)toupper((unsigned char)*p);
+    }
+    if (fp != stdin) fclose(fp);
+    if (bad) {
+        free(ops);      // the strings live until the program exits
+        return NULL;
+    }
+    return ops;
+}
+
+// Run one operation on c; *bytes is what it moved
+static int batch_run(conn_t *c, batch_op_t *op, unsigned long long *bytes)
+{
+    xfer_opts_t opts = {0};
+    struct stat st;
+    *bytes = 0;
+    if (strcmp(op->cmd, "RM") == 0) return do_rm(c, op->a);
+    if (strcmp(op->cmd, "GET") == 0) {
+        int status = do_get(c, op->a, op->b, &opts);
+        if (status == 0 && strncmp(g_reply, "NOT_MODIFIED", 12) != 0 &&
+            stat(op->b, &st) == 0)
+            *bytes = (unsigned long long)st.st_size;
+        return status;
+    }
+    if (stat(op->a, &st) == 0) *bytes = (unsigned long long)st.st_size;
+    return do_write(c, op->a, op->b, op->perm, strcmp(op->cmd, "APPEND") == 0, &opts);
+}
+
+// One connection of the pool: take operations until none are left.
+// After a failure the connection may be out of step with the server
+// (half a payload sent, say), so the next operation gets a fresh one
+static void *batch_worker(void *arg)
+{
+    batch_t *b = arg;
+    conn_t conn;
+    int sock = -1;
+    g_quiet = 1;
+    for (;;) {
+        int i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+        if (i >= b->n) break;
+        batch_op_t *op = &b->ops[i];
+
+        double t0 = now_sec();
+        unsigned long long bytes = 0;
+        int status = 1;
+        for (int attempt = 0; ; ++attempt) {
+            g_busy_ms = 0;
+            g_reply[0] = '\0';
+            if (sock < 0) {
+                if ((sock = connect_server()) < 0) {
+                    snprintf(g_reply, sizeof(g_reply), "cannot reach the server");
+                    break;
+                }
+                conn_init(&conn, sock);
+                if (b->compress) negotiate(&conn);
+            }
+            status = batch_run(&conn, op, &bytes);
+            if (status != 0) {
+                close(sock);
+                conn_release(&conn);
+                sock = -1;
+            }
+            if (!g_busy_ms || attempt == BUSY_RETRIES) break;
+            usleep((g_busy_ms + (unsigned)rand() % (g_busy_ms / 2 + 1)) * 1000);
+        }
+        double ms = (now_sec() - t0) * 1e3;
+
+        char what[2 * BUF_SIZE];
+        snprintf(what, sizeof(what), "%-6s %s%s%s", op->cmd, op->a,
+                 op->b ? " " : "", op->b ? op->b : "");
+        if (status == 0) {
+            __atomic_add_fetch(&b->bytes, bytes, __ATOMIC_RELAXED);
+            printf("[Batch] %4d ok   %s (%llu bytes, %.1f ms)\n", op->line, what, bytes, ms);
+        } else {
+            __atomic_add_fetch(&b->failed, 1, __ATOMIC_RELAXED);
+            // a server refusal says why; local errors went to stderr
+            int refused = strncmp(g_reply, "ERR", 3) == 0 ||
+                          strncmp(g_reply, "BUSY", 4) == 0 ||
+                          strncmp(g_reply, "cannot", 6) == 0;
+            printf("[Batch] %4d FAIL %s: %s (%.1f ms)\n", op->line, what,
+                   refused ? g_reply : "failed", ms);
+        }
+    }
+    if (sock >= 0) {
+        close(sock);
+        conn_release(&conn);
+    }
+    return NULL;
+}
+
+// For a "batch manifest [-j connections] [-z]" command
+static int run_batch(int argc, char *argv[])
+{
+    const char *path = NULL;
+    int conns = BATCH_CONNS, compress = 0;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) conns = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-z") == 0)            compress = 1;
+        else if (!path)                                 path = argv[i];
+    }
+    if (!path) {
+        fprintf(stderr, "Not enough args for batch.\n");
+        return 1;
+    }
+    if (conns < 1) conns = 1;
+    if (conns > MAX_STREAMS) conns = MAX_STREAMS;
+
+    batch_t b = { .compress = compress };
+    if (!(b.ops = load_manifest(path, &b.n))) return 1;
+    if (b.n == 0) {
+        printf("[Batch] %s: nothing to do\n", path);
+        return 0;
+    }
+    if (conns > b.n) conns = b.n;
+
+    // Writes and reads alike go to the server, not to replicas
+    pick_server("batch");
+    srand((unsigned)getpid());
+    setvbuf(stdout, NULL, _IOLBF, 0);   // whole result lines, even into a pipe
+
+    double t0 = now_sec();
+    pthread_t tids[MAX_STREAMS];
+    int started = 0;
+    for (; started < conns; ++started)
+        if (pthread_create(&tids[started], NULL, batch_worker, &b) != 0) break;
+    if (started == 0) batch_worker(&b);
+    for (int i = 0; i < started; ++i) pthread_join(tids[i], NULL);
+    double dt = now_sec() - t0;
+
+    printf("[Batch] %d operations over %d connections in %.3f s: %d ok, %d failed; "
+           "%llu bytes, %.1f ops/s, %.2f MB/s\n",
+           b.n, started ? started : 1, dt, b.n - b.failed, b.failed, b.bytes,
+           b.n / dt, b.bytes / dt / 1e6);
+    free(b.ops);
+    return b.failed ? 1 : 0;
+}
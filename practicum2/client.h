@@ -3,5 +3,8 @@
 
 #include "common.h"
 
+// Times a command is run again after "BUSY retry_after_ms=N"
+#define BUSY_RETRIES 5
+
 #endif // CLIENT_H
 
@@ -16,9 +16,70 @@
 #define PORT 2024
 #define BUF_SIZE 1024
 
+// Chunk size for streaming file payloads
+#define XFER_BUF (64 * 1024)
+
+// Longest file version token (GET ver= / if_none_match=), with NUL
+#define VER_LEN 64
+
+// Local index of downloaded file versions, for conditional GETs
+#define CLIENT_CACHE_INDEX ".rfs_cache"
+
 // The top-level folder in which the server stores files
 #define SERVER_DATA_DIR "server_data"
 
+// Append-only log that persists the permission table across restarts
+#define META_LOG_PATH "server_meta.log"
+
+// Content-addressed chunks for chunked mode (rfserver -C)
+#define CHUNK_STORE_DIR "server_chunks"
+
+// Server-side cache of hot file contents (total budget / largest file)
+#define FILECACHE_BYTES     (64u << 20)
+#define FILECACHE_MAX_ENTRY (1u << 20)
+
+// Batch commands (MGET/MPUT): I/O threads, files in flight per batch,
+// payload bytes a batch may hold in memory (larger files are streamed)
+#define BATCH_THREADS   8
+#define BATCH_WINDOW    64
+#define BATCH_BUFFERED  (32u << 20)
+#define BATCH_MAX_ITEMS (1u << 20)
+
+// Disk operations in flight on the server's io_uring (diskio.c)
+#define DISKIO_DEPTH 256
+
+// Admission control (admit.c): default limits on open connections and
+// on payload bytes in flight (rfserver -m / -b), the retry hint sent
+// with BUSY, and the accept queue length (-L)
+#define ADMIT_MAX_CONNS  512
+#define ADMIT_MAX_BYTES  (256ull << 20)
+#define ADMIT_RETRY_MS   100
+#define LISTEN_BACKLOG   1024
+
+// Fair scheduling (fairq.c): credit per round for each client with
+// work waiting, and what starting a request costs
+#define FAIR_QUANTUM   XFER_BUF
+#define FAIR_REQ_COST  4096
+
+// Parallel uploads (PUT_BEGIN) open at once, in a table shared by all
+// server processes
+#define UPLOAD_SLOTS 256
+// ...and per upload: separate ranges received so far, and parts being
+// written at once
+#define UPLOAD_RANGES 32
+#define UPLOAD_PARTS  16
+
+// rfserver -P: most shard processes, and the longest wait before a
+// shard that keeps crashing is started again
+#define SHARDS_MAX        64
+#define SHARD_BACKOFF_MS  5000
+
+// Replication (replica.c): changes kept for followers that fall
+// behind, most followers per primary (-R), pause before a reconnect
+#define REPL_LOG_SIZE      65536
+#define REPL_MAX_FOLLOWERS 8
+#define REPL_RETRY_MS      1000
+
 // Permissions
 typedef enum {
     READ_WRITE,
@@ -0,0 +1,202 @@
+/* --------------------------------------------------------------------
+ *  crc32c.c  –  CRC-32C: SSE4.2 instruction, three streams at once,
+ *               with a slicing-by-8 fallback
+ * ------------------------------------------------------------------ */
+#include "crc32c.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#define POLY 0x82f63b78u                /* Castagnoli, bit-reflected */
+
+/* the hardware path runs three streams of LONG bytes side by side,
+ * then of SHORT bytes, and joins them by shifting with a table */
+#define LONG  8192
+#define SHORT 256
+
+static uint32_t g_table[8][256];        /* slicing-by-8 */
+static uint32_t g_long[4][256];         /* crc * x^(8*LONG) mod POLY */
+static uint32_t g_short[4][256];        /* crc * x^(8*SHORT) mod POLY */
+static int      g_hw;
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+
+/* ---- GF(2) matrices: 32 columns of 32 bits, for shifting a sum ---- */
+
+static uint32_t gf2_times(const uint32_t *mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+    for (; vec; vec >>= 1, ++mat)
+        if (vec & 1) sum ^= *mat;
+    return sum;
+}
+
+static void gf2_square(uint32_t *square, const uint32_t *mat)
+{
+    for (int n = 0; n < 32; ++n)
+        square[n] = gf2_times(mat, mat[n]);
+}
+
+/* odd = the operator that feeds one zero bit through the register */
+static void one_zero_bit(uint32_t odd[32])
+{
+    odd[0] = POLY;
+    for (int n = 1; n < 32; ++n) odd[n] = 1u << (n - 1);
+}
+
+/* op = the operator for len zero bytes, len a power of two */
+static void zeros_op(uint32_t op[32], size_t len)
+{
+    uint32_t odd[32];
+    one_zero_bit(odd);
+    gf2_square(op, odd);                /* 2 zero bits */
+    gf2_square(odd, op);                /* 4 zero bits */
+    for (;;) {
+        gf2_square(op, odd);            /* 1, 4, 16 ... bytes */
+        if ((len >>= 1) == 0) return;
+        gf2_square(odd, op);            /* 2, 8, 32 ... bytes */
+        if ((len >>= 1) == 0) break;
+    }
+    memcpy(op, odd, sizeof(odd));
+}
+
+/* byte-indexed tables of the len-zero-bytes operator */
+static void zeros_table(uint32_t t[4][256], size_t len)
+{
+    uint32_t op[32];
+    zeros_op(op, len);
+    for (uint32_t n = 0; n < 256; ++n) {
+        t[0][n] = gf2_times(op, n);
+        t[1][n] = gf2_times(op, n << 8);
+        t[2][n] = gf2_times(op, n << 16);
+        t[3][n] = gf2_times(op, n << 24);
+    }
+}
+
+static inline uint32_t shift(uint32_t t[4][256], uint32_t crc)
+{
+    return t[0][crc & 0xff] ^ t[1][(crc >> 8) & 0xff] ^
+           t[2][(crc >> 16) & 0xff] ^ t[3][crc >> 24];
+}
+
+static void init(void)
+{
+    for (uint32_t n = 0; n < 256; ++n) {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; ++k)
+            crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+        g_table[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; ++n) {
+        uint32_t crc = g_table[0][n];
+        for (int k = 1; k < 8; ++k) {
+            crc = g_table[0][crc & 0xff] ^ (crc >> 8);
+            g_table[k][n] = crc;
+        }
+    }
+    zeros_table(g_long, LONG);
+    zeros_table(g_short, SHORT);
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    g_hw = __builtin_cpu_supports("sse4.2") != 0;
+#endif
+}
+
+uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len)
+{
+    pthread_once(&g_once, init);
+    const uint8_t *p = buf;
+    crc = ~crc;
+    for (; len && ((uintptr_t)p & 7); --len)
+        crc = g_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        w ^= crc;
+        crc = g_table[7][w & 0xff] ^ g_table[6][(w >> 8) & 0xff] ^
+              g_table[5][(w >> 16) & 0xff] ^ g_table[4][(w >> 24) & 0xff] ^
+              g_table[3][(w >> 32) & 0xff] ^ g_table[2][(w >> 40) & 0xff] ^
+              g_table[1][(w >> 48) & 0xff] ^ g_table[0][w >> 56];
+    }
+#endif
+    for (; len; --len)
+        crc = g_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+static inline __attribute__((target("sse4.2")))
+uint64_t crc_word(uint64_t crc, const uint8_t *p)
+{
+    uint64_t w;
+    memcpy(&w, p, 8);
+    return __builtin_ia32_crc32di(crc, w);
+}
+
+/* three streams of `block` bytes each, joined into crc0 */
+static inline __attribute__((target("sse4.2")))
+uint64_t crc_three(uint64_t crc0, const uint8_t *p, size_t block, uint32_t t[4][256])
+{
+    uint64_t crc1 = 0, crc2 = 0;
+    for (const uint8_t *end = p + block; p < end; p += 8) {
+        crc0 = crc_word(crc0, p);
+        crc1 = crc_word(crc1, p + block);
+        crc2 = crc_word(crc2, p + 2 * block);
+    }
+    crc0 = shift(t, (uint32_t)crc0) ^ crc1;
+    return shift(t, (uint32_t)crc0) ^ crc2;
+}
+
+static __attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t crc, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    uint64_t crc0 = ~crc;
+    for (; len && ((uintptr_t)p & 7); --len)
+        crc0 = __builtin_ia32_crc32qi((uint32_t)crc0, *p++);
+    for (; len >= 3 * LONG; len -= 3 * LONG, p += 3 * LONG)
+        crc0 = crc_three(crc0, p, LONG, g_long);
+    for (; len >= 3 * SHORT; len -= 3 * SHORT, p += 3 * SHORT)
+        crc0 = crc_three(crc0, p, SHORT, g_short);
+    for (; len >= 8; len -= 8, p += 8)
+        crc0 = crc_word(crc0, p);
+    for (; len; --len)
+        crc0 = __builtin_ia32_crc32qi((uint32_t)crc0, *p++);
+    return ~(uint32_t)crc0;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    pthread_once(&g_once, init);
+#if defined(__x86_64__)
+    if (g_hw) return crc32c_sse42(crc, buf, len);
+#endif
+    return crc32c_sw(crc, buf, len);
+}
+
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+    /* feed len2 zero bytes through crc1, squaring the operator for
+     * each bit of len2 (zlib's crc32_combine) */
+    uint32_t even[32], odd[32];
+    if (len2 == 0) return crc1;
+    one_zero_bit(odd);
+    gf2_square(even, odd);              /* 2 zero bits */
+    gf2_square(odd, even);              /* 4 zero bits */
+    for (;;) {
+        gf2_square(even, odd);
+        if (len2 & 1) crc1 = gf2_times(even, crc1);
+        if ((len2 >>= 1) == 0) break;
+        gf2_square(odd, even);
+        if (len2 & 1) crc1 = gf2_times(odd, crc1);
+        if ((len2 >>= 1) == 0) break;
+    }
+    return crc1 ^ crc2;
+}
+
+int crc32c_hw(void)
+{
+    pthread_once(&g_once, init);
+    return g_hw;
+}
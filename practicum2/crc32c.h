@@ -0,0 +1,31 @@
+/* --------------------------------------------------------------------
+ *  crc32c.h  –  CRC-32C (Castagnoli), the checksum of every transfer
+ *
+ *  On x86-64 CPUs with SSE4.2 the crc32 instruction does the work,
+ *  three independent streams at a time so its 3-cycle latency is
+ *  hidden, and the three partial sums are joined with precomputed
+ *  shift tables.  Elsewhere a slicing-by-8 table version gives the
+ *  same result.  The choice is made once, at the first call.
+ *
+ *  Sums chain like zlib's crc32(): start from 0 and feed the running
+ *  value back in, crc32c(crc32c(0, a, n), b, m) == crc32c(0, a||b, n+m).
+ * ------------------------------------------------------------------ */
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/* The table version, whatever the CPU: the reference the hardware
+ * path is checked against. */
+uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len);
+
+/* Sum of a||b from the sums of a and of b, where b is len2 bytes. */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+/* 1 when crc32c() runs on the SSE4.2 instruction */
+int      crc32c_hw(void);
+
+#endif // CRC32C_H
@@ -0,0 +1,194 @@
+/* --------------------------------------------------------------------
+ *  crcbench.c  –  transfer checksums: CRC32C speed, and what it adds
+ *                 to a WRITE and a GET
+ *
+ *  First the checksum alone: the standard check value, the SSE4.2
+ *  path against the table version at odd lengths and alignments,
+ *  crc32c_combine(), and both speeds.  Then <reps> WRITEs and GETs of
+ *  a <size>-byte file against a running rfserver, alternating plain
+ *  requests with crc=1 ones (the client sums what it sends and
+ *  receives, the server what it stores, as rfs does).  "+%" is how
+ *  much longer the checked requests took; "sum ms" is one pass of
+ *  crc32c() over the file.  Keep <size> above FILECACHE_MAX_ENTRY so
+ *  GETs come from the disk path.
+ *
+ *  usage: crcbench [-n reps] [-s size_MB]
+ * ------------------------------------------------------------------ */
+#include "proto.h"
+#include "crc32c.h"
+
+#include <netinet/tcp.h>
+#include <time.h>
+
+static int    g_reps = 5;
+static size_t g_size = 64u << 20;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int check_crc(void)
+{
+    if (crc32c(0, "123456789", 9) != 0xe3069283u ||
+        crc32c_sw(0, "123456789", 9) != 0xe3069283u)
+        return -1;
+    static uint8_t buf[100000];
+    unsigned seed = 7;
+    for (size_t i = 0; i < sizeof(buf); ++i) buf[i] = (uint8_t)rand_r(&seed);
+    for (int t = 0; t < 2000; ++t) {
+        size_t off = (size_t)rand_r(&seed) % 64;
+        size_t len = (size_t)rand_r(&seed) % (t & 1 ? sizeof(buf) - 64 : 2000);
+        size_t cut = len ? (size_t)rand_r(&seed) % len : 0;
+        uint32_t all = crc32c(0, buf + off, len);
+        if (all != crc32c_sw(0, buf + off, len) ||
+            all != crc32c(crc32c(0, buf + off, cut), buf + off + cut, len - cut) ||
+            all != crc32c_combine(crc32c(0, buf + off, cut),
+                                  crc32c(0, buf + off + cut, len - cut), len - cut))
+            return -1;
+    }
+    return 0;
+}
+
+/* MB/s of one implementation over n bytes, a transfer buffer at a time */
+static double crc_rate(uint32_t (*fn)(uint32_t, const void *, size_t),
+                       const char *buf, size_t n)
+{
+    volatile uint32_t sink;
+    uint32_t sum = 0;
+    double t0 = now_sec();
+    for (size_t off = 0; off < n; off += XFER_BUF)
+        sum = fn(sum, buf + off, n - off < XFER_BUF ? n - off : XFER_BUF);
+    sink = sum;
+    (void)sink;
+    return n / (now_sec() - t0) / 1e6;
+}
+
+static int connect_to(conn_t *c)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) return -1;
+    struct sockaddr_in a = {0};
+    a.sin_family = AF_INET;
+    a.sin_port   = htons(PORT);
+    inet_pton(AF_INET, "127.0.0.1", &a.sin_addr);
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(s, (struct sockaddr *)&a, sizeof(a)) < 0) { close(s); return -1; }
+    conn_init(c, s);
+    return 0;
+}
+
+static int do_write(conn_t *c, const char *data, size_t n, int crc)
+{
+    char line[MAX_LINE];
+    if (send_line(c->fd, "WRITE crcbench crcbench.dat size=%zu%s", n,
+                  crc ? " crc=1" : "") < 0 ||
+        conn_read_line(c, line, sizeof(line)) < 0 ||
+        strcmp(line, "OK_READY_TO_RECEIVE") != 0)
+        return -1;
+    uint32_t sum = 0;
+    for (size_t off = 0; off < n; off += XFER_BUF) {
+        size_t k = n - off < XFER_BUF ? n - off : XFER_BUF;
+        if (crc) sum = crc32c(sum, data + off, k);
+        if (send_payload(c, data + off, k) < 0) return -1;
+    }
+    if (crc && send_line(c->fd, "CRC %08x", sum) < 0) return -1;
+    if (conn_read_line(c, line, sizeof(line)) < 0 || strncmp(line, "WRITE_OK", 8) != 0)
+        return -1;
+    return 0;
+}
+
+static int do_get(conn_t *c, char *buf, size_t n, int crc)
+{
+    char line[MAX_LINE];
+    if (send_line(c->fd, "GET crcbench.dat -%s", crc ? " crc=1" : "") < 0 ||
+        conn_read_line(c, line, sizeof(line)) < 0 ||
+        strncmp(line, "OK_SENDING_FILE", 15) != 0)
+        return -1;
+    uint32_t sum = 0;
+    for (size_t got = 0; got < n; ) {
+        ssize_t k = conn_read_payload(c, buf + got, n - got);
+        if (k <= 0) return -1;
+        if (crc) sum = crc32c(sum, buf + got, (size_t)k);
+        got += (size_t)k;
+    }
+    unsigned expect;
+    if (crc && (conn_read_line(c, line, sizeof(line)) < 0 ||
+                sscanf(line, "CRC %8x", &expect) != 1 || expect != sum))
+        return -1;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "n:s:")) != -1) {
+        switch (ch) {
+        case 'n': g_reps = atoi(optarg); break;
+        case 's': g_size = (size_t)strtoull(optarg, NULL, 10) << 20; break;
+        default:  optind = argc + 1;
+        }
+    }
+    if (optind != argc || g_reps < 1 || g_size == 0) {
+        fprintf(stderr, "usage: %s [-n reps] [-s size_MB]\n", argv[0]);
+        return 1;
+    }
+    char *data = malloc(g_size), *back = malloc(g_size);
+    if (!data || !back) { perror("malloc"); return 1; }
+    unsigned seed = 11;
+    for (size_t i = 0; i < g_size; ++i) data[i] = (char)rand_r(&seed);
+
+    if (check_crc() < 0) {
+        fprintf(stderr, "crcbench: crc32c self-test FAILED\n");
+        return 1;
+    }
+    double sw = crc_rate(crc32c_sw, data, g_size);
+    double hw = crc_rate(crc32c, data, g_size);
+    printf("crc32c self-test ok; table %.0f MB/s, %s %.0f MB/s (%.1fx)\n",
+           sw, crc32c_hw() ? "sse4.2" : "table", hw, hw / sw);
+
+    conn_t c;
+    if (connect_to(&c) < 0) {
+        fprintf(stderr, "crcbench: cannot reach rfserver on port %d\n", PORT);
+        return 1;
+    }
+    /* [op][crc]: total and best seconds */
+    double tot[2][2] = {{0}}, best[2][2] = {{1e9, 1e9}, {1e9, 1e9}};
+    int ok = do_write(&c, data, g_size, 0) == 0;    /* warm-up */
+    for (int i = 0; i < g_reps && ok; ++i) {
+        for (int crc = 0; crc < 2 && ok; ++crc) {
+            double t0 = now_sec();
+            if (do_write(&c, data, g_size, crc) < 0) { ok = 0; break; }
+            double t1 = now_sec();
+            if (do_get(&c, back, g_size, crc) < 0) { ok = 0; break; }
+            double t2 = now_sec();
+            if (memcmp(data, back, g_size) != 0) {
+                fprintf(stderr, "crcbench: GET returned different bytes\n");
+                ok = 0;
+            }
+            double d[2] = { t1 - t0, t2 - t1 };
+            for (int op = 0; op < 2; ++op) {
+                tot[op][crc] += d[op];
+                if (d[op] < best[op][crc]) best[op][crc] = d[op];
+            }
+        }
+    }
+    send_line(c.fd, "RM crcbench.dat");
+    close(c.fd);
+    conn_release(&c);
+    if (!ok) { fprintf(stderr, "crcbench: transfer failed\n"); return 1; }
+
+    printf("%-6s %10s %9s %9s %9s %9s %7s %7s\n", "op", "bytes", "ms/op", "crc ms/op",
+           "best ms", "crc best", "+%", "sum ms");
+    const char *names[2] = { "WRITE", "GET" };
+    for (int op = 0; op < 2; ++op)
+        printf("%-6s %10zu %9.1f %9.1f %9.1f %9.1f %7.2f %7.2f\n", names[op], g_size,
+               tot[op][0] / g_reps * 1e3, tot[op][1] / g_reps * 1e3,
+               best[op][0] * 1e3, best[op][1] * 1e3,
+               (best[op][1] / best[op][0] - 1) * 100, g_size / (hw * 1e6) * 1e3);
+    free(data); free(back);
+    return 0;
+}
@@ -0,0 +1,99 @@
+/* --------------------------------------------------------------------
+ *  delta.c  –  rolling / strong block sums and the signature index
+ * ------------------------------------------------------------------ */
+#include "delta.h"
+#include "sha256.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+size_t delta_block_size(unsigned long long size)
+{
+    size_t b = (size_t)sqrt((double)size);
+    b = (b + 1023) & ~(size_t)1023;         /* whole KiB */
+    if (b < DELTA_MIN_BLOCK) b = DELTA_MIN_BLOCK;
+    if (b > DELTA_MAX_BLOCK) b = DELTA_MAX_BLOCK;
+    return b;
+}
+
+uint32_t delta_weak(const uint8_t *p, size_t n)
+{
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < n; ++i) {
+        a += p[i];
+        b += (uint32_t)(n - i) * p[i];
+    }
+    return (a & 0xffff) | (b & 0xffff) << 16;
+}
+
+void delta_strong(const uint8_t *p, size_t n, uint8_t out[DELTA_STRONG])
+{
+    uint8_t d[SHA256_LEN];
+    sha256(p, n, d);
+    memcpy(out, d, DELTA_STRONG);
+}
+
+void delta_sig_pack(const delta_sig_t *s, uint8_t *out)
+{
+    delta_put_u32(out, s->weak);
+    memcpy(out + 4, s->strong, DELTA_STRONG);
+}
+
+void delta_sig_unpack(const uint8_t *in, delta_sig_t *s)
+{
+    s->weak = delta_get_u32(in);
+    memcpy(s->strong, in + 4, DELTA_STRONG);
+}
+
+/* the weak sum's low bits are poorly spread: mix before masking */
+static inline uint32_t slot_of(const delta_index_t *ix, uint32_t w)
+{
+    return (w * 2654435761u >> 7) & ix->mask;
+}
+
+int delta_index_init(delta_index_t *ix, const delta_sig_t *sig, size_t n)
+{
+    size_t cap = 16;
+    while (cap < 2 * n) cap <<= 1;
+    ix->sig  = sig;
+    ix->n    = n;
+    ix->mask = (uint32_t)(cap - 1);
+    ix->head = calloc(cap, sizeof(uint32_t));
+    ix->next = calloc(n ? n : 1, sizeof(uint32_t));
+    if (!ix->head || !ix->next) { delta_index_free(ix); return -1; }
+    /* insert backwards so each chain lists blocks in file order */
+    for (size_t i = n; i-- > 0; ) {
+        uint32_t s = slot_of(ix, sig[i].weak);
+        ix->next[i] = ix->head[s];
+        ix->head[s] = (uint32_t)i + 1;
+    }
+    return 0;
+}
+
+void delta_index_free(delta_index_t *ix)
+{
+    free(ix->head);
+    free(ix->next);
+    ix->head = ix->next = NULL;
+}
+
+long delta_index_find(const delta_index_t *ix, uint32_t w, const uint8_t *p,
+                      size_t blk, long prefer)
+{
+    uint8_t strong[DELTA_STRONG];
+    int     have = 0;
+    if (prefer >= 0 && (size_t)prefer < ix->n && ix->sig[prefer].weak == w) {
+        delta_strong(p, blk, strong);
+        have = 1;
+        if (memcmp(ix->sig[prefer].strong, strong, DELTA_STRONG) == 0)
+            return prefer;
+    }
+    for (uint32_t e = ix->head[slot_of(ix, w)]; e; e = ix->next[e - 1]) {
+        const delta_sig_t *s = &ix->sig[e - 1];
+        if (s->weak != w) continue;
+        if (!have) { delta_strong(p, blk, strong); have = 1; }
+        if (memcmp(s->strong, strong, DELTA_STRONG) == 0)
+            return (long)(e - 1);
+    }
+    return -1;
+}
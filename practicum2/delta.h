@@ -0,0 +1,88 @@
+/* --------------------------------------------------------------------
+ *  delta.h  –  rsync-style block signatures and matching, shared by
+ *              rfs (WRITE -D) and rfserver (SIGS / DELTA)
+ *
+ *  The server cuts its copy of a file into fixed blocks and sends a
+ *  signature per block: a weak rolling sum and a truncated SHA-256.
+ *  The client slides a window over the new file one byte at a time;
+ *  the weak sum rolls in O(1), and only a weak hit costs a strong
+ *  hash.  Matched windows travel as block references, the rest as
+ *  literals, so the upload is about as big as the change.
+ * ------------------------------------------------------------------ */
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define DELTA_MIN_BLOCK (2 * 1024)
+#define DELTA_MAX_BLOCK (128 * 1024)
+#define DELTA_STRONG    16              /* bytes of SHA-256 kept */
+#define DELTA_SIG       (4 + DELTA_STRONG)  /* one signature on the wire */
+
+/* Ops of a DELTA stream, all integers little endian:
+ *   'L' u32 n, n bytes     literal data
+ *   'C' u32 first, u32 k   blocks first .. first+k-1 of the old copy
+ *   'E'                    end of the new file */
+#define DELTA_LITERAL 'L'
+#define DELTA_COPY    'C'
+#define DELTA_END     'E'
+
+typedef struct {
+    uint32_t weak;
+    uint8_t  strong[DELTA_STRONG];
+} delta_sig_t;
+
+static inline void delta_put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v; p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16); p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t delta_get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+           (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* Block size for a file of `size` bytes: about sqrt(size), so the
+ * signatures and the literal slack around a change grow together. */
+size_t delta_block_size(unsigned long long size);
+
+/* Weak sum of p[0..n): a = sum p[i], b = sum (n - i) * p[i], both
+ * mod 2^16, returned as a | b << 16. */
+uint32_t delta_weak(const uint8_t *p, size_t n);
+
+/* Slide an n-byte window's weak sum one byte: drop out, take in. */
+static inline uint32_t delta_roll(uint32_t w, uint8_t out, uint8_t in, size_t n)
+{
+    uint32_t a = (w & 0xffff) - out + in;
+    uint32_t b = (w >> 16) - (uint32_t)(n * out) + a;
+    return (a & 0xffff) | (b & 0xffff) << 16;
+}
+
+void delta_strong(const uint8_t *p, size_t n, uint8_t out[DELTA_STRONG]);
+
+/* (De)serialise one signature record of DELTA_SIG bytes. */
+void delta_sig_pack(const delta_sig_t *s, uint8_t *out);
+void delta_sig_unpack(const uint8_t *in, delta_sig_t *s);
+
+/* Signatures hashed by weak sum, for the client's sliding window. */
+typedef struct {
+    const delta_sig_t *sig;
+    size_t    n;
+    uint32_t *head, *next;      /* chains of index + 1, 0 ends */
+    uint32_t  mask;
+} delta_index_t;
+
+int  delta_index_init(delta_index_t *ix, const delta_sig_t *sig, size_t n);
+void delta_index_free(delta_index_t *ix);
+
+/* A block whose signature matches the window p[0..blk) with weak sum
+ * w, or -1.  Block `prefer` (the one after the last match) wins when
+ * it matches, so runs of unchanged blocks stay runs. */
+long delta_index_find(const delta_index_t *ix, uint32_t w, const uint8_t *p,
+                      size_t blk, long prefer);
+
+#endif // DELTA_H
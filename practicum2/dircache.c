@@ -0,0 +1,469 @@
+/* --------------------------------------------------------------------
+ *  dircache.c  –  per-directory entry tables kept fresh by inotify
+ * ------------------------------------------------------------------ */
+#define _GNU_SOURCE
+#include "dircache.h"
+
+#include <dirent.h>
+#include <sys/inotify.h>
+
+#define DC_TABLE 1024                       /* buckets, by path and by wd */
+#define DC_MASK  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                  IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct dc_ent {
+    unsigned long long  size;
+    long long           mtime;
+    char                type;               /* 'f' or 'd' */
+    char                name[];
+} dc_ent_t;
+
+/* Entries are kept sorted by name: a lookup is a binary search, one
+ * created or removed file costs a memmove of pointers, and a listing
+ * never has to sort. */
+typedef struct dc_dir {
+    char            *path;                  /* relative to root, "" = root */
+    int              wd;                    /* inotify watch, -1 if none */
+    int              loaded;                /* entries match the disk */
+    pthread_mutex_t  lock;
+    dc_ent_t       **v;
+    size_t           n, cap;
+    dc_text_t       *text;                  /* rendered listing, or NULL */
+    struct dc_dir   *next_path, *next_wd;
+} dc_dir_t;
+
+static char              g_root[BUF_SIZE];
+static dircache_sizer_t  g_sizer;
+static int               g_ifd = -1;
+static dc_dir_t         *g_by_path[DC_TABLE];
+static dc_dir_t         *g_by_wd[DC_TABLE];
+static pthread_mutex_t   g_lock = PTHREAD_MUTEX_INITIALIZER;
+static dc_stats_t        g_stats;           /* atomic counters */
+
+#define BUMP(field, d) __atomic_add_fetch(&g_stats.field, (d), __ATOMIC_RELAXED)
+
+static uint64_t fnv1a(const char *s)
+{
+    uint64_t h = 1469598103934665603ULL;
+    while (*s) { h ^= (unsigned char)*s++; h *= 1099511628211ULL; }
+    return h;
+}
+
+/* "a//b/./c/" -> "a/b/c"; ".", "/" and "" -> "".  -1 on ".." */
+static int norm_path(const char *in, char *out, size_t cap)
+{
+    size_t o = 0;
+    while (*in) {
+        while (*in == '/') ++in;
+        const char *end = strchrnul(in, '/');
+        size_t len = (size_t)(end - in);
+        if (len == 2 && in[0] == '.' && in[1] == '.') return -1;
+        if (len && !(len == 1 && in[0] == '.')) {
+            if (o + len + 2 > cap) return -1;
+            if (o) out[o++] = '/';
+            memcpy(out + o, in, len);
+            o += len;
+        }
+        in = end;
+    }
+    out[o] = '\0';
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Entries of one directory (caller holds d->lock)                    */
+/* ------------------------------------------------------------------ */
+
+/* Index of name in d->v, or where it would go; *hit tells which */
+static size_t ent_find(const dc_dir_t *d, const char *name, int *hit)
+{
+    size_t lo = 0, hi = d->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(d->v[mid]->name, name);
+        if (c == 0) { *hit = 1; return mid; }
+        if (c < 0) lo = mid + 1; else hi = mid;
+    }
+    *hit = 0;
+    return lo;
+}
+
+static int cmp_ent(const void *a, const void *b)
+{
+    return strcmp((*(dc_ent_t *const *)a)->name, (*(dc_ent_t *const *)b)->name);
+}
+
+static void ent_fill(dc_ent_t *e, const struct stat *st)
+{
+    e->type  = S_ISDIR(st->st_mode) ? 'd' : 'f';
+    e->size  = S_ISDIR(st->st_mode) ? 0 : (unsigned long long)st->st_size;
+    e->mtime = (long long)st->st_mtime;
+}
+
+/* New entry at index i (i == d->n appends; dir_load sorts after) */
+static void ent_insert(dc_dir_t *d, size_t i, const char *name,
+                       const struct stat *st)
+{
+    if (d->n == d->cap) {
+        size_t cap = d->cap ? d->cap * 2 : 64;
+        dc_ent_t **v = realloc(d->v, cap * sizeof(*v));
+        if (!v) return;
+        d->v   = v;
+        d->cap = cap;
+    }
+    size_t len = strlen(name) + 1;
+    dc_ent_t *e = malloc(sizeof(*e) + len);
+    if (!e) return;
+    memcpy(e->name, name, len);
+    ent_fill(e, st);
+    memmove(d->v + i + 1, d->v + i, (d->n - i) * sizeof(*d->v));
+    d->v[i] = e;
+    ++d->n;
+    BUMP(entries, 1);
+}
+
+static void ent_set(dc_dir_t *d, const char *name, const struct stat *st)
+{
+    int hit;
+    size_t i = ent_find(d, name, &hit);
+    if (hit) ent_fill(d->v[i], st);
+    else     ent_insert(d, i, name, st);
+}
+
+static void ent_remove(dc_dir_t *d, const char *name)
+{
+    int hit;
+    size_t i = ent_find(d, name, &hit);
+    if (!hit) return;
+    free(d->v[i]);
+    memmove(d->v + i, d->v + i + 1, (d->n - i - 1) * sizeof(*d->v));
+    --d->n;
+    BUMP(entries, -1);
+}
+
+static void ent_clear(dc_dir_t *d)
+{
+    for (size_t i = 0; i < d->n; ++i) free(d->v[i]);
+    BUMP(entries, -(uint64_t)d->n);
+    d->n = 0;
+}
+
+static void text_drop(dc_dir_t *d)
+{
+    if (d->text) dircache_release(d->text);
+    d->text = NULL;
+}
+
+/* stat() of root/rel with the sizer's fix-ups; 0 or -errno */
+static int stat_rel(const char *rel, struct stat *st)
+{
+    char full[BUF_SIZE * 2];
+    snprintf(full, sizeof(full), "%s/%s", g_root, rel);
+    if (lstat(full, st) < 0) return -errno;
+    if (g_sizer && S_ISREG(st->st_mode)) g_sizer(full, st);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Directory table                                                    */
+/* ------------------------------------------------------------------ */
+static dc_dir_t *dir_lookup(const char *path, int create)
+{
+    size_t i = fnv1a(path) & (DC_TABLE - 1);
+    pthread_mutex_lock(&g_lock);
+    dc_dir_t *d = g_by_path[i];
+    while (d && strcmp(d->path, path) != 0) d = d->next_path;
+    if (!d && create && (d = calloc(1, sizeof(*d)))) {
+        if (!(d->path = strdup(path))) {
+            free(d);
+            d = NULL;
+        } else {
+            d->wd = -1;
+            pthread_mutex_init(&d->lock, NULL);
+            d->next_path = g_by_path[i];
+            g_by_path[i] = d;               /* never freed, only reloaded */
+            BUMP(dirs, 1);
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+    return d;
+}
+
+static dc_dir_t *dir_by_wd(int wd)
+{
+    pthread_mutex_lock(&g_lock);
+    dc_dir_t *d = g_by_wd[wd & (DC_TABLE - 1)];
+    while (d && d->wd != wd) d = d->next_wd;
+    pthread_mutex_unlock(&g_lock);
+    return d;
+}
+
+static void dir_set_wd(dc_dir_t *d, int wd)
+{
+    pthread_mutex_lock(&g_lock);
+    if (d->wd >= 0) {
+        dc_dir_t **pp = &g_by_wd[d->wd & (DC_TABLE - 1)];
+        while (*pp && *pp != d) pp = &(*pp)->next_wd;
+        if (*pp) *pp = d->next_wd;
+    }
+    d->wd = wd;
+    if (wd >= 0) {
+        d->next_wd = g_by_wd[wd & (DC_TABLE - 1)];
+        g_by_wd[wd & (DC_TABLE - 1)] = d;
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+/* Read d from disk (caller holds d->lock).  The watch goes on first,
+ * so a change made during the scan shows up as an event afterwards. */
+static int dir_load(dc_dir_t *d)
+{
+    char full[BUF_SIZE * 2];
+    snprintf(full, sizeof(full), "%s/%s", g_root, d->path);
+    if (g_ifd >= 0 && d->wd < 0) {
+        int wd = inotify_add_watch(g_ifd, full, DC_MASK | IN_ONLYDIR);
+        if (wd >= 0) dir_set_wd(d, wd);
+    }
+    DIR *dp = opendir(full);
+    if (!dp) return -errno;
+
+    ent_clear(d);
+    text_drop(d);
+    char rel[BUF_SIZE * 2];
+    struct dirent *de;
+    while ((de = readdir(dp))) {
+        if (de->d_name[0] == '.') continue;  /* ".", "..", temp files */
+        snprintf(rel, sizeof(rel), "%s%s%s", d->path, *d->path ? "/" : "",
+                 de->d_name);
+        struct stat st;
+        if (stat_rel(rel, &st) == 0 && (S_ISREG(st.st_mode) || S_ISDIR(st.st_mode)))
+            ent_insert(d, d->n, de->d_name, &st);
+    }
+    closedir(dp);
+    qsort(d->v, d->n, sizeof(*d->v), cmp_ent);
+    d->loaded = 1;
+    BUMP(scans, 1);
+    return 0;
+}
+
+/* Re-stat one name of d; outside the lock, then applied under it */
+static void dir_refresh(dc_dir_t *d, const char *name)
+{
+    if (name[0] == '.') return;
+    char rel[BUF_SIZE * 2];
+    snprintf(rel, sizeof(rel), "%s%s%s", d->path, *d->path ? "/" : "", name);
+    struct stat st;
+    int ok = stat_rel(rel, &st) == 0 && (S_ISREG(st.st_mode) || S_ISDIR(st.st_mode));
+
+    pthread_mutex_lock(&d->lock);
+    if (d->loaded) {
+        if (ok) ent_set(d, name, &st);
+        else    ent_remove(d, name);
+        text_drop(d);
+    }
+    pthread_mutex_unlock(&d->lock);
+}
+
+/* Forget d's entries; the next list reads it again.  A directory that
+ * was moved or deleted also loses its watch, which followed the inode. */
+static void dir_invalidate(dc_dir_t *d, uint32_t mask)
+{
+    pthread_mutex_lock(&d->lock);
+    d->loaded = 0;
+    ent_clear(d);
+    text_drop(d);
+    if (d->wd >= 0 && (mask & (IN_DELETE_SELF | IN_MOVE_SELF)))
+        inotify_rm_watch(g_ifd, d->wd);
+    if (mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+        dir_set_wd(d, -1);
+    pthread_mutex_unlock(&d->lock);
+}
+
+/* ------------------------------------------------------------------ */
+/*  inotify                                                            */
+/* ------------------------------------------------------------------ */
+static void *watch_thread(void *unused)
+{
+    (void)unused;
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(g_ifd, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR) continue;
+            perror("dircache: inotify read");
+            return NULL;
+        }
+        for (char *p = buf; p < buf + len; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(*ev) + ev->len;
+            BUMP(events, 1);
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                /* events were lost: trust nothing, reread on demand */
+                BUMP(overflows, 1);
+                for (int i = 0; i < DC_TABLE; ++i) {
+                    pthread_mutex_lock(&g_lock);
+                    dc_dir_t *d = g_by_path[i];
+                    pthread_mutex_unlock(&g_lock);
+                    for (; d; d = d->next_path) dir_invalidate(d, IN_Q_OVERFLOW);
+                }
+                continue;
+            }
+            dc_dir_t *d = dir_by_wd(ev->wd);
+            if (!d) continue;
+            if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+                dir_invalidate(d, ev->mask);
+            else if (ev->len)
+                dir_refresh(d, ev->name);
+        }
+    }
+    return NULL;
+}
+
+int dircache_init(const char *root, dircache_sizer_t sizer)
+{
+    snprintf(g_root, sizeof(g_root), "%s", root);
+    g_sizer = sizer;
+    g_ifd = inotify_init1(IN_CLOEXEC);
+    if (g_ifd < 0) {
+        /* still correct for the server's own changes */
+        perror("dircache: inotify_init1");
+        return 0;
+    }
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, watch_thread, NULL) != 0) return -1;
+    pthread_detach(tid);
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/*  Queries                                                            */
+/* ------------------------------------------------------------------ */
+/* Decimal digits of v at p; returns the end.  (A 100k-entry listing
+ * is rebuilt after every change, and printf dominated that.) */
+static char *put_num(char *p, unsigned long long v)
+{
+    char tmp[24];
+    int n = 0;
+    do { tmp[n++] = (char)('0' + v % 10); v /= 10; } while (v);
+    while (n) *p++ = tmp[--n];
+    return p;
+}
+
+/* Listing text of d (caller holds d->lock) */
+static dc_text_t *render(dc_dir_t *d)
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < d->n; ++i)
+        bytes += strlen(d->v[i]->name) + 2 + 2 * 21 + 2;
+    dc_text_t *t = malloc(sizeof(*t) + bytes + 1);
+    if (!t) return NULL;
+    t->refs = 1;
+    t->n    = d->n;
+    char *p = t->data;
+    for (size_t i = 0; i < d->n; ++i) {
+        const dc_ent_t *e = d->v[i];
+        *p++ = e->type;
+        *p++ = ' ';
+        p = put_num(p, e->size);
+        *p++ = ' ';
+        if (e->mtime < 0) *p++ = '-';
+        p = put_num(p, e->mtime < 0 ? -(unsigned long long)e->mtime
+                                    : (unsigned long long)e->mtime);
+        *p++ = ' ';
+        size_t len = strlen(e->name);
+        memcpy(p, e->name, len);
+        p += len;
+        *p++ = '\n';
+    }
+    t->len = (size_t)(p - t->data);
+    BUMP(renders, 1);
+    return t;
+}
+
+dc_text_t *dircache_list(const char *dir, int *err)
+{
+    char path[BUF_SIZE];
+    if (norm_path(dir, path, sizeof(path)) < 0) { *err = EINVAL; return NULL; }
+    dc_dir_t *d = dir_lookup(path, 1);
+    if (!d) { *err = ENOMEM; return NULL; }
+
+    pthread_mutex_lock(&d->lock);
+    int rc = d->loaded ? 0 : dir_load(d);
+    if (rc == 0 && !d->text) d->text = render(d);
+    dc_text_t *t = rc == 0 ? d->text : NULL;
+    if (t) __atomic_add_fetch(&t->refs, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&d->lock);
+
+    BUMP(lists, 1);
+    *err = rc ? -rc : t ? 0 : ENOMEM;
+    return t;
+}
+
+void dircache_release(dc_text_t *t)
+{
+    if (__atomic_sub_fetch(&t->refs, 1, __ATOMIC_ACQ_REL) == 0) free(t);
+}
+
+int dircache_stat(const char *path, char *type,
+                  unsigned long long *size, long long *mtime)
+{
+    char rel[BUF_SIZE];
+    if (norm_path(path, rel, sizeof(rel)) < 0) return -EINVAL;
+    char *slash = strrchr(rel, '/');
+    const char *name = slash ? slash + 1 : rel;
+    if (slash) *slash = '\0';
+
+    /* a listed parent answers from memory */
+    dc_dir_t *d = *name ? dir_lookup(slash ? rel : "", 0) : NULL;
+    if (d) {
+        int found = -1;
+        pthread_mutex_lock(&d->lock);
+        if (d->loaded) {
+            int hit;
+            size_t i = ent_find(d, name, &hit);
+            found = hit;
+            if (hit) {
+                *type  = d->v[i]->type;
+                *size  = d->v[i]->size;
+                *mtime = d->v[i]->mtime;
+            }
+        }
+        pthread_mutex_unlock(&d->lock);
+        if (found >= 0) return found ? 0 : -ENOENT;
+    }
+
+    if (slash) *slash = '/';
+    if (*name == '.') return -ENOENT;       /* hidden, as in listings */
+    struct stat st;
+    int rc = stat_rel(rel, &st);
+    if (rc < 0) return rc;
+    if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) return -ENOENT;
+    *type  = S_ISDIR(st.st_mode) ? 'd' : 'f';
+    *size  = S_ISDIR(st.st_mode) ? 0 : (unsigned long long)st.st_size;
+    *mtime = (long long)st.st_mtime;
+    return 0;
+}
+
+void dircache_touch(const char *path)
+{
+    char rel[BUF_SIZE];
+    if (norm_path(path, rel, sizeof(rel)) < 0) return;
+    char *slash = strrchr(rel, '/');
+    const char *name = slash ? slash + 1 : rel;
+    if (!*name) return;
+    if (slash) *slash = '\0';
+    dc_dir_t *d = dir_lookup(slash ? rel : "", 0);
+    if (d) dir_refresh(d, name);            /* uncached dirs need nothing */
+}
+
+void dircache_get_stats(dc_stats_t *out)
+{
+    out->dirs      = __atomic_load_n(&g_stats.dirs,      __ATOMIC_RELAXED);
+    out->entries   = __atomic_load_n(&g_stats.entries,   __ATOMIC_RELAXED);
+    out->scans     = __atomic_load_n(&g_stats.scans,     __ATOMIC_RELAXED);
+    out->renders   = __atomic_load_n(&g_stats.renders,   __ATOMIC_RELAXED);
+    out->lists     = __atomic_load_n(&g_stats.lists,     __ATOMIC_RELAXED);
+    out->events    = __atomic_load_n(&g_stats.events,    __ATOMIC_RELAXED);
+    out->overflows = __atomic_load_n(&g_stats.overflows, __ATOMIC_RELAXED);
+}
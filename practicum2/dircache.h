@@ -0,0 +1,58 @@
+/* --------------------------------------------------------------------
+ *  dircache.h  –  in-memory directory metadata behind LS and STAT
+ *
+ *  A directory is read from disk the first time it is listed; after
+ *  that its entries are kept up to date one name at a time, by the
+ *  server's own WRITE/RM paths (dircache_touch) and by inotify for
+ *  changes made behind the server's back.  The sorted listing text is
+ *  rendered once and shared until the directory changes again, so
+ *  listing a large, quiet folder costs a memcpy, not a rescan.
+ *  Hidden names (temp files, ".…") are never listed.
+ * ------------------------------------------------------------------ */
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+#include "common.h"
+#include <stdint.h>
+#include <sys/stat.h>
+
+/* Rendered listing: n lines "<f|d> <size> <mtime> <name>\n" */
+typedef struct dc_text {
+    int    refs;                /* atomic */
+    size_t n;
+    size_t len;
+    char   data[];
+} dc_text_t;
+
+typedef struct {
+    uint64_t dirs;              /* directories cached */
+    uint64_t entries;
+    uint64_t scans;             /* full directory reads */
+    uint64_t renders;           /* listing texts built */
+    uint64_t lists;
+    uint64_t events;            /* inotify events applied */
+    uint64_t overflows;
+} dc_stats_t;
+
+/* Fixes up st for the file at full (e.g. the logical size of a
+ * chunked file); may be NULL. */
+typedef void (*dircache_sizer_t)(const char *full, struct stat *st);
+
+/* Cache directories below root; starts the inotify thread. */
+int dircache_init(const char *root, dircache_sizer_t sizer);
+
+/* Referenced listing of dir ("" or "." for root), sorted by name, or
+ * NULL with *err = ENOENT / ENOTDIR / EINVAL.  Release when done. */
+dc_text_t *dircache_list(const char *dir, int *err);
+void       dircache_release(dc_text_t *t);
+
+/* Type ('f' or 'd'), size and mtime of path; 0 or -errno. */
+int dircache_stat(const char *path, char *type,
+                  unsigned long long *size, long long *mtime);
+
+/* path was created, changed or removed: refresh its entry. */
+void dircache_touch(const char *path);
+
+void dircache_get_stats(dc_stats_t *out);
+
+#endif // DIRCACHE_H
@@ -0,0 +1,330 @@
+/* --------------------------------------------------------------------
+ *  diskio.c  –  io_uring (raw system calls, no liburing) with a
+ *               workpool fallback
+ * ------------------------------------------------------------------ */
+#define _GNU_SOURCE                         /* preadv2(), RWF_NOWAIT */
+#include "diskio.h"
+#include "workpool.h"
+#include "seal.h"
+#include "common.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+enum { OP_READ, OP_WRITE, OP_OPEN };
+
+static dio_backend_t g_backend = DIO_SYNC;
+
+/* the ring: submitters share the SQ under g_sq_lock, one reaper
+ * thread drains the CQ and wakes the owners */
+static struct {
+    int                  fd;
+    unsigned            *sq_tail, *sq_mask, *sq_array;
+    unsigned            *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned             entries, inflight, max_inflight;
+} g_ring;
+static pthread_mutex_t g_sq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_sq_room = PTHREAD_COND_INITIALIZER;
+static unsigned long long g_ops, g_inline;
+
+static void complete(dio_t *d, int here);
+
+static int ring_enter(unsigned submit, unsigned wait, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, g_ring.fd, submit, wait, flags, NULL, 0);
+}
+
+static void *reaper(void *unused)
+{
+    (void)unused;
+    for (;;) {
+        if (ring_enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+            perror("io_uring_enter");
+            sleep(1);
+            continue;
+        }
+        unsigned head = *g_ring.cq_head, n = 0;
+        while (head != __atomic_load_n(g_ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &g_ring.cqes[head & *g_ring.cq_mask];
+            dio_t *d = (dio_t *)(uintptr_t)cqe->user_data;
+            d->res = cqe->res;
+            ++head; ++n;
+            __atomic_store_n(g_ring.cq_head, head, __ATOMIC_RELEASE);
+            complete(d, 0);
+        }
+        if (n) {
+            pthread_mutex_lock(&g_sq_lock);
+            g_ring.inflight -= n;
+            pthread_cond_broadcast(&g_sq_room);
+            pthread_mutex_unlock(&g_sq_lock);
+        }
+    }
+    return NULL;
+}
+
+static int ring_init(unsigned depth)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+    if (fd < 0) return -1;
+
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int    single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && cq_len > sq_len) sq_len = cq_len;
+    char *sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    fd, IORING_OFF_SQ_RING);
+    char *cq = single ? sq : mmap(NULL, cq_len, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+        close(fd);                          /* the mappings die with it */
+        return -1;
+    }
+    g_ring.fd       = fd;
+    g_ring.sq_tail  = (unsigned *)(sq + p.sq_off.tail);
+    g_ring.sq_mask  = (unsigned *)(sq + p.sq_off.ring_mask);
+    g_ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+    g_ring.cq_head  = (unsigned *)(cq + p.cq_off.head);
+    g_ring.cq_tail  = (unsigned *)(cq + p.cq_off.tail);
+    g_ring.cq_mask  = (unsigned *)(cq + p.cq_off.ring_mask);
+    g_ring.cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    g_ring.sqes     = sqes;
+    /* the CQ holds at least as many entries as the SQ, so capping what
+     * is in flight at the SQ size means completions never overflow */
+    g_ring.entries  = p.sq_entries;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, reaper, NULL) != 0) { close(fd); return -1; }
+    pthread_detach(tid);
+    return 0;
+}
+
+static void ring_submit(dio_t *d)
+{
+    pthread_mutex_lock(&g_sq_lock);
+    while (g_ring.inflight == g_ring.entries)
+        pthread_cond_wait(&g_sq_room, &g_sq_lock);
+    unsigned tail = *g_ring.sq_tail, idx = tail & *g_ring.sq_mask;
+    struct io_uring_sqe *sqe = &g_ring.sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    switch (d->op) {
+    case OP_READ:
+    case OP_WRITE:
+        sqe->opcode = d->op == OP_READ ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe->fd     = d->fd;
+        sqe->addr   = (uintptr_t)d->buf;
+        sqe->len    = (unsigned)d->len;
+        sqe->off    = (unsigned long long)d->off;
+        break;
+    case OP_OPEN:
+        sqe->opcode     = IORING_OP_OPENAT;
+        sqe->fd         = AT_FDCWD;
+        sqe->addr       = (uintptr_t)d->path;
+        sqe->len        = d->mode;
+        sqe->open_flags = (unsigned)d->flags;
+        break;
+    }
+    sqe->user_data = (uintptr_t)d;
+    g_ring.sq_array[idx] = idx;
+    __atomic_store_n(g_ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    if (++g_ring.inflight > g_ring.max_inflight) g_ring.max_inflight = g_ring.inflight;
+    pthread_mutex_unlock(&g_sq_lock);
+
+    /* outside the lock: the kernel may complete a cached read inline.
+     * Each call consumes one queued entry, not necessarily ours. */
+    int rc;
+    while ((rc = ring_enter(1, 0, 0)) < 0 &&
+           (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+        sched_yield();                      /* kernel short of memory */
+    if (rc < 0) {                           /* the ring itself is broken */
+        perror("io_uring_enter");
+        abort();
+    }
+}
+
+/* the blocking system call behind an operation */
+static void run_sync(dio_t *d)
+{
+    ssize_t r;
+    switch (d->op) {
+    case OP_READ:  r = pread(d->fd, d->buf, d->len, d->off); break;
+    case OP_WRITE: r = pwrite(d->fd, d->buf, d->len, d->off); break;
+    default:       r = open(d->path, d->flags, d->mode); break;
+    }
+    d->res = r < 0 ? -errno : r;
+}
+
+static void pool_job(void *arg)
+{
+    dio_t *d = arg;
+    run_sync(d);
+    complete(d, 1);
+}
+
+static void unseal_job(void *arg)
+{
+    dio_t *d = arg;
+    seal_apply(d->nonce, d->buf, (size_t)d->res, d->off);
+    sem_post(&d->done);
+}
+
+/* d has its result: decrypt what a sealed read brought in, then wake
+ * the owner.  The reaper and the caller's own thread (here == 0)
+ * leave the decryption to a pool thread, so neither the other
+ * completions nor the caller's network I/O wait for it. */
+static void complete(dio_t *d, int here)
+{
+    if (d->op == OP_READ && d->nonce && d->res > 0) {
+        if (here) unseal_job(d);
+        else workpool_submit(unseal_job, d);
+        return;
+    }
+    sem_post(&d->done);
+}
+
+/* Most reads hit the page cache and most buffered writes only copy
+ * into it: try those without blocking first, and hand the kernel or
+ * the pool only what would wait for the disk.  1 when d is complete. */
+static int try_nowait(dio_t *d)
+{
+    if (d->op == OP_OPEN) return 0;
+    /* O_DIRECT I/O never waits for the cache: "nowait" would still
+     * wait for the device, one request at a time */
+    int fl = fcntl(d->fd, F_GETFL);
+    if (fl < 0 || (fl & O_DIRECT)) return 0;
+    struct iovec v = { d->buf, d->len };
+    ssize_t r = d->op == OP_READ ? preadv2(d->fd, &v, 1, d->off, RWF_NOWAIT)
+                                 : pwritev2(d->fd, &v, 1, d->off, RWF_NOWAIT);
+    if (r < 0) {
+        if (errno == EAGAIN || errno == EOPNOTSUPP || errno == EINVAL) return 0;
+        d->res = -errno;
+        return 1;
+    }
+    /* a short read is a valid result; a short write must finish */
+    if (d->op == OP_READ || (size_t)r == d->len) { d->res = r; return 1; }
+    d->done_early = (size_t)r;
+    d->buf  = (char *)d->buf + r;
+    d->len -= (size_t)r;
+    d->off += r;
+    return 0;
+}
+
+/* hand d to the backend; here == 1 on a pool thread */
+static void issue(dio_t *d, int here)
+{
+    if (g_backend != DIO_SYNC && try_nowait(d)) {
+        __atomic_add_fetch(&g_inline, 1, __ATOMIC_RELAXED);
+        complete(d, here);
+        return;
+    }
+    switch (g_backend) {
+    case DIO_URING: ring_submit(d); break;
+    case DIO_POOL:  if (here) pool_job(d); else workpool_submit(pool_job, d); break;
+    case DIO_SYNC:  run_sync(d); complete(d, 1); break;
+    }
+}
+
+/* encrypt a sealed write on a pool thread, then write it from there */
+static void seal_job(void *arg)
+{
+    dio_t *d = arg;
+    seal_apply(d->nonce, d->buf, d->len, d->off);
+    issue(d, 1);
+}
+
+static void dio_start(dio_t *d)
+{
+    sem_init(&d->done, 0, 0);
+    __atomic_add_fetch(&g_ops, 1, __ATOMIC_RELAXED);
+    d->done_early = 0;
+    d->nonce = d->op == OP_OPEN ? NULL : seal_nonce(d->fd);
+    if (d->op == OP_WRITE && d->nonce) {
+        if (g_backend == DIO_SYNC) seal_apply(d->nonce, d->buf, d->len, d->off);
+        else { workpool_submit(seal_job, d); return; }
+    }
+    issue(d, 0);
+}
+
+int diskio_init(dio_backend_t want, unsigned depth)
+{
+    g_backend = want;
+    if (want == DIO_URING && ring_init(depth) < 0) {
+        perror("io_uring_setup (using the thread pool)");
+        g_backend = DIO_POOL;
+    }
+    return 0;
+}
+
+const char *diskio_backend(void)
+{
+    return g_backend == DIO_URING ? "uring" : g_backend == DIO_POOL ? "pool" : "sync";
+}
+
+void diskio_get_stats(unsigned long long *ops, unsigned long long *inline_ops,
+                      unsigned *max_inflight)
+{
+    *ops = __atomic_load_n(&g_ops, __ATOMIC_RELAXED);
+    *inline_ops = __atomic_load_n(&g_inline, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&g_sq_lock);
+    *max_inflight = g_ring.max_inflight;
+    pthread_mutex_unlock(&g_sq_lock);
+}
+
+void dio_read(dio_t *d, int fd, void *buf, size_t len, off_t off)
+{
+    d->op = OP_READ; d->fd = fd; d->buf = buf; d->len = len; d->off = off;
+    dio_start(d);
+}
+
+void dio_write(dio_t *d, int fd, void *buf, size_t len, off_t off)
+{
+    d->op = OP_WRITE; d->fd = fd; d->buf = buf; d->len = len; d->off = off;
+    dio_start(d);
+}
+
+void dio_open(dio_t *d, const char *path, int flags, mode_t mode)
+{
+    d->op = OP_OPEN; d->path = path; d->flags = flags; d->mode = mode;
+    dio_start(d);
+}
+
+ssize_t dio_wait(dio_t *d)
+{
+    while (sem_wait(&d->done) < 0 && errno == EINTR)
+        ;
+    sem_destroy(&d->done);
+    if (d->res < 0 && d->done_early == 0) { errno = (int)-d->res; return -1; }
+    return (d->res < 0 ? 0 : d->res) + (ssize_t)d->done_early;
+}
+
+ssize_t diskio_pread(int fd, void *buf, size_t len, off_t off)
+{
+    dio_t d;
+    dio_read(&d, fd, buf, len, off);
+    return dio_wait(&d);
+}
+
+int diskio_open(const char *path, int flags, mode_t mode)
+{
+    dio_t d;
+    dio_open(&d, path, flags, mode);
+    int fd = (int)dio_wait(&d);
+    if (fd >= 0 && seal_attach(fd) < 0) {
+        int e = errno;
+        close(fd);
+        errno = e;
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,71 @@
+/* --------------------------------------------------------------------
+ *  diskio.h  –  asynchronous open / read / write for the server
+ *
+ *  A client thread starts a disk operation, goes back to its socket,
+ *  and collects the result when it needs it: a GET reads the next
+ *  buffer while the current one is being sent, a WRITE stores one
+ *  buffer while the next one arrives.  All threads share one
+ *  io_uring, so the kernel sees the disk work of every request at
+ *  once, at whatever queue depth the clients produce.
+ *
+ *  Reads that hit the page cache and writes that only fill it are
+ *  done on the spot (RWF_NOWAIT); only what would block goes async.
+ *
+ *  Where io_uring is unavailable (old kernel, seccomp, disabled by
+ *  sysctl) the operations run on the workpool threads instead.  The
+ *  "sync" backend runs them inline: the old blocking path, kept for
+ *  comparison.  Never wait for a dio_t from inside a workpool job.
+ * ------------------------------------------------------------------ */
+#ifndef DISKIO_H
+#define DISKIO_H
+
+#include <semaphore.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef enum { DIO_URING, DIO_POOL, DIO_SYNC } dio_backend_t;
+
+/* One operation in flight.  Lives with its caller (usually on the
+ * stack) from dio_read()/dio_write()/dio_open() until dio_wait(). */
+typedef struct {
+    sem_t       done;
+    ssize_t     res;            /* bytes, or fd for an open; -errno */
+    int         op, fd, flags;
+    mode_t      mode;
+    void       *buf;
+    size_t      len;
+    off_t       off;
+    const char *path;
+    size_t      done_early;     /* bytes written before it had to wait */
+    const uint8_t *nonce;       /* seal of fd, see seal.h */
+} dio_t;
+
+/* Pick a backend; DIO_URING falls back to DIO_POOL (whose threads
+ * must already be running, see workpool_init()) if the ring cannot
+ * be set up.  depth bounds the operations in flight on the ring. */
+int diskio_init(dio_backend_t want, unsigned depth);
+
+/* "uring", "pool" or "sync" */
+const char *diskio_backend(void);
+
+/* operations started, those finished without waiting (see
+ * try_nowait() in diskio.c), and the most ever in flight on the ring */
+void diskio_get_stats(unsigned long long *ops, unsigned long long *inline_ops,
+                      unsigned *max_inflight);
+
+/* On a sealed fd (see seal.h) the read buffer is decrypted before
+ * dio_wait() returns, and the write buffer is encrypted in place. */
+void dio_read(dio_t *d, int fd, void *buf, size_t len, off_t off);
+void dio_write(dio_t *d, int fd, void *buf, size_t len, off_t off);
+void dio_open(dio_t *d, const char *path, int flags, mode_t mode);
+
+/* Result of the operation, like the system call: -1 and errno on
+ * failure. */
+ssize_t dio_wait(dio_t *d);
+
+/* start + wait, for callers with nothing to overlap; diskio_open()
+ * also attaches the file's seal */
+ssize_t diskio_pread(int fd, void *buf, size_t len, off_t off);
+int     diskio_open(const char *path, int flags, mode_t mode);
+
+#endif // DISKIO_H
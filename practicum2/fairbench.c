@@ -0,0 +1,211 @@
+/* --------------------------------------------------------------------
+ *  fairbench.c  –  small-request latency next to a noisy neighbour
+ *
+ *  One "interactive" client GETs a <small>-byte file, pausing <think>
+ *  µs between requests, and records each request's latency.  It runs
+ *  alone for <secs> seconds, then for <secs> more while a "bulk"
+ *  client keeps <conns> connections busy writing and reading back
+ *  <size> MB files.  The two clients connect from different loopback
+ *  addresses (127.0.0.3 and 127.0.0.2), so the server tells them
+ *  apart as it would two hosts.  Run it against rfserver -Q 0 (no
+ *  fair scheduling) and against a plain rfserver to compare.
+ *
+ *  usage: fairbench [-c conns] [-s size_MB] [-k small_bytes]
+ *                   [-t think_us] [-d secs] [-p port] [-i]
+ * ------------------------------------------------------------------ */
+#define _GNU_SOURCE                         /* SCHED_IDLE */
+#include "proto.h"
+#include "lathist.h"
+
+#include <netinet/tcp.h>
+#include <sched.h>
+#include <time.h>
+
+#define BULK_ADDR  "127.0.0.2"
+#define SMALL_ADDR "127.0.0.3"
+
+static int    g_conns = 8;
+static size_t g_size  = 16u << 20;
+static size_t g_small = 4096;
+static int    g_think = 1000;
+static int    g_secs  = 5;
+static int    g_port  = PORT;
+static int    g_idle;                   /* -i: bulk threads on spare CPU only */
+static char  *g_payload;
+static volatile int g_stop;
+static unsigned long long g_bulk_bytes;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* a connection to the server from source address from */
+static int connect_from(conn_t *c, const char *from)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) return -1;
+    struct sockaddr_in a = {0};
+    a.sin_family = AF_INET;
+    inet_pton(AF_INET, from, &a.sin_addr);
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (bind(s, (struct sockaddr *)&a, sizeof(a)) < 0) { close(s); return -1; }
+    a.sin_port = htons(g_port);
+    inet_pton(AF_INET, "127.0.0.1", &a.sin_addr);
+    if (connect(s, (struct sockaddr *)&a, sizeof(a)) < 0) { close(s); return -1; }
+    conn_init(c, s);
+    return 0;
+}
+
+static int put_file(conn_t *c, const char *path, size_t n)
+{
+    char line[MAX_LINE];
+    if (send_line(c->fd, "WRITE - %s size=%zu", path, n) < 0 ||
+        conn_read_line(c, line, sizeof(line)) < 0 ||
+        strcmp(line, "OK_READY_TO_RECEIVE") != 0 ||
+        send_all(c->fd, g_payload, n) < 0 ||
+        conn_read_line(c, line, sizeof(line)) < 0 ||
+        strncmp(line, "WRITE_OK", 8) != 0)
+        return -1;
+    return 0;
+}
+
+static int get_file(conn_t *c, const char *path, unsigned long long *bytes)
+{
+    char line[MAX_LINE], buf[XFER_BUF];
+    unsigned long long n;
+    if (send_line(c->fd, "GET %s -", path) < 0 ||
+        conn_read_line(c, line, sizeof(line)) < 0 ||
+        sscanf(line, "OK_SENDING_FILE %llu", &n) != 1)
+        return -1;
+    for (unsigned long long got = 0; got < n; ) {
+        size_t want = n - got < sizeof(buf) ? (size_t)(n - got) : sizeof(buf);
+        ssize_t k = conn_read(c, buf, want);
+        if (k <= 0) return -1;
+        got += (unsigned long long)k;
+    }
+    *bytes = n;
+    return 0;
+}
+
+/* one connection of the noisy neighbour: upload, download, repeat */
+static void *bulk(void *arg)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "fairbench_bulk%d", (int)(intptr_t)arg);
+    conn_t c;
+    if (g_idle) {
+        struct sched_param sp = {0};
+        pthread_setschedparam(pthread_self(), SCHED_IDLE, &sp);
+    }
+    if (connect_from(&c, BULK_ADDR) < 0) return NULL;
+    while (!g_stop) {
+        unsigned long long got = 0;
+        if (put_file(&c, path, g_size) < 0) break;
+        __atomic_add_fetch(&g_bulk_bytes, g_size, __ATOMIC_RELAXED);
+        if (g_stop || get_file(&c, path, &got) < 0) break;
+        __atomic_add_fetch(&g_bulk_bytes, got, __ATOMIC_RELAXED);
+    }
+    send_line(c.fd, "RM %s", path);
+    close(c.fd);
+    return NULL;
+}
+
+/* the interactive client for one phase; -1 on a failed request */
+static int small_phase(conn_t *c, lathist_t *h)
+{
+    uint64_t end = now_ns() + (uint64_t)g_secs * 1000000000ULL;
+    while (now_ns() < end) {
+        unsigned long long got;
+        uint64_t t0 = now_ns();
+        if (get_file(c, "fairbench_small", &got) < 0 || got != g_small) return -1;
+        lathist_add(h, now_ns() - t0);
+        usleep((useconds_t)g_think);
+    }
+    return 0;
+}
+
+static void report(const char *phase, const lathist_t *h, double mbs)
+{
+    printf("%-6s %8llu %8.0f %8.0f %8.0f %8.0f %8.0f %9.1f\n", phase,
+           (unsigned long long)h->count, lathist_mean(h) / 1e3,
+           lathist_pct(h, 0.50) / 1e3, lathist_pct(h, 0.99) / 1e3,
+           lathist_pct(h, 0.999) / 1e3, h->max / 1e3, mbs);
+}
+
+int main(int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "c:s:k:t:d:p:i")) != -1) {
+        switch (ch) {
+        case 'c': g_conns = atoi(optarg); break;
+        case 's': g_size  = (size_t)strtoull(optarg, NULL, 10) << 20; break;
+        case 'k': g_small = (size_t)strtoull(optarg, NULL, 10); break;
+        case 't': g_think = atoi(optarg); break;
+        case 'd': g_secs  = atoi(optarg); break;
+        case 'p': g_port  = atoi(optarg); break;
+        case 'i': g_idle  = 1; break;
+        default:  optind = argc + 1;
+        }
+    }
+    if (optind != argc || g_conns < 1 || g_size == 0 || g_secs < 1 || g_think < 0) {
+        fprintf(stderr, "usage: %s [-c conns] [-s size_MB] [-k small_bytes] "
+                        "[-t think_us] [-d secs] [-p port] [-i]\n", argv[0]);
+        return 1;
+    }
+    size_t most = g_size > g_small ? g_size : g_small;
+    if (!(g_payload = malloc(most))) { perror("malloc"); return 1; }
+    unsigned seed = 5;
+    for (size_t i = 0; i < most; ++i) g_payload[i] = (char)rand_r(&seed);
+
+    conn_t c;
+    if (connect_from(&c, SMALL_ADDR) < 0 || put_file(&c, "fairbench_small", g_small) < 0) {
+        fprintf(stderr, "fairbench: cannot reach rfserver on port %d\n", g_port);
+        return 1;
+    }
+
+    static lathist_t alone, noisy;
+    printf("small GETs of %zu bytes, %d us apart; bulk: %d connections, %zu MB files\n",
+           g_small, g_think, g_conns, g_size >> 20);
+    printf("%-6s %8s %8s %8s %8s %8s %8s %9s\n", "phase", "GETs", "mean us",
+           "p50 us", "p99 us", "p999 us", "max us", "bulk MB/s");
+    if (small_phase(&c, &alone) < 0) { fprintf(stderr, "fairbench: GET failed\n"); return 1; }
+    report("alone", &alone, 0);
+
+    pthread_t tid[g_conns];
+    for (int i = 0; i < g_conns; ++i)
+        pthread_create(&tid[i], NULL, bulk, (void *)(intptr_t)i);
+    sleep(1);                                   /* let the bulk transfers get going */
+    unsigned long long b0 = __atomic_load_n(&g_bulk_bytes, __ATOMIC_RELAXED);
+    uint64_t t0 = now_ns();
+    int rc = small_phase(&c, &noisy);
+    double mbs = (__atomic_load_n(&g_bulk_bytes, __ATOMIC_RELAXED) - b0) /
+                 ((now_ns() - t0) / 1e9) / 1e6;
+    g_stop = 1;
+    for (int i = 0; i < g_conns; ++i)
+        pthread_join(tid[i], NULL);
+    if (rc < 0) { fprintf(stderr, "fairbench: GET failed\n"); return 1; }
+    report("noisy", &noisy, mbs);
+
+    /* the server's own view of the queueing */
+    char line[MAX_LINE];
+    unsigned long long n;
+    send_line(c.fd, "RM fairbench_small");
+    conn_read_line(&c, line, sizeof(line));
+    if (send_line(c.fd, "STATS") == 0 && conn_read_line(&c, line, sizeof(line)) >= 0 &&
+        sscanf(line, "OK_STATS %llu", &n) == 1) {
+        char *text = malloc(n + 1);
+        if (text && conn_read_full(&c, text, n) == 0) {
+            text[n] = '\0';
+            char *fair = strstr(text, "\nfair ");
+            if (fair) printf("server: %.*s\n", (int)strcspn(fair + 1, "\n"), fair + 1);
+        }
+        free(text);
+    }
+    close(c.fd);
+    free(g_payload);
+    return 0;
+}
@@ -0,0 +1,184 @@
+/* --------------------------------------------------------------------
+ *  fairq.c  –  deficit round-robin over client addresses
+ * ------------------------------------------------------------------ */
+#include "fairq.h"
+#include "common.h"
+
+#include <time.h>
+
+/* per-address queues: open addressing on the address; an entry with
+ * no turns queued is free for another address */
+#define FAIR_CLIENTS 1024
+#define FAIR_PROBE   16
+
+/* a thread waiting for its turn; lives on that thread's stack */
+typedef struct waiter {
+    size_t          cost;
+    int             granted;
+    pthread_cond_t  cv;
+    struct waiter  *next;
+} waiter_t;
+
+typedef struct client {
+    uint32_t        ip;
+    long long       deficit;            /* credit left this round */
+    int             visiting;           /* at the head, quantum added */
+    waiter_t       *head, *tail;        /* queued turns, oldest first */
+    struct client  *next;               /* in the round */
+} client_t;
+
+static unsigned        g_slots, g_busy, g_clients;
+static client_t        g_table[FAIR_CLIENTS];
+static client_t       *g_first, *g_last;  /* the round: clients with turns queued */
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long g_turns, g_queued, g_wait_ns;
+
+static __thread uint32_t t_ip;
+static __thread int      t_held;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* the entry of ip: its own, else a free one; g_lock held */
+static client_t *client_of(uint32_t ip)
+{
+    uint32_t h = ip * 2654435761u % FAIR_CLIENTS;
+    client_t *spare = NULL;
+    for (unsigned probe = 0; probe < FAIR_PROBE; ++probe) {
+        client_t *c = &g_table[(h + probe) % FAIR_CLIENTS];
+        if (c->head && c->ip == ip) return c;
+        if (!c->head && !spare) spare = c;
+    }
+    if (!spare) return &g_table[h];     /* crowded: share a queue */
+    spare->ip = ip;
+    spare->deficit = 0;
+    return spare;
+}
+
+/* Give free slots to queued turns; g_lock held */
+static void dispatch(void)
+{
+    while (g_busy < g_slots && g_first) {
+        client_t *c = g_first;
+        if (!c->visiting) {
+            c->deficit += FAIR_QUANTUM;
+            c->visiting = 1;
+        }
+        waiter_t *w = c->head;
+        if ((long long)w->cost > c->deficit) {
+            /* credit spent: to the back of the round */
+            c->visiting = 0;
+            if (c != g_last) {
+                g_first = c->next;
+                c->next = NULL;
+                g_last->next = c;
+                g_last = c;
+            }
+            continue;
+        }
+        c->deficit -= (long long)w->cost;
+        if (!(c->head = w->next)) c->tail = NULL;
+        w->granted = 1;
+        pthread_cond_signal(&w->cv);
+        ++g_busy;
+        if (!c->head) {
+            /* nothing left to wait for: out of the round, credit too */
+            c->deficit  = 0;
+            c->visiting = 0;
+            if (!(g_first = c->next)) g_last = NULL;
+            c->next = NULL;
+            --g_clients;
+        }
+    }
+}
+
+void fair_init(unsigned slots)
+{
+    g_slots = slots;
+}
+
+void fair_bind(uint32_t ip)
+{
+    t_ip = ip;
+}
+
+void fair_take(size_t cost)
+{
+    if (!g_slots) return;
+    if (t_held) fair_give();
+    pthread_mutex_lock(&g_lock);
+    ++g_turns;
+    if (g_busy < g_slots && !g_first) {
+        ++g_busy;
+        pthread_mutex_unlock(&g_lock);
+        t_held = 1;
+        return;
+    }
+
+    waiter_t w = { .cost = cost };
+    pthread_cond_init(&w.cv, NULL);
+    client_t *c = client_of(t_ip);
+    if (!c->head) {
+        /* joins the round at the back */
+        c->next = NULL;
+        if (g_last) g_last->next = c;
+        else        g_first = c;
+        g_last = c;
+        ++g_clients;
+        c->head = &w;
+    } else {
+        c->tail->next = &w;
+    }
+    c->tail = &w;
+    ++g_queued;
+
+    uint64_t t0 = now_ns();
+    dispatch();
+    while (!w.granted) pthread_cond_wait(&w.cv, &g_lock);
+    g_wait_ns += now_ns() - t0;
+    pthread_mutex_unlock(&g_lock);
+    pthread_cond_destroy(&w.cv);
+    t_held = 1;
+}
+
+void fair_give(void)
+{
+    if (!t_held) return;
+    t_held = 0;
+    pthread_mutex_lock(&g_lock);
+    --g_busy;
+    dispatch();
+    pthread_mutex_unlock(&g_lock);
+}
+
+void fair_pace(size_t cost)
+{
+    if (!g_slots) return;
+    /* a client with nothing queued has nobody of its own to wait
+     * behind, and needs no slot: let it through (sparse flows first,
+     * as fq_codel does) */
+    pthread_mutex_lock(&g_lock);
+    client_t *c = client_of(t_ip);
+    int sparse = !c->head;
+    if (sparse) ++g_turns;
+    pthread_mutex_unlock(&g_lock);
+    if (sparse) return;
+    fair_take(cost);
+    fair_give();
+}
+
+void fair_get_stats(fair_stats_t *st)
+{
+    pthread_mutex_lock(&g_lock);
+    st->slots   = g_slots;
+    st->busy    = g_busy;
+    st->clients = g_clients;
+    st->turns   = g_turns;
+    st->queued  = g_queued;
+    st->wait_ns = g_wait_ns;
+    pthread_mutex_unlock(&g_lock);
+}
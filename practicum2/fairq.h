@@ -0,0 +1,56 @@
+/* --------------------------------------------------------------------
+ *  fairq.h  –  per-client fair scheduling of the server's transfer work
+ *
+ *  With a thread per connection, a client with eight bulk uploads gets
+ *  eight times the disk and CPU of a client with one small GET, and
+ *  the GET waits behind all of them.  Here every request as it starts,
+ *  and every chunk of payload a handler stores or loads, first takes a
+ *  turn.  At most <slots> turns are held at once.  When one is given
+ *  back, deficit round-robin picks the next: each client with turns
+ *  queued gets FAIR_QUANTUM bytes of credit per round and spends it on
+ *  its turns in arrival order; credit is kept from round to round only
+ *  while the client still has turns queued.  Bulk clients share
+ *  evenly whatever their number of connections, and a client with no
+ *  backlog gets its small requests through at once, however many
+ *  transfers another client runs.  Clients are told apart by IP
+ *  address, as for the -r rate limit.
+ *
+ *  Socket I/O happens between turns, so a client that stops reading
+ *  or sending holds no slot.  While a slot is free and nobody waits, a
+ *  turn costs one uncontended mutex.
+ * ------------------------------------------------------------------ */
+#ifndef FAIRQ_H
+#define FAIRQ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    unsigned           slots, busy;
+    unsigned           clients;         /* with turns queued now */
+    unsigned long long turns, queued;   /* turns taken; of those, waited for */
+    unsigned long long wait_ns;         /* total time waited */
+} fair_stats_t;
+
+/* Hand out at most slots turns at once; 0 = off, every call returns
+ * at once. */
+void fair_init(unsigned slots);
+
+/* The calling thread serves client ip (network order). */
+void fair_bind(uint32_t ip);
+
+/* Wait for the next turn of this thread's client to do cost bytes of
+ * work, and hold a slot until fair_give().  A thread holds one turn at
+ * most: taking another gives back the first. */
+void fair_take(size_t cost);
+void fair_give(void);
+
+/* For work done without a slot (a send from memory, the start of a
+ * request): wait behind the client's own queued turns, in their place
+ * in the round, then go on.  A client with nothing queued goes on at
+ * once, so an occasional small request never waits for a slot. */
+void fair_pace(size_t cost);
+
+void fair_get_stats(fair_stats_t *st);
+
+#endif // FAIRQ_H
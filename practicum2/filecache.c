@@ -0,0 +1,254 @@
+/* --------------------------------------------------------------------
+ *  filecache.c  –  sharded CLOCK cache of whole-file contents
+ * ------------------------------------------------------------------ */
+#include "filecache.h"
+
+#define FC_SHARD_BITS 4
+#define FC_SHARDS     (1 << FC_SHARD_BITS)
+#define FC_BUCKETS    4096              /* hash chains per shard */
+
+typedef struct fc_node {
+    uint64_t        hash;
+    char           *path;
+    fc_buf_t       *buf;
+    int             referenced;         /* CLOCK bit, set on every hit */
+    struct fc_node *hnext;              /* hash chain */
+    struct fc_node *prev, *next;        /* CLOCK ring */
+} fc_node_t;
+
+typedef struct {
+    pthread_rwlock_t lock;
+    fc_node_t       *buckets[FC_BUCKETS];
+    fc_node_t       *hand;              /* NULL when the ring is empty */
+    size_t           bytes;
+    size_t           entries;
+    uint64_t         gen;               /* bumped by every invalidation */
+} fc_shard_t;
+
+static fc_shard_t g_shards[FC_SHARDS];
+static size_t     g_shard_budget;
+static size_t     g_max_entry;
+
+static uint64_t g_hits, g_misses, g_inserts, g_evictions, g_invalidations;
+
+#define FC_INC(c) __atomic_add_fetch(&(c), 1, __ATOMIC_RELAXED)
+
+static uint64_t fc_hash(const char *s)
+{
+    uint64_t h = 1469598103934665603ULL;        /* FNV-1a */
+    for (; *s; ++s) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static fc_shard_t *fc_shard(uint64_t h)
+{
+    return &g_shards[h >> (64 - FC_SHARD_BITS)];
+}
+
+/* ----------  shard internals (caller holds the lock)  ------------- */
+static fc_node_t **fc_slot(fc_shard_t *sh, uint64_t h, const char *path)
+{
+    fc_node_t **pp = &sh->buckets[h % FC_BUCKETS];
+    while (*pp && ((*pp)->hash != h || strcmp((*pp)->path, path) != 0))
+        pp = &(*pp)->hnext;
+    return pp;
+}
+
+static void ring_insert(fc_shard_t *sh, fc_node_t *n)
+{
+    if (!sh->hand) {
+        n->prev = n->next = n;
+        sh->hand = n;
+        return;
+    }
+    /* just behind the hand: the last node it will visit */
+    n->next = sh->hand;
+    n->prev = sh->hand->prev;
+    n->prev->next = n;
+    sh->hand->prev = n;
+}
+
+static void ring_remove(fc_shard_t *sh, fc_node_t *n)
+{
+    if (n->next == n) {
+        sh->hand = NULL;
+    } else {
+        n->prev->next = n->next;
+        n->next->prev = n->prev;
+        if (sh->hand == n) sh->hand = n->next;
+    }
+}
+
+static void node_unlink(fc_shard_t *sh, fc_node_t **slot)
+{
+    fc_node_t *n = *slot;
+    *slot = n->hnext;
+    ring_remove(sh, n);
+    sh->bytes -= n->buf->len;
+    --sh->entries;
+}
+
+static void node_free(fc_node_t *n)
+{
+    filecache_release(n->buf);
+    free(n->path);
+    free(n);
+}
+
+/* second-chance sweep until len more bytes fit */
+static void fc_evict_for(fc_shard_t *sh, size_t len)
+{
+    while (sh->hand && sh->bytes + len > g_shard_budget) {
+        fc_node_t *n = sh->hand;
+        if (__atomic_exchange_n(&n->referenced, 0, __ATOMIC_RELAXED)) {
+            sh->hand = n->next;
+            continue;
+        }
+        node_unlink(sh, fc_slot(sh, n->hash, n->path));
+        node_free(n);
+        FC_INC(g_evictions);
+    }
+}
+
+/* ====================================================================
+ *  public API
+ * ===================================================================*/
+void filecache_init(size_t budget, size_t max_entry)
+{
+    for (int s = 0; s < FC_SHARDS; ++s)
+        pthread_rwlock_init(&g_shards[s].lock, NULL);
+    g_shard_budget = budget / FC_SHARDS;
+    g_max_entry    = max_entry < g_shard_budget ? max_entry : g_shard_budget;
+}
+
+size_t filecache_max_entry(void)
+{
+    return g_max_entry;
+}
+
+fc_buf_t *filecache_get(const char *path)
+{
+    fc_buf_t *b = filecache_peek(path);
+    if (g_max_entry) filecache_count(b != NULL);
+    return b;
+}
+
+void filecache_count(int hit)
+{
+    FC_INC(*(hit ? &g_hits : &g_misses));
+}
+
+fc_buf_t *filecache_peek(const char *path)
+{
+    if (!g_max_entry) return NULL;
+
+    uint64_t    h  = fc_hash(path);
+    fc_shard_t *sh = fc_shard(h);
+    fc_buf_t   *b  = NULL;
+
+    pthread_rwlock_rdlock(&sh->lock);
+    fc_node_t *n = *fc_slot(sh, h, path);
+    if (n) {
+        __atomic_store_n(&n->referenced, 1, __ATOMIC_RELAXED);
+        b = n->buf;
+        __atomic_add_fetch(&b->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_rwlock_unlock(&sh->lock);
+    return b;
+}
+
+void filecache_release(fc_buf_t *b)
+{
+    if (b && __atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(b);
+}
+
+uint64_t filecache_generation(const char *path)
+{
+    return __atomic_load_n(&fc_shard(fc_hash(path))->gen, __ATOMIC_ACQUIRE);
+}
+
+void filecache_put(const char *path, const char *data, size_t len,
+                   uint64_t gen, const char *ver, uint32_t crc)
+{
+    if (len > g_max_entry) return;
+
+    /* copy outside the lock */
+    fc_buf_t  *b = malloc(sizeof(fc_buf_t) + len);
+    fc_node_t *n = malloc(sizeof(fc_node_t));
+    char      *p = strdup(path);
+    if (!b || !n || !p) { free(b); free(n); free(p); return; }
+    b->refs = 1;                        /* the cache's own reference */
+    b->len  = len;
+    snprintf(b->ver, sizeof(b->ver), "%s", ver ? ver : "");
+    b->crc  = crc;
+    memcpy(b->data, data, len);
+
+    uint64_t    h  = fc_hash(path);
+    fc_shard_t *sh = fc_shard(h);
+
+    pthread_rwlock_wrlock(&sh->lock);
+    if (sh->gen != gen) {               /* invalidated while we read */
+        pthread_rwlock_unlock(&sh->lock);
+        free(b); free(n); free(p);
+        return;
+    }
+    fc_node_t **slot = fc_slot(sh, h, path);
+    fc_node_t  *old  = *slot;
+    if (old) node_unlink(sh, slot);
+    fc_evict_for(sh, len);
+
+    n->hash = h;
+    n->path = p;
+    n->buf  = b;
+    n->referenced = 0;
+    slot = fc_slot(sh, h, path);
+    n->hnext = *slot;
+    *slot = n;
+    ring_insert(sh, n);
+    sh->bytes += len;
+    ++sh->entries;
+    pthread_rwlock_unlock(&sh->lock);
+
+    if (old) node_free(old);
+    FC_INC(g_inserts);
+}
+
+void filecache_invalidate(const char *path)
+{
+    if (!g_max_entry) return;
+
+    uint64_t    h  = fc_hash(path);
+    fc_shard_t *sh = fc_shard(h);
+
+    pthread_rwlock_wrlock(&sh->lock);
+    __atomic_add_fetch(&sh->gen, 1, __ATOMIC_RELEASE);
+    fc_node_t **slot = fc_slot(sh, h, path);
+    fc_node_t  *n    = *slot;
+    if (n) node_unlink(sh, slot);
+    pthread_rwlock_unlock(&sh->lock);
+
+    if (n) {
+        node_free(n);
+        FC_INC(g_invalidations);
+    }
+}
+
+void filecache_get_stats(fc_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->hits          = __atomic_load_n(&g_hits, __ATOMIC_RELAXED);
+    out->misses        = __atomic_load_n(&g_misses, __ATOMIC_RELAXED);
+    out->inserts       = __atomic_load_n(&g_inserts, __ATOMIC_RELAXED);
+    out->evictions     = __atomic_load_n(&g_evictions, __ATOMIC_RELAXED);
+    out->invalidations = __atomic_load_n(&g_invalidations, __ATOMIC_RELAXED);
+    for (int s = 0; s < FC_SHARDS; ++s) {
+        pthread_rwlock_rdlock(&g_shards[s].lock);
+        out->entries += g_shards[s].entries;
+        out->bytes   += g_shards[s].bytes;
+        pthread_rwlock_unlock(&g_shards[s].lock);
+    }
+}
@@ -0,0 +1,63 @@
+/* --------------------------------------------------------------------
+ *  filecache.h  –  byte-budgeted in-memory cache of hot file contents
+ *
+ *  Keyed by remote path.  Lookups take only a shared shard lock and
+ *  hand back a reference-counted buffer, so any number of GETs of the
+ *  same file are served from memory in parallel.  WRITE and RM call
+ *  filecache_invalidate(); a fill that raced with an invalidation is
+ *  discarded thanks to the per-shard generation counter.
+ * ------------------------------------------------------------------ */
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include "common.h"
+#include <stdint.h>
+
+typedef struct fc_buf {
+    int    refs;                /* atomic */
+    size_t len;
+    char   ver[VER_LEN];        /* version token of the bytes, or "" */
+    uint32_t crc;               /* CRC32C of the bytes */
+    char   data[];
+} fc_buf_t;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t evictions;
+    uint64_t invalidations;
+    uint64_t entries;
+    uint64_t bytes;
+} fc_stats_t;
+
+/* budget: total bytes of file data kept; max_entry: largest cacheable
+ * file.  A budget of 0 disables the cache. */
+void filecache_init(size_t budget, size_t max_entry);
+
+/* Largest file the cache will accept (0 when disabled). */
+size_t filecache_max_entry(void);
+
+/* Referenced buffer for path, or NULL on a miss.  Release when done. */
+fc_buf_t *filecache_get(const char *path);
+
+/* filecache_get() that leaves the hit/miss counters alone, for callers
+ * that may still turn the entry down; they report the outcome with
+ * filecache_count(). */
+fc_buf_t *filecache_peek(const char *path);
+void      filecache_count(int hit);
+void      filecache_release(fc_buf_t *b);
+
+/* Snapshot the shard generation before reading the file from disk ... */
+uint64_t filecache_generation(const char *path);
+
+/* ... and insert the bytes read, with their version token (may be
+ * NULL) and CRC32C; dropped if path was invalidated since. */
+void filecache_put(const char *path, const char *data, size_t len,
+                   uint64_t gen, const char *ver, uint32_t crc);
+
+void filecache_invalidate(const char *path);
+
+void filecache_get_stats(fc_stats_t *out);
+
+#endif // FILECACHE_H
@@ -0,0 +1,209 @@
+/* --------------------------------------------------------------------
+ *  iobench.c  –  random reads at a high queue depth through each
+ *                diskio backend
+ *
+ *  "sync" is the server's old model: one blocked thread per read in
+ *  flight, <depth> threads in all.  "uring" and "pool" keep <depth>
+ *  reads in flight from a single thread through diskio.c.  Each
+ *  backend runs in its own child process for <secs> seconds and
+ *  reports reads/s, MB/s and per-read latency.
+ *
+ *  The file should be bigger than RAM, or pass -D (O_DIRECT) to
+ *  keep the page cache out of it; -c <bytes> creates the file first.
+ *
+ *  usage: iobench [-q depth] [-s block] [-t secs] [-D] [-c bytes]
+ *                 [-b uring,pool,sync] file
+ *  sizes take k/m/g suffixes.
+ * ------------------------------------------------------------------ */
+#define _GNU_SOURCE                         /* O_DIRECT */
+#include "diskio.h"
+#include "workpool.h"
+#include "lathist.h"
+#include "common.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+
+static int    g_depth  = 64;
+static size_t g_block  = 4096;
+static int    g_secs   = 5;
+static int    g_direct = 0;
+static int    g_fd;
+static unsigned long long g_blocks;         /* g_block-sized slots in the file */
+
+static lathist_t          g_lat;
+static unsigned long long g_reads;
+static volatile int       g_stop;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static unsigned long long parse_size(const char *s)
+{
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    switch (*end) {
+    case 'g': case 'G': v <<= 10; /* fall through */
+    case 'm': case 'M': v <<= 10; /* fall through */
+    case 'k': case 'K': v <<= 10; break;
+    }
+    return v;
+}
+
+static off_t rand_off(unsigned *seed)
+{
+    unsigned long long r = (unsigned long long)rand_r(seed) << 31 | (unsigned)rand_r(seed);
+    return (off_t)(r % g_blocks * g_block);
+}
+
+static void *aligned_buf(void)
+{
+    void *p = NULL;
+    return posix_memalign(&p, 4096, g_block) == 0 ? p : NULL;
+}
+
+/* sync: one thread per outstanding read */
+static void *sync_reader(void *arg)
+{
+    unsigned seed = (unsigned)(uintptr_t)arg;
+    char *buf = aligned_buf();
+    while (buf && !g_stop) {
+        uint64_t t0 = now_ns();
+        if (diskio_pread(g_fd, buf, g_block, rand_off(&seed)) != (ssize_t)g_block) break;
+        lathist_add(&g_lat, now_ns() - t0);
+        __atomic_add_fetch(&g_reads, 1, __ATOMIC_RELAXED);
+    }
+    free(buf);
+    return NULL;
+}
+
+static void run_sync(void)
+{
+    pthread_t *tid = calloc((size_t)g_depth, sizeof(pthread_t));
+    for (int i = 0; i < g_depth; ++i)
+        pthread_create(&tid[i], NULL, sync_reader, (void *)(uintptr_t)(i + 1));
+    sleep((unsigned)g_secs);
+    g_stop = 1;
+    for (int i = 0; i < g_depth; ++i) pthread_join(tid[i], NULL);
+    free(tid);
+}
+
+/* uring / pool: one thread, g_depth reads in flight, reaped in order */
+static void run_async(void)
+{
+    dio_t    *d   = calloc((size_t)g_depth, sizeof(dio_t));
+    char    **buf = calloc((size_t)g_depth, sizeof(char *));
+    uint64_t *t0  = calloc((size_t)g_depth, sizeof(uint64_t));
+    unsigned  seed = 1;
+    for (int i = 0; i < g_depth; ++i) {
+        buf[i] = aligned_buf();
+        t0[i]  = now_ns();
+        dio_read(&d[i], g_fd, buf[i], g_block, rand_off(&seed));
+    }
+    uint64_t end = now_ns() + (uint64_t)g_secs * 1000000000ULL;
+    for (int i = 0; ; i = (i + 1) % g_depth) {
+        if (dio_wait(&d[i]) != (ssize_t)g_block) { perror("read"); break; }
+        uint64_t t = now_ns();
+        lathist_add(&g_lat, t - t0[i]);
+        ++g_reads;
+        if (t >= end) {                     /* drain the rest */
+            for (int j = (i + 1) % g_depth; j != i; j = (j + 1) % g_depth)
+                dio_wait(&d[j]);
+            break;
+        }
+        t0[i] = t;
+        dio_read(&d[i], g_fd, buf[i], g_block, rand_off(&seed));
+    }
+    for (int i = 0; i < g_depth; ++i) free(buf[i]);
+    free(buf); free(t0); free(d);
+}
+
+static void bench(const char *name)
+{
+    dio_backend_t b = strcmp(name, "sync") == 0 ? DIO_SYNC :
+                      strcmp(name, "pool") == 0 ? DIO_POOL : DIO_URING;
+    if (b == DIO_POOL) workpool_init(BATCH_THREADS);
+    diskio_init(b, (unsigned)g_depth);
+    if (strcmp(diskio_backend(), name) != 0) {
+        printf("%-6s unavailable\n", name);
+        return;
+    }
+    uint64_t t = now_ns();
+    if (b == DIO_SYNC) run_sync(); else run_async();
+    double secs = (now_ns() - t) / 1e9;
+    printf("%-6s %6d %8s %10.0f %9.1f %9.1f %9.1f %9.1f\n", name,
+           b == DIO_SYNC ? g_depth : 1, b == DIO_POOL ? "8" : "-",
+           g_reads / secs, g_reads * (double)g_block / secs / 1e6,
+           lathist_pct(&g_lat, 0.50) / 1e3, lathist_pct(&g_lat, 0.99) / 1e3,
+           lathist_pct(&g_lat, 0.999) / 1e3);
+}
+
+static int create_file(const char *path, unsigned long long bytes)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    char *buf = malloc(XFER_BUF);
+    if (fd < 0 || !buf) { perror(path); return -1; }
+    unsigned seed = 7;
+    for (size_t i = 0; i < XFER_BUF; ++i) buf[i] = (char)rand_r(&seed);
+    for (unsigned long long off = 0; off < bytes; off += XFER_BUF) {
+        size_t k = bytes - off < XFER_BUF ? (size_t)(bytes - off) : XFER_BUF;
+        if (write(fd, buf, k) != (ssize_t)k) { perror("write"); close(fd); return -1; }
+    }
+    fsync(fd);
+    close(fd);
+    free(buf);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *backends = "sync,pool,uring";
+    unsigned long long create = 0;
+    int ch;
+    while ((ch = getopt(argc, argv, "q:s:t:Dc:b:")) != -1) {
+        switch (ch) {
+        case 'q': g_depth  = atoi(optarg); break;
+        case 's': g_block  = (size_t)parse_size(optarg); break;
+        case 't': g_secs   = atoi(optarg); break;
+        case 'D': g_direct = 1; break;
+        case 'c': create   = parse_size(optarg); break;
+        case 'b': backends = optarg; break;
+        default:  optind = argc + 1;
+        }
+    }
+    if (optind != argc - 1 || g_depth < 1 || g_block == 0) {
+        fprintf(stderr, "usage: %s [-q depth] [-s block] [-t secs] [-D] [-c bytes] "
+                        "[-b uring,pool,sync] file\n", argv[0]);
+        return 1;
+    }
+    const char *path = argv[optind];
+    if (create && create_file(path, create) < 0) return 1;
+
+    g_fd = open(path, O_RDONLY | (g_direct ? O_DIRECT : 0));
+    struct stat st;
+    if (g_fd < 0 || fstat(g_fd, &st) < 0) { perror(path); return 1; }
+    g_blocks = (unsigned long long)st.st_size / g_block;
+    if (g_blocks == 0) { fprintf(stderr, "%s: smaller than one block\n", path); return 1; }
+
+    printf("%llu MB file, %zu-byte random reads, queue depth %d%s\n",
+           (unsigned long long)st.st_size >> 20, g_block, g_depth,
+           g_direct ? ", O_DIRECT" : "");
+    printf("%-6s %6s %8s %10s %9s %9s %9s %9s\n", "io", "thr", "workers",
+           "reads/s", "MB/s", "p50(us)", "p99(us)", "p999(us)");
+    fflush(stdout);
+
+    char list[256];
+    snprintf(list, sizeof(list), "%s", backends);
+    for (char *save, *b = strtok_r(list, ",", &save); b; b = strtok_r(NULL, ",", &save)) {
+        pid_t pid = fork();
+        if (pid == 0) { bench(b); fflush(stdout); _exit(0); }
+        if (pid > 0) waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
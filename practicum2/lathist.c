@@ -0,0 +1,66 @@
+/* --------------------------------------------------------------------
+ *  lathist.c  –  log-linear latency histogram
+ * ------------------------------------------------------------------ */
+#include "lathist.h"
+
+static int bucket_of(uint64_t v)
+{
+    if (v < LH_SUB) return (int)v;
+    int exp = 63 - __builtin_clzll(v);              /* >= 4 */
+    int sub = (int)(v >> (exp - 4)) & (LH_SUB - 1);
+    return (exp - 3) * LH_SUB + sub;
+}
+
+/* midpoint of bucket i */
+static uint64_t bucket_value(int i)
+{
+    if (i < LH_SUB) return (uint64_t)i;
+    int exp = i / LH_SUB + 3;
+    uint64_t width = 1ULL << (exp - 4);
+    return (uint64_t)(LH_SUB + i % LH_SUB) * width + width / 2;
+}
+
+void lathist_add(lathist_t *h, uint64_t ns)
+{
+    __atomic_add_fetch(&h->b[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->sum, ns, __ATOMIC_RELAXED);
+    uint64_t m = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (ns > m && !__atomic_compare_exchange_n(&h->max, &m, ns, 1,
+                                                  __ATOMIC_RELAXED,
+                                                  __ATOMIC_RELAXED))
+        ;
+}
+
+void lathist_merge(lathist_t *dst, const lathist_t *src)
+{
+    for (int i = 0; i < LH_BUCKETS; ++i)
+        dst->b[i] += __atomic_load_n(&src->b[i], __ATOMIC_RELAXED);
+    dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    dst->sum   += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    uint64_t m  = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    if (m > dst->max) dst->max = m;
+}
+
+uint64_t lathist_pct(const lathist_t *h, double q)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < LH_BUCKETS; ++i) total += h->b[i];
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (double)total);
+    if (rank >= total) rank = total - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < LH_BUCKETS; ++i) {
+        seen += h->b[i];
+        if (seen > rank) {
+            uint64_t v = bucket_value(i);
+            return (h->max && v > h->max) ? h->max : v;
+        }
+    }
+    return h->max;
+}
+
+uint64_t lathist_mean(const lathist_t *h)
+{
+    return h->count ? h->sum / h->count : 0;
+}
@@ -0,0 +1,34 @@
+/* --------------------------------------------------------------------
+ *  lathist.h  –  log-linear latency histogram
+ *
+ *  Values (nanoseconds) fall into buckets that are 1/16 of a power of
+ *  two wide, so any reported percentile is within ~6% of the true
+ *  value.  lathist_add() uses relaxed atomics: one histogram may be
+ *  shared by many threads, or kept per thread and merged later.
+ * ------------------------------------------------------------------ */
+#ifndef LATHIST_H
+#define LATHIST_H
+
+#include <stdint.h>
+
+#define LH_SUB      16                  /* sub-buckets per power of two */
+#define LH_BUCKETS  (61 * LH_SUB)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t b[LH_BUCKETS];
+} lathist_t;
+
+void     lathist_add(lathist_t *h, uint64_t ns);
+
+/* dst += src (src may be updated concurrently) */
+void     lathist_merge(lathist_t *dst, const lathist_t *src);
+
+/* value at quantile q (0..1), e.g. 0.99 for p99; 0 when empty */
+uint64_t lathist_pct(const lathist_t *h, double q);
+
+uint64_t lathist_mean(const lathist_t *h);
+
+#endif // LATHIST_H
@@ -0,0 +1,472 @@
+/* --------------------------------------------------------------------
+ *  loadgen.c  –  concurrent load generator for rfserver
+ *
+ *  Opens <conns> persistent connections, each driven by its own thread,
+ *  and issues a random mix of WRITE / GET / RM for <secs> seconds
+ *  against <files> paths picked with Zipf(<skew>).  Payload sizes are
+ *  fixed or log-uniform over a range.  Prints throughput and
+ *  p50/p99/p999 latency per operation.  A comma list for -c runs one
+ *  round per level, which shows where the server saturates.
+ *
+ *  With -F <bytes> the pwrite / pget ops hit one shared file of that
+ *  size with ranged WRITE / GET (offset=), each connection in its own
+ *  stripe, e.g. -F 256m -m pwrite=100 -s 64k -c 1,2,4,8 measures how
+ *  writers to disjoint ranges of a single file scale.
+ *
+ *  With -O every request opens its own connection (counted in its
+ *  latency), which turns the run into a test of how fast the server
+ *  accepts, e.g. against rfserver -P <cores>.
+ *
+ *  Requests the server turns away ("BUSY retry_after_ms=N") count as
+ *  busy, not as errors or latency samples; the worker waits as told
+ *  and goes on, on a new connection if the server hung up.
+ *
+ *  usage: loadgen [-c conns[,conns...]] [-d secs] [-m get=70,write=20,rm=10]
+ *                 [-s size|min-max] [-n files] [-z skew] [-P prefix]
+ *                 [-F shared_bytes] [-H host] [-p port] [-N] [-O]
+ *  sizes take k/m/g suffixes, e.g. -s 4k or -s 1k-4m.
+ * ------------------------------------------------------------------ */
+#include "proto.h"
+#include "lathist.h"
+
+#include <math.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <time.h>
+
+enum { OP_GET, OP_WRITE, OP_RM, OP_PGET, OP_PWRITE, OP_COUNT };
+static const char *op_names[OP_COUNT] = { "GET", "WRITE", "RM", "PGET", "PWRITE" };
+
+static int         g_secs     = 10;
+static int         g_mix[OP_COUNT] = { 70, 20, 10, 0, 0 };
+static size_t      g_size_lo  = 4096, g_size_hi = 4096;
+static int         g_files    = 1000;
+static double      g_skew     = 0.99;
+static const char *g_prefix   = "lg_";
+static const char *g_host     = "127.0.0.1";
+static int         g_port     = PORT;
+static int         g_populate = 1;
+static int         g_per_op   = 0;      /* -O: a connection per request */
+static size_t      g_shared   = 0;      /* -F: size of the shared file */
+static double     *g_cdf;               /* Zipf CDF over path ranks */
+static char       *g_payload;           /* g_size_hi random bytes */
+static volatile int g_stop;
+
+typedef struct {
+    lathist_t          lat;
+    unsigned long long bytes;
+    unsigned long long miss;            /* GET/RM of an absent path */
+    unsigned long long busy;            /* turned away by admission control */
+    unsigned long long err;
+} op_stats_t;
+
+typedef struct {
+    uint64_t   seed;
+    int        index, nworkers;         /* picks the shared-file stripe */
+    op_stats_t op[OP_COUNT];
+    unsigned long long reconnects;
+} worker_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+    *s ^= *s << 13; *s ^= *s >> 7; *s ^= *s << 17;
+    return *s;
+}
+
+static double uniform(uint64_t *rng)
+{
+    return (xorshift(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int zipf_pick(uint64_t *rng)
+{
+    double u = uniform(rng);
+    int lo = 0, hi = g_files - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (g_cdf[mid] < u) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+/* log-uniform in [lo, hi]: as many 1-2 KiB files as 1-2 MiB ones */
+static size_t size_pick(uint64_t *rng)
+{
+    if (g_size_lo == g_size_hi) return g_size_lo;
+    double l = log((double)g_size_lo), h = log((double)g_size_hi);
+    return (size_t)exp(l + (h - l) * uniform(rng));
+}
+
+static int op_pick(uint64_t *rng)
+{
+    int total = 0;
+    for (int op = 0; op < OP_COUNT; ++op) total += g_mix[op];
+    int x = (int)(xorshift(rng) % (uint64_t)total);
+    for (int op = 0; op < OP_COUNT; ++op) {
+        if (x < g_mix[op]) return op;
+        x -= g_mix[op];
+    }
+    return OP_GET;
+}
+
+static int connect_to(void)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) return -1;
+    struct sockaddr_in a = {0};
+    a.sin_family = AF_INET;
+    a.sin_port   = htons(g_port);
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (inet_pton(AF_INET, g_host, &a.sin_addr) <= 0 ||
+        connect(s, (struct sockaddr *)&a, sizeof(a)) < 0) {
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+/* a size-aligned offset inside worker w's stripe of the shared file */
+static unsigned long long stripe_pick(const worker_t *w, size_t size,
+                                      uint64_t *rng)
+{
+    unsigned long long stripe = g_shared / (unsigned long long)w->nworkers;
+    unsigned long long slots  = stripe >= size ? stripe / size : 1;
+    return stripe * (unsigned long long)w->index +
+           xorshift(rng) % slots * size;
+}
+
+/* "BUSY retry_after_ms=N [close=1]": 2, or 3 if the server hangs up;
+ * 0 for any other reply */
+static int busy_reply(const char *line, unsigned *retry_ms)
+{
+    if (sscanf(line, "BUSY retry_after_ms=%u", retry_ms) != 1) return 0;
+    return strstr(line, " close=1") ? 3 : 2;
+}
+
+/* One request; 0 ok, 1 miss, 2/3 busy (see busy_reply(), *retry_ms
+ * set), -1 protocol/connection error.  *bytes gets the payload bytes
+ * moved.  off applies to PGET/PWRITE. */
+static int do_op(conn_t *c, int op, const char *path, size_t size,
+                 unsigned long long off, unsigned long long *bytes,
+                 unsigned *retry_ms)
+{
+    char line[MAX_LINE];
+    int  busy;
+    *bytes = 0;
+    switch (op) {
+    case OP_WRITE:
+    case OP_PWRITE: {
+        int rc = op == OP_PWRITE
+            ? send_line(c->fd, "WRITE - %s size=%zu offset=%llu", path, size, off)
+            : send_line(c->fd, "WRITE - %s size=%zu", path, size);
+        if (rc < 0 || conn_read_line(c, line, sizeof(line)) < 0)
+            return -1;
+        if ((busy = busy_reply(line, retry_ms))) return busy;
+        if (strcmp(line, "OK_READY_TO_RECEIVE") != 0) return -1;
+        if (send_all(c->fd, g_payload, size) < 0 ||
+            conn_read_line(c, line, sizeof(line)) < 0 ||
+            strncmp(line, "WRITE_OK", 8) != 0)
+            return -1;
+        *bytes = size;
+        return 0;
+    }
+
+    case OP_GET:
+    case OP_PGET: {
+        unsigned long long n;
+        int rc = op == OP_PGET
+            ? send_line(c->fd, "GET %s - offset=%llu length=%zu", path, off, size)
+            : send_line(c->fd, "GET %s -", path);
+        if (rc < 0 || conn_read_line(c, line, sizeof(line)) < 0)
+            return -1;
+        if ((busy = busy_reply(line, retry_ms))) return busy;
+        if (strcmp(line, "ERR_FILE_NOT_FOUND") == 0) return 1;
+        if (sscanf(line, "OK_SENDING_FILE %llu", &n) != 1) return -1;
+        char buf[XFER_BUF];
+        for (unsigned long long got = 0; got < n; ) {
+            size_t want = n - got < sizeof(buf) ? (size_t)(n - got) : sizeof(buf);
+            ssize_t r = conn_read(c, buf, want);
+            if (r <= 0) return -1;
+            got += (unsigned long long)r;
+        }
+        *bytes = n;
+        return 0;
+    }
+
+    default:
+        if (send_line(c->fd, "RM %s", path) < 0 ||
+            conn_read_line(c, line, sizeof(line)) < 0)
+            return -1;
+        if ((busy = busy_reply(line, retry_ms))) return busy;
+        if (strcmp(line, "RM_OK") == 0) return 0;
+        return strcmp(line, "ERR_REMOVE_FAILED") == 0 ? 1 : -1;
+    }
+}
+
+static void *worker(void *arg)
+{
+    worker_t *w = arg;
+    uint64_t  rng = w->seed;
+    conn_t    c;
+    char      path[256];
+
+    conn_init(&c, g_per_op ? -1 : connect_to());
+    while (!g_stop) {
+        if (c.fd < 0 && !g_per_op) {
+            ++w->reconnects;
+            usleep(10000);
+            conn_init(&c, connect_to());
+            continue;
+        }
+        int    op   = op_pick(&rng);
+        size_t size = size_pick(&rng);
+        unsigned long long off = 0;
+        if (op == OP_PGET || op == OP_PWRITE) {
+            snprintf(path, sizeof(path), "%sshared", g_prefix);
+            off = stripe_pick(w, size, &rng);
+        } else {
+            snprintf(path, sizeof(path), "%s%d", g_prefix, zipf_pick(&rng));
+        }
+
+        unsigned long long bytes;
+        unsigned retry = 0;
+        uint64_t t0 = now_ns();
+        if (g_per_op) conn_init(&c, connect_to());
+        int rc = c.fd < 0 ? -1 : do_op(&c, op, path, size, off, &bytes, &retry);
+        uint64_t dt = now_ns() - t0;
+        if (g_per_op && c.fd >= 0) {
+            close(c.fd);
+            c.fd = -1;
+        }
+
+        op_stats_t *s = &w->op[op];
+        if (rc >= 2) {                       /* come back when told to */
+            ++s->busy;
+            usleep(retry * 1000);
+            if (rc == 3 && c.fd >= 0) {
+                close(c.fd);
+                conn_init(&c, connect_to());
+            }
+            continue;
+        }
+        if (rc < 0) {                        /* resync on a fresh socket */
+            ++s->err;
+            if (c.fd >= 0) close(c.fd);
+            c.fd = -1;
+            continue;
+        }
+        lathist_add(&s->lat, dt);
+        s->bytes += bytes;
+        s->miss  += rc == 1;
+    }
+    if (c.fd >= 0) close(c.fd);
+    return NULL;
+}
+
+/* write every path once so GETs do not start out as misses */
+static int populate(void)
+{
+    conn_t c;
+    conn_init(&c, connect_to());
+    if (c.fd < 0) { perror("connect"); return -1; }
+    uint64_t rng = 42;
+    char path[256];
+    for (int k = 0; k < g_files; ++k) {
+        unsigned long long bytes;
+        unsigned retry;
+        snprintf(path, sizeof(path), "%s%d", g_prefix, k);
+        if (do_op(&c, OP_WRITE, path, size_pick(&rng), 0, &bytes, &retry) != 0) {
+            fprintf(stderr, "populate: WRITE %s failed\n", path);
+            close(c.fd);
+            return -1;
+        }
+    }
+
+    /* the shared file, written in payload-sized ranges */
+    snprintf(path, sizeof(path), "%sshared", g_prefix);
+    for (size_t off = 0; off < g_shared; off += g_size_hi) {
+        unsigned long long bytes;
+        unsigned retry;
+        size_t n = g_shared - off < g_size_hi ? g_shared - off : g_size_hi;
+        if (do_op(&c, OP_PWRITE, path, n, off, &bytes, &retry) != 0) {
+            fprintf(stderr, "populate: WRITE %s failed\n", path);
+            close(c.fd);
+            return -1;
+        }
+    }
+    close(c.fd);
+    return 0;
+}
+
+static void run_level(int conns)
+{
+    pthread_t tid[conns];
+    worker_t *w = calloc((size_t)conns, sizeof(*w));
+    if (!w) return;
+
+    g_stop = 0;
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < conns; ++i) {
+        w[i].seed     = 0x9e3779b97f4a7c15ULL * (uint64_t)(i + 1) ^ t0;
+        w[i].index    = i;
+        w[i].nworkers = conns;
+        pthread_create(&tid[i], NULL, worker, &w[i]);
+    }
+    sleep((unsigned)g_secs);
+    g_stop = 1;
+    for (int i = 0; i < conns; ++i)
+        pthread_join(tid[i], NULL);
+    double secs = (now_ns() - t0) / 1e9;
+
+    static op_stats_t tot[OP_COUNT];
+    memset(tot, 0, sizeof(tot));
+    unsigned long long ops = 0, bytes = 0, reconnects = 0;
+    for (int i = 0; i < conns; ++i) {
+        for (int op = 0; op < OP_COUNT; ++op) {
+            lathist_merge(&tot[op].lat, &w[i].op[op].lat);
+            tot[op].bytes += w[i].op[op].bytes;
+            tot[op].miss  += w[i].op[op].miss;
+            tot[op].busy  += w[i].op[op].busy;
+            tot[op].err   += w[i].op[op].err;
+        }
+        reconnects += w[i].reconnects;
+    }
+    for (int op = 0; op < OP_COUNT; ++op) {
+        ops   += tot[op].lat.count;
+        bytes += tot[op].bytes;
+    }
+
+    printf("\nconns=%d  %.1f s  %.0f ops/s  %.1f MB/s%s\n", conns, secs,
+           ops / secs, bytes / secs / 1e6, reconnects ? "  (reconnects!)" : "");
+    printf("  %-6s %10s %10s %9s %8s %8s %6s %9s %9s %9s %9s\n", "op", "count",
+           "ops/s", "MB/s", "miss", "busy", "err", "p50(us)", "p99(us)", "p999(us)",
+           "max(us)");
+    for (int op = 0; op < OP_COUNT; ++op) {
+        op_stats_t *s = &tot[op];
+        if (!s->lat.count && !s->err && !s->busy) continue;
+        printf("  %-6s %10llu %10.0f %9.1f %8llu %8llu %6llu %9.1f %9.1f %9.1f %9.1f\n",
+               op_names[op], (unsigned long long)s->lat.count,
+               s->lat.count / secs, s->bytes / secs / 1e6, s->miss, s->busy, s->err,
+               lathist_pct(&s->lat, 0.50) / 1e3, lathist_pct(&s->lat, 0.99) / 1e3,
+               lathist_pct(&s->lat, 0.999) / 1e3, s->lat.max / 1e3);
+    }
+    free(w);
+}
+
+/* "4096", "4k", "1m" -> bytes */
+static size_t parse_size(const char *s, char **end)
+{
+    double v = strtod(s, end);
+    switch (**end) {
+    case 'k': case 'K': v *= 1024;               ++*end; break;
+    case 'm': case 'M': v *= 1024 * 1024;        ++*end; break;
+    case 'g': case 'G': v *= 1024 * 1024 * 1024; ++*end; break;
+    }
+    return (size_t)v;
+}
+
+static int parse_mix(char *s)
+{
+    int mix[OP_COUNT] = {0};
+    for (char *tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+        char *eq = strchr(tok, '=');
+        if (!eq) return -1;
+        *eq = '\0';
+        int op;
+        for (op = 0; op < OP_COUNT; ++op)
+            if (strcasecmp(tok, op_names[op]) == 0) break;
+        if (op == OP_COUNT) return -1;
+        mix[op] = atoi(eq + 1);
+    }
+    int total = 0;
+    for (int op = 0; op < OP_COUNT; ++op) total += mix[op];
+    if (total <= 0) return -1;
+    memcpy(g_mix, mix, sizeof(mix));
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char *levels = "8";
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:m:s:n:z:P:F:H:p:NO")) != -1) {
+        char *end;
+        switch (opt) {
+        case 'c': levels   = optarg;       break;
+        case 'd': g_secs   = atoi(optarg); break;
+        case 'n': g_files  = atoi(optarg); break;
+        case 'z': g_skew   = atof(optarg); break;
+        case 'P': g_prefix = optarg;       break;
+        case 'H': g_host   = optarg;       break;
+        case 'p': g_port   = atoi(optarg); break;
+        case 'N': g_populate = 0;          break;
+        case 'O': g_per_op   = 1;          break;
+        case 'm':
+            if (parse_mix(optarg) < 0) {
+                fprintf(stderr, "bad mix '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'F':
+            g_shared = parse_size(optarg, &end);
+            break;
+        case 's':
+            g_size_lo = g_size_hi = parse_size(optarg, &end);
+            if (*end == '-') g_size_hi = parse_size(end + 1, &end);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-c conns[,conns...]] [-d secs] "
+                            "[-m get=70,write=20,rm=10] [-s size|min-max] "
+                            "[-n files] [-z skew] [-P prefix] "
+                            "[-F shared_bytes] [-H host] "
+                            "[-p port] [-N] [-O]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (g_files < 1 || g_secs < 1 || g_size_hi < g_size_lo || g_size_lo < 1 ||
+        g_size_hi > (1u << 30) ||
+        ((g_mix[OP_PGET] || g_mix[OP_PWRITE]) && g_shared < g_size_hi)) {
+        fprintf(stderr, "bad arguments\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Zipf(s) CDF: P(rank k) ~ 1 / k^s */
+    g_cdf = malloc(sizeof(double) * g_files);
+    double sum = 0, acc = 0;
+    for (int k = 0; k < g_files; ++k)
+        sum += 1.0 / pow(k + 1, g_skew);
+    for (int k = 0; k < g_files; ++k) {
+        acc += 1.0 / pow(k + 1, g_skew) / sum;
+        g_cdf[k] = acc;
+    }
+
+    g_payload = malloc(g_size_hi);
+    if (!g_cdf || !g_payload) { perror("malloc"); return 1; }
+    uint64_t rng = 0x2545f4914f6cdd1dULL;
+    for (size_t i = 0; i < g_size_hi; ++i)
+        g_payload[i] = (char)xorshift(&rng);
+
+    printf("loadgen: %s:%d mix get=%d,write=%d,rm=%d,pget=%d,pwrite=%d "
+           "size=%zu-%zu files=%d skew=%.2f shared=%zu %ds/level\n",
+           g_host, g_port, g_mix[OP_GET], g_mix[OP_WRITE], g_mix[OP_RM],
+           g_mix[OP_PGET], g_mix[OP_PWRITE], g_size_lo, g_size_hi, g_files,
+           g_skew, g_shared, g_secs);
+
+    if (g_populate && populate() < 0) return 1;
+    for (char *tok = strtok(levels, ","); tok; tok = strtok(NULL, ",")) {
+        int conns = atoi(tok);
+        if (conns > 0) run_level(conns);
+    }
+    free(g_payload);
+    free(g_cdf);
+    return 0;
+}
@@ -0,0 +1,76 @@
+/* --------------------------------------------------------------------
+ *  logger.c  –  double-buffered background log writer
+ * ------------------------------------------------------------------ */
+#include "logger.h"
+#include "common.h"
+
+#include <stdarg.h>
+#include <time.h>
+
+#define LOG_BUF (256 * 1024)
+
+int g_log_enabled = 0;
+
+static char            g_buf[2][LOG_BUF];
+static size_t          g_used;              /* bytes in g_buf[g_cur] */
+static int             g_cur;
+static unsigned long   g_dropped;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_wake = PTHREAD_COND_INITIALIZER;
+
+void logger_printf(const char *fmt, ...)
+{
+    char    line[BUF_SIZE];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if (n >= (int)sizeof(line)) n = sizeof(line) - 1;
+
+    pthread_mutex_lock(&g_lock);
+    if (g_used + (size_t)n > LOG_BUF) {
+        ++g_dropped;
+    } else {
+        memcpy(g_buf[g_cur] + g_used, line, (size_t)n);
+        g_used += (size_t)n;
+        if (g_used > LOG_BUF / 2) pthread_cond_signal(&g_wake);
+    }
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void *writer_thread(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&g_lock);
+        if (g_used == 0) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += 100 * 1000000L;   /* flush at least every 100 ms */
+            if (ts.tv_nsec >= 1000000000L) { ++ts.tv_sec; ts.tv_nsec -= 1000000000L; }
+            pthread_cond_timedwait(&g_wake, &g_lock, &ts);
+        }
+        /* swap buffers, then write the full one without the lock */
+        int           full    = g_cur;
+        size_t        len     = g_used;
+        unsigned long dropped = g_dropped;
+        g_cur     = !g_cur;
+        g_used    = 0;
+        g_dropped = 0;
+        pthread_mutex_unlock(&g_lock);
+
+        if (len) fwrite(g_buf[full], 1, len, stdout);
+        if (dropped) printf("[Server] (log: %lu lines dropped)\n", dropped);
+        if (len || dropped) fflush(stdout);
+    }
+    return NULL;
+}
+
+void logger_init(void)
+{
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, writer_thread, NULL) != 0) return;
+    pthread_detach(tid);
+    g_log_enabled = 1;
+}
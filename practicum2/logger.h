@@ -0,0 +1,23 @@
+/* --------------------------------------------------------------------
+ *  logger.h  –  optional asynchronous request log (rfserver -v)
+ *
+ *  LOG() formats into a shared in-memory buffer and returns; a
+ *  background thread writes the buffer to stdout in large blocks.  A
+ *  client thread never waits on the terminal.  When the buffer is full,
+ *  lines are dropped and counted instead.  Without -v, LOG() costs one
+ *  branch.
+ * ------------------------------------------------------------------ */
+#ifndef LOGGER_H
+#define LOGGER_H
+
+extern int g_log_enabled;
+
+#define LOG(...) do { if (g_log_enabled) logger_printf(__VA_ARGS__); } while (0)
+
+/* Start the writer thread and enable LOG(). */
+void logger_init(void);
+
+void logger_printf(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+
+#endif // LOGGER_H
@@ -0,0 +1,136 @@
+/* --------------------------------------------------------------------
+ *  lz.c  –  LZ77 block compressor / checked decompressor
+ * ------------------------------------------------------------------ */
+#include "lz.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define HASH_BITS 14
+#define MIN_MATCH 4
+#define MAX_OFF   65535
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t hash4(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* 15 + 255 + 255 + ... + rest, after a nibble of 15 */
+static uint8_t *put_len(uint8_t *op, size_t len)
+{
+    for (len -= 15; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/* One sequence: lit literals from anchor, then (if mlen) a match */
+static uint8_t *put_seq(uint8_t *op, uint8_t *oend, const uint8_t *anchor,
+                        size_t lit, size_t off, size_t mlen)
+{
+    /* worst case: token, length bytes, literals, offset, length bytes */
+    size_t need = 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1;
+    if (need > (size_t)(oend - op)) return NULL;
+
+    uint8_t *tok = op++;
+    *tok = (uint8_t)((lit < 15 ? lit : 15) << 4);
+    if (lit >= 15) op = put_len(op, lit);
+    memcpy(op, anchor, lit);
+    op += lit;
+    if (mlen) {
+        *op++ = (uint8_t)off;
+        *op++ = (uint8_t)(off >> 8);
+        size_t m = mlen - MIN_MATCH;
+        *tok |= (uint8_t)(m < 15 ? m : 15);
+        if (m >= 15) op = put_len(op, m);
+    }
+    return op;
+}
+
+size_t lz_compress(const void *src_, size_t n, void *dst_, size_t cap)
+{
+    const uint8_t *src = src_, *end = src + n;
+    const uint8_t *ip = src, *anchor = src;
+    uint8_t *op = dst_, *oend = op + cap;
+    uint32_t table[1u << HASH_BITS];
+
+    if (n > LZ_MAX_BLOCK) return 0;
+    memset(table, 0, sizeof(table));
+
+    /* skip ahead faster the longer nothing has matched */
+    unsigned misses = 0;
+    while (n >= MIN_MATCH && ip <= end - MIN_MATCH) {
+        uint32_t v = read32(ip);
+        uint32_t h = hash4(v);
+        const uint8_t *ref = src + table[h];
+        table[h] = (uint32_t)(ip - src);
+        if (ref >= ip || ip - ref > MAX_OFF || read32(ref) != v) {
+            ip += 1 + (misses++ >> 5);
+            continue;
+        }
+        misses = 0;
+        const uint8_t *m = ip + MIN_MATCH, *r = ref + MIN_MATCH;
+        while (m < end && *m == *r) { ++m; ++r; }
+
+        op = put_seq(op, oend, anchor, (size_t)(ip - anchor),
+                     (size_t)(ip - ref), (size_t)(m - ip));
+        if (!op) return 0;
+        if (m - 2 <= end - MIN_MATCH)       /* seed the next search */
+            table[hash4(read32(m - 2))] = (uint32_t)(m - 2 - src);
+        ip = anchor = m;
+    }
+    op = put_seq(op, oend, anchor, (size_t)(end - anchor), 0, 0);
+    return op ? (size_t)(op - (uint8_t *)dst_) : 0;
+}
+
+/* read a 15+ length continuation; -1 if it runs off the input */
+static int get_len(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+    uint8_t b;
+    do {
+        if (*ip >= iend) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+int lz_decompress(const void *src, size_t n, void *dst, size_t raw)
+{
+    const uint8_t *ip = src, *iend = ip + n;
+    uint8_t *op = dst, *ostart = op, *oend = op + raw;
+
+    while (ip < iend) {
+        uint8_t tok = *ip++;
+        size_t lit = tok >> 4;
+        if (lit == 15 && get_len(&ip, iend, &lit) < 0) return -1;
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) return -1;
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+        if (ip == iend) break;              /* final, literal-only sequence */
+
+        if (iend - ip < 2) return -1;
+        size_t off = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t mlen = tok & 15;
+        if (mlen == 15 && get_len(&ip, iend, &mlen) < 0) return -1;
+        mlen += MIN_MATCH;
+        if (off == 0 || off > (size_t)(op - ostart) || mlen > (size_t)(oend - op))
+            return -1;
+        const uint8_t *ref = op - off;
+        if (off >= mlen) {
+            memcpy(op, ref, mlen);
+            op += mlen;
+        } else {
+            while (mlen--) *op++ = *ref++;  /* overlapping: a repeat */
+        }
+    }
+    return op == oend ? 0 : -1;
+}
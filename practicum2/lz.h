@@ -0,0 +1,27 @@
+/* --------------------------------------------------------------------
+ *  lz.h  –  small LZ77 block codec (LZ4-style sequences) for
+ *           compressing transfer payloads on the wire
+ *
+ *  A block is a run of sequences: a token byte (literal count in the
+ *  high nibble, match length - 4 in the low one, 15 = more length
+ *  bytes follow), the literals, then a 2-byte little-endian offset
+ *  back into the output.  The last sequence has literals only.
+ *  Greedy matching over a single hash table: fast rather than tight.
+ * ------------------------------------------------------------------ */
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+
+#define LZ_MAX_BLOCK (64 * 1024)
+
+/* Compress src[0..n) (n <= LZ_MAX_BLOCK) into dst.  Returns the
+ * compressed size, or 0 when it would not fit in cap bytes – pass a
+ * cap below n to give up early on data that does not compress. */
+size_t lz_compress(const void *src, size_t n, void *dst, size_t cap);
+
+/* Expand n bytes of src into exactly raw bytes at dst.  0 on success,
+ * -1 if the input is corrupt (never writes outside dst). */
+int lz_decompress(const void *src, size_t n, void *dst, size_t raw);
+
+#endif // LZ_H
@@ -0,0 +1,252 @@
+/* --------------------------------------------------------------------
+ *  msgbench.c  –  remote latency of the shared message cache
+ *
+ *  Stores messages 1..<msgs> with PUTMSG, then runs three phases of
+ *  <secs> seconds, each with <conns> connections issuing requests
+ *  back to back:
+ *    hot   GETMSG of a random id in 1..<hot>, which stays cached
+ *    cold  GETMSG of a random id in 1..<msgs>; keep <msgs> well above
+ *          the server's cache (STATS "msgcache") so most are misses
+ *    mget  MGETMSG of <batch> random ids in 1..<hot>
+ *  Latency is per request (per batch for mget); "hit %" is from the
+ *  server's own hit and miss counters over the phase.  -N skips the
+ *  stores when the messages are already there.
+ *
+ *  usage: msgbench [-c conns] [-n msgs] [-k hot] [-b batch]
+ *                  [-d secs] [-p port] [-N]
+ * ------------------------------------------------------------------ */
+#include "proto.h"
+#include "lathist.h"
+
+#include <netinet/tcp.h>
+#include <time.h>
+
+enum { PH_HOT, PH_COLD, PH_MGET, PH_COUNT };
+static const char *ph_names[PH_COUNT] = { "hot", "cold", "mget" };
+
+static int g_conns = 8;
+static int g_msgs  = 20000;
+static int g_hot   = 1000;
+static int g_batch = 16;
+static int g_secs  = 5;
+static int g_port  = PORT;
+static int g_store = 1;
+static int g_phase;
+static volatile int g_stop;
+
+typedef struct {
+    int                id;
+    pthread_t          tid;
+    lathist_t          lat;
+    unsigned long long msgs, err;
+} worker_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int connect_to(conn_t *c)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) return -1;
+    struct sockaddr_in a = {0};
+    a.sin_family = AF_INET;
+    a.sin_port   = htons(g_port);
+    inet_pton(AF_INET, "127.0.0.1", &a.sin_addr);
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(s, (struct sockaddr *)&a, sizeof(a)) < 0) { close(s); return -1; }
+    conn_init(c, s);
+    return 0;
+}
+
+static int store_one(conn_t *c, int id)
+{
+    char text[128], line[MAX_LINE];
+    int n = snprintf(text, sizeof(text), "Hello, this is message %d from msgbench!", id);
+    if (send_line(c->fd, "PUTMSG %d from=sender%d to=receiver%d size=%d",
+                  id, id % 100, id % 37, n) < 0 ||
+        send_all(c->fd, text, (size_t)n) < 0 ||
+        conn_read_line(c, line, sizeof(line)) < 0)
+        return -1;
+    return strncmp(line, "PUTMSG_OK", 9) == 0 ? 0 : -1;
+}
+
+/* read one "MSG ..." reply and its text; 1 found, 0 missing, -1 error */
+static int read_msg(conn_t *c, int id)
+{
+    char line[MAX_LINE], text[1024];
+    int got;
+    size_t size;
+    if (conn_read_line(c, line, sizeof(line)) < 0) return -1;
+    if (strncmp(line, "MISS ", 5) == 0 || strcmp(line, "ERR_MSG_NOT_FOUND") == 0) return 0;
+    const char *sz = strstr(line, " size=");
+    if (sscanf(line, "MSG %d", &got) != 1 || got != id || !sz ||
+        sscanf(sz, " size=%zu", &size) != 1 || size > sizeof(text) ||
+        conn_read_full(c, text, size) < 0)
+        return -1;
+    return 1;
+}
+
+static int get_one(conn_t *c, int id)
+{
+    if (send_line(c->fd, "GETMSG %d", id) < 0) return -1;
+    return read_msg(c, id);
+}
+
+static int get_batch(conn_t *c, unsigned *seed)
+{
+    int ids[g_batch];
+    char req[MAX_LINE * 2];
+    int used = snprintf(req, sizeof(req), "MGETMSG count=%d\n", g_batch);
+    for (int i = 0; i < g_batch; ++i) {
+        ids[i] = 1 + (int)(rand_r(seed) % (unsigned)g_hot);
+        used += snprintf(req + used, sizeof(req) - (size_t)used, "%d\n", ids[i]);
+    }
+    if (send_all(c->fd, req, (size_t)used) < 0) return -1;
+    for (int i = 0; i < g_batch; ++i)
+        if (read_msg(c, ids[i]) < 0) return -1;
+    char line[MAX_LINE];
+    if (conn_read_line(c, line, sizeof(line)) < 0 || strncmp(line, "MGETMSG_OK", 10) != 0)
+        return -1;
+    return 1;
+}
+
+static void *store_worker(void *arg)
+{
+    worker_t *w = arg;
+    conn_t c;
+    if (connect_to(&c) < 0) { w->err = 1; return NULL; }
+    for (int id = 1 + w->id; id <= g_msgs; id += g_conns)
+        if (store_one(&c, id) < 0) { ++w->err; break; }
+    close(c.fd);
+    return NULL;
+}
+
+static void *run_worker(void *arg)
+{
+    worker_t *w = arg;
+    unsigned seed = (unsigned)(w->id * 7919 + g_phase + 1);
+    conn_t c;
+    if (connect_to(&c) < 0) { w->err = 1; return NULL; }
+    while (!g_stop) {
+        int range = g_phase == PH_COLD ? g_msgs : g_hot;
+        uint64_t t0 = now_ns();
+        int rc = g_phase == PH_MGET ? get_batch(&c, &seed)
+                                    : get_one(&c, 1 + (int)(rand_r(&seed) % (unsigned)range));
+        if (rc < 0) { ++w->err; break; }
+        lathist_add(&w->lat, now_ns() - t0);
+        w->msgs += g_phase == PH_MGET ? (unsigned)g_batch : 1;
+    }
+    close(c.fd);
+    return NULL;
+}
+
+/* the server's message cache hits and misses so far */
+static int server_counts(unsigned long long *hits, unsigned long long *misses)
+{
+    conn_t c;
+    char line[MAX_LINE];
+    unsigned long long n;
+    int rc = -1;
+    if (connect_to(&c) < 0) return -1;
+    if (send_line(c.fd, "STATS") == 0 && conn_read_line(&c, line, sizeof(line)) >= 0 &&
+        sscanf(line, "OK_STATS %llu", &n) == 1) {
+        char *text = malloc(n + 1);
+        if (text && conn_read_full(&c, text, n) == 0) {
+            text[n] = '\0';
+            char *m = strstr(text, "\nmsgcache ");
+            if (m && (m = strstr(m, " hits=")) &&
+                sscanf(m, " hits=%llu misses=%llu", hits, misses) == 2)
+                rc = 0;
+        }
+        free(text);
+    }
+    close(c.fd);
+    return rc;
+}
+
+int main(int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "c:n:k:b:d:p:N")) != -1) {
+        switch (ch) {
+        case 'c': g_conns = atoi(optarg); break;
+        case 'n': g_msgs  = atoi(optarg); break;
+        case 'k': g_hot   = atoi(optarg); break;
+        case 'b': g_batch = atoi(optarg); break;
+        case 'd': g_secs  = atoi(optarg); break;
+        case 'p': g_port  = atoi(optarg); break;
+        case 'N': g_store = 0; break;
+        default:  optind = argc + 1;
+        }
+    }
+    if (optind != argc || g_conns < 1 || g_msgs < 1 || g_hot < 1 || g_hot > g_msgs ||
+        g_batch < 1 || g_batch > 256 || g_secs < 1) {
+        fprintf(stderr, "usage: %s [-c conns] [-n msgs] [-k hot] [-b batch] "
+                        "[-d secs] [-p port] [-N]\n", argv[0]);
+        return 1;
+    }
+    unsigned long long h0, m0;
+    if (server_counts(&h0, &m0) < 0) {
+        fprintf(stderr, "msgbench: cannot reach rfserver on port %d\n", g_port);
+        return 1;
+    }
+
+    worker_t *w = calloc((size_t)g_conns, sizeof(*w));
+    if (!w) { perror("calloc"); return 1; }
+    if (g_store) {
+        uint64_t t0 = now_ns();
+        for (int i = 0; i < g_conns; ++i) {
+            w[i].id = i;
+            pthread_create(&w[i].tid, NULL, store_worker, &w[i]);
+        }
+        unsigned long long err = 0;
+        for (int i = 0; i < g_conns; ++i) {
+            pthread_join(w[i].tid, NULL);
+            err += w[i].err;
+        }
+        if (err) { fprintf(stderr, "msgbench: PUTMSG failed\n"); return 1; }
+        printf("stored %d messages in %.2f s\n", g_msgs, (now_ns() - t0) / 1e9);
+    }
+
+    printf("%d connections, hot ids 1..%d, cold ids 1..%d, batches of %d\n",
+           g_conns, g_hot, g_msgs, g_batch);
+    printf("%-5s %9s %10s %8s %8s %8s %8s %6s\n", "phase", "requests", "msgs/s",
+           "mean us", "p50 us", "p99 us", "p999 us", "hit %");
+    for (g_phase = 0; g_phase < PH_COUNT; ++g_phase) {
+        server_counts(&h0, &m0);
+        memset(w, 0, (size_t)g_conns * sizeof(*w));
+        g_stop = 0;
+        uint64_t t0 = now_ns();
+        for (int i = 0; i < g_conns; ++i) {
+            w[i].id = i;
+            pthread_create(&w[i].tid, NULL, run_worker, &w[i]);
+        }
+        sleep((unsigned)g_secs);
+        g_stop = 1;
+        static lathist_t all;
+        memset(&all, 0, sizeof(all));
+        unsigned long long msgs = 0, err = 0;
+        for (int i = 0; i < g_conns; ++i) {
+            pthread_join(w[i].tid, NULL);
+            lathist_merge(&all, &w[i].lat);
+            msgs += w[i].msgs;
+            err  += w[i].err;
+        }
+        double secs = (now_ns() - t0) / 1e9;
+        if (err) { fprintf(stderr, "msgbench: %s phase failed\n", ph_names[g_phase]); return 1; }
+        unsigned long long h1 = h0, m1 = m0;
+        server_counts(&h1, &m1);
+        double hit = h1 + m1 > h0 + m0 ? 100.0 * (h1 - h0) / (h1 - h0 + m1 - m0) : 0;
+        printf("%-5s %9llu %10.0f %8.1f %8.1f %8.1f %8.1f %6.1f\n", ph_names[g_phase],
+               (unsigned long long)all.count, msgs / secs, lathist_mean(&all) / 1e3,
+               lathist_pct(&all, 0.50) / 1e3, lathist_pct(&all, 0.99) / 1e3,
+               lathist_pct(&all, 0.999) / 1e3, hit);
+    }
+    free(w);
+    return 0;
+}
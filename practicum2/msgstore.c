@@ -0,0 +1,64 @@
+/* --------------------------------------------------------------------
+ *  msgstore.c  –  practicum1's cache.c, shared by the client threads
+ * ------------------------------------------------------------------ */
+#include "msgstore.h"
+#include "cache.h"
+#include "common.h"
+
+#define MSG_DIR "messages"              /* where store_msg() writes */
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long g_puts;
+static unsigned long long g_reads;      /* uncached: every get */
+static int g_cached;
+
+int msgstore_init(int cached)
+{
+    if (mkdir(MSG_DIR, 0777) < 0 && errno != EEXIST) {
+        perror(MSG_DIR);
+        return -1;
+    }
+    g_cached = cached;
+    if (cached) init_cache();
+    return 0;
+}
+
+int msgstore_put(const Message *msg)
+{
+    pthread_mutex_lock(&g_lock);
+    int rc = g_cached ? put_msg(msg) : store_msg(msg);
+    ++g_puts;
+    pthread_mutex_unlock(&g_lock);
+    return rc ? -1 : 0;
+}
+
+int msgstore_get(int id, Message *out)
+{
+    if (!g_cached) {
+        /* store_msg() renames whole files into place: no lock needed */
+        Message *m = retrieve_msg(id);
+        __atomic_add_fetch(&g_reads, 1, __ATOMIC_RELAXED);
+        if (m) memcpy(out, m, sizeof(*out));
+        free(m);
+        return m ? 0 : -1;
+    }
+    /* the cache keeps its copy; ours must be taken before the next
+     * call can evict it */
+    pthread_mutex_lock(&g_lock);
+    Message *m = get_msg_from_cache_or_disk(id);
+    if (m) memcpy(out, m, sizeof(*out));
+    pthread_mutex_unlock(&g_lock);
+    return m ? 0 : -1;
+}
+
+void msgstore_get_stats(msgstore_stats_t *st)
+{
+    CacheStats cs = { 0, __atomic_load_n(&g_reads, __ATOMIC_RELAXED) };
+    pthread_mutex_lock(&g_lock);
+    st->cached   = g_cached ? get_cache_stats(&cs) : 0;
+    st->puts     = g_puts;
+    pthread_mutex_unlock(&g_lock);
+    st->capacity = g_cached ? CACHE_CAPACITY : 0;
+    st->hits     = cs.hits;
+    st->misses   = cs.misses;
+}
@@ -0,0 +1,36 @@
+/* --------------------------------------------------------------------
+ *  msgstore.h  –  the practicum1 message store behind PUTMSG/GETMSG
+ *
+ *  One LRU cache of 1 KiB messages (practicum1 cache.c) for every
+ *  client thread, so a message one client reads or writes is warm for
+ *  all the others.  Messages live in messages/<id>.msg beside
+ *  server_data/; put_msg() writes through, and a miss is read from
+ *  there.  The practicum1 code is single-threaded, so one mutex guards
+ *  every call into it; a hit is a hash probe and a 1 KiB copy under
+ *  that lock.  Shards (-P) each have their own memory but share
+ *  messages/, so there the cache is left out and every get reads the
+ *  file.
+ * ------------------------------------------------------------------ */
+#ifndef MSGSTORE_H
+#define MSGSTORE_H
+
+#include "message.h"
+
+typedef struct {
+    int                cached, capacity;
+    unsigned long long hits, misses, puts;
+} msgstore_stats_t;
+
+/* Create messages/ and, if cached, an empty cache; -1 on failure.
+ * Uncached, every put and get goes straight to messages/. */
+int  msgstore_init(int cached);
+
+/* Store a message (cache and disk); -1 if it could not be written. */
+int  msgstore_put(const Message *msg);
+
+/* Copy message id into *out; -1 if there is no such message. */
+int  msgstore_get(int id, Message *out);
+
+void msgstore_get_stats(msgstore_stats_t *st);
+
+#endif // MSGSTORE_H
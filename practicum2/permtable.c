@@ -0,0 +1,474 @@
+/* --------------------------------------------------------------------
+ *  permtable.c  –  sharded open-addressing permission table
+ *                  backed by an append-only metadata log
+ * ------------------------------------------------------------------ */
+#include "permtable.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+/* ----------  table layout  ---------------------------------------- */
+#define PT_SHARD_BITS 6
+#define PT_SHARDS     (1 << PT_SHARD_BITS)     /* 64 independent locks */
+#define PT_MIN_SLOTS  64                       /* per shard, power of 2 */
+
+typedef struct {
+    uint64_t     hash;          /* 0 marks an empty slot */
+    char        *path;
+    permission_t perm;
+} pt_slot_t;
+
+typedef struct {
+    pthread_rwlock_t lock;
+    pt_slot_t       *slots;
+    size_t           mask;      /* nslots - 1 */
+    size_t           used;
+} pt_shard_t;
+
+static pt_shard_t g_shards[PT_SHARDS];
+static size_t     g_live;       /* guarded by g_log_lock */
+
+/* ----------  on-disk log  ------------------------------------------
+ *  Each record is a 4-byte header followed by the path bytes:
+ *      u8 op | u8 perm | u16 len (little endian) | path[len]
+ * ------------------------------------------------------------------ */
+enum { PT_OP_SET = 1, PT_OP_DEL = 2 };
+#define PT_HDR_LEN   4
+#define PT_MAX_PATH  4096
+
+static int             g_log_fd = -1;
+static char            g_log_path[BUF_SIZE];
+static size_t          g_log_records;   /* records in the current log */
+static pthread_mutex_t g_log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* ----------  sharing the log between processes (rfserver -P)  ------
+ *  Each shard process keeps its own table and tails the one log.  How
+ *  much of the log is valid lives in memory shared by all of them; a
+ *  process that has applied less than that reads the rest before it
+ *  looks anything up.  Changes are made under flock() on the log, so
+ *  first-writer-wins holds across processes too, and a record torn by
+ *  a process that died mid-append is cut off by the next writer.  The
+ *  log is only compacted at start-up, while nothing tails it.
+ * ------------------------------------------------------------------ */
+typedef struct { uint64_t bytes; } pt_tail_t;
+
+static pt_tail_t      *g_tail;          /* NULL unless shared */
+static uint64_t        g_applied;       /* log bytes in our table (atomic) */
+static pthread_mutex_t g_sync_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* ----------  hashing  ---------------------------------------------- */
+static uint64_t pt_hash(const char *s, size_t len)
+{
+    uint64_t h = 1469598103934665603ULL;        /* FNV-1a */
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+static pt_shard_t *pt_shard(uint64_t h)
+{
+    return &g_shards[h >> (64 - PT_SHARD_BITS)];
+}
+
+/* ----------  shard primitives (caller holds the shard lock)  ------- */
+static pt_slot_t *shard_find(pt_shard_t *sh, uint64_t h, const char *path)
+{
+    for (size_t i = h & sh->mask; sh->slots[i].hash; i = (i + 1) & sh->mask)
+        if (sh->slots[i].hash == h && strcmp(sh->slots[i].path, path) == 0)
+            return &sh->slots[i];
+    return NULL;
+}
+
+static void shard_place(pt_shard_t *sh, pt_slot_t s)
+{
+    size_t i = s.hash & sh->mask;
+    while (sh->slots[i].hash)
+        i = (i + 1) & sh->mask;
+    sh->slots[i] = s;
+    ++sh->used;
+}
+
+static int shard_grow(pt_shard_t *sh)
+{
+    size_t     old_n = sh->mask + 1;
+    pt_slot_t *old   = sh->slots;
+    pt_slot_t *fresh = calloc(old_n * 2, sizeof(pt_slot_t));
+    if (!fresh) return -1;
+
+    sh->slots = fresh;
+    sh->mask  = old_n * 2 - 1;
+    sh->used  = 0;
+    for (size_t i = 0; i < old_n; ++i)
+        if (old[i].hash) shard_place(sh, old[i]);
+    free(old);
+    return 0;
+}
+
+/* insert or overwrite; returns 1 if a new entry was created */
+static int shard_put(pt_shard_t *sh, uint64_t h, const char *path,
+                     permission_t p)
+{
+    pt_slot_t *s = shard_find(sh, h, path);
+    if (s) { s->perm = p; return 0; }
+
+    if ((sh->used + 1) * 4 > (sh->mask + 1) * 3 && shard_grow(sh) < 0)
+        return -1;
+    char *copy = strdup(path);
+    if (!copy) return -1;
+    shard_place(sh, (pt_slot_t){ h, copy, p });
+    return 1;
+}
+
+/* backward-shift deletion keeps linear probing tombstone-free */
+static int shard_del(pt_shard_t *sh, uint64_t h, const char *path)
+{
+    pt_slot_t *s = shard_find(sh, h, path);
+    if (!s) return 0;
+
+    size_t i = (size_t)(s - sh->slots);
+    free(s->path);
+    for (size_t j = (i + 1) & sh->mask; sh->slots[j].hash;
+         j = (j + 1) & sh->mask) {
+        size_t home = sh->slots[j].hash & sh->mask;
+        /* move j back into the hole unless its home lies in (i, j] */
+        if (((j - home) & sh->mask) >= ((j - i) & sh->mask)) {
+            sh->slots[i] = sh->slots[j];
+            i = j;
+        }
+    }
+    sh->slots[i].hash = 0;
+    sh->slots[i].path = NULL;
+    --sh->used;
+    return 1;
+}
+
+/* ----------  log helpers  ------------------------------------------ */
+static int log_encode(char *out, int op, permission_t p,
+                      const char *path, size_t len)
+{
+    out[0] = (char)op;
+    out[1] = (char)p;
+    out[2] = (char)(len & 0xff);
+    out[3] = (char)(len >> 8);
+    memcpy(out + PT_HDR_LEN, path, len);
+    return (int)(PT_HDR_LEN + len);
+}
+
+/* caller holds g_log_lock */
+static void log_append(int op, permission_t p, const char *path)
+{
+    char   rec[PT_HDR_LEN + PT_MAX_PATH];
+    size_t len = strlen(path);
+    if (len > PT_MAX_PATH || g_log_fd < 0) return;
+
+    int n = log_encode(rec, op, p, path, len);
+    if (write(g_log_fd, rec, n) != n) {
+        perror("permtable: log append");
+    } else if (g_tail) {                    /* we hold the flock */
+        __atomic_store_n(&g_applied, g_applied + n, __ATOMIC_RELAXED);
+        __atomic_store_n(&g_tail->bytes, g_tail->bytes + n, __ATOMIC_RELEASE);
+    }
+    ++g_log_records;
+}
+
+/* Apply the complete records at the front of buf[0..have); returns the
+ * bytes they take up, or sets *corrupt at a record that cannot be. */
+static size_t log_apply(const char *buf, size_t have, int *corrupt)
+{
+    size_t pos = 0;
+    while (have - pos >= PT_HDR_LEN) {
+        const unsigned char *r = (const unsigned char *)buf + pos;
+        size_t len = r[2] | ((size_t)r[3] << 8);
+        if (len > PT_MAX_PATH) { *corrupt = 1; break; }
+        if (have - pos < PT_HDR_LEN + len) break;
+
+        char path[PT_MAX_PATH + 1];
+        memcpy(path, r + PT_HDR_LEN, len);
+        path[len] = '\0';
+        uint64_t    h  = pt_hash(path, len);
+        pt_shard_t *sh = pt_shard(h);
+        int         d  = 0;
+        pthread_rwlock_wrlock(&sh->lock);
+        if (r[0] == PT_OP_SET)
+            d = shard_put(sh, h, path, (permission_t)r[1]) == 1;
+        else if (r[0] == PT_OP_DEL)
+            d = -shard_del(sh, h, path);
+        pthread_rwlock_unlock(&sh->lock);
+
+        pthread_mutex_lock(&g_log_lock);
+        g_live += d;
+        ++g_log_records;
+        pthread_mutex_unlock(&g_log_lock);
+        pos += PT_HDR_LEN + len;
+    }
+    return pos;
+}
+
+/* Replay every complete record; a torn tail is cut off. */
+static int log_replay(int fd)
+{
+    char    buf[64 * 1024];
+    size_t  have = 0;
+    off_t   good = 0;
+    ssize_t n;
+    int     corrupt = 0;
+
+    while (!corrupt && (n = read(fd, buf + have, sizeof(buf) - have)) > 0) {
+        have += (size_t)n;
+        size_t pos = log_apply(buf, have, &corrupt);
+        good += (off_t)pos;
+        memmove(buf, buf + pos, have - pos);
+        have -= pos;
+    }
+    if (have) {
+        fprintf(stderr, "permtable: dropping %zu-byte torn record\n", have);
+        if (ftruncate(fd, good) < 0) perror("permtable: ftruncate");
+    }
+    return 0;
+}
+
+/* Apply what other processes appended since we last looked.  Caller
+ * holds g_sync_lock. */
+static void log_catch_up_locked(void)
+{
+    char buf[64 * 1024];
+    for (;;) {
+        uint64_t end  = __atomic_load_n(&g_tail->bytes, __ATOMIC_ACQUIRE);
+        uint64_t from = g_applied;
+        if (from >= end) break;
+        size_t  want = end - from < sizeof(buf) ? (size_t)(end - from) : sizeof(buf);
+        ssize_t n    = pread(g_log_fd, buf, want, (off_t)from);
+        int     corrupt = 0;
+        size_t  used = n > 0 ? log_apply(buf, (size_t)n, &corrupt) : 0;
+        if (used == 0) {
+            fprintf(stderr, "permtable: log unreadable at %llu\n",
+                    (unsigned long long)from);
+            break;
+        }
+        __atomic_store_n(&g_applied, from + used, __ATOMIC_RELAXED);
+    }
+}
+
+static void share_catch_up(void)
+{
+    if (!g_tail ||
+        __atomic_load_n(&g_tail->bytes, __ATOMIC_ACQUIRE) ==
+        __atomic_load_n(&g_applied, __ATOMIC_RELAXED))
+        return;
+    pthread_mutex_lock(&g_sync_lock);
+    log_catch_up_locked();
+    pthread_mutex_unlock(&g_sync_lock);
+}
+
+/* Become the one process allowed to append, and see everything the
+ * others appended first. */
+static void share_lock(void)
+{
+    pthread_mutex_lock(&g_sync_lock);
+    while (flock(g_log_fd, LOCK_EX) < 0 && errno == EINTR)
+        ;
+    struct stat st;
+    if (fstat(g_log_fd, &st) == 0 && (uint64_t)st.st_size > g_tail->bytes) {
+        fprintf(stderr, "permtable: dropping torn record of a dead process\n");
+        if (ftruncate(g_log_fd, (off_t)g_tail->bytes) < 0)
+            perror("permtable: ftruncate");
+    }
+    log_catch_up_locked();
+}
+
+static void share_unlock(void)
+{
+    flock(g_log_fd, LOCK_UN);
+    pthread_mutex_unlock(&g_sync_lock);
+}
+
+/* Rewrite the log with one SET per live entry.  Caller holds every
+ * shard lock (read mode suffices) and g_log_lock. */
+static void log_compact_locked(void)
+{
+    char tmp[BUF_SIZE + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", g_log_path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { perror("permtable: compact"); return; }
+
+    char   out[64 * 1024];
+    size_t used = 0, records = 0;
+    int    ok = 1;
+    for (int s = 0; s < PT_SHARDS && ok; ++s)
+        for (size_t i = 0; i <= g_shards[s].mask && ok; ++i) {
+            pt_slot_t *sl = &g_shards[s].slots[i];
+            if (!sl->hash) continue;
+            size_t len = strlen(sl->path);
+            if (used + PT_HDR_LEN + len > sizeof(out)) {
+                ok = write(fd, out, used) == (ssize_t)used;
+                used = 0;
+            }
+            used += log_encode(out + used, PT_OP_SET, sl->perm, sl->path, len);
+            ++records;
+        }
+    if (ok && used) ok = write(fd, out, used) == (ssize_t)used;
+    if (ok) ok = fsync(fd) == 0;
+    close(fd);
+
+    if (!ok || rename(tmp, g_log_path) < 0) {
+        perror("permtable: compact");
+        unlink(tmp);
+        return;
+    }
+    int nfd = open(g_log_path, O_WRONLY | O_APPEND);
+    if (nfd < 0) { perror("permtable: reopen"); return; }
+    if (g_log_fd >= 0) close(g_log_fd);
+    g_log_fd      = nfd;
+    g_log_records = records;
+}
+
+/* compact when dead records outnumber live ones by a wide margin */
+static int log_needs_compaction(void)
+{
+    return g_log_records > 4096 && g_log_records > 2 * g_live;
+}
+
+static void log_compact(void)
+{
+    for (int s = 0; s < PT_SHARDS; ++s)
+        pthread_rwlock_rdlock(&g_shards[s].lock);
+    pthread_mutex_lock(&g_log_lock);
+    if (log_needs_compaction())
+        log_compact_locked();
+    pthread_mutex_unlock(&g_log_lock);
+    for (int s = PT_SHARDS - 1; s >= 0; --s)
+        pthread_rwlock_unlock(&g_shards[s].lock);
+}
+
+/* ====================================================================
+ *  public API
+ * ===================================================================*/
+int permtable_init(const char *log_path)
+{
+    for (int s = 0; s < PT_SHARDS; ++s) {
+        pthread_rwlock_init(&g_shards[s].lock, NULL);
+        g_shards[s].slots = calloc(PT_MIN_SLOTS, sizeof(pt_slot_t));
+        g_shards[s].mask  = PT_MIN_SLOTS - 1;
+        g_shards[s].used  = 0;
+    }
+    snprintf(g_log_path, sizeof(g_log_path), "%s", log_path);
+
+    int fd = open(log_path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) { perror("permtable: open log"); return -1; }
+    log_replay(fd);
+    close(fd);
+
+    g_log_fd = open(log_path, O_WRONLY | O_APPEND);
+    if (g_log_fd < 0) { perror("permtable: open log"); return -1; }
+    if (g_log_records > g_live)
+        log_compact_locked();       /* single-threaded here */
+    printf("[Server] Loaded %zu permission entries from '%s'\n",
+           g_live, log_path);
+    return 0;
+}
+
+int permtable_share(void)
+{
+    g_tail = mmap(NULL, sizeof(*g_tail), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (g_tail == MAP_FAILED) { g_tail = NULL; perror("permtable: mmap"); return -1; }
+    struct stat st;
+    if (fstat(g_log_fd, &st) < 0) { perror("permtable: fstat"); return -1; }
+    g_tail->bytes = g_applied = (uint64_t)st.st_size;
+    return 0;
+}
+
+int permtable_attach(void)
+{
+    /* flock() belongs to the open file, which fork() shares: each
+     * process needs its own to exclude the others */
+    int fd = open(g_log_path, O_RDWR | O_APPEND);
+    if (fd < 0) { perror("permtable: open log"); return -1; }
+    close(g_log_fd);
+    g_log_fd = fd;
+    return 0;
+}
+
+permission_t permtable_get(const char *path)
+{
+    uint64_t     h  = pt_hash(path, strlen(path));
+    pt_shard_t  *sh = pt_shard(h);
+    permission_t p  = READ_WRITE;          /* default for unknown files */
+
+    share_catch_up();
+    pthread_rwlock_rdlock(&sh->lock);
+    pt_slot_t *s = shard_find(sh, h, path);
+    if (s) p = s->perm;
+    pthread_rwlock_unlock(&sh->lock);
+    return p;
+}
+
+int permtable_set_if_absent(const char *path, permission_t p,
+                            permission_t *out)
+{
+    uint64_t    h  = pt_hash(path, strlen(path));
+    pt_shard_t *sh = pt_shard(h);
+    int         created = 0;
+
+    /* fast path: already known, a shared lock is enough */
+    share_catch_up();
+    pthread_rwlock_rdlock(&sh->lock);
+    pt_slot_t *s = shard_find(sh, h, path);
+    if (s) {
+        *out = s->perm;
+        pthread_rwlock_unlock(&sh->lock);
+        return 0;
+    }
+    pthread_rwlock_unlock(&sh->lock);
+
+    if (g_tail) share_lock();
+    pthread_rwlock_wrlock(&sh->lock);
+    s = shard_find(sh, h, path);            /* lost a race? */
+    if (s) {
+        p = s->perm;
+    } else if (shard_put(sh, h, path, p) == 1) {
+        pthread_mutex_lock(&g_log_lock);
+        ++g_live;
+        log_append(PT_OP_SET, p, path);
+        pthread_mutex_unlock(&g_log_lock);
+        created = 1;
+    }
+    pthread_rwlock_unlock(&sh->lock);
+    if (g_tail) share_unlock();
+    *out = p;
+    return created;
+}
+
+void permtable_remove(const char *path)
+{
+    uint64_t    h  = pt_hash(path, strlen(path));
+    pt_shard_t *sh = pt_shard(h);
+    int         compact = 0;
+
+    if (g_tail) share_lock();
+    pthread_rwlock_wrlock(&sh->lock);
+    if (shard_del(sh, h, path)) {
+        pthread_mutex_lock(&g_log_lock);
+        --g_live;
+        log_append(PT_OP_DEL, READ_WRITE, path);
+        compact = !g_tail && log_needs_compaction();
+        pthread_mutex_unlock(&g_log_lock);
+    }
+    pthread_rwlock_unlock(&sh->lock);
+    if (g_tail) share_unlock();
+
+    if (compact) log_compact();
+}
+
+size_t permtable_count(void)
+{
+    share_catch_up();
+    pthread_mutex_lock(&g_log_lock);
+    size_t n = g_live;
+    pthread_mutex_unlock(&g_log_lock);
+    return n;
+}
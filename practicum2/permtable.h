@@ -0,0 +1,41 @@
+/* --------------------------------------------------------------------
+ *  permtable.h  –  hash-indexed, persistent permission table
+ *
+ *  Maps a remote path to its RO/RW permission.  The table is split
+ *  into independently locked shards (one rwlock each) so concurrent
+ *  lookups never contend on a global mutex, and every change is
+ *  appended to a compact on-disk log that is replayed at start-up.
+ *  Several processes can share one log and stay in step.
+ * ------------------------------------------------------------------ */
+#ifndef PERMTABLE_H
+#define PERMTABLE_H
+
+#include "common.h"
+
+/* Load (and compact) the log at log_path, then keep appending to it.
+ * Returns 0 on success, -1 if the log cannot be opened. */
+int permtable_init(const char *log_path);
+
+/* Share the table between processes (rfserver -P): call once after
+ * permtable_init() and before forking, then permtable_attach() in each
+ * child before its first lookup.  Every process then sees the others'
+ * changes through the log. */
+int permtable_share(void);
+int permtable_attach(void);
+
+/* Permission of path, READ_WRITE for unknown files. */
+permission_t permtable_get(const char *path);
+
+/* First-writer-wins: record p for path unless it already has an
+ * entry.  Stores the permission in effect afterwards in *out and
+ * returns 1 if this call created the entry, 0 if it already existed. */
+int permtable_set_if_absent(const char *path, permission_t p,
+                            permission_t *out);
+
+/* Forget path (called once the file itself has been removed). */
+void permtable_remove(const char *path);
+
+/* Number of live entries (for diagnostics). */
+size_t permtable_count(void);
+
+#endif // PERMTABLE_H
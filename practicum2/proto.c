@@ -0,0 +1,265 @@
+/* --------------------------------------------------------------------
+ *  proto.c  –  line/payload framing helpers shared by rfs and rfserver
+ * ------------------------------------------------------------------ */
+#include "proto.h"
+#include "lz.h"
+
+/* socket bytes moved by this process (read by rfserver's STATS) */
+static unsigned long long g_rx, g_tx;
+static unsigned long long g_zraw, g_zwire;
+
+#define ZF_HDR     8
+#define ZF_TRY_GAP 16               /* stored frames between retries */
+
+/* framing state of a compressed connection */
+struct zctx {
+    char    *out;                   /* last frame, decoded */
+    size_t   opos, olen;
+    char    *wire;                  /* frame being sent / received */
+    unsigned misses;                /* frames in a row that did not shrink */
+    unsigned skip;                  /* send stored without trying */
+};
+
+void proto_bytes(unsigned long long *in, unsigned long long *out)
+{
+    *in  = __atomic_load_n(&g_rx, __ATOMIC_RELAXED);
+    *out = __atomic_load_n(&g_tx, __ATOMIC_RELAXED);
+}
+
+void proto_zbytes(unsigned long long *raw, unsigned long long *wire)
+{
+    *raw  = __atomic_load_n(&g_zraw, __ATOMIC_RELAXED);
+    *wire = __atomic_load_n(&g_zwire, __ATOMIC_RELAXED);
+}
+
+void conn_init(conn_t *c, int fd)
+{
+    c->fd  = fd;
+    c->pos = c->len = 0;
+    c->z   = NULL;
+}
+
+int conn_compress(conn_t *c)
+{
+    if (c->z) return 0;
+    struct zctx *z = calloc(1, sizeof(*z));
+    if (z) {
+        z->out  = malloc(LZ_MAX_BLOCK);
+        z->wire = malloc(ZF_HDR + LZ_MAX_BLOCK);
+    }
+    if (!z || !z->out || !z->wire) {
+        if (z) { free(z->out); free(z->wire); }
+        free(z);
+        return -1;
+    }
+    c->z = z;
+    return 0;
+}
+
+void conn_release(conn_t *c)
+{
+    if (!c->z) return;
+    free(c->z->out);
+    free(c->z->wire);
+    free(c->z);
+    c->z = NULL;
+}
+
+static int conn_fill(conn_t *c)
+{
+    ssize_t n;
+    do {
+        n = recv(c->fd, c->buf, sizeof(c->buf), 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return -1;
+    __atomic_add_fetch(&g_rx, (unsigned long long)n, __ATOMIC_RELAXED);
+    c->pos = 0;
+    c->len = (size_t)n;
+    return 0;
+}
+
+int conn_read_line(conn_t *c, char *line, size_t cap)
+{
+    size_t used = 0;
+    for (;;) {
+        if (c->pos == c->len && conn_fill(c) < 0) return -1;
+        char ch = c->buf[c->pos++];
+        if (ch == '\n') break;
+        if (used + 1 >= cap) return -1;         /* overlong */
+        line[used++] = ch;
+    }
+    if (used && line[used - 1] == '\r') --used;
+    line[used] = '\0';
+    return (int)used;
+}
+
+ssize_t conn_read(conn_t *c, void *buf, size_t len)
+{
+    if (c->pos < c->len) {
+        size_t n = c->len - c->pos;
+        if (n > len) n = len;
+        memcpy(buf, c->buf + c->pos, n);
+        c->pos += n;
+        return (ssize_t)n;
+    }
+    /* nothing buffered: large reads go straight to the caller */
+    ssize_t n;
+    do {
+        n = recv(c->fd, buf, len, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) __atomic_add_fetch(&g_rx, (unsigned long long)n, __ATOMIC_RELAXED);
+    return n;
+}
+
+int conn_read_full(conn_t *c, void *buf, size_t len)
+{
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = conn_read(c, p, len);
+        if (n <= 0) return -1;
+        p += n; len -= (size_t)n;
+    }
+    return 0;
+}
+
+int send_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        __atomic_add_fetch(&g_tx, (unsigned long long)n, __ATOMIC_RELAXED);
+        p += n; len -= (size_t)n;
+    }
+    return 0;
+}
+
+static void put_u32(char *p, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i) p[i] = (char)(v >> (8 * i));
+}
+
+static uint32_t get_u32(const char *p)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= (uint32_t)(unsigned char)p[i] << (8 * i);
+    return v;
+}
+
+int send_payload(conn_t *c, const void *buf, size_t len)
+{
+    struct zctx *z = c->z;
+    if (!z) return send_all(c->fd, buf, len);
+
+    const char *p = buf;
+    while (len > 0) {
+        size_t   k = len < LZ_MAX_BLOCK ? len : LZ_MAX_BLOCK;
+        uint32_t w = 0;
+        /* worth it only if it saves 1/16; after repeated failures
+         * (media, archives) stop trying for a while */
+        if (z->skip) --z->skip;
+        else         w = (uint32_t)lz_compress(p, k, z->wire + ZF_HDR, k - k / 16);
+        if (w) {
+            z->misses = 0;
+        } else {
+            if (++z->misses >= 2) z->skip = ZF_TRY_GAP;
+            memcpy(z->wire + ZF_HDR, p, k);
+        }
+        put_u32(z->wire, (uint32_t)k);
+        put_u32(z->wire + 4, w ? w : (uint32_t)k | ZF_STORED);
+        size_t wlen = w ? w : k;
+        if (send_all(c->fd, z->wire, ZF_HDR + wlen) < 0) return -1;
+        __atomic_add_fetch(&g_zraw, k, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&g_zwire, ZF_HDR + wlen, __ATOMIC_RELAXED);
+        p += k; len -= k;
+    }
+    return 0;
+}
+
+ssize_t conn_read_payload(conn_t *c, void *buf, size_t len)
+{
+    struct zctx *z = c->z;
+    if (!z) return conn_read(c, buf, len);
+
+    if (z->opos == z->olen) {
+        char hdr[ZF_HDR];
+        if (conn_read_full(c, hdr, ZF_HDR) < 0) return -1;
+        uint32_t raw    = get_u32(hdr);
+        uint32_t w      = get_u32(hdr + 4);
+        int      stored = (w & ZF_STORED) != 0;
+        w &= ~ZF_STORED;
+        if (raw == 0 || raw > LZ_MAX_BLOCK || w > raw || (stored && w != raw)) {
+            errno = EPROTO;
+            return -1;
+        }
+        if (stored) {
+            if (conn_read_full(c, z->out, raw) < 0) return -1;
+        } else if (conn_read_full(c, z->wire, w) < 0 ||
+                   lz_decompress(z->wire, w, z->out, raw) < 0) {
+            errno = EPROTO;
+            return -1;
+        }
+        __atomic_add_fetch(&g_zraw, raw, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&g_zwire, ZF_HDR + w, __ATOMIC_RELAXED);
+        z->opos = 0;
+        z->olen = raw;
+    }
+    size_t n = z->olen - z->opos;
+    if (n > len) n = len;
+    memcpy(buf, z->out + z->opos, n);
+    z->opos += n;
+    return (ssize_t)n;
+}
+
+int send_line(int fd, const char *fmt, ...)
+{
+    char    line[MAX_LINE];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line) - 1, fmt, ap);
+    va_end(ap);
+    if (n < 0) return -1;
+    if (n > (int)sizeof(line) - 2) n = sizeof(line) - 2;
+    line[n++] = '\n';
+    return send_all(fd, line, (size_t)n);
+}
+
+void parse_request(char *line, request_t *r)
+{
+    memset(r, 0, sizeof(*r));
+    char *save = NULL;
+    for (char *tok = strtok_r(line, " \t", &save); tok;
+         tok = strtok_r(NULL, " \t", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!r->cmd) {
+            r->cmd = tok;
+        } else if (eq && r->nopts < MAX_OPTS) {
+            *eq = '\0';
+            r->keys[r->nopts]   = tok;
+            r->vals[r->nopts++] = eq + 1;
+        } else if (!eq && r->nargs < MAX_ARGS) {
+            r->args[r->nargs++] = tok;
+        }
+    }
+}
+
+const char *req_opt(const request_t *r, const char *key)
+{
+    for (int i = 0; i < r->nopts; ++i)
+        if (strcasecmp(r->keys[i], key) == 0)
+            return r->vals[i];
+    return NULL;
+}
+
+int req_opt_u64(const request_t *r, const char *key, unsigned long long *out)
+{
+    const char *v = req_opt(r, key);
+    if (!v || !isdigit((unsigned char)*v)) return 0;
+    char *end;
+    errno = 0;
+    unsigned long long x = strtoull(v, &end, 10);
+    if (errno || *end) return 0;
+    *out = x;
+    return 1;
+}
@@ -0,0 +1,92 @@
+/* --------------------------------------------------------------------
+ *  proto.h  –  framing shared by rfs and rfserver
+ *
+ *  Every request and every status reply is one text line ending in
+ *  '\n'.  File payloads follow a line that announces their length
+ *  (size=N on WRITE/APPEND, the count in "OK_SENDING_FILE N" on GET),
+ *  so several requests can share one connection and a payload can be
+ *  any size.  Optional arguments are key=value tokens.
+ *
+ *  After "HELLO compress=lz" / "HELLO_OK compress=lz" the GET and
+ *  WRITE/APPEND payloads of that connection travel as frames: an
+ *  8-byte header (raw length, wire length | ZF_STORED, both little
+ *  endian) and up to LZ_MAX_BLOCK bytes, lz-compressed or stored as
+ *  is when they do not shrink.  The announced lengths stay the raw
+ *  byte counts; everything else on the connection is unchanged.
+ * ------------------------------------------------------------------ */
+#ifndef PROTO_H
+#define PROTO_H
+
+#include "common.h"
+#include <stdarg.h>
+
+#define MAX_LINE  BUF_SIZE          /* longest request / status line */
+#define MAX_ARGS  8
+#define MAX_OPTS  8
+
+#define ZF_STORED 0x80000000u       /* frame holds raw bytes */
+
+/* Buffered reader over a connected socket. */
+typedef struct {
+    int          fd;
+    size_t       pos, len;
+    char         buf[BUF_SIZE];
+    struct zctx *z;             /* payload framing, NULL when off */
+} conn_t;
+
+void conn_init(conn_t *c, int fd);
+
+/* Frame this connection's payloads from now on; -1 if out of memory.
+ * conn_release() frees the framing state. */
+int  conn_compress(conn_t *c);
+void conn_release(conn_t *c);
+
+/* Next '\n'-terminated line without the newline (a trailing '\r' is
+ * dropped too).  Returns its length, or -1 on EOF, error or overlong
+ * line. */
+int conn_read_line(conn_t *c, char *line, size_t cap);
+
+/* Like recv(): buffered bytes first, then at most one recv(). */
+ssize_t conn_read(conn_t *c, void *buf, size_t len);
+
+/* Exactly len bytes, 0 on success, -1 on EOF/error. */
+int conn_read_full(conn_t *c, void *buf, size_t len);
+
+int send_all(int fd, const void *buf, size_t len);
+
+/* A file payload (or a piece of one): framed when the connection
+ * negotiated compression, plain bytes otherwise.  The reader returns
+ * at most len raw bytes, like conn_read(). */
+int     send_payload(conn_t *c, const void *buf, size_t len);
+ssize_t conn_read_payload(conn_t *c, void *buf, size_t len);
+
+/* Total bytes received / sent through these helpers. */
+void proto_bytes(unsigned long long *in, unsigned long long *out);
+
+/* Payload bytes through framed connections, before and after lz. */
+void proto_zbytes(unsigned long long *raw, unsigned long long *wire);
+
+/* printf-style line; the '\n' is appended here. */
+int send_line(int fd, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/* A tokenised request (or status) line.  Tokens point into the
+ * caller's line buffer. */
+typedef struct {
+    char *cmd;
+    char *args[MAX_ARGS];
+    int   nargs;
+    char *keys[MAX_OPTS];
+    char *vals[MAX_OPTS];
+    int   nopts;
+} request_t;
+
+void parse_request(char *line, request_t *r);
+
+/* value of key=..., or NULL */
+const char *req_opt(const request_t *r, const char *key);
+
+/* numeric option; returns 1 if present and well formed, else 0 */
+int req_opt_u64(const request_t *r, const char *key, unsigned long long *out);
+
+#endif // PROTO_H
@@ -0,0 +1,27 @@
+/* --------------------------------------------------------------------
+ *  rangelock.h  –  byte-range file locks (open file description locks)
+ *
+ *  F_OFD_SETLKW locks belong to the open file description, not to the
+ *  process, so every client thread's own open() gets independent locks.
+ *  Two writers to disjoint ranges of one file, or a reader and a writer
+ *  of different ranges, run concurrently.  len == 0 means "from start
+ *  to end of file and beyond", the equivalent of the old whole-file
+ *  flock().  Note that flock() and these locks do not see each other,
+ *  so every path that touches SERVER_DATA_DIR uses these.
+ * ------------------------------------------------------------------ */
+#ifndef RANGELOCK_H
+#define RANGELOCK_H
+
+#include <sys/types.h>
+
+#define RANGE_EOF 0                 /* len: to end of file, growing */
+
+/* Block until [start, start+len) is locked shared (exclusive = 0) or
+ * exclusive (1).  The fd must be open for reading / writing
+ * respectively.  Wait time goes to the server statistics. */
+int range_lock(int fd, int exclusive, off_t start, off_t len);
+
+/* Drop every range this open file description holds. */
+int range_unlock(int fd);
+
+#endif // RANGELOCK_H
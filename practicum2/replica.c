@@ -0,0 +1,411 @@
+/* --------------------------------------------------------------------
+ *  replica.c  –  change log and shipping threads (primary), position
+ *                and lag (follower)
+ * ------------------------------------------------------------------ */
+#define _GNU_SOURCE                         /* nftw(), getrandom() */
+#include "replica.h"
+#include "proto.h"
+#include "permtable.h"
+#include "rangelock.h"
+#include "upload.h"
+#include "seal.h"
+#include "crc32c.h"
+#include "logger.h"
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <netinet/tcp.h>
+#include <sys/random.h>
+#include <time.h>
+
+/* ----------  primary: the change log  ------------------------------
+ *  Change seq lives in g_log[seq % REPL_LOG_SIZE] until REPL_LOG_SIZE
+ *  newer ones overwrite it.  Only the path is kept: what a follower
+ *  gets is the path's state when its turn comes, so a burst of writes
+ *  to one file ships its final bytes, possibly more than once.
+ * ------------------------------------------------------------------ */
+typedef struct {
+    char    *path;
+    uint64_t ts_ms;
+} repl_entry_t;
+
+enum { REPL_DOWN, REPL_SYNC, REPL_LIVE };
+static const char *g_state_names[] = { "down", "sync", "live" };
+
+typedef struct {
+    char               host[64];
+    int                port;
+    int                state;           /* REPL_*, atomic */
+    uint64_t           acked;           /* last change confirmed, atomic */
+    uint64_t           since_ms;        /* entered this state */
+    unsigned long long bytes, syncs;    /* atomic */
+} follower_t;
+
+static repl_entry_t   *g_log;
+static uint64_t        g_head;          /* last seq handed out */
+static uint64_t        g_epoch;         /* this primary run */
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_grew = PTHREAD_COND_INITIALIZER;
+static follower_t      g_followers[REPL_MAX_FOLLOWERS];
+static int             g_nfollowers;
+
+/* ----------  follower: where we stand  ----------------------------- */
+static int             g_is_follower;
+static uint64_t        g_at_epoch, g_at_seq, g_lag_ms, g_applied;
+static pthread_mutex_t g_at_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t repl_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+int repl_add_follower(const char *spec)
+{
+    if (g_nfollowers == REPL_MAX_FOLLOWERS) return -1;
+    follower_t *f = &g_followers[g_nfollowers];
+    const char *colon = strrchr(spec, ':');
+    if (colon)
+        snprintf(f->host, sizeof(f->host), "%.*s", (int)(colon - spec), spec);
+    else
+        snprintf(f->host, sizeof(f->host), "127.0.0.1");
+    f->port = atoi(colon ? colon + 1 : spec);
+    struct in_addr a;
+    if (f->port <= 0 || f->port > 65535 || inet_pton(AF_INET, f->host, &a) != 1)
+        return -1;
+    ++g_nfollowers;
+    return 0;
+}
+
+void repl_changed(const char *path)
+{
+    if (!g_nfollowers) return;
+    char *copy = strdup(path);
+    if (!copy) return;                      /* the next full copy has it */
+    pthread_mutex_lock(&g_lock);
+    repl_entry_t *e = &g_log[++g_head % REPL_LOG_SIZE];
+    free(e->path);
+    e->path  = copy;
+    e->ts_ms = repl_now_ms();
+    pthread_cond_broadcast(&g_grew);
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void set_state(follower_t *f, int state)
+{
+    __atomic_store_n(&f->since_ms, repl_now_ms(), __ATOMIC_RELAXED);
+    __atomic_store_n(&f->state, state, __ATOMIC_RELAXED);
+}
+
+static int dial(const follower_t *f)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) return -1;
+    struct sockaddr_in a = {0};
+    a.sin_family = AF_INET;
+    a.sin_port   = htons(f->port);
+    inet_pton(AF_INET, f->host, &a.sin_addr);
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(s, (struct sockaddr *)&a, sizeof(a)) < 0) { close(s); return -1; }
+    return s;
+}
+
+/* the follower's "REPL_OK ..." for the request just sent */
+static int await_ok(conn_t *c)
+{
+    char line[MAX_LINE];
+    if (conn_read_line(c, line, sizeof(line)) < 0) return -1;
+    if (strncmp(line, "REPL_OK", 7) == 0) return 0;
+    fprintf(stderr, "[Server] Follower answered '%s'\n", line);
+    return -1;
+}
+
+/* Send path's current state as change seq: its bytes, read under a
+ * shared lock like a GET, or its removal. */
+static int ship_path(follower_t *f, conn_t *c, const char *path,
+                     uint64_t seq, uint64_t ts)
+{
+    char full[BUF_SIZE];
+    snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, path);
+    int fd = open(full, O_RDONLY);
+    if (fd >= 0 && seal_attach(fd) < 0) { close(fd); return -1; }
+    if (fd < 0) {
+        if (errno != ENOENT && errno != ENOTDIR) return -1;
+        if (send_line(c->fd, "REPL_RM %s seq=%llu ts=%llu", path,
+                      (unsigned long long)seq, (unsigned long long)ts) < 0)
+            return -1;
+        return await_ok(c);
+    }
+
+    int rc = -1;
+    struct stat st;
+    if (range_lock(fd, 0, 0, RANGE_EOF) < 0) { close(fd); return -1; }
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        send_line(c->fd, "REPL_PUT %s seq=%llu ts=%llu perm=%s size=%llu crc=1", path,
+                  (unsigned long long)seq, (unsigned long long)ts,
+                  permtable_get(path) == READ_ONLY ? "RO" : "RW",
+                  (unsigned long long)st.st_size) == 0) {
+        char     buf[XFER_BUF];
+        off_t    off = 0;
+        uint32_t sum = 0;
+        while (off < st.st_size) {
+            size_t  want = st.st_size - off < (off_t)sizeof(buf)
+                         ? (size_t)(st.st_size - off) : sizeof(buf);
+            ssize_t n = seal_pread(fd, buf, want, off);
+            if (n <= 0) break;              /* the follower sees a short payload */
+            sum = crc32c(sum, buf, (size_t)n);
+            if (send_payload(c, buf, (size_t)n) < 0) break;
+            off += n;
+        }
+        __atomic_add_fetch(&f->bytes, (unsigned long long)off, __ATOMIC_RELAXED);
+        rc = off == st.st_size ? send_line(c->fd, "CRC %08x", sum) : -1;
+    }
+    range_unlock(fd);
+    close(fd);
+    return rc < 0 ? -1 : await_ok(c);
+}
+
+/* nftw() has no user pointer: the sync in progress on this thread */
+static __thread follower_t *t_follower;
+static __thread conn_t     *t_conn;
+
+static int sync_one(const char *fpath, const struct stat *sb, int type,
+                    struct FTW *ftw)
+{
+    (void)sb;
+    if (type != FTW_F || upload_is_tmp(fpath + ftw->base)) return 0;
+    const char *path = fpath + strlen(SERVER_DATA_DIR) + 1;
+    return ship_path(t_follower, t_conn, path, 0, repl_now_ms()) < 0 ? 1 : 0;
+}
+
+/* Copy every file across; the follower drops what the copy did not
+ * touch.  Returns the change the copy is at least as new as. */
+static int full_sync(follower_t *f, conn_t *c, uint64_t *seq)
+{
+    pthread_mutex_lock(&g_lock);
+    uint64_t at = g_head;
+    pthread_mutex_unlock(&g_lock);
+
+    set_state(f, REPL_SYNC);
+    __atomic_add_fetch(&f->syncs, 1, __ATOMIC_RELAXED);
+    LOG("[Server] Full copy to follower %s:%d\n", f->host, f->port);
+    if (send_line(c->fd, "REPL_SYNC epoch=%016llx", (unsigned long long)g_epoch) < 0 ||
+        await_ok(c) < 0)
+        return -1;
+    t_follower = f;
+    t_conn     = c;
+    if (nftw(SERVER_DATA_DIR, sync_one, 32, FTW_PHYS) != 0) return -1;
+    if (send_line(c->fd, "REPL_SYNC_END seq=%llu", (unsigned long long)at) < 0 ||
+        await_ok(c) < 0)
+        return -1;
+    *seq = at;
+    return 0;
+}
+
+/* One connection's worth of shipping; returns when it breaks. */
+static void ship_session(follower_t *f, conn_t *c)
+{
+    char line[MAX_LINE];
+    unsigned long long epoch, seq;
+    if (send_line(c->fd, "REPL_HELLO epoch=%016llx", (unsigned long long)g_epoch) < 0 ||
+        conn_read_line(c, line, sizeof(line)) < 0 ||
+        sscanf(line, "REPL_AT epoch=%llx seq=%llu", &epoch, &seq) != 2) {
+        fprintf(stderr, "[Server] Follower %s:%d did not answer REPL_HELLO\n",
+                f->host, f->port);
+        return;
+    }
+
+    pthread_mutex_lock(&g_lock);
+    int resume = epoch == g_epoch && seq <= g_head && g_head - seq < REPL_LOG_SIZE;
+    pthread_mutex_unlock(&g_lock);
+    uint64_t at = seq;
+    if (!resume && full_sync(f, c, &at) < 0) return;
+    __atomic_store_n(&f->acked, at, __ATOMIC_RELAXED);
+    set_state(f, REPL_LIVE);
+    printf("[Server] Follower %s:%d live at change %llu\n", f->host, f->port,
+           (unsigned long long)at);
+
+    for (;;) {
+        char     path[BUF_SIZE];
+        uint64_t ts;
+        pthread_mutex_lock(&g_lock);
+        while (g_head == at)
+            pthread_cond_wait(&g_grew, &g_lock);
+        if (g_head - at >= REPL_LOG_SIZE) { /* fell off the log */
+            pthread_mutex_unlock(&g_lock);
+            return;
+        }
+        repl_entry_t *e = &g_log[++at % REPL_LOG_SIZE];
+        snprintf(path, sizeof(path), "%s", e->path);
+        ts = e->ts_ms;
+        pthread_mutex_unlock(&g_lock);
+
+        if (ship_path(f, c, path, at, ts) < 0) return;
+        __atomic_store_n(&f->acked, at, __ATOMIC_RELAXED);
+    }
+}
+
+static void *shipper(void *arg)
+{
+    follower_t *f = arg;
+    for (;;) {
+        int s = dial(f);
+        if (s >= 0) {
+            conn_t c;
+            conn_init(&c, s);
+            ship_session(f, &c);
+            close(s);
+            conn_release(&c);
+            if (__atomic_load_n(&f->state, __ATOMIC_RELAXED) != REPL_DOWN)
+                printf("[Server] Lost follower %s:%d; reconnecting\n", f->host, f->port);
+        }
+        set_state(f, REPL_DOWN);
+        usleep(REPL_RETRY_MS * 1000);
+    }
+    return NULL;
+}
+
+void repl_start(void)
+{
+    if (!g_nfollowers) return;
+    g_log = calloc(REPL_LOG_SIZE, sizeof(*g_log));
+    if (!g_log || getrandom(&g_epoch, sizeof(g_epoch), 0) != sizeof(g_epoch)) {
+        perror("replica");
+        g_nfollowers = 0;
+        return;
+    }
+    g_epoch |= 1;                           /* 0 means "unknown" */
+    for (int i = 0; i < g_nfollowers; ++i) {
+        set_state(&g_followers[i], REPL_DOWN);
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, shipper, &g_followers[i]) == 0)
+            pthread_detach(tid);
+    }
+}
+
+/* ----------  follower  --------------------------------------------- */
+void repl_follow(void)
+{
+    g_is_follower = 1;
+}
+
+void repl_position(uint64_t *epoch, uint64_t *seq)
+{
+    pthread_mutex_lock(&g_at_lock);
+    *epoch = g_at_epoch;
+    *seq   = g_at_seq;
+    pthread_mutex_unlock(&g_at_lock);
+}
+
+static uint64_t        g_sync_epoch;
+static struct timespec g_sync_mark;     /* ctime of a file made at REPL_SYNC */
+static void          (*g_drop)(const char *path);
+
+int repl_sync_begin(uint64_t epoch)
+{
+    /* the file system's own clock: every file the copy writes gets a
+     * ctime at least this new */
+    char mark[BUF_SIZE + 64];
+    struct stat st;
+    upload_tmp_path(mark, sizeof(mark), SERVER_DATA_DIR "/sync", "write",
+                    upload_new_id());
+    int fd = open(mark, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror("replica: sync mark");
+        if (fd >= 0) { close(fd); unlink(mark); }
+        return -1;
+    }
+    close(fd);
+    unlink(mark);
+
+    pthread_mutex_lock(&g_at_lock);
+    g_at_epoch = g_at_seq = 0;
+    g_sync_epoch = epoch;
+    g_sync_mark  = st.st_ctim;
+    pthread_mutex_unlock(&g_at_lock);
+    return 0;
+}
+
+static int sweep_old(const char *fpath, const struct stat *sb, int type,
+                     struct FTW *ftw)
+{
+    if (type != FTW_F || upload_is_tmp(fpath + ftw->base)) return 0;
+    if (sb->st_ctim.tv_sec > g_sync_mark.tv_sec ||
+        (sb->st_ctim.tv_sec == g_sync_mark.tv_sec &&
+         sb->st_ctim.tv_nsec >= g_sync_mark.tv_nsec))
+        return 0;
+    g_drop(fpath + strlen(SERVER_DATA_DIR) + 1);
+    return 0;
+}
+
+void repl_sync_end(uint64_t seq, void (*drop)(const char *path))
+{
+    g_drop = drop;
+    nftw(SERVER_DATA_DIR, sweep_old, 32, FTW_PHYS);
+    pthread_mutex_lock(&g_at_lock);
+    g_at_epoch = g_sync_epoch;
+    g_at_seq   = seq;
+    pthread_mutex_unlock(&g_at_lock);
+}
+
+void repl_applied(uint64_t seq, uint64_t ts_ms)
+{
+    uint64_t now = repl_now_ms();
+    pthread_mutex_lock(&g_at_lock);
+    if (seq) g_at_seq = seq;
+    g_lag_ms = now > ts_ms ? now - ts_ms : 0;
+    ++g_applied;
+    pthread_mutex_unlock(&g_at_lock);
+}
+
+size_t repl_format(char *buf, size_t cap)
+{
+    size_t n = 0;
+    if (g_nfollowers) {
+        pthread_mutex_lock(&g_lock);
+        uint64_t head = g_head;
+        pthread_mutex_unlock(&g_lock);
+        n += (size_t)snprintf(buf, cap, "repl role=primary epoch=%016llx head=%llu "
+                              "followers=%d\n", (unsigned long long)g_epoch,
+                              (unsigned long long)head, g_nfollowers);
+        for (int i = 0; i < g_nfollowers && n < cap; ++i) {
+            follower_t *f = &g_followers[i];
+            uint64_t acked = __atomic_load_n(&f->acked, __ATOMIC_RELAXED);
+            int      state = __atomic_load_n(&f->state, __ATOMIC_RELAXED);
+            uint64_t now   = repl_now_ms(), lag = 0;
+            if (state != REPL_LIVE) {
+                lag = now - __atomic_load_n(&f->since_ms, __ATOMIC_RELAXED);
+            } else if (acked < head) {
+                /* age of the oldest change it has not confirmed */
+                pthread_mutex_lock(&g_lock);
+                lag = head - acked < REPL_LOG_SIZE
+                    ? now - g_log[(acked + 1) % REPL_LOG_SIZE].ts_ms : 0;
+                pthread_mutex_unlock(&g_lock);
+            }
+            n += (size_t)snprintf(buf + n, cap - n,
+                                  "repl_follower %s:%d state=%s acked=%llu behind=%llu "
+                                  "lag_ms=%llu syncs=%llu bytes=%llu\n",
+                                  f->host, f->port, g_state_names[state],
+                                  (unsigned long long)acked,
+                                  (unsigned long long)(head - acked),
+                                  (unsigned long long)lag,
+                                  __atomic_load_n(&f->syncs, __ATOMIC_RELAXED),
+                                  __atomic_load_n(&f->bytes, __ATOMIC_RELAXED));
+        }
+    } else {
+        pthread_mutex_lock(&g_at_lock);
+        if (g_is_follower)
+            n = (size_t)snprintf(buf, cap, "repl role=follower epoch=%016llx "
+                                 "applied_seq=%llu applied=%llu lag_ms=%llu\n",
+                                 (unsigned long long)g_at_epoch,
+                                 (unsigned long long)g_at_seq,
+                                 (unsigned long long)g_applied,
+                                 (unsigned long long)g_lag_ms);
+        else
+            n = (size_t)snprintf(buf, cap, "repl role=none\n");
+        pthread_mutex_unlock(&g_at_lock);
+    }
+    return n < cap ? n : cap - 1;
+}
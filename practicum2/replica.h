@@ -0,0 +1,64 @@
+/* --------------------------------------------------------------------
+ *  replica.h  –  asynchronous replication to read-only followers
+ *
+ *  Primary (rfserver -R host:port, once per follower): every change
+ *  to a path gets the next sequence number in an in-memory change
+ *  log, and one thread per follower ships the path's current state
+ *  (its bytes and permission, or its absence) in log order, waiting
+ *  for each acknowledgement.  Writers never wait for a follower.  A
+ *  follower that is new, restarted, or so far behind that the log no
+ *  longer holds its next change first gets a full copy of the data
+ *  directory.
+ *
+ *  Follower (rfserver -F): server.c applies the REPL_* requests; this
+ *  module keeps the follower's position in the primary's log and how
+ *  far behind the primary it runs.
+ * ------------------------------------------------------------------ */
+#ifndef REPLICA_H
+#define REPLICA_H
+
+#include "common.h"
+#include <stdint.h>
+
+/* --- primary --- */
+
+/* Ship changes to spec ("host:port" or "port" on this host).  Call
+ * once per follower before repl_start(); -1 on a bad spec or too many
+ * followers. */
+int  repl_add_follower(const char *spec);
+
+/* Start one shipping thread per follower. */
+void repl_start(void);
+
+/* path was written, replaced or removed (a no-op without followers) */
+void repl_changed(const char *path);
+
+/* --- follower --- */
+
+/* This server is a follower (rfserver -F). */
+void repl_follow(void);
+
+/* Where this follower stands: the primary's epoch and the last change
+ * applied from it (0, 0 when unknown). */
+void repl_position(uint64_t *epoch, uint64_t *seq);
+
+/* A full copy from primary epoch starts; the position stays unknown
+ * until it ends.  -1 if the start cannot be marked. */
+int  repl_sync_begin(uint64_t epoch);
+
+/* The full copy is complete and reflects change seq: drop() every
+ * file it did not write (path relative to the data directory). */
+void repl_sync_end(uint64_t seq, void (*drop)(const char *path));
+
+/* Change seq (0 for items of a full copy) made at ts_ms on the
+ * primary's clock is now applied. */
+void repl_applied(uint64_t seq, uint64_t ts_ms);
+
+/* Wall clock in ms, the timestamps changes carry. */
+uint64_t repl_now_ms(void);
+
+/* "repl ..." STATS lines for whichever role this server plays;
+ * returns the length written (snprintf-style, truncated to cap - 1). */
+size_t repl_format(char *buf, size_t cap);
+
+#endif // REPLICA_H
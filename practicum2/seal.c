@@ -0,0 +1,98 @@
+/* --------------------------------------------------------------------
+ *  seal.c  –  server key, per-file nonces, keystream XOR
+ * ------------------------------------------------------------------ */
+#include "seal.h"
+#include "chacha.h"
+#include "common.h"
+
+#include <fcntl.h>
+#include <sys/random.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+#define NONCE_XATTR "user.rfs.nonce"
+
+/* nonce of every open fd, indexed by fd; a slot is only touched by
+ * the thread that owns the fd */
+typedef struct {
+    uint8_t sealed;
+    uint8_t nonce[CHACHA_NONCE];
+} fdseal_t;
+
+static uint8_t   g_key[CHACHA_KEY];
+static int       g_on;
+static fdseal_t *g_fds;
+static int       g_nfds;
+static unsigned long long g_bytes;
+
+int seal_init(const char *keyfile)
+{
+    int fd = open(keyfile, O_RDONLY);
+    if (fd < 0) { perror(keyfile); return -1; }
+    ssize_t n = read(fd, g_key, sizeof(g_key));
+    char extra;
+    int long_file = read(fd, &extra, 1) > 0;
+    close(fd);
+    if (n != (ssize_t)sizeof(g_key) || long_file) {
+        fprintf(stderr, "%s: key must be exactly %d bytes "
+                        "(head -c %d /dev/urandom > %s)\n",
+                keyfile, CHACHA_KEY, CHACHA_KEY, keyfile);
+        return -1;
+    }
+    struct rlimit rl;
+    g_nfds = getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY
+           ? (int)(rl.rlim_cur < (1u << 20) ? rl.rlim_cur : (1u << 20)) : (1 << 20);
+    g_fds = calloc((size_t)g_nfds, sizeof(fdseal_t));
+    if (!g_fds) { perror("seal: calloc"); return -1; }
+    g_on = 1;
+    return 0;
+}
+
+int seal_enabled(void)
+{
+    return g_on;
+}
+
+int seal_attach(int fd)
+{
+    if (!g_on) return 0;
+    if (fd < 0 || fd >= g_nfds) { errno = EMFILE; return -1; }
+    fdseal_t *s = &g_fds[fd];
+    s->sealed = 0;
+    for (;;) {
+        ssize_t n = fgetxattr(fd, NONCE_XATTR, s->nonce, sizeof(s->nonce));
+        if (n == (ssize_t)sizeof(s->nonce)) { s->sealed = 1; return 0; }
+        if (n >= 0) { errno = EINVAL; return -1; }  /* not ours */
+        if (errno != ENODATA) return -1;
+
+        /* no nonce: a file with data predates -E and stays clear */
+        struct stat st;
+        if (fstat(fd, &st) < 0) return -1;
+        if (st.st_size > 0) return 0;
+        if (getrandom(s->nonce, sizeof(s->nonce), 0) != (ssize_t)sizeof(s->nonce))
+            return -1;
+        if (fsetxattr(fd, NONCE_XATTR, s->nonce, sizeof(s->nonce), XATTR_CREATE) == 0) {
+            s->sealed = 1;
+            return 0;
+        }
+        if (errno != EEXIST) return -1;
+        /* another opener got there first: use its nonce */
+    }
+}
+
+const uint8_t *seal_nonce(int fd)
+{
+    return g_on && fd >= 0 && fd < g_nfds && g_fds[fd].sealed ? g_fds[fd].nonce : NULL;
+}
+
+void seal_apply(const uint8_t *nonce, void *buf, size_t len, off_t off)
+{
+    chacha_xor(g_key, nonce, (uint64_t)off, buf, len);
+    __atomic_add_fetch(&g_bytes, len, __ATOMIC_RELAXED);
+}
+
+unsigned long long seal_bytes(void)
+{
+    return __atomic_load_n(&g_bytes, __ATOMIC_RELAXED);
+}
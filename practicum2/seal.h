@@ -0,0 +1,65 @@
+/* --------------------------------------------------------------------
+ *  seal.h  –  encryption at rest (rfserver -E keyfile)
+ *
+ *  File contents are stored XORed with a ChaCha20 keystream under
+ *  the server key and a random per-file nonce, kept in the file's
+ *  "user.rfs.nonce" extended attribute.  The keystream is addressed
+ *  by file offset, so ranged reads and writes, appends and parallel
+ *  parts each seal their own bytes; sizes do not change.
+ *
+ *  A file gets its nonce while it is still empty (every upload path
+ *  builds a new file); files without one are read and written in the
+ *  clear, so a data directory from before -E keeps working.
+ *
+ *  Sealing rides on diskio: a sealed dio_write() encrypts on a
+ *  workpool thread while the client thread receives the next buffer,
+ *  and a sealed dio_read() decrypts there while it sends the
+ *  previous one.
+ * ------------------------------------------------------------------ */
+#ifndef SEAL_H
+#define SEAL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* Load the 32-byte key; until then nothing is sealed. */
+int  seal_init(const char *keyfile);
+int  seal_enabled(void);
+
+/* Look up the nonce of a newly opened fd, giving the file one if it
+ * is empty and has none yet.  0, or -1 with errno (e.g. ENOTSUP when
+ * the file system has no user xattrs). */
+int  seal_attach(int fd);
+
+/* nonce of an attached fd, NULL if its file is stored in the clear */
+const uint8_t *seal_nonce(int fd);
+
+/* buf ^= keystream at file offset off (seals and unseals) */
+void seal_apply(const uint8_t *nonce, void *buf, size_t len, off_t off);
+
+/* keystream offset for sealing small per-file metadata: far past any
+ * byte a file can hold, so it never reuses the keystream of data */
+#define SEAL_META_OFF ((off_t)1 << 62)
+
+/* bytes sealed and unsealed so far */
+unsigned long long seal_bytes(void);
+
+/* blocking pread/pwrite through the seal; seal_pwrite() encrypts buf
+ * in place, so it is ciphertext afterwards */
+static inline ssize_t seal_pread(int fd, void *buf, size_t len, off_t off)
+{
+    ssize_t n = pread(fd, buf, len, off);
+    const uint8_t *nonce = seal_nonce(fd);
+    if (n > 0 && nonce) seal_apply(nonce, buf, (size_t)n, off);
+    return n;
+}
+
+static inline ssize_t seal_pwrite(int fd, void *buf, size_t len, off_t off)
+{
+    const uint8_t *nonce = seal_nonce(fd);
+    if (nonce) seal_apply(nonce, buf, len, off);
+    return pwrite(fd, buf, len, off);
+}
+
+#endif // SEAL_H
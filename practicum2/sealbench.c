@@ -0,0 +1,206 @@
+/* --------------------------------------------------------------------
+ *  sealbench.c  –  encryption at rest: cipher speed, and what it
+ *                  adds to a WRITE and a GET
+ *
+ *  First the cipher alone: a known-answer check, the vector code
+ *  against the scalar reference at odd offsets, and both speeds.
+ *  Then <reps> WRITEs and GETs of a <size>-byte file against a
+ *  running rfserver.  Run it once against "rfserver" and once against
+ *  "rfserver -E keyfile"; the STATS "seal" line says which one this
+ *  is.  "serial +ms" is what one pass of the cipher over the file
+ *  would add if it ran between the socket and the disk instead of
+ *  beside them.  Keep <size> above FILECACHE_MAX_ENTRY so GETs come
+ *  from the disk path and not from the (plaintext) file cache.
+ *
+ *  usage: sealbench [-n reps] [-s size]
+ * ------------------------------------------------------------------ */
+#include "proto.h"
+#include "chacha.h"
+
+#include <netinet/tcp.h>
+#include <time.h>
+
+static int    g_reps = 5;
+static size_t g_size = 64u << 20;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ChaCha20, all-zero key and nonce, block 0 (DJB's test vector) */
+static const uint8_t KAT[16] = {
+    0x76, 0xb8, 0xe0, 0xad, 0xa0, 0xf1, 0x3d, 0x90,
+    0x40, 0x5d, 0x6a, 0xe5, 0x53, 0x86, 0xbd, 0x28
+};
+
+static int check_cipher(void)
+{
+    uint8_t key[CHACHA_KEY] = {0}, nonce[CHACHA_NONCE] = {0}, a[3000], b[3000];
+    memset(a, 0, 64);
+    chacha_xor(key, nonce, 0, a, 64);
+    if (memcmp(a, KAT, sizeof(KAT)) != 0) return -1;
+
+    unsigned seed = 5;
+    for (int i = 0; i < CHACHA_KEY; ++i) key[i] = (uint8_t)rand_r(&seed);
+    for (int i = 0; i < CHACHA_NONCE; ++i) nonce[i] = (uint8_t)rand_r(&seed);
+    for (int t = 0; t < 2000; ++t) {
+        /* near the 2^32-block counter carry too */
+        uint64_t off = (uint64_t)rand_r(&seed) % 100000 +
+                       (t & 1 ? (1ULL << 38) - 50000 : 0);
+        size_t len = (size_t)rand_r(&seed) % sizeof(a);
+        for (size_t i = 0; i < len; ++i) a[i] = b[i] = (uint8_t)i;
+        chacha_xor(key, nonce, off, a, len);
+        chacha_xor_ref(key, nonce, off, b, len);
+        if (memcmp(a, b, len) != 0) return -1;
+    }
+    return 0;
+}
+
+/* MB/s of one cipher over n bytes */
+static double cipher_rate(void (*fn)(const uint8_t *, const uint8_t *, uint64_t,
+                                     void *, size_t),
+                          char *buf, size_t n)
+{
+    uint8_t key[CHACHA_KEY] = {1}, nonce[CHACHA_NONCE] = {2};
+    double t0 = now_sec();
+    for (size_t off = 0; off < n; off += XFER_BUF)
+        fn(key, nonce, off, buf + off, n - off < XFER_BUF ? n - off : XFER_BUF);
+    return n / (now_sec() - t0) / 1e6;
+}
+
+static int connect_to(conn_t *c)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) return -1;
+    struct sockaddr_in a = {0};
+    a.sin_family = AF_INET;
+    a.sin_port   = htons(PORT);
+    inet_pton(AF_INET, "127.0.0.1", &a.sin_addr);
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(s, (struct sockaddr *)&a, sizeof(a)) < 0) { close(s); return -1; }
+    conn_init(c, s);
+    return 0;
+}
+
+/* the server's "seal ..." STATS line, without the newline */
+static void seal_state(conn_t *c, char *out, size_t cap)
+{
+    char line[MAX_LINE];
+    size_t n;
+    snprintf(out, cap, "unknown");
+    if (send_line(c->fd, "STATS") < 0 || conn_read_line(c, line, sizeof(line)) < 0 ||
+        sscanf(line, "OK_STATS %zu", &n) != 1)
+        return;
+    char *buf = malloc(n + 1);
+    if (!buf) return;
+    size_t got = 0;
+    ssize_t k;
+    while (got < n && (k = conn_read(c, buf + got, n - got)) > 0) got += (size_t)k;
+    buf[got] = '\0';
+    char *p = strstr(buf, "\nseal ");
+    if (p) snprintf(out, cap, "%.*s", (int)strcspn(p + 6, "\n"), p + 6);
+    free(buf);
+}
+
+static int do_write(conn_t *c, const char *data, size_t n)
+{
+    char line[MAX_LINE];
+    if (send_line(c->fd, "WRITE sealbench sealbench.dat size=%zu", n) < 0 ||
+        conn_read_line(c, line, sizeof(line)) < 0 ||
+        strcmp(line, "OK_READY_TO_RECEIVE") != 0)
+        return -1;
+    for (size_t off = 0; off < n; off += XFER_BUF)
+        if (send_payload(c, data + off, n - off < XFER_BUF ? n - off : XFER_BUF) < 0)
+            return -1;
+    if (conn_read_line(c, line, sizeof(line)) < 0 || strncmp(line, "WRITE_OK", 8) != 0)
+        return -1;
+    return 0;
+}
+
+static int do_get(conn_t *c, char *buf, size_t n)
+{
+    char line[MAX_LINE];
+    if (send_line(c->fd, "GET sealbench.dat -") < 0 ||
+        conn_read_line(c, line, sizeof(line)) < 0 ||
+        strncmp(line, "OK_SENDING_FILE", 15) != 0)
+        return -1;
+    for (size_t got = 0; got < n; ) {
+        ssize_t k = conn_read_payload(c, buf + got, n - got);
+        if (k <= 0) return -1;
+        got += (size_t)k;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "n:s:")) != -1) {
+        switch (ch) {
+        case 'n': g_reps = atoi(optarg); break;
+        case 's': g_size = (size_t)strtoull(optarg, NULL, 10) << 20; break;
+        default:  optind = argc + 1;
+        }
+    }
+    if (optind != argc || g_reps < 1 || g_size == 0) {
+        fprintf(stderr, "usage: %s [-n reps] [-s size_MB]\n", argv[0]);
+        return 1;
+    }
+    char *data = malloc(g_size), *back = malloc(g_size);
+    if (!data || !back) { perror("malloc"); return 1; }
+    unsigned seed = 11;
+    for (size_t i = 0; i < g_size; ++i) data[i] = (char)rand_r(&seed);
+
+    if (check_cipher() < 0) {
+        fprintf(stderr, "sealbench: cipher self-test FAILED\n");
+        return 1;
+    }
+    double ref = cipher_rate(chacha_xor_ref, back, g_size);
+    double vec = cipher_rate(chacha_xor, back, g_size);
+    printf("chacha20 self-test ok; scalar %.0f MB/s, %d-lane vector %.0f MB/s (%.1fx)\n",
+           ref, CHACHA_LANES, vec, vec / ref);
+
+    conn_t c;
+    if (connect_to(&c) < 0) {
+        fprintf(stderr, "sealbench: cannot reach rfserver on port %d\n", PORT);
+        return 1;
+    }
+    char state[128];
+    seal_state(&c, state, sizeof(state));
+    printf("server seal: %s\n", state);
+    printf("%-6s %10s %9s %9s %9s %11s\n", "op", "bytes", "MB/s", "ms/op", "best ms",
+           "serial +ms");
+
+    double tw = 0, tg = 0, bw = 1e9, bg = 1e9;
+    int ok = 1;
+    for (int i = 0; i < g_reps && ok; ++i) {
+        double t0 = now_sec();
+        if (do_write(&c, data, g_size) < 0) { ok = 0; break; }
+        double t1 = now_sec();
+        if (do_get(&c, back, g_size) < 0) { ok = 0; break; }
+        double t2 = now_sec();
+        if (memcmp(data, back, g_size) != 0) {
+            fprintf(stderr, "sealbench: GET returned different bytes\n");
+            ok = 0;
+        }
+        tw += t1 - t0; tg += t2 - t1;
+        if (t1 - t0 < bw) bw = t1 - t0;
+        if (t2 - t1 < bg) bg = t2 - t1;
+    }
+    send_line(c.fd, "RM sealbench.dat");
+    close(c.fd);
+    conn_release(&c);
+    if (!ok) { fprintf(stderr, "sealbench: transfer failed\n"); return 1; }
+
+    double serial = g_size / (vec * 1e6) * 1e3;
+    printf("%-6s %10zu %9.1f %9.1f %9.1f %11.1f\n", "WRITE", g_size,
+           g_size * g_reps / tw / 1e6, tw / g_reps * 1e3, bw * 1e3, serial);
+    printf("%-6s %10zu %9.1f %9.1f %9.1f %11.1f\n", "GET", g_size,
+           g_size * g_reps / tg / 1e6, tg / g_reps * 1e3, bg * 1e3, serial);
+    free(data); free(back);
+    return 0;
+}
@@ -1,256 +1,2654 @@
 /* --------------------------------------------------------------------
  *  server.c  –  multi‑threaded remote‑file‑system server
- *               now with per‑file flock() to protect concurrent access
+ *               with byte‑range locks to protect concurrent access
  * ------------------------------------------------------------------ */
  #include "server.h"
+ #include "permtable.h"
+ #include "filecache.h"
+ #include "proto.h"
+ #include "chunkstore.h"
+ #include "cdc.h"
+#include "upload.h"
+#include "stats.h"
+#include "logger.h"
+#include "workpool.h"
+#include "dircache.h"
+#include "delta.h"
+#include "diskio.h"
+#include "seal.h"
+#include "admit.h"
+#include "replica.h"
+#include "crc32c.h"
+#include "fairq.h"
+#include "msgstore.h"
 
- #include <sys/file.h>   /* flock()  */
+ #include "rangelock.h"
  #include <fcntl.h>      /* open()   */
  #include <sys/stat.h>   /* mkdir()  */
+ #include <limits.h>     /* INT_MAX  */
+ #include <signal.h>     /* SIGPIPE  */
+#include <sys/xattr.h> /* fgetxattr() */
+#include <netinet/tcp.h>/* TCP_NODELAY */
+#include <sys/prctl.h> /* PR_SET_PDEATHSIG */
+#include <sys/wait.h>  /* waitpid() */
  
- /* ----------  global permission table (unchanged)  ----------------- */
- #define MAX_FILES 100
+ /* rfserver -C: store uploads as deduplicated chunks + manifests */
+ static int g_chunked = 0;
+ 
+ /* rfserver -Z: turn down clients that ask for compressed payloads */
+ static int g_no_compress = 0;
+ 
+ /* rfserver -P: number of shard processes serving the port */
+ static int g_shards = 1;
+ 
+ /* rfserver -p: port to listen on */
+ static int g_port = PORT;
+ 
+ /* rfserver -F: a read-only follower of a primary (see replica.h) */
+ static int g_follower = 0;
+ 
+ /* remotePath was written, replaced or removed: drop its cached
+  * content and refresh its directory entry */
+ static void file_changed(const char *remotePath)
+ {
+     filecache_invalidate(remotePath);
+     dircache_touch(remotePath);
+     repl_changed(remotePath);
+ }
+ 
+ static permission_t parse_perm(const char *s)
+ {
+     if (!s)                        return READ_WRITE;
+     if (strcasecmp(s, "RO") == 0)  return READ_ONLY;
+     return READ_WRITE;
+ }
+ 
+ /* Discard the rest of a payload we could not store (and the CRC line
+  * after it when the client sends one), so the connection stays in
+  * sync for the next request. */
+ static int drain_payload(conn_t *c, unsigned long long left, int trailer)
+ {
+     char buf[XFER_BUF];
+     while (left > 0) {
+         ssize_t n = conn_read(c, buf, left < sizeof(buf) ? left : sizeof(buf));
+         if (n <= 0) return -1;
+         left -= (unsigned long long)n;
+     }
+     return trailer && conn_read_line(c, buf, sizeof(buf)) < 0 ? -1 : 0;
+ }
+ 
+ /* permission logic: the first WRITE of a path decides RO/RW, later
+  * writes are refused once the path is read-only.  Returns 1 when the
+  * write must not go ahead; *first is set when this write created the
+  * path's entry, which write_failed() takes back if the write fails. */
+ static int write_denied(const char *remotePath, const char *permStr, int *first)
+ {
+     permission_t perm;
+     *first = permtable_set_if_absent(remotePath, parse_perm(permStr), &perm);
+     return !*first && perm == READ_ONLY;
+ }
+ 
+ /* A first write that did not land decides nothing: otherwise a failed
+  * RO write would leave the path read-only with no file behind it. */
+ static void write_failed(const char *remotePath, int first)
+ {
+     if (first) permtable_remove(remotePath);
+ }
+ 
+ /* write_denied() that also sends the refusal */
+ static int write_refused(conn_t *c, const char *remotePath, const char *permStr,
+                          int *first)
+ {
+     if (write_denied(remotePath, permStr, first)) {
+         send_line(c->fd, "ERR_FILE_IS_READ_ONLY");
+         LOG("[Server]  -> rejected (read‑only)\n");
+         return 1;
+     }
+     return 0;
+ }
+ 
+ /* ====================================================================
+  *  CRC32C checksums  --------------------------------------------------
+  *    WRITE/APPEND/PUT_PART ... crc=1 + payload + "CRC <hex>"
+  *      -> ERR_CHECKSUM_MISMATCH if the bytes that arrived differ
+  *    GET ... crc=1 -> OK_SENDING_FILE ... + payload + "CRC <hex>"
+  *  The sum of a whole file is kept in its "user.rfs.crc32c" xattr
+  *  together with the size and mtime it describes, sealed like the
+  *  data under -E.  A full WRITE or DELTA stores the sum of the bytes
+  *  as they arrived, APPEND extends it, a ranged write drops it, and a
+  *  whole-file GET of a file without one stores the sum of what it
+  *  read.  A GET that finds one sends it instead of summing what it
+  *  reads back, so the client checks the bytes against the upload.
+  * ===================================================================*/
+ #define CRC_XATTR "user.rfs.crc32c"
+ 
+ typedef struct {
+     uint32_t crc;
+     uint32_t pad;
+     uint64_t size;
+     uint64_t mtime_ns;
+ } crc_meta_t;
+ 
+ /* did the client ask for a CRC line after the payload? */
+ static int wants_crc(request_t *r)
+ {
+     const char *v = req_opt(r, "crc");
+     return v && strcmp(v, "1") == 0;
+ }
+ 
+ static uint64_t mtime_ns(const struct stat *st)
+ {
+     return (uint64_t)st->st_mtim.tv_sec * 1000000000ULL + (uint64_t)st->st_mtim.tv_nsec;
+ }
+ 
+ /* The stored sum of fd's file, if it still describes st: 1 and *crc,
+  * else 0.  Chunked files (manifests) have none. */
+ static int crc_meta_get(int fd, const struct stat *st, uint32_t *crc)
+ {
+     crc_meta_t m;
+     if (g_chunked ||
+         fgetxattr(fd, CRC_XATTR, &m, sizeof(m)) != (ssize_t)sizeof(m) ||
+         m.size != (uint64_t)st->st_size || m.mtime_ns != mtime_ns(st))
+         return 0;
+     const uint8_t *nonce = seal_nonce(fd);
+     if (nonce) seal_apply(nonce, &m.crc, sizeof(m.crc), SEAL_META_OFF);
+     *crc = m.crc;
+     return 1;
+ }
+ 
+ /* Store crc as the sum of fd's file as it is now.  Best effort: a
+  * file without one is summed by the next whole GET instead. */
+ static void crc_meta_set(int fd, uint32_t crc)
+ {
+     struct stat st;
+     if (g_chunked || fstat(fd, &st) < 0) return;
+     crc_meta_t m = { crc, 0, (uint64_t)st.st_size, mtime_ns(&st) };
+     const uint8_t *nonce = seal_nonce(fd);
+     if (nonce) seal_apply(nonce, &m.crc, sizeof(m.crc), SEAL_META_OFF);
+     fsetxattr(fd, CRC_XATTR, &m, sizeof(m), 0);
+ }
+ 
+ /* An in-place write may leave size and mtime as they were (same clock
+  * tick), so it removes the sum outright. */
+ static void crc_meta_drop(int fd)
+ {
+     fremovexattr(fd, CRC_XATTR);
+ }
+ 
+ /* Read the "CRC <hex>" line after a crc=1 upload and hold it against
+  * sum, the CRC of what arrived: 0 if they match, 1 if not, -1 if the
+  * line is missing (the connection is out of sync). */
+ static int crc_check(conn_t *c, uint32_t sum)
+ {
+     char line[MAX_LINE];
+     unsigned sent;
+     if (conn_read_line(c, line, sizeof(line)) < 0 ||
+         sscanf(line, "CRC %8x", &sent) != 1)
+         return -1;
+     if (sent == sum) return 0;
+     stats_crc_mismatch();
+     LOG("[Server]  -> checksum mismatch: received %08x, client sent %08x\n",
+         sum, sent);
+     return 1;
+ }
+ 
+ static int send_crc(conn_t *c, uint32_t sum, int stored)
+ {
+     stats_crc_sent(stored);
+     return send_line(c->fd, "CRC %08x", sum);
+ }
+ 
+ /* ====================================================================
+  *  Chunked storage helpers (rfserver -C)
+  * ===================================================================*/
+ static void manifest_unref(const manifest_t *m)
+ {
+     for (size_t i = 0; i < m->n; ++i)
+         chunkstore_unref(m->chunks[i].hash);
+ }
+ 
+ static double dedup_ratio(void)
+ {
+     cs_stats_t st;
+     chunkstore_get_stats(&st);
+     return st.physical ? (double)st.logical / st.physical : 1.0;
+ }
+ 
+ /* Publish m (whose chunk references the caller holds) as the new
+  * content of the locked file fd, releasing whatever it replaces. */
+ static int commit_manifest(int fd, const manifest_t *m)
+ {
+     manifest_t old;
+     int had = manifest_read(fd, &old) == 1;
+     if (manifest_write(fd, m) < 0) {
+         if (had) manifest_free(&old);
+         return -1;
+     }
+     chunkstore_account((long long)m->size);
+     if (had) {
+         manifest_unref(&old);
+         chunkstore_account(-(long long)old.size);
+         manifest_free(&old);
+     }
+     return 0;
+ }
+ 
+ /* Full WRITE in chunked mode: cut the incoming stream into
+  * content-defined chunks and store only the ones we lack. */
+ static int handle_write_chunked(conn_t *c, const char *remotePath,
+                                 const char *full, unsigned long long size,
+                                 int want_crc, int first)
+ {
+     int fd = open(full, O_RDWR | O_CREAT, 0666);
+     if (fd < 0) {
+         perror("open");
+         write_failed(remotePath, first);
+         send_line(c->fd, "ERR_OPEN");
+         return 0;
+     }
+     if (range_lock(fd, 1, 0, RANGE_EOF) < 0) { perror("range_lock"); close(fd);
+         write_failed(remotePath, first);
+         send_line(c->fd, "ERR_FLOCK_FAILED"); return 0; }
+ 
+     send_line(c->fd, "OK_READY_TO_RECEIVE");
+ 
+     uint8_t *buf = malloc(2 * CDC_MAX);
+     size_t   have = 0;
+     unsigned long long got = 0;
+     uint32_t sum = 0;
+     int eof = 0, io_err = !buf, net_err = 0, bad_crc = 0;
+     manifest_t m = {0};
+ 
+     while (buf && (!eof || have > 0)) {
+         if (!eof && have < CDC_MAX) {
+             size_t want = 2 * CDC_MAX - have;
+             if (size - got < want) want = (size_t)(size - got);
+             ssize_t n = want ? conn_read_payload(c, buf + have, want) : 0;
+             if (n <= 0) { eof = 1; net_err = got < size; }
+             else {
+                 sum = crc32c(sum, buf + have, (size_t)n);
+                 have += (size_t)n; got += (unsigned long long)n;
+             }
+             continue;
+         }
+         size_t  cut = cdc_cut(buf, have);
+         uint8_t h[SHA256_LEN];
+         sha256(buf, cut, h);
+         if (!io_err) {
+             if (!chunkstore_ref(h) && chunkstore_put(h, buf, cut) < 0)
+                 io_err = 1;
+             else if (manifest_add(&m, h, (uint32_t)cut) < 0) {
+                 chunkstore_unref(h);
+                 io_err = 1;
+             }
+         }
+         memmove(buf, buf + cut, have - cut);
+         have -= cut;
+         if (net_err) break;
+     }
+     free(buf);
+ 
+     if (want_crc && !net_err) {
+         int k = crc_check(c, sum);
+         if (k < 0) net_err = 1;
+         else       bad_crc = k;
+     }
+     if (!io_err && !net_err && !bad_crc && commit_manifest(fd, &m) < 0) io_err = 1;
+     if (io_err || net_err || bad_crc) {
+         manifest_unref(&m);
+         write_failed(remotePath, first);
+     }
+     range_unlock(fd);
+     close(fd);
+     file_changed(remotePath);
+ 
+     unsigned long long fsize = m.size;
+     manifest_free(&m);
+     if (net_err) {
+         LOG("[Server]  -> client vanished after %llu bytes\n", got);
+         return -1;
+     }
+     if (io_err || bad_crc) {
+         send_line(c->fd, bad_crc ? "ERR_CHECKSUM_MISMATCH" : "ERR_WRITE_FAILED");
+         return 0;
+     }
+     double ratio = dedup_ratio();
+     send_line(c->fd, "WRITE_OK %llu size=%llu dedup=%.2f", got, fsize, ratio);
+     LOG("[Server]  -> stored %llu bytes as chunks (dedup ratio %.2f)\n",
+            fsize, ratio);
+     return 0;
+ }
+ 
+ /* ====================================================================
+  *  DWRITE  ------------------------------------------------------------
+  *    DWRITE <local> <remote> [RO|RW] chunks=N size=S
+  *    followed by N lines "<sha256 hex> <len>" (the file's chunk list).
+  *  Reply: "NEED k" and k lines holding the indices of chunks the
+  *  server lacks; the client sends just those chunks back to back and
+  *  gets "WRITE_OK <bytes sent> size=S new=k dedup=<ratio>".
+  * ===================================================================*/
+ 
+ /* tiny open-addressing set of chunk indices, keyed by digest */
+ typedef struct { size_t *slot; size_t mask; const manifest_t *m; } idxset_t;
+ 
+ static int idxset_add(idxset_t *s, size_t i)    /* 0 if already there */
+ {
+     const uint8_t *h = s->m->chunks[i].hash;
+     uint64_t key;
+     memcpy(&key, h, sizeof(key));
+     for (size_t p = key & s->mask; ; p = (p + 1) & s->mask) {
+         if (s->slot[p] == (size_t)-1) { s->slot[p] = i; return 1; }
+         if (memcmp(s->m->chunks[s->slot[p]].hash, h, SHA256_LEN) == 0)
+             return 0;
+     }
+ }
+ 
+ static int handle_dwrite(conn_t *c, request_t *r)
+ {
+     char *remotePath = r->args[1];
+     char *permStr    = (r->nargs > 2) ? r->args[2] : NULL;
+     unsigned long long nchunks, size;
+     if (!req_opt_u64(r, "chunks", &nchunks) || !req_opt_u64(r, "size", &size)) {
+         send_line(c->fd, "ERR_BAD_ARGS");
+         return -1;                          /* cannot resync */
+     }
+     LOG("[Server] DWRITE: remote='%s' chunks=%llu size=%llu\n",
+            remotePath, nchunks, size);
+ 
+     /* the chunk list */
+     manifest_t m = {0};
+     char line[MAX_LINE];
+     for (unsigned long long i = 0; i < nchunks; ++i) {
+         char     hex[SHA256_HEX];
+         unsigned len;
+         uint8_t  h[SHA256_LEN];
+         if (conn_read_line(c, line, sizeof(line)) < 0 ||
+             sscanf(line, "%64s %u", hex, &len) != 2 ||
+             sha256_from_hex(hex, h) < 0 || len == 0 || len > CDC_MAX ||
+             manifest_add(&m, h, len) < 0) {
+             manifest_free(&m);
+             send_line(c->fd, "ERR_BAD_ARGS");
+             return -1;
+         }
+     }
+     if (m.size != size) {
+         manifest_free(&m);
+         send_line(c->fd, "ERR_BAD_ARGS");
+         return -1;
+     }
+     if (!g_chunked) {
+         manifest_free(&m);
+         send_line(c->fd, "ERR_NOT_CHUNKED");
+         return 0;
+     }
+     int first;
+     if (write_refused(c, remotePath, permStr, &first)) {
+         manifest_free(&m);
+         return 0;
+     }
+ 
+     /* which chunks do we lack?  held[i] marks references we own */
+     size_t   cap  = 16;
+     while (cap < 2 * m.n) cap <<= 1;
+     idxset_t set  = { malloc(cap * sizeof(size_t)), cap - 1, &m };
+     uint8_t *held = calloc(m.n ? m.n : 1, 1);
+     size_t  *need = malloc((m.n ? m.n : 1) * sizeof(size_t));
+     size_t   k = 0;
+     if (!set.slot || !held || !need) {
+         free(set.slot); free(held); free(need); manifest_free(&m);
+         write_failed(remotePath, first);
+         send_line(c->fd, "ERR_NO_MEMORY");
+         return 0;
+     }
+     memset(set.slot, 0xff, cap * sizeof(size_t));
+     for (size_t i = 0; i < m.n; ++i) {
+         if (!idxset_add(&set, i)) continue;             /* repeat in file */
+         if (chunkstore_ref(m.chunks[i].hash)) held[i] = 1;
+         else need[k++] = i;
+     }
+     free(set.slot);
+ 
+     /* NEED k + k indices, batched into as few sends as possible */
+     char   out[XFER_BUF];
+     size_t used = (size_t)snprintf(out, sizeof(out), "NEED %zu\n", k);
+     int    rc   = 0;
+     for (size_t j = 0; j < k && rc == 0; ++j) {
+         if (used + 32 > sizeof(out)) { rc = send_all(c->fd, out, used); used = 0; }
+         used += (size_t)snprintf(out + used, sizeof(out) - used, "%zu\n", need[j]);
+     }
+     if (rc == 0) rc = send_all(c->fd, out, used);
+ 
+     /* receive the missing chunks in the order we asked for them */
+     uint8_t *chunk = malloc(CDC_MAX);
+     unsigned long long got = 0;
+     int bad = !chunk;
+     for (size_t j = 0; j < k && rc == 0; ++j) {
+         size_t i = need[j], len = m.chunks[i].len;
+         if (!chunk) { rc = drain_payload(c, len, 0); continue; }
+         if (conn_read_full(c, chunk, len) < 0) { rc = -1; break; }
+         got += len;
+         if (!bad && chunkstore_put(m.chunks[i].hash, chunk, len) == 0) held[i] = 1;
+         else bad = 1;
+     }
+     free(chunk);
+     free(need);
+ 
+     /* repeats inside the file each need their own reference */
+     for (size_t i = 0; i < m.n && rc == 0 && !bad; ++i)
+         if (!held[i]) {
+             if (chunkstore_ref(m.chunks[i].hash)) held[i] = 1;
+             else bad = 1;
+         }
+ 
+     if (rc == 0 && !bad) {
+         char full[BUF_SIZE];
+         snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, remotePath);
+         int fd = open(full, O_RDWR | O_CREAT, 0666);
+         if (fd < 0 || range_lock(fd, 1, 0, RANGE_EOF) < 0 ||
+             commit_manifest(fd, &m) < 0)
+             bad = 1;
+         if (fd >= 0) { range_unlock(fd); close(fd); }
+         file_changed(remotePath);
+     }
+     if (rc < 0 || bad)
+         for (size_t i = 0; i < m.n; ++i)
+             if (held[i]) chunkstore_unref(m.chunks[i].hash);
+     free(held);
+     if (rc < 0 || bad) write_failed(remotePath, first);
+ 
+     if (rc < 0) { manifest_free(&m); return -1; }
+     if (bad) {
+         send_line(c->fd, "ERR_WRITE_FAILED");
+     } else {
+         double ratio = dedup_ratio();
+         send_line(c->fd, "WRITE_OK %llu size=%llu new=%zu dedup=%.2f",
+                   got, m.size, k, ratio);
+         LOG("[Server]  -> %zu of %zu chunks were new (%llu bytes), "
+                "dedup ratio %.2f\n", k, m.n, got, ratio);
+     }
+     manifest_free(&m);
+     return 0;
+ }
+ 
+ /* ====================================================================
+  *  WRITE / APPEND  ----------------------------------------------------
+  *    WRITE  <local> <remote> [RO|RW] size=N [offset=M] [crc=1]
+  *    APPEND <local> <remote> [RO|RW] size=N [crc=1]
+  *  Without offset= a WRITE replaces the whole file: the payload goes
+  *  to a hidden temp file that rename() publishes once it is complete,
+  *  so readers never wait for it and never see half of it.  With
+  *  offset= the payload overwrites bytes [M, M+N) in place.  size= is
+  *  required (ERR_BAD_ARGS without it).  The client sends the payload
+  *  only after OK_READY_TO_RECEIVE, so an error before that needs no
+  *  draining.
+  * ===================================================================*/
+ 
+ /* Make the finished temp file tmp the new content of full.  Readers
+  * that already opened the old file finish reading the old version;
+  * new opens see the new one.  No lock: rename() is atomic. */
+ static int publish_file(const char *tmp, const char *full, const char *remotePath)
+ {
+     int rc = rename(tmp, full);
+     if (rc < 0) { perror("rename"); unlink(tmp); }
+     file_changed(remotePath);
+     return rc;
+ }
+ 
+ /* Exclusive lock for a write: [offset, offset+size) for a ranged
+  * write, the current end of file onwards for an append, else the
+  * whole file.  An append re-checks the size once it holds the lock,
+  * since the file may have shrunk meanwhile. */
+ static int lock_write_range(int fd, int append, int ranged,
+                             unsigned long long offset, unsigned long long size)
+ {
+     if (ranged) return range_lock(fd, 1, (off_t)offset, (off_t)size);
+     if (!append) return range_lock(fd, 1, 0, RANGE_EOF);
+     struct stat st;
+     for (;;) {
+         if (fstat(fd, &st) < 0) return -1;
+         off_t from = st.st_size;
+         if (range_lock(fd, 1, from, RANGE_EOF) < 0) return -1;
+         if (fstat(fd, &st) < 0) return -1;
+         if (st.st_size >= from) return 0;
+         range_unlock(fd);
+     }
+ }
+ 
+ /* open + lock for an in-place (ranged / append) write.  If a full
+  * WRITE renamed a new file over the path while we waited for the
+  * lock, our bytes belong in the new file: reopen and retry. */
+ static int open_in_place(const char *full, int flags, int append, int ranged,
+                          unsigned long long offset, unsigned long long size)
+ {
+     for (;;) {
+         int fd = diskio_open(full, flags, 0666);
+         if (fd < 0) return -1;
+         if (lock_write_range(fd, append, ranged, offset, size) < 0) {
+             close(fd);
+             return -1;
+         }
+         struct stat mine, now;
+         if (fstat(fd, &mine) == 0 && stat(full, &now) == 0 &&
+             mine.st_ino == now.st_ino && mine.st_dev == now.st_dev)
+             return fd;
+         range_unlock(fd);
+         close(fd);
+     }
+ }
+ 
+ static int handle_write(conn_t *c, request_t *r, int append)
+ {
+     char *remotePath = r->args[1];
+     char *permStr    = (r->nargs > 2) ? r->args[2] : NULL;
+ 
+     unsigned long long size = 0, offset = 0;
+     int sized   = req_opt_u64(r, "size", &size);
+     int ranged  = req_opt_u64(r, "offset", &offset);
+     int want_crc = wants_crc(r);
+ 
+     LOG("[Server] %s: remote='%s' perm='%s' size=%llu offset=%llu\n",
+            append ? "APPEND" : "WRITE", remotePath,
+            permStr ? permStr : "(default RW)", size, offset);
+ 
+     if (!sized || (append && ranged))
+         return send_line(c->fd, "ERR_BAD_ARGS");
+ 
+     int first;
+     if (write_refused(c, remotePath, permStr, &first))
+         return 0;                           /* client sends nothing */
+ 
+     char full[BUF_SIZE];
+     snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, remotePath);
+ 
+     if (g_chunked && !append && !ranged)
+         return handle_write_chunked(c, remotePath, full, size, want_crc, first);
+ 
+     /* A full write fills a private temp file (no lock needed); an
+      * in-place write locks just the bytes it will touch.  A manifest
+      * is always locked whole. */
+     int  replace = !append && !ranged;
+     char tmp[BUF_SIZE + 64];
+     int  fd;
+     if (replace) {
+         upload_tmp_path(tmp, sizeof(tmp), full, "write", upload_new_id());
+         fd = diskio_open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+     } else {
+         int flags = (g_chunked ? O_RDWR : O_WRONLY) | O_CREAT | (append ? O_APPEND : 0);
+         fd = open_in_place(full, flags, append, ranged && !g_chunked, offset, size);
+     }
+     if (fd < 0) {
+         perror("open");
+         write_failed(remotePath, first);
+         send_line(c->fd, "ERR_OPEN");
+         return 0;
+     }
+     /* an append extends the file's stored sum, a ranged write voids it */
+     uint32_t old_sum = 0;
+     int      had_sum = 0;
+     if (append) {
+         /* O_APPEND ignores the offset, but a sealed file's keystream
+          * is addressed by it: the bytes land at the current end,
+          * which the tail lock keeps still */
+         struct stat st;
+         if (fstat(fd, &st) == 0) {
+             offset  = (unsigned long long)st.st_size;
+             had_sum = crc_meta_get(fd, &st, &old_sum);
+         }
+     } else if (ranged) {
+         crc_meta_drop(fd);
+     }
+     if (g_chunked) {
+         /* partial updates of a manifest would corrupt it */
+         manifest_t m;
+         int rc = manifest_read(fd, &m);
+         manifest_free(&m);
+         if (rc != 0) {
+             range_unlock(fd); close(fd);
+             write_failed(remotePath, first);
+             send_line(c->fd, "ERR_CHUNKED_FILE");
+             return 0;
+         }
+     }
+     /* tell client to send data */
+     send_line(c->fd, "OK_READY_TO_RECEIVE");
+ 
+     /* store one buffer while the next one arrives.  Writes go out one
+      * at a time and in order, so with O_APPEND (which ignores the
+      * offset) they still land back to back. */
+     char bufs[2][XFER_BUF];
+     dio_t d;
+     ssize_t pending = 0;                    /* bytes of the write in flight */
+     int cur = 0;
+     unsigned long long got = 0;
+     uint32_t sum = 0;                       /* CRC32C of the payload */
+     int io_err = 0, net_err = 0, bad_crc = 0;
+     while (got < size) {
+         size_t want = XFER_BUF;
+         if (size - got < want) want = (size_t)(size - got);
+         ssize_t n = conn_read_payload(c, bufs[cur], want);
+         if (n <= 0) { net_err = 1; break; }
+         fair_take((size_t)n);
+         sum = crc32c(sum, bufs[cur], (size_t)n);  /* before a seal encrypts it */
+         if (pending && dio_wait(&d) != pending) { perror("write"); io_err = 1; }
+         pending = 0;
+         if (!io_err) {
+             dio_write(&d, fd, bufs[cur], (size_t)n, (off_t)(offset + got));
+             pending = n;
+         }
+         fair_give();
+         got += (unsigned long long)n;
+         cur ^= 1;
+     }
+     if (pending && dio_wait(&d) != pending) { perror("write"); io_err = 1; }
+     if (want_crc && !net_err) {
+         int k = crc_check(c, sum);
+         if (k < 0) net_err = 1;
+         else       bad_crc = k;
+     }
+     int ok = !io_err && !net_err && !bad_crc;
+ 
+     struct stat st;
+     unsigned long long fsize = (fstat(fd, &st) == 0) ? (unsigned long long)st.st_size : 0;
+     if (replace) {
+         /* durable before it becomes visible: a crash leaves the old
+          * file or the whole new one, never a torn mix */
+         if (ok) crc_meta_set(fd, sum);
+         if (ok && fdatasync(fd) < 0) { perror("fdatasync"); io_err = 1; }
+         close(fd);
+         if (io_err || net_err || bad_crc) unlink(tmp);
+         else if (publish_file(tmp, full, remotePath) < 0) io_err = 1;
+     } else {
+         if (ok && had_sum) crc_meta_set(fd, crc32c_combine(old_sum, sum, got));
+         range_unlock(fd);
+         close(fd);
+         /* the file changed on every path out of here */
+         file_changed(remotePath);
+     }
+     if (net_err || io_err || bad_crc) write_failed(remotePath, first);
+ 
+     if (net_err) {
+         LOG("[Server]  -> client vanished after %llu bytes\n", got);
+         return -1;
+     }
+     if (io_err || bad_crc) {
+         send_line(c->fd, bad_crc ? "ERR_CHECKSUM_MISMATCH" : "ERR_WRITE_FAILED");
+         return 0;
+     }
+     send_line(c->fd, "WRITE_OK %llu size=%llu", got, fsize);
+     LOG("[Server]  -> wrote %llu bytes to '%s'\n", got, full);
+     return 0;
+ }
+ 
+ /* ====================================================================
+  *  GET  ---------------------------------------------------------------
+  *    GET <remote> <local> [offset=M] [length=N] [if_none_match=<ver>]
+  *        [if_match=<ver>] [crc=1]
+  *  Reply: "OK_SENDING_FILE <n> size=<total> ver=<ver>" + n bytes
+  *         (+ "CRC <hex>" with crc=1), or
+  *         "NOT_MODIFIED ver=<ver>" when the file is still version <ver>, or
+  *         "ERR_VERSION_CHANGED ver=<ver>" when it is no longer (or may
+  *         no longer be) the if_match= version.
+  * ===================================================================*/
+ 
+ /* Version token of a file: inode, size and mtime.  A full WRITE
+  * renames a new inode into place and APPEND changes the size; an
+  * in-place ranged write changes the mtime, unless it falls in the
+  * same clock tick as the previous write.  So a token taken while the
+  * mtime is that fresh is marked racy ("~") and never matches. */
+ static void file_version(const struct stat *st, char *out, size_t cap)
+ {
+     struct timespec now;
+     clock_gettime(CLOCK_REALTIME, &now);
+     int racy = st->st_mtim.tv_sec >= now.tv_sec - 1;
+     snprintf(out, cap, "%llx-%llx-%llx%s",
+              (unsigned long long)st->st_ino, (unsigned long long)st->st_size,
+              (unsigned long long)st->st_mtim.tv_sec * 1000000000ULL +
+                  (unsigned long long)st->st_mtim.tv_nsec,
+              racy ? "~" : "");
+ }
+ 
+ /* does the client's if_none_match= name version ver? */
+ static int version_matches(request_t *r, const char *ver)
+ {
+     const char *want = req_opt(r, "if_none_match");
+     return want && *ver && !strchr(ver, '~') && strcmp(want, ver) == 0;
+ }
+ 
+ /* does the client's if_match= name a version other than ver?  A racy
+  * ver might hide an in-place write, so it never matches either. */
+ static int version_changed(request_t *r, const char *ver)
+ {
+     const char *want = req_opt(r, "if_match");
+     return want && (!*ver || strchr(ver, '~') || strcmp(want, ver) != 0);
+ }
+ 
+ /* Cached content of remotePath, or NULL.  With -P another shard may
+  * have replaced the file behind this process's back, so a hit is
+  * first held against the version on disk: one stat(), still no open
+  * and no lock.  Unless racy_ok, an entry with a racy version token
+  * ("~") is passed over too.  Only an entry actually handed back
+  * counts as a cache hit. */
+ static fc_buf_t *cache_lookup(const char *remotePath, int racy_ok)
+ {
+     if (!filecache_max_entry()) return NULL;
+     fc_buf_t *hit = filecache_peek(remotePath);
+     if (hit && !racy_ok && strchr(hit->ver, '~')) {
+         filecache_release(hit);
+         hit = NULL;
+     }
+     if (hit && g_shards > 1) {
+         char full[BUF_SIZE], ver[VER_LEN] = "";
+         struct stat st;
+         snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, remotePath);
+         if (stat(full, &st) == 0) file_version(&st, ver, sizeof(ver));
+         if (strcmp(ver, hit->ver) != 0) {
+             filecache_release(hit);
+             filecache_invalidate(remotePath);
+             hit = NULL;
+         }
+     }
+     filecache_count(hit != NULL);
+     return hit;
+ }
+
+ /* pread() from a plain file, or through its manifest when m != NULL */
+ static ssize_t object_pread(int fd, const manifest_t *m, void *buf,
+                             size_t len, unsigned long long off)
+ {
+     if (m) return manifest_pread(m, buf, len, off);
+     return diskio_pread(fd, buf, len, (off_t)off);
+ }
+ 
+ /* clamp [offset, offset+length) to a file of `total` bytes */
+ static int get_range(request_t *r, unsigned long long total,
+                      unsigned long long *off, unsigned long long *len)
+ {
+     unsigned long long o = 0, n = 0;
+     req_opt_u64(r, "offset", &o);
+     if (o > total) return -1;
+     if (!req_opt_u64(r, "length", &n) || n > total - o)
+         n = total - o;
+     *off = o; *len = n;
+     return 0;
+ }
+ 
+ /* Send bytes [off, off+len) of a plain file, reading the next buffer
+  * while the current one goes out, and sum them into *sum unless it is
+  * NULL.  -1 if the file came up short or the client went away. */
+ static int stream_file(conn_t *c, int fd, unsigned long long off,
+                        unsigned long long len, unsigned long long *sent,
+                        uint32_t *sum)
+ {
+     char   bufs[2][XFER_BUF];
+     dio_t  d;
+     int    cur = 0, pending = 0, rc = 0;
+     unsigned long long done = 0;
+     if (len == 0) return 0;
+     dio_read(&d, fd, bufs[0], len < XFER_BUF ? (size_t)len : XFER_BUF, (off_t)off);
+     pending = 1;
+     while (done < len) {
+         fair_take(len - done < XFER_BUF ? (size_t)(len - done) : XFER_BUF);
+         ssize_t n = dio_wait(&d);
+         pending = 0;
+         if (n <= 0) { fair_give(); rc = -1; break; }  /* shrank under us: resync */
+         unsigned long long next = done + (unsigned long long)n;
+         if (next < len) {
+             size_t want = len - next < XFER_BUF ? (size_t)(len - next) : XFER_BUF;
+             dio_read(&d, fd, bufs[cur ^ 1], want, (off_t)(off + next));
+             pending = 1;
+         }
+         if (sum) *sum = crc32c(*sum, bufs[cur], (size_t)n);
+         fair_give();
+         if (send_payload(c, bufs[cur], (size_t)n) < 0) { rc = -1; break; }
+         done = next;
+         cur ^= 1;
+     }
+     if (pending) dio_wait(&d);              /* it reads into our stack */
+     *sent = done;
+     return rc;
+ }
+ 
+ static int handle_get(conn_t *c, request_t *r)
+ {
+     char *remotePath = r->args[0];
+     unsigned long long off, len;
+     int want_crc = wants_crc(r);
+     LOG("[Server] GET: remote='%s'\n", remotePath);
+ 
+     /* hot path: straight from memory, no open/lock round trip (a
+      * racy version is rechecked against the disk below) */
+     fc_buf_t *hit = cache_lookup(remotePath, 0);
+     if (hit) {
+         int rc = 0;
+         if (version_matches(r, hit->ver)) {
+             rc = send_line(c->fd, "NOT_MODIFIED ver=%s", hit->ver);
+             LOG("[Server]  -> not modified (cached)\n");
+         } else if (version_changed(r, hit->ver)) {
+             rc = send_line(c->fd, "ERR_VERSION_CHANGED ver=%s", hit->ver);
+         } else if (get_range(r, hit->len, &off, &len) < 0) {
+             send_line(c->fd, "ERR_BAD_RANGE");
+         } else {
+             fair_pace((size_t)len);
+             send_line(c->fd, "OK_SENDING_FILE %llu size=%zu ver=%s", len,
+                       hit->len, hit->ver);
+             rc = send_payload(c, hit->data + off, (size_t)len);
+             if (rc == 0 && want_crc) {
+                 int all = len == hit->len;
+                 rc = send_crc(c, all ? hit->crc : crc32c(0, hit->data + off, (size_t)len), all);
+             }
+             LOG("[Server]  -> sent %llu bytes (cached)\n", len);
+         }
+         filecache_release(hit);
+         return rc;
+     }
+     uint64_t gen = filecache_generation(remotePath);
+ 
+     char full[BUF_SIZE];
+     snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, remotePath);
+ 
+     int fd = diskio_open(full, O_RDONLY, 0);
+     if (fd < 0) {
+         send_line(c->fd, "ERR_FILE_NOT_FOUND");
+         LOG("[Server]  -> not found\n");
+         return 0;
+     }
+     /* Shared lock on just the requested bytes, so writers elsewhere in
+      * the file carry on.  A whole-file GET (which may fill the cache)
+      * and any read through a manifest lock everything. */
+     unsigned long long lo = 0, ln = 0;
+     req_opt_u64(r, "offset", &lo);
+     req_opt_u64(r, "length", &ln);
+     if (g_chunked) lo = ln = 0;
+     if (range_lock(fd, 0, (off_t)lo, (off_t)ln) < 0) {
+         perror("range_lock"); close(fd);
+         send_line(c->fd, "ERR_FLOCK_FAILED"); return 0; }
+     int whole = lo == 0 && ln == 0;
+ 
+     /* in chunked mode the file may be a manifest: read through it */
+     manifest_t m = {0};
+     int chunked = g_chunked ? manifest_read(fd, &m) : 0;
+     if (chunked < 0) {
+         range_unlock(fd); close(fd);
+         send_line(c->fd, "ERR_BAD_MANIFEST");
+         return 0;
+     }
+     const manifest_t *mp = chunked ? &m : NULL;
+ 
+     struct stat st;
+     char ver[VER_LEN] = "";
+     uint32_t stored = 0;
+     int      have_sum = 0;
+     if (fstat(fd, &st) == 0) {
+         file_version(&st, ver, sizeof(ver));
+         have_sum = !chunked && crc_meta_get(fd, &st, &stored);
+     }
+     unsigned long long size = chunked ? m.size : *ver ? (unsigned long long)st.st_size : 0;
+     if (version_matches(r, ver)) {
+         range_unlock(fd); close(fd);
+         manifest_free(&m);
+         LOG("[Server]  -> not modified\n");
+         return send_line(c->fd, "NOT_MODIFIED ver=%s", ver);
+     }
+     if (version_changed(r, ver)) {
+         range_unlock(fd); close(fd);
+         manifest_free(&m);
+         return send_line(c->fd, "ERR_VERSION_CHANGED ver=%s", ver);
+     }
+     if (get_range(r, size, &off, &len) < 0) {
+         range_unlock(fd); close(fd);
+         manifest_free(&m);
+         send_line(c->fd, "ERR_BAD_RANGE");
+         return 0;
+     }
+     unsigned retry;
+     if (!admit_bytes(len, &retry)) {
+         range_unlock(fd); close(fd);
+         manifest_free(&m);
+         LOG("[Server]  -> busy, retry after %u ms\n", retry);
+         return send_line(c->fd, "BUSY retry_after_ms=%u", retry);
+     }
+ 
+     if (whole && size <= filecache_max_entry()) {
+         /* small enough to cache: read it whole, then publish */
+         char  *data = malloc(size + 1);
+         size_t got  = 0;
+         ssize_t n;
+         fair_take((size_t)size);
+         while (data && got < size &&
+                (n = object_pread(fd, mp, data + got, size - got, got)) > 0)
+             got += (size_t)n;
+         /* the cached copy carries its sum, stored or taken now */
+         uint32_t sum = stored;
+         int whole_sum = have_sum && got == size;
+         if (data && !whole_sum) {
+             sum = crc32c(0, data, got);
+             if (!chunked && got == size) crc_meta_set(fd, sum);
+         }
+         fair_give();
+         range_unlock(fd);
+         close(fd);
+         manifest_free(&m);
+         if (!data) { admit_bytes_done(len); send_line(c->fd, "ERR_NO_MEMORY"); return 0; }
+ 
+         filecache_put(remotePath, data, got, gen, ver, sum);
+         unsigned long long charged = len;
+         if (off + len > got) len = off < got ? got - off : 0;
+         send_line(c->fd, "OK_SENDING_FILE %llu size=%zu ver=%s", len, got, ver);
+         int rc = send_payload(c, data + off, (size_t)len);
+         if (rc == 0 && want_crc) {
+             int all = len == got;
+             rc = send_crc(c, all ? sum : crc32c(0, data + off, (size_t)len), all && whole_sum);
+         }
+         admit_bytes_done(charged);
+         LOG("[Server]  -> sent %llu bytes\n", len);
+         free(data);
+         return rc;
+     }
+ 
+     /* too big for the cache (or ranged): stream it under the lock,
+      * summing what goes out unless the whole file's sum is stored */
+     send_line(c->fd, "OK_SENDING_FILE %llu size=%llu ver=%s", len, size, ver);
+     unsigned long long sent = 0;
+     int all = off == 0 && len == size;
+     int rc = 0;
+     uint32_t sum = 0;
+     int summing = !(all && have_sum) && (want_crc || (all && !mp));
+     if (!mp) {
+         rc = stream_file(c, fd, off, len, &sent, summing ? &sum : NULL);
+     } else {
+         char buf[XFER_BUF];
+         while (sent < len) {
+             size_t want = (len - sent < sizeof(buf)) ? (size_t)(len - sent) : sizeof(buf);
+             fair_take(want);
+             ssize_t n = object_pread(fd, mp, buf, want, off + sent);
+             if (n > 0 && summing) sum = crc32c(sum, buf, (size_t)n);
+             fair_give();
+             if (n <= 0) { rc = -1; break; }      /* shrank under us: resync */
+             if (send_payload(c, buf, (size_t)n) < 0) { rc = -1; break; }
+             sent += (unsigned long long)n;
+         }
+     }
+     if (rc == 0 && summing && all && !mp) crc_meta_set(fd, sum);
+     range_unlock(fd);
+     close(fd);
+     manifest_free(&m);
+     if (rc == 0 && want_crc)
+         rc = send_crc(c, summing ? sum : stored, !summing);
+     admit_bytes_done(len);
+     LOG("[Server]  -> sent %llu bytes\n", sent);
+     return rc;
+ }
+ 
+ /* ====================================================================
+  *  SIGS / DELTA  ------------------------------------------------------
+  *    SIGS  <remote> [block=B]
+  *      -> "SIGS_OK <k> size=<S> block=<B> ver=<ver>" + k signatures of
+  *         DELTA_SIG bytes, one per whole block of the current copy
+  *    DELTA <local> <remote> [RO|RW] size=S block=B base=<ver> sha=<hex>
+  *      -> "OK_READY_TO_RECEIVE"; the client sends delta.h ops up to
+  *         DELTA_END as a payload
+  *      -> "WRITE_OK S size=S literal=L copied=C"
+  *  The new content is rebuilt from the literals and blocks of the old
+  *  copy in a temp file, which rename() publishes like a full WRITE.
+  *  The old copy must still be version <ver> (ERR_BASE_CHANGED) and
+  *  the result must hash to sha= (ERR_DELTA_MISMATCH); on either the
+  *  client falls back to a plain WRITE.
+  * ===================================================================*/
+ 
+ /* exactly len payload bytes, 0 on success, -1 on EOF/error */
+ static int payload_read_full(conn_t *c, void *buf, size_t len)
+ {
+     char *p = buf;
+     while (len > 0) {
+         ssize_t n = conn_read_payload(c, p, len);
+         if (n <= 0) return -1;
+         p += n; len -= (size_t)n;
+     }
+     return 0;
+ }
+ 
+ static int handle_sigs(conn_t *c, request_t *r)
+ {
+     char *remotePath = r->args[0];
+     LOG("[Server] SIGS: remote='%s'\n", remotePath);
+     if (g_chunked) return send_line(c->fd, "ERR_CHUNKED_MODE");
+ 
+     char full[BUF_SIZE];
+     snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, remotePath);
+     int fd = diskio_open(full, O_RDONLY, 0);
+     if (fd < 0) return send_line(c->fd, "ERR_FILE_NOT_FOUND");
+     /* whole file: in-place writers wait, full WRITEs rename past us */
+     if (range_lock(fd, 0, 0, 0) < 0) {
+         close(fd);
+         return send_line(c->fd, "ERR_FLOCK_FAILED");
+     }
+     struct stat st;
+     char ver[VER_LEN] = "";
+     if (fstat(fd, &st) == 0) file_version(&st, ver, sizeof(ver));
+     unsigned long long size = *ver ? (unsigned long long)st.st_size : 0, blk;
+     if (!req_opt_u64(r, "block", &blk) || blk < DELTA_MIN_BLOCK || blk > DELTA_MAX_BLOCK)
+         blk = delta_block_size(size);
+     uint8_t *data = malloc(blk);
+     if (!data) {
+         range_unlock(fd); close(fd);
+         return send_line(c->fd, "ERR_NO_MEMORY");
+     }
+ 
+     unsigned long long k = size / blk;
+     int rc = send_line(c->fd, "SIGS_OK %llu size=%llu block=%llu ver=%s",
+                        k, size, blk, ver);
+     uint8_t out[XFER_BUF - XFER_BUF % DELTA_SIG];
+     size_t  used = 0;
+     for (unsigned long long i = 0; i < k && rc == 0; ++i) {
+         if (diskio_pread(fd, data, blk, (off_t)(i * blk)) != (ssize_t)blk) {
+             rc = -1;                        /* promised k: cannot resync */
+             break;
+         }
+         delta_sig_t s;
+         s.weak = delta_weak(data, blk);
+         delta_strong(data, blk, s.strong);
+         delta_sig_pack(&s, out + used);
+         used += DELTA_SIG;
+         if (used == sizeof(out)) { rc = send_all(c->fd, out, used); used = 0; }
+     }
+     if (rc == 0 && used) rc = send_all(c->fd, out, used);
+     range_unlock(fd);
+     close(fd);
+     free(data);
+     LOG("[Server]  -> %llu signatures of %llu-byte blocks\n", k, blk);
+     return rc;
+ }
+ 
+ static int handle_delta(conn_t *c, request_t *r)
+ {
+     char *remotePath = r->args[1];
+     char *permStr    = (r->nargs > 2) ? r->args[2] : NULL;
+     const char *base = req_opt(r, "base"), *hex = req_opt(r, "sha");
+     unsigned long long size, blk;
+     uint8_t want[SHA256_LEN];
+     if (!req_opt_u64(r, "size", &size) || !req_opt_u64(r, "block", &blk) ||
+         blk < DELTA_MIN_BLOCK || blk > DELTA_MAX_BLOCK || !base || !hex ||
+         sha256_from_hex(hex, want) < 0)
+         return send_line(c->fd, "ERR_BAD_ARGS");   /* client sends nothing */
+     LOG("[Server] DELTA: remote='%s' size=%llu block=%llu\n", remotePath, size, blk);
+ 
+     if (g_chunked) return send_line(c->fd, "ERR_CHUNKED_MODE");
+     int first;
+     if (write_refused(c, remotePath, permStr, &first))
+         return 0;
+ 
+     char full[BUF_SIZE];
+     snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, remotePath);
+     int old = diskio_open(full, O_RDONLY, 0);
+     if (old < 0) {
+         write_failed(remotePath, first);
+         return send_line(c->fd, "ERR_FILE_NOT_FOUND");
+     }
+     if (range_lock(old, 0, 0, 0) < 0) {
+         close(old);
+         write_failed(remotePath, first);
+         return send_line(c->fd, "ERR_FLOCK_FAILED");
+     }
+     /* the block numbers refer to the copy the client saw in SIGS.  A
+      * racy token may have lost its "~" since; a same-tick rewrite it
+      * cannot see is caught by the sha= check instead */
+     struct stat st;
+     char ver[VER_LEN] = "";
+     if (fstat(old, &st) == 0) file_version(&st, ver, sizeof(ver));
+     if (strncmp(ver, base, strcspn(ver, "~")) != 0 ||
+         strcspn(ver, "~") != strcspn(base, "~")) {
+         range_unlock(old); close(old);
+         write_failed(remotePath, first);
+         LOG("[Server]  -> base changed (%s, client had %s)\n", ver, base);
+         return send_line(c->fd, "ERR_BASE_CHANGED ver=%s", ver);
+     }
+     unsigned long long nblocks = (unsigned long long)st.st_size / blk;
+ 
+     char tmp[BUF_SIZE + 64];
+     upload_tmp_path(tmp, sizeof(tmp), full, "write", upload_new_id());
+     int      fd  = diskio_open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+     uint8_t *buf = malloc(blk > XFER_BUF ? blk : XFER_BUF);
+     if (fd < 0 || !buf) {
+         if (fd >= 0) { close(fd); unlink(tmp); }
+         free(buf);
+         range_unlock(old); close(old);
+         write_failed(remotePath, first);
+         return send_line(c->fd, fd < 0 ? "ERR_OPEN" : "ERR_NO_MEMORY");
+     }
+     send_line(c->fd, "OK_READY_TO_RECEIVE");
+ 
+     /* apply ops in order; after a bad reference or a failed write keep
+      * reading up to DELTA_END so the connection stays in sync */
+     sha256_t h;
+     sha256_init(&h);
+     uint32_t sum = 0;                       /* CRC32C of the rebuilt file */
+     unsigned long long made = 0, lit = 0;   /* made: where the next byte goes */
+     int rc = 0, bad = 0, io_err = 0;
+     for (;;) {
+         uint8_t op[9];
+         if (payload_read_full(c, op, 1) < 0) { rc = -1; break; }
+         if (op[0] == DELTA_END) break;
+         if (op[0] == DELTA_LITERAL) {
+             if (payload_read_full(c, op + 1, 4) < 0) { rc = -1; break; }
+             uint32_t n = delta_get_u32(op + 1);
+             while (n > 0 && rc == 0) {
+                 size_t k = n < XFER_BUF ? n : XFER_BUF;
+                 if (payload_read_full(c, buf, k) < 0) { rc = -1; break; }
+                 if (!bad && !io_err) {
+                     sha256_update(&h, buf, k);  /* before a seal encrypts buf */
+                     sum = crc32c(sum, buf, k);
+                     if (seal_pwrite(fd, buf, k, (off_t)made) != (ssize_t)k) {
+                         perror("write");
+                         io_err = 1;
+                     }
+                 }
+                 n -= (uint32_t)k; made += k; lit += k;
+             }
+         } else if (op[0] == DELTA_COPY) {
+             if (payload_read_full(c, op + 1, 8) < 0) { rc = -1; break; }
+             unsigned long long first = delta_get_u32(op + 1);
+             unsigned long long k     = delta_get_u32(op + 5);
+             if (first + k > nblocks) { bad = 1; continue; }
+             for (unsigned long long b = first; b < first + k && !bad && !io_err; ++b) {
+                 if (diskio_pread(old, buf, blk, (off_t)(b * blk)) != (ssize_t)blk) { bad = 1; break; }
+                 sha256_update(&h, buf, blk);
+                 sum = crc32c(sum, buf, blk);
+                 off_t at = (off_t)(made + (b - first) * blk);
+                 if (seal_pwrite(fd, buf, blk, at) != (ssize_t)blk) { perror("write"); io_err = 1; }
+             }
+             made += k * blk;
+         } else {
+             rc = -1;                        /* not an op: cannot resync */
+             break;
+         }
+     }
+     range_unlock(old);
+     close(old);
+     free(buf);
+ 
+     uint8_t got[SHA256_LEN];
+     sha256_final(&h, got);
+     if (rc == 0 && !bad && !io_err &&
+         (made != size || memcmp(got, want, SHA256_LEN) != 0))
+         bad = 1;
+     /* durable before it becomes visible, as in handle_write() */
+     if (rc == 0 && !bad && !io_err) {
+         crc_meta_set(fd, sum);
+         if (fdatasync(fd) < 0) { perror("fdatasync"); io_err = 1; }
+     }
+     close(fd);
+     if (rc < 0 || bad || io_err) unlink(tmp);
+     else if (publish_file(tmp, full, remotePath) < 0) io_err = 1;
+     if (rc < 0 || bad || io_err) write_failed(remotePath, first);
+ 
+     if (rc < 0) {
+         LOG("[Server]  -> client vanished mid-delta\n");
+         return -1;
+     }
+     if (bad) {
+         LOG("[Server]  -> delta does not rebuild the client's file\n");
+         return send_line(c->fd, "ERR_DELTA_MISMATCH");
+     }
+     if (io_err) return send_line(c->fd, "ERR_WRITE_FAILED");
+     LOG("[Server]  -> rebuilt %llu bytes, %llu of them sent\n", made, lit);
+     return send_line(c->fd, "WRITE_OK %llu size=%llu literal=%llu copied=%llu",
+                      size, size, lit, made - lit);
+ }
+ 
+ /* ====================================================================
+  *  Parallel upload  ---------------------------------------------------
+  *    PUT_BEGIN  <local> <remote> [RO|RW] size=S   -> UPLOAD_ID <id>
+  *    PUT_PART   id=<id> offset=M size=N [crc=1] + N bytes -> PART_OK <n>
+  *    PUT_COMMIT id=<id>                           -> WRITE_OK S size=S
+  *    PUT_ABORT  id=<id>                           -> ABORT_OK
+  *  Parts may arrive on any number of connections and in any order,
+  *  but may not overlap (a resent part is acknowledged and skipped);
+  *  the commit renames the assembled temp file over the target once
+  *  every byte is covered.
+  * ===================================================================*/
+ #define UPLOAD_IDLE_SECS (10 * 60)
+ 
+ static int upload_id(request_t *r, uint64_t *id)
+ {
+     const char *s = req_opt(r, "id");
+     char *end;
+     if (!s) return 0;
+     *id = strtoull(s, &end, 16);
+     return *end == '\0';
+ }
+ 
+ static int handle_put_begin(conn_t *c, request_t *r)
+ {
+     char *remotePath = r->args[1];
+     char *permStr    = (r->nargs > 2) ? r->args[2] : NULL;
+     unsigned long long size;
+ 
+     LOG("[Server] PUT_BEGIN: remote='%s'\n", remotePath);
+     upload_expire(UPLOAD_IDLE_SECS);
+ 
+     if (!req_opt_u64(r, "size", &size))
+         return send_line(c->fd, "ERR_BAD_ARGS");
+     if (g_chunked)                          /* client falls back to WRITE */
+         return send_line(c->fd, "ERR_CHUNKED_MODE");
+     int first;
+     if (write_refused(c, remotePath, permStr, &first))
+         return 0;
+ 
+     char full[BUF_SIZE];
+     snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, remotePath);
+     upload_t *u = upload_begin(remotePath, full, size, first);
+     if (!u) {
+         write_failed(remotePath, first);
+         return send_line(c->fd, "ERR_OPEN");
+     }
+     unsigned long long id = u->id;
+     upload_release(u);
+     LOG("[Server]  -> upload %016llx, %llu bytes\n", id, size);
+     return send_line(c->fd, "UPLOAD_ID %016llx", id);
+ }
+ 
+ static int handle_put_part(conn_t *c, request_t *r)
+ {
+     uint64_t id;
+     unsigned long long off, size;
+     if (!upload_id(r, &id) || !req_opt_u64(r, "offset", &off) ||
+         !req_opt_u64(r, "size", &size)) {
+         send_line(c->fd, "ERR_BAD_ARGS");
+         return -1;                          /* unknown payload length */
+     }
+ 
+     int want_crc = wants_crc(r);
+     upload_t *u = upload_get(id);
+     int fd = -1, claim = -1;
+     if (!u || off > u->size || size > u->size - off ||
+         (claim = upload_claim(id, off, size)) != 0 ||
+         (fd = open(u->tmp, O_WRONLY)) < 0 || seal_attach(fd) < 0) {
+         if (fd >= 0) close(fd);
+         if (claim == 0) upload_settle(id, off, size, 0);
+         if (u) upload_release(u);
+         if (claim == 1) {                   /* a retry of a part we have */
+             if (drain_payload(c, size, want_crc) < 0) return -1;
+             return send_line(c->fd, "PART_OK %llu", size);
+         }
+         /* overlapping parts would leave holes the byte count misses */
+         send_line(c->fd, u ? "ERR_BAD_RANGE" : "ERR_NO_SUCH_UPLOAD");
+         return drain_payload(c, size, want_crc);
+     }
+ 
+     char buf[XFER_BUF];
+     unsigned long long got = 0;
+     uint32_t sum = 0;
+     int io_err = 0, bad_crc = 0;
+     time_t touched = time(NULL);
+     while (got < size) {
+         size_t want = size - got < sizeof(buf) ? (size_t)(size - got) : sizeof(buf);
+         ssize_t n = conn_read(c, buf, want);
+         if (n <= 0) break;
+         /* a part can take longer than the idle timeout to arrive */
+         if (time(NULL) != touched) { touched = time(NULL); upload_touch(id); }
+         fair_take((size_t)n);
+         sum = crc32c(sum, buf, (size_t)n);
+         if (!io_err && seal_pwrite(fd, buf, (size_t)n, (off_t)(off + got)) != n) {
+             perror("pwrite");
+             io_err = 1;
+         }
+         fair_give();
+         got += (unsigned long long)n;
+     }
+     close(fd);
+     if (got == size && want_crc) bad_crc = crc_check(c, sum);
+     upload_settle(id, off, size, got == size && !io_err && !bad_crc);
+     upload_release(u);
+ 
+     if (got < size || bad_crc < 0) return -1;   /* client vanished, or out of sync */
+     if (bad_crc) return send_line(c->fd, "ERR_CHECKSUM_MISMATCH");
+     if (io_err) return send_line(c->fd, "ERR_WRITE_FAILED");
+     return send_line(c->fd, "PART_OK %llu", size);
+ }
+ 
+ static int handle_put_commit(conn_t *c, request_t *r, int abort)
+ {
+     uint64_t id;
+     if (!upload_id(r, &id)) return send_line(c->fd, "ERR_BAD_ARGS");
+     upload_t *u = upload_take(id);
+     if (!u) return send_line(c->fd, "ERR_NO_SUCH_UPLOAD");
+ 
+     unsigned long long got = u->received;
+     if (abort || !upload_complete(u)) {
+         LOG("[Server] %s upload of '%s' (%llu/%llu bytes)\n",
+                abort ? "Aborted" : "Incomplete", u->remote, got, u->size);
+         unlink(u->tmp);
+         write_failed(u->remote, u->perm_first);
+         upload_release(u);
+         return send_line(c->fd, abort ? "ABORT_OK" : "ERR_INCOMPLETE");
+     }
+ 
+     /* swap the new file in; readers keep their old inode */
+     char full[sizeof(SERVER_DATA_DIR) + sizeof(u->remote)];
+     snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, u->remote);
+     /* durable before it becomes visible, as for WRITE */
+     int rc = 0;
+     int fd = open(u->tmp, O_WRONLY);
+     if (fd < 0) { perror("open"); rc = -1; }
+     else {
+         if (fdatasync(fd) < 0) { perror("fdatasync"); rc = -1; }
+         close(fd);
+     }
+     if (rc < 0) unlink(u->tmp);
+     else rc = publish_file(u->tmp, full, u->remote);
+     if (rc < 0) write_failed(u->remote, u->perm_first);
+ 
+     if (rc == 0) LOG("[Server]  -> committed %llu bytes to '%s'\n", u->size, full);
+     unsigned long long size = u->size;
+     upload_release(u);
+     if (rc < 0) return send_line(c->fd, "ERR_WRITE_FAILED");
+     return send_line(c->fd, "WRITE_OK %llu size=%llu", size, size);
+ }
+ 
+ /* ====================================================================
+  *  Batches  -----------------------------------------------------------
+  *    MGET count=K  + K lines "<remote>"
+  *      -> per path, in order: "FILE <remote> <n>" + n bytes
+  *                          or "MISS <remote> <ERR_CODE>"
+  *      -> "MGET_OK <K> bytes=<total>"
+  *    MPUT count=K [RO|RW]  -> "OK_READY_TO_RECEIVE"; the client then
+  *      streams K entries "<remote> size=<n>" + n bytes
+  *      -> per entry, in order: "STORED <remote>" or "FAILED <remote> <ERR_CODE>"
+  *      -> "MPUT_OK <K> stored=<m>"
+  *  The client thread stays on the socket while the work pool does the
+  *  per-file disk I/O, up to BATCH_WINDOW files at a time.  Either way
+  *  at most BATCH_BUFFERED payload bytes wait in memory, charged to
+  *  admission; an MGET file that does not fit is sent from disk by the
+  *  client thread instead.  MPUT files are published one by one with
+  *  the same temp file + rename as WRITE.
+  * ===================================================================*/
+ typedef struct batch batch_t;
  
  typedef struct {
-     char filename[256];
-     permission_t perm;          /* READ_ONLY or READ_WRITE */
- } filemeta_t;
+     batch_t    *b;
+     char       *path;
+     const char *err;                /* NULL on success */
+     fc_buf_t   *hit;                /* MGET: cached content, or ... */
+     char       *data;               /* ... a private copy / MPUT payload */
+     size_t      len;
+     size_t      held;               /* MGET: bytes of data charged to buffered */
+     int         stream;             /* MGET: too big to hold, send from disk */
+     char       *tmp;                /* MPUT: temp file awaiting rename */
+     int         perm_first;         /* MPUT: created the path's permission */
+     int         done;
+ } batch_item_t;
+ 
+ struct batch {
+     batch_item_t   *items;
+     size_t          n;
+     size_t          buffered;       /* payload bytes in memory */
+     size_t          pending;        /* submitted jobs not yet done */
+     pthread_mutex_t lock;
+     pthread_cond_t  cond;
+ };
+ 
+ static void batch_finish(batch_item_t *it, size_t freed)
+ {
+     batch_t *b = it->b;
+     pthread_mutex_lock(&b->lock);
+     it->done = 1;
+     --b->pending;
+     b->buffered -= freed;
+     pthread_cond_broadcast(&b->cond);
+     pthread_mutex_unlock(&b->lock);
+ }
+ 
+ static void batch_submit(batch_item_t *it, void (*fn)(void *))
+ {
+     pthread_mutex_lock(&it->b->lock);
+     ++it->b->pending;
+     pthread_mutex_unlock(&it->b->lock);
+     workpool_submit(fn, it);
+ }
+ 
+ static void batch_free(batch_t *b)
+ {
+     pthread_mutex_lock(&b->lock);           /* no job may still run */
+     while (b->pending) pthread_cond_wait(&b->cond, &b->lock);
+     pthread_mutex_unlock(&b->lock);
+     for (size_t i = 0; i < b->n; ++i) {
+         batch_item_t *it = &b->items[i];
+         if (it->hit) filecache_release(it->hit);
+         if (it->tmp) unlink(it->tmp);       /* never published */
+         if (it->held) admit_bytes_done(it->held);
+         write_failed(it->path, it->perm_first);
+         free(it->data);
+         free(it->tmp);
+         free(it->path);
+     }
+     free(b->items);
+     pthread_mutex_destroy(&b->lock);
+     pthread_cond_destroy(&b->cond);
+ }
+ 
+ static int batch_init(batch_t *b, size_t n)
+ {
+     memset(b, 0, sizeof(*b));
+     b->items = calloc(n, sizeof(*b->items));
+     if (!b->items) return -1;
+     b->n = n;
+     for (size_t i = 0; i < n; ++i) b->items[i].b = b;
+     pthread_mutex_init(&b->lock, NULL);
+     pthread_cond_init(&b->cond, NULL);
+     return 0;
+ }
+ 
+ /* MGET: may it hold size more bytes in memory?  They count against
+  * the batch's BATCH_BUFFERED and the server's admitted bytes until
+  * mget_drop().  A file over a quarter of the budget is never held. */
+ static int mget_hold(batch_item_t *it, size_t size)
+ {
+     batch_t *b = it->b;
+     unsigned retry;
+     if (size > BATCH_BUFFERED / 4) return 0;
+     pthread_mutex_lock(&b->lock);
+     int room = b->buffered + size <= BATCH_BUFFERED;
+     if (room) b->buffered += size;
+     pthread_mutex_unlock(&b->lock);
+     if (room && !admit_bytes(size, &retry)) {
+         pthread_mutex_lock(&b->lock);
+         b->buffered -= size;
+         pthread_mutex_unlock(&b->lock);
+         room = 0;
+     }
+     if (room) it->held = size;
+     return room;
+ }
+ 
+ /* MGET: an item has gone out; let go of its memory */
+ static void mget_drop(batch_item_t *it)
+ {
+     if (it->hit) { filecache_release(it->hit); it->hit = NULL; }
+     free(it->data);
+     it->data = NULL;
+     if (it->held) {
+         pthread_mutex_lock(&it->b->lock);
+         it->b->buffered -= it->held;
+         pthread_mutex_unlock(&it->b->lock);
+         admit_bytes_done(it->held);
+         it->held = 0;
+     }
+ }
  
- static filemeta_t      g_files[MAX_FILES];
- static int             g_file_count = 0;
- static pthread_mutex_t g_files_lock = PTHREAD_MUTEX_INITIALIZER;
+ /* MGET job: whole file into memory, from the cache when hot, unless
+  * mget_hold() finds no room for it */
+ static void mget_load(void *arg)
+ {
+     batch_item_t *it = arg;
+     if ((it->hit = cache_lookup(it->path, 1))) {
+         it->len = it->hit->len;
+         batch_finish(it, 0);
+         return;
+     }
+     uint64_t gen = filecache_generation(it->path);
+     char full[BUF_SIZE];
+     snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, it->path);
+     int fd = open(full, O_RDONLY);
+     if (fd >= 0 && seal_attach(fd) < 0) { close(fd); fd = -1; }
+     if (fd < 0) { it->err = "ERR_FILE_NOT_FOUND"; batch_finish(it, 0); return; }
+     if (range_lock(fd, 0, 0, RANGE_EOF) < 0) {
+         close(fd);
+         it->err = "ERR_FLOCK_FAILED";
+         batch_finish(it, 0);
+         return;
+     }
+     manifest_t m = {0};
+     int chunked = g_chunked ? manifest_read(fd, &m) : 0;
+     struct stat st;
+     char ver[VER_LEN] = "";
+     if (fstat(fd, &st) == 0) file_version(&st, ver, sizeof(ver));
+     size_t size = chunked == 1 ? m.size : *ver ? (size_t)st.st_size : 0;
+     if (chunked < 0)                  it->err = "ERR_BAD_MANIFEST";
+     else if (!mget_hold(it, size))    it->stream = 1;
+     else if (!(it->data = malloc(size + 1))) it->err = "ERR_NO_MEMORY";
+     else {
+         /* a workpool job must not wait on diskio: read right here */
+         ssize_t n;
+         while (it->len < size &&
+                (n = chunked == 1 ? manifest_pread(&m, it->data + it->len,
+                                                   size - it->len, it->len)
+                                  : seal_pread(fd, it->data + it->len, size - it->len,
+                                               (off_t)it->len)) > 0)
+             it->len += (size_t)n;
+     }
+     /* a copy for the cache carries the file's sum */
+     uint32_t sum = 0;
+     int loaded = !it->err && !it->stream;
+     if (loaded && it->len <= filecache_max_entry() &&
+         !(chunked == 0 && it->len == size && crc_meta_get(fd, &st, &sum)))
+         sum = crc32c(0, it->data, it->len);
+     range_unlock(fd);
+     close(fd);
+     manifest_free(&m);
+     if (loaded) filecache_put(it->path, it->data, it->len, gen, ver, sum);
+     batch_finish(it, 0);
+ }
  
- /* ----------  helpers for permission table  ------------------------ */
- static permission_t get_file_permission(const char *path)
+ /* MGET item mget_load() left on disk: send it from there, under a
+  * shared lock, XFER_BUF at a time.  -1 if the client went away or the
+  * file shrank under the lock (the reply is out of sync). */
+ static int mget_stream(conn_t *c, batch_item_t *it, unsigned long long *sent)
  {
-     pthread_mutex_lock(&g_files_lock);
-     for (int i = 0; i < g_file_count; ++i)
-         if (strcmp(g_files[i].filename, path) == 0) {
-             permission_t p = g_files[i].perm;
-             pthread_mutex_unlock(&g_files_lock);
-             return p;
+     char full[BUF_SIZE];
+     snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, it->path);
+     *sent = 0;
+     int fd = diskio_open(full, O_RDONLY, 0);
+     if (fd < 0) return send_line(c->fd, "MISS %s ERR_FILE_NOT_FOUND", it->path);
+     if (range_lock(fd, 0, 0, RANGE_EOF) < 0) {
+         close(fd);
+         return send_line(c->fd, "MISS %s ERR_FLOCK_FAILED", it->path);
+     }
+     manifest_t m = {0};
+     int chunked = g_chunked ? manifest_read(fd, &m) : 0;
+     const manifest_t *mp = chunked == 1 ? &m : NULL;
+     struct stat st;
+     int rc;
+     if (chunked < 0 || fstat(fd, &st) < 0) {
+         rc = send_line(c->fd, "MISS %s %s", it->path,
+                        chunked < 0 ? "ERR_BAD_MANIFEST" : "ERR_FILE_NOT_FOUND");
+     } else {
+         unsigned long long size = mp ? m.size : (unsigned long long)st.st_size;
+         char buf[XFER_BUF];
+         rc = send_line(c->fd, "FILE %s %llu", it->path, size);
+         while (rc == 0 && *sent < size) {
+             size_t want = size - *sent < sizeof(buf) ? (size_t)(size - *sent) : sizeof(buf);
+             fair_take(want);
+             ssize_t n = object_pread(fd, mp, buf, want, *sent);
+             fair_give();
+             if (n <= 0) rc = -1;
+             else if ((rc = send_all(c->fd, buf, (size_t)n)) == 0)
+                 *sent += (unsigned long long)n;
          }
-     pthread_mutex_unlock(&g_files_lock);
-     return READ_WRITE;          /* default for unknown files */
+     }
+     range_unlock(fd);
+     close(fd);
+     manifest_free(&m);
+     return rc;
  }
  
- static void set_file_permission(const char *path, permission_t p)
+ static int handle_mget(conn_t *c, request_t *r)
  {
-     pthread_mutex_lock(&g_files_lock);
-     /* if already present, leave it unchanged */
-     for (int i = 0; i < g_file_count; ++i)
-         if (strcmp(g_files[i].filename, path) == 0) {
-             pthread_mutex_unlock(&g_files_lock);
-             return;
+     unsigned long long k;
+     if (!req_opt_u64(r, "count", &k) || k == 0 || k > BATCH_MAX_ITEMS) {
+         send_line(c->fd, "ERR_BAD_ARGS");
+         return -1;                          /* cannot skip the path list */
+     }
+     LOG("[Server] MGET: %llu files\n", k);
+ 
+     batch_t b;
+     if (batch_init(&b, (size_t)k) < 0) return -1;
+     char line[MAX_LINE];
+     for (size_t i = 0; i < b.n; ++i) {
+         if (conn_read_line(c, line, sizeof(line)) <= 0 ||
+             !(b.items[i].path = strdup(line))) {
+             batch_free(&b);
+             return -1;
+         }
+     }
+ 
+     /* keep up to BATCH_WINDOW loads ahead of the item being sent */
+     size_t next = 0;
+     for (; next < b.n && next < BATCH_WINDOW; ++next)
+         batch_submit(&b.items[next], mget_load);
+ 
+     unsigned long long total = 0;
+     int rc = 0;
+     for (size_t i = 0; i < b.n && rc == 0; ++i) {
+         batch_item_t *it = &b.items[i];
+         pthread_mutex_lock(&b.lock);
+         while (!it->done) pthread_cond_wait(&b.cond, &b.lock);
+         pthread_mutex_unlock(&b.lock);
+ 
+         if (it->err) {
+             rc = send_line(c->fd, "MISS %s %s", it->path, it->err);
+         } else if (it->stream) {
+             unsigned long long sent;
+             rc = mget_stream(c, it, &sent);
+             total += sent;
+         } else {
+             const char *data = it->hit ? it->hit->data : it->data;
+             fair_pace(it->len);             /* loaded by the pool, paced here */
+             rc = send_line(c->fd, "FILE %s %zu", it->path, it->len);
+             if (rc == 0) rc = send_all(c->fd, data, it->len);
+             total += it->len;
          }
-     if (g_file_count < MAX_FILES) {
-         strncpy(g_files[g_file_count].filename, path,
-                 sizeof(g_files[g_file_count].filename) - 1);
-         g_files[g_file_count].filename[255] = '\0';
-         g_files[g_file_count].perm = p;
-         ++g_file_count;
+         mget_drop(it);
+         if (next < b.n) batch_submit(&b.items[next++], mget_load);
      }
-     pthread_mutex_unlock(&g_files_lock);
+     batch_free(&b);
+     if (rc < 0) return -1;
+     LOG("[Server]  -> sent %llu files, %llu bytes\n", k, total);
+     return send_line(c->fd, "MGET_OK %llu bytes=%llu", k, total);
  }
  
- static permission_t parse_perm(const char *s)
+ /* MPUT job: payload into its temp file, durable but not yet visible */
+ static void mput_store(void *arg)
  {
-     if (!s)                        return READ_WRITE;
-     if (strcasecmp(s, "RO") == 0)  return READ_ONLY;
-     return READ_WRITE;
+     batch_item_t *it = arg;
+     size_t len = it->len;
+     int fd = open(it->tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+     if (fd < 0 || seal_attach(fd) < 0 ||
+         seal_pwrite(fd, it->data, len, 0) != (ssize_t)len || fdatasync(fd) < 0) {
+         perror("mput");
+         it->err = "ERR_WRITE_FAILED";
+     }
+     if (fd >= 0) close(fd);
+     free(it->data);
+     it->data = NULL;
+     batch_finish(it, len);
+ }
+ 
+ /* an MPUT entry too big to buffer: stream it into its temp file here */
+ static int mput_stream(conn_t *c, batch_item_t *it, unsigned long long size)
+ {
+     int fd = open(it->tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+     if (fd >= 0 && seal_attach(fd) < 0) { close(fd); unlink(it->tmp); fd = -1; }
+     if (fd < 0) it->err = "ERR_OPEN";
+     char buf[XFER_BUF];
+     for (unsigned long long got = 0; got < size; ) {
+         size_t want = size - got < sizeof(buf) ? (size_t)(size - got) : sizeof(buf);
+         ssize_t n = conn_read(c, buf, want);
+         if (n <= 0) { if (fd >= 0) close(fd); return -1; }
+         fair_take((size_t)n);
+         if (!it->err && seal_pwrite(fd, buf, (size_t)n, (off_t)got) != n)
+             it->err = "ERR_WRITE_FAILED";
+         fair_give();
+         got += (unsigned long long)n;
+     }
+     if (fd >= 0) {
+         if (!it->err && fdatasync(fd) < 0) it->err = "ERR_WRITE_FAILED";
+         close(fd);
+     }
+     return 0;
+ }
+ 
+ static int handle_mput(conn_t *c, request_t *r)
+ {
+     char *permStr = (r->nargs > 0) ? r->args[0] : NULL;
+     unsigned long long k;
+     if (!req_opt_u64(r, "count", &k) || k == 0 || k > BATCH_MAX_ITEMS)
+         return send_line(c->fd, "ERR_BAD_ARGS");
+     if (g_chunked)
+         return send_line(c->fd, "ERR_CHUNKED_MODE");
+     LOG("[Server] MPUT: %llu files\n", k);
+ 
+     batch_t b;
+     if (batch_init(&b, (size_t)k) < 0) return send_line(c->fd, "ERR_NO_MEMORY");
+     send_line(c->fd, "OK_READY_TO_RECEIVE");
+ 
+     char line[MAX_LINE];
+     for (size_t i = 0; i < b.n; ++i) {
+         batch_item_t *it = &b.items[i];
+         request_t e;
+         unsigned long long size;
+         if (conn_read_line(c, line, sizeof(line)) <= 0) break;
+         parse_request(line, &e);
+         if (!e.cmd || !req_opt_u64(&e, "size", &size) ||
+             !(it->path = strdup(e.cmd)))
+             break;
+ 
+         char full[BUF_SIZE];
+         snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, it->path);
+         if (write_denied(it->path, permStr, &it->perm_first)) {
+             it->err  = "ERR_FILE_IS_READ_ONLY";
+             it->done = 1;
+             if (drain_payload(c, size, 0) < 0) break;
+             continue;
+         }
+         it->tmp = malloc(BUF_SIZE + 64);
+         if (!it->tmp) break;
+         upload_tmp_path(it->tmp, BUF_SIZE + 64, full, "write", upload_new_id());
+ 
+         if (size > BATCH_BUFFERED / 4) {
+             if (mput_stream(c, it, size) < 0) break;
+             it->done = 1;
+             continue;
+         }
+         /* bounded read-ahead: wait for workers to drain the buffer */
+         pthread_mutex_lock(&b.lock);
+         while (b.buffered && b.buffered + size > BATCH_BUFFERED)
+             pthread_cond_wait(&b.cond, &b.lock);
+         b.buffered += (size_t)size;
+         pthread_mutex_unlock(&b.lock);
+         fair_pace((size_t)size);            /* stored by the pool, paced here */
+         it->len  = (size_t)size;
+         it->data = malloc(it->len + 1);
+         if (!it->data || conn_read_full(c, it->data, it->len) < 0) {
+             pthread_mutex_lock(&b.lock);
+             b.buffered -= it->len;
+             pthread_mutex_unlock(&b.lock);
+             break;
+         }
+         batch_submit(it, mput_store);
+     }
+ 
+     /* every entry arrived?  (else the connection is unusable) */
+     int complete = b.n == 0 || b.items[b.n - 1].path != NULL;
+     pthread_mutex_lock(&b.lock);
+     while (b.pending) pthread_cond_wait(&b.cond, &b.lock);
+     pthread_mutex_unlock(&b.lock);
+     if (!complete) {
+         LOG("[Server]  -> MPUT stream broken off\n");
+         batch_free(&b);
+         return -1;
+     }
+ 
+     /* publish in order and report; replies go out in large sends */
+     char out[XFER_BUF];
+     size_t used = 0;
+     unsigned long long stored = 0;
+     int rc = 0;
+     for (size_t i = 0; i < b.n && rc == 0; ++i) {
+         batch_item_t *it = &b.items[i];
+         if (!it->err) {
+             char full[BUF_SIZE];
+             snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, it->path);
+             if (publish_file(it->tmp, full, it->path) < 0) it->err = "ERR_WRITE_FAILED";
+             else { free(it->tmp); it->tmp = NULL; it->perm_first = 0; ++stored; }
+         }
+         if (used + MAX_LINE + 32 > sizeof(out)) {
+             rc = send_all(c->fd, out, used);
+             used = 0;
+         }
+         used += (size_t)snprintf(out + used, sizeof(out) - used,
+                                  it->err ? "FAILED %s %s\n" : "STORED %s\n",
+                                  it->path, it->err);
+     }
+     if (rc == 0) rc = send_all(c->fd, out, used);
+     batch_free(&b);
+     LOG("[Server]  -> stored %llu of %llu files\n", stored, k);
+     return rc < 0 ? -1 : send_line(c->fd, "MPUT_OK %llu stored=%llu", k, stored);
  }
  
  /* ====================================================================
-  *  WRITE  -------------------------------------------------------------
+  *  Message store  -----------------------------------------------------
+  *    PUTMSG <id> from=<sender> to=<receiver> [delivered=1] size=<n>
+  *           + n bytes of text              -> "PUTMSG_OK <id>"
+  *    GETMSG <id>
+  *      -> "MSG <id> ts=<t> from=<s> to=<r> delivered=<d> size=<n>"
+  *         + n bytes of text, or "ERR_MSG_NOT_FOUND"
+  *    MGETMSG count=K  + K lines "<id>"
+  *      -> per id, in order: "MSG ..." + text or "MISS <id> <ERR_CODE>"
+  *      -> "MGETMSG_OK <K> found=<m>"
+  *  practicum1's messages through one shared cache (msgstore.h).  Ids
+  *  are positive, names single tokens of at most MAX_SENDER_LEN - 1
+  *  bytes, the text at most MAX_CONTENT_LEN - 1.
   * ===================================================================*/
- static void handle_write(int csock,
-                          char *localArg,
-                          char *remotePath,
-                          char *permStr)
- {
-     printf("[Server] WRITE: remote='%s' perm='%s'\n",
-            remotePath, permStr ? permStr : "(default RW)");
- 
-     /* permission logic */
-     permission_t perm = get_file_permission(remotePath);
-     if (perm == READ_WRITE) {                    /* first time? */
-         set_file_permission(remotePath, parse_perm(permStr));
-         perm = get_file_permission(remotePath);
-     }
-     if (perm == READ_ONLY) {
-         send(csock, "ERR_FILE_IS_READ_ONLY", 22, 0);
-         printf("[Server]  -> rejected (read‑only)\n");
-         return;
+
+ /* a positive message id, or -1 */
+ static int msg_id(const char *s)
+ {
+     char *end;
+     errno = 0;
+     long id = strtol(s, &end, 10);
+     return errno || *end || id <= 0 || id > INT_MAX ? -1 : (int)id;
+ }
+
+ /* append the MSG reply for m to out (room for sizeof(Message) + a line) */
+ static size_t msg_format(char *out, const Message *m)
+ {
+     size_t len = strnlen(m->content, MAX_CONTENT_LEN);
+     int n = snprintf(out, MAX_LINE, "MSG %d ts=%lld from=%s to=%s delivered=%d size=%zu\n",
+                      m->id, (long long)m->time_sent, m->sender, m->receiver,
+                      m->delivered != 0, len);
+     memcpy(out + n, m->content, len);
+     return (size_t)n + len;
+ }
+
+ static int handle_putmsg(conn_t *c, request_t *r)
+ {
+     unsigned long long size;
+     if (!req_opt_u64(r, "size", &size) || size >= MAX_CONTENT_LEN) {
+         send_line(c->fd, "ERR_BAD_ARGS");
+         return -1;                          /* cannot skip the text */
+     }
+     char text[MAX_CONTENT_LEN];
+     if (conn_read_full(c, text, (size_t)size) < 0) return -1;
+     text[size] = '\0';
+
+     int id = msg_id(r->args[0]);
+     const char *from = req_opt(r, "from"), *to = req_opt(r, "to");
+     unsigned long long delivered = 0;
+     req_opt_u64(r, "delivered", &delivered);
+     LOG("[Server] PUTMSG: id=%d size=%llu\n", id, size);
+     if (id < 0 || !from || !to || strlen(from) >= MAX_SENDER_LEN ||
+         strlen(to) >= MAX_RECEIVER_LEN || memchr(text, '\0', (size_t)size))
+         return send_line(c->fd, "ERR_BAD_ARGS");
+
+     Message m = { .id = id, .time_sent = time(NULL), .delivered = delivered != 0 };
+     strcpy(m.sender, from);
+     strcpy(m.receiver, to);
+     memcpy(m.content, text, (size_t)size + 1);
+     if (msgstore_put(&m) < 0) return send_line(c->fd, "ERR_WRITE_FAILED");
+     return send_line(c->fd, "PUTMSG_OK %d", id);
+ }
+
+ static int handle_getmsg(conn_t *c, request_t *r)
+ {
+     int id = msg_id(r->args[0]);
+     LOG("[Server] GETMSG: id=%d\n", id);
+     Message m;
+     if (id < 0 || msgstore_get(id, &m) < 0)
+         return send_line(c->fd, id < 0 ? "ERR_BAD_ARGS" : "ERR_MSG_NOT_FOUND");
+     char out[MAX_LINE + sizeof(Message)];
+     return send_all(c->fd, out, msg_format(out, &m));
+ }
+
+ static int handle_mgetmsg(conn_t *c, request_t *r)
+ {
+     unsigned long long k;
+     if (!req_opt_u64(r, "count", &k) || k == 0 || k > BATCH_MAX_ITEMS) {
+         send_line(c->fd, "ERR_BAD_ARGS");
+         return -1;                          /* cannot skip the id list */
+     }
+     LOG("[Server] MGETMSG: %llu messages\n", k);
+     int *ids = malloc((size_t)k * sizeof(*ids));
+     if (!ids) return -1;
+     char line[MAX_LINE];
+     for (size_t i = 0; i < k; ++i) {
+         if (conn_read_line(c, line, sizeof(line)) <= 0) { free(ids); return -1; }
+         ids[i] = msg_id(line);
+     }
+
+     /* replies go out XFER_BUF at a time, not a syscall per message */
+     char *out = malloc(XFER_BUF + MAX_LINE + sizeof(Message));
+     if (!out) { free(ids); return -1; }
+     size_t used = 0;
+     unsigned long long found = 0;
+     int rc = 0;
+     for (size_t i = 0; i < k && rc == 0; ++i) {
+         Message m;
+         if (ids[i] > 0 && msgstore_get(ids[i], &m) == 0) {
+             used += msg_format(out + used, &m);
+             ++found;
+         } else {
+             used += (size_t)snprintf(out + used, MAX_LINE, "MISS %d %s\n", ids[i],
+                                      ids[i] > 0 ? "ERR_MSG_NOT_FOUND" : "ERR_BAD_ARGS");
+         }
+         if (used >= XFER_BUF || i + 1 == k) {
+             fair_pace(used);
+             rc = send_all(c->fd, out, used);
+             used = 0;
+         }
      }
+     free(out);
+     free(ids);
+     if (rc < 0) return -1;
+     LOG("[Server]  -> %llu of %llu found\n", found, k);
+     return send_line(c->fd, "MGETMSG_OK %llu found=%llu", k, found);
+ }
+
+ /* ====================================================================
+  *  RM  ----------------------------------------------------------------
+  * ===================================================================*/
+ static int handle_rm(conn_t *c, request_t *r)
+ {
+     char *remotePath = r->args[0];
+     LOG("[Server] RM: remote='%s'\n", remotePath);
  
-     /* tell client to send data */
-     send(csock, "OK_READY_TO_RECEIVE", 20, 0);
+     if (permtable_get(remotePath) == READ_ONLY) {
+         send_line(c->fd, "ERR_FILE_IS_READ_ONLY");
+         LOG("[Server]  -> rejected (read‑only)\n");
+         return 0;
+     }
  
      char full[BUF_SIZE];
      snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, remotePath);
  
-     /* open + exclusive lock */
-     int fd = open(full, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-     if (fd < 0) { perror("open"); send(csock,"ERR_OPEN",8,0); return; }
-     if (flock(fd, LOCK_EX) < 0) { perror("flock(EX)"); close(fd);
-         send(csock,"ERR_FLOCK_FAILED",16,0); return; }
- 
-     /* receive exactly one chunk (demo) */
-     char buf[BUF_SIZE] = {0};
-     int  n = recv(csock, buf, sizeof(buf), 0);
-     if (n <= 0) {
-         flock(fd, LOCK_UN);
-         close(fd);
-         send(csock,"ERR_RECV_FILE_DATA",18,0);
-         return;
-     }
-     if (write(fd, buf, n) != n) {
-         perror("write");
-         flock(fd, LOCK_UN); close(fd);
-         send(csock,"ERR_WRITE_FAILED",16,0);
-         return;
-     }
+     int fd = open(full, O_RDWR);            /* open just for lock */
+     if (fd < 0) { send_line(c->fd, "ERR_REMOVE_FAILED");
+                   LOG("[Server]  -> file not present\n"); return 0; }
+     if (range_lock(fd, 1, 0, RANGE_EOF) < 0) { perror("range_lock"); close(fd);
+         send_line(c->fd, "ERR_FLOCK_FAILED"); return 0; }
  
-     flock(fd, LOCK_UN);
+     manifest_t m = {0};
+     int chunked = g_chunked ? manifest_read(fd, &m) == 1 : 0;
+     int rc = remove(full);
+     range_unlock(fd);
      close(fd);
-     send(csock, "WRITE_OK", 8, 0);
-     printf("[Server]  -> wrote %d bytes to '%s'\n", n, full);
+     if (rc == 0 && chunked) {
+         manifest_unref(&m);
+         chunkstore_account(-(long long)m.size);
+     }
+     manifest_free(&m);
+ 
+     if (rc == 0) {
+         permtable_remove(remotePath);
+         file_changed(remotePath);
+         send_line(c->fd, "RM_OK");
+         LOG("[Server]  -> removed\n");
+     } else {
+         send_line(c->fd, "ERR_REMOVE_FAILED");
+         perror("remove");
+     }
+     return 0;
  }
  
  /* ====================================================================
-  *  GET  ---------------------------------------------------------------
+  *  LS / STAT  ---------------------------------------------------------
+  *    LS [dir]   ->  "OK_LISTING <n> bytes=<len>" + len bytes of lines
+  *                   "<f|d> <size> <mtime> <name>", sorted by name
+  *    STAT path  ->  "STAT_OK type=<f|d> size=<n> mtime=<secs> perm=<RO|RW>"
+  *    STAT path crc=1  adds " crc=<hex>", the CRC32C of the whole file
+  *                     (not with -C: a manifest takes no ranged writes)
+  *  Both are answered from dircache; a folder is read from disk once
+  *  and then kept current by file_changed() and inotify.  Only the sum
+  *  comes from the file itself (stored, or read through under a shared
+  *  lock), and size= is then the size it was taken over.
   * ===================================================================*/
- static void handle_get(int csock,
-                        char *remotePath,
-                        char *localArg)
+ static const char *dir_err(int err)
  {
-     printf("[Server] GET: remote='%s'\n", remotePath);
+     return err == ENOENT  ? "ERR_FILE_NOT_FOUND" :
+            err == ENOTDIR ? "ERR_NOT_A_DIRECTORY" :
+            err == EINVAL  ? "ERR_BAD_ARGS" : "ERR_NO_MEMORY";
+ }
+ 
+ static int handle_ls(conn_t *c, request_t *r)
+ {
+     const char *dir = (r->nargs > 0) ? r->args[0] : "";
+     LOG("[Server] LS: '%s'\n", dir);
+     int err;
+     dc_text_t *t = dircache_list(dir, &err);
+     if (!t) return send_line(c->fd, "%s", dir_err(err));
+     int rc = send_line(c->fd, "OK_LISTING %zu bytes=%zu", t->n, t->len);
+     if (rc == 0) rc = send_all(c->fd, t->data, t->len);
+     dircache_release(t);
+     return rc;
+ }
  
+ /* CRC32C of the whole of remotePath and the size it covers: 0, or -1
+  * if the file cannot be opened or read */
+ static int file_sum(const char *remotePath, uint32_t *crc, unsigned long long *size)
+ {
      char full[BUF_SIZE];
      snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, remotePath);
+     int fd = diskio_open(full, O_RDONLY, 0);
+     if (fd < 0) return -1;
+     if (range_lock(fd, 0, 0, 0) < 0) { close(fd); return -1; }
+     struct stat st;
+     int rc = fstat(fd, &st);
+     if (rc == 0 && !crc_meta_get(fd, &st, crc)) {
+         char buf[XFER_BUF];
+         unsigned long long done = 0, len = (unsigned long long)st.st_size;
+         uint32_t sum = 0;
+         while (rc == 0 && done < len) {
+             size_t want = len - done < sizeof(buf) ? (size_t)(len - done) : sizeof(buf);
+             fair_take(want);
+             ssize_t n = diskio_pread(fd, buf, want, (off_t)done);
+             if (n > 0) sum = crc32c(sum, buf, (size_t)n);
+             fair_give();
+             if (n <= 0) rc = -1;
+             else done += (unsigned long long)n;
+         }
+         if (rc == 0) crc_meta_set(fd, sum);
+         *crc = sum;
+     }
+     *size = (unsigned long long)st.st_size;
+     range_unlock(fd);
+     close(fd);
+     return rc;
+ }
  
-     int fd = open(full, O_RDONLY);
-     if (fd < 0) {
-         send(csock,"ERR_FILE_NOT_FOUND",18,0);
-         printf("[Server]  -> not found\n");
-         return;
+ static int handle_stat(conn_t *c, request_t *r)
+ {
+     if (r->nargs < 1) return send_line(c->fd, "ERR_BAD_ARGS");
+     char *remotePath = r->args[0];
+     char type;
+     unsigned long long size;
+     long long mtime;
+     int rc = dircache_stat(remotePath, &type, &size, &mtime);
+     if (rc < 0) return send_line(c->fd, "%s", dir_err(-rc));
+     const char *perm = type == 'f' && permtable_get(remotePath) == READ_ONLY ? "RO" : "RW";
+     if (type == 'f' && !g_chunked && wants_crc(r)) {
+         uint32_t sum;
+         if (file_sum(remotePath, &sum, &size) < 0)
+             return send_line(c->fd, "ERR_FILE_NOT_FOUND");
+         return send_line(c->fd, "STAT_OK type=%c size=%llu mtime=%lld perm=%s crc=%08x",
+                          type, size, mtime, perm, sum);
      }
-     if (flock(fd, LOCK_SH) < 0) { perror("flock(SH)"); close(fd);
-         send(csock,"ERR_FLOCK_FAILED",16,0); return; }
+     return send_line(c->fd, "STAT_OK type=%c size=%llu mtime=%lld perm=%s",
+                      type, size, mtime, perm);
+ }
  
-     char buf[BUF_SIZE] = {0};
-     int  n = read(fd, buf, sizeof(buf));
-     flock(fd, LOCK_UN);
+ /* dircache sizer: in -C mode a file holds a manifest; list the
+  * size of the content it describes */
+ static void logical_size(const char *full, struct stat *st)
+ {
+     if (!g_chunked) return;
+     int fd = open(full, O_RDONLY);
+     if (fd < 0) return;
+     manifest_t m = {0};
+     if (manifest_read(fd, &m) == 1) st->st_size = (off_t)m.size;
+     manifest_free(&m);
      close(fd);
+ }
  
-     send(csock,"OK_SENDING_FILE",15,0);
-     if (n > 0) send(csock, buf, n, 0);
-     printf("[Server]  -> sent %d bytes\n", n);
+ /* ====================================================================
+  *  HELLO  -------------------------------------------------------------
+  *    HELLO compress=lz  ->  "HELLO_OK compress=lz|none"
+  *  Sent first by a client that wants its GET and WRITE payloads
+  *  compressed; from the reply on, both ends frame them (proto.h).
+  * ===================================================================*/
+ static int handle_hello(conn_t *c, request_t *r)
+ {
+     const char *want = req_opt(r, "compress");
+     int lz = want && !g_no_compress && strstr(want, "lz") != NULL;
+     if (lz && conn_compress(c) < 0) lz = 0;
+     return send_line(c->fd, "HELLO_OK compress=%s", lz ? "lz" : "none");
  }
  
  /* ====================================================================
-  *  RM  ----------------------------------------------------------------
+  *  Replication, follower side (rfserver -F)  --------------------------
+  *    REPL_HELLO epoch=<E>                 -> REPL_AT epoch=<E'> seq=<n>
+  *    REPL_SYNC epoch=<E>                  -> REPL_OK 0
+  *    REPL_PUT <path> seq=<n> ts=<ms> perm=<RO|RW> size=<S> crc=1
+  *             + S bytes + "CRC <hex>"     -> REPL_OK <n>
+  *    REPL_RM  <path> seq=<n> ts=<ms>      -> REPL_OK <n>
+  *    REPL_SYNC_END seq=<n>                -> REPL_OK <n>
+  *  The primary (replica.c) sends these one at a time on one
+  *  connection.  REPL_AT says where to resume; when the primary cannot
+  *  resume there it sends a full copy (items with seq=0) between
+  *  REPL_SYNC and REPL_SYNC_END, and files the copy did not write are
+  *  then removed.  Clients may only read from a follower.
   * ===================================================================*/
- static void handle_rm(int csock, char *remotePath)
+ 
+ /* requests that change files, refused on a follower */
+ static int is_client_write(const char *cmd)
+ {
+     static const char *w[] = { "WRITE", "APPEND", "DWRITE", "DELTA", "PUT_BEGIN",
+                                "PUT_PART", "PUT_COMMIT", "PUT_ABORT", "MPUT", "RM",
+                                "PUTMSG" };
+     for (size_t i = 0; i < sizeof(w) / sizeof(w[0]); ++i)
+         if (strcasecmp(cmd, w[i]) == 0) return 1;
+     return 0;
+ }
+ 
+ /* mkdir -p of the directories above full */
+ static void make_parents(const char *full)
  {
-     printf("[Server] RM: remote='%s'\n", remotePath);
+     char dir[BUF_SIZE];
+     snprintf(dir, sizeof(dir), "%s", full);
+     for (char *p = dir + strlen(SERVER_DATA_DIR) + 1; (p = strchr(p, '/')); ++p) {
+         *p = '\0';
+         mkdir(dir, 0777);
+         *p = '/';
+     }
+ }
  
-     if (get_file_permission(remotePath) == READ_ONLY) {
-         send(csock,"ERR_FILE_IS_READ_ONLY",22,0);
-         printf("[Server]  -> rejected (read‑only)\n");
-         return;
+ /* the primary's permission for path, even where a removed file came
+  * back with another one */
+ static void set_replica_perm(const char *remotePath, permission_t want)
+ {
+     permission_t now;
+     if (!permtable_set_if_absent(remotePath, want, &now) && now != want) {
+         permtable_remove(remotePath);
+         permtable_set_if_absent(remotePath, want, &now);
+     }
+ }
+ 
+ static int handle_repl_put(conn_t *c, request_t *r)
+ {
+     char *remotePath = r->args[0];
+     unsigned long long seq = 0, ts = 0, size;
+     if (!req_opt_u64(r, "size", &size)) { send_line(c->fd, "ERR_BAD_ARGS"); return -1; }
+     req_opt_u64(r, "seq", &seq);
+     req_opt_u64(r, "ts", &ts);
+     LOG("[Server] REPL_PUT: remote='%s' seq=%llu size=%llu\n", remotePath, seq, size);
+ 
+     char full[BUF_SIZE], tmp[BUF_SIZE + 64];
+     snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, remotePath);
+     make_parents(full);
+     upload_tmp_path(tmp, sizeof(tmp), full, "write", upload_new_id());
+     int fd = diskio_open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+     if (fd < 0) {
+         perror("open");
+         send_line(c->fd, "ERR_OPEN");
+         return drain_payload(c, size, 0);
+     }
+ 
+     char buf[XFER_BUF];
+     unsigned long long got = 0;
+     uint32_t sum = 0;
+     int io_err = 0, bad_crc = 0;
+     while (got < size) {
+         size_t want = size - got < sizeof(buf) ? (size_t)(size - got) : sizeof(buf);
+         ssize_t n = conn_read_payload(c, buf, want);
+         if (n <= 0) break;
+         sum = crc32c(sum, buf, (size_t)n);
+         if (!io_err && seal_pwrite(fd, buf, (size_t)n, (off_t)got) != n) {
+             perror("pwrite");
+             io_err = 1;
+         }
+         got += (unsigned long long)n;
      }
+     int lost = got < size;                  /* primary went away */
+     if (!lost && wants_crc(r) && (bad_crc = crc_check(c, sum)) < 0) lost = 1;
+     if (!lost && !io_err && !bad_crc) {
+         crc_meta_set(fd, sum);
+         if (fdatasync(fd) < 0) { perror("fdatasync"); io_err = 1; }
+     }
+     close(fd);
+     if (lost || io_err || bad_crc) {
+         unlink(tmp);
+         if (lost) return -1;
+         return send_line(c->fd, bad_crc ? "ERR_CHECKSUM_MISMATCH" : "ERR_WRITE_FAILED");
+     }
+     if (publish_file(tmp, full, remotePath) < 0)
+         return send_line(c->fd, "ERR_WRITE_FAILED");
+     set_replica_perm(remotePath, parse_perm(req_opt(r, "perm")));
+     repl_applied(seq, ts);
+     return send_line(c->fd, "REPL_OK %llu", seq);
+ }
  
+ /* drop path from this follower; 0 if it is gone */
+ static int replica_remove(const char *remotePath)
+ {
      char full[BUF_SIZE];
      snprintf(full, sizeof(full), "%s/%s", SERVER_DATA_DIR, remotePath);
+     if (unlink(full) < 0 && errno != ENOENT) return -1;
+     permtable_remove(remotePath);
+     file_changed(remotePath);
+     return 0;
+ }
+ 
+ static void replica_drop(const char *remotePath)
+ {
+     LOG("[Server]  -> '%s' is gone on the primary\n", remotePath);
+     replica_remove(remotePath);
+ }
  
-     int fd = open(full, O_WRONLY);          /* open just for lock */
-     if (fd < 0) { send(csock,"ERR_REMOVE_FAILED",17,0);
-                   printf("[Server]  -> file not present\n"); return; }
-     if (flock(fd, LOCK_EX) < 0) { perror("flock(EX)"); close(fd);
-         send(csock,"ERR_FLOCK_FAILED",16,0); return; }
+ static int handle_repl_rm(conn_t *c, request_t *r)
+ {
+     unsigned long long seq = 0, ts = 0;
+     req_opt_u64(r, "seq", &seq);
+     req_opt_u64(r, "ts", &ts);
+     LOG("[Server] REPL_RM: remote='%s' seq=%llu\n", r->args[0], seq);
+     if (replica_remove(r->args[0]) < 0) {
+         perror("unlink");
+         return send_line(c->fd, "ERR_REMOVE_FAILED");
+     }
+     repl_applied(seq, ts);
+     return send_line(c->fd, "REPL_OK %llu", seq);
+ }
  
-     int rc = remove(full);
-     flock(fd, LOCK_UN);
-     close(fd);
+ static int handle_repl(conn_t *c, request_t *r)
+ {
+     if (!g_follower) {
+         send_line(c->fd, "ERR_NOT_A_FOLLOWER");
+         return -1;                          /* a REPL_PUT payload may follow */
+     }
+     unsigned long long epoch = 0, seq = 0;
+     const char *e = req_opt(r, "epoch");
+     if (e) epoch = strtoull(e, NULL, 16);
+     req_opt_u64(r, "seq", &seq);
  
-     if (rc == 0) {
-         send(csock,"RM_OK",5,0);
-         printf("[Server]  -> removed\n");
-     } else {
-         send(csock,"ERR_REMOVE_FAILED",17,0);
-         perror("remove");
+     if (strcasecmp(r->cmd, "REPL_PUT") == 0 && r->nargs >= 1)
+         return handle_repl_put(c, r);
+     if (strcasecmp(r->cmd, "REPL_RM") == 0 && r->nargs >= 1)
+         return handle_repl_rm(c, r);
+     if (strcasecmp(r->cmd, "REPL_HELLO") == 0) {
+         uint64_t at_epoch, at_seq;
+         repl_position(&at_epoch, &at_seq);
+         if (at_epoch != epoch) at_epoch = at_seq = 0;
+         return send_line(c->fd, "REPL_AT epoch=%016llx seq=%llu",
+                          (unsigned long long)at_epoch, (unsigned long long)at_seq);
      }
+     if (strcasecmp(r->cmd, "REPL_SYNC") == 0) {
+         if (repl_sync_begin(epoch) < 0) return send_line(c->fd, "ERR_OPEN");
+         printf("[Server] Full copy from primary %016llx\n", epoch);
+         return send_line(c->fd, "REPL_OK 0");
+     }
+     if (strcasecmp(r->cmd, "REPL_SYNC_END") == 0) {
+         repl_sync_end(seq, replica_drop);
+         return send_line(c->fd, "REPL_OK %llu", seq);
+     }
+     return send_line(c->fd, "ERR_BAD_ARGS");
+ }
+ 
+ /* ====================================================================
+  *  STATS  -------------------------------------------------------------
+  *    STATS  ->  "OK_STATS <n>" followed by n bytes of "key value" lines
+  * ===================================================================*/
+ static int handle_stats(conn_t *c)
+ {
+     char buf[16384];
+     size_t n = stats_format(buf, sizeof(buf));
+     if (send_line(c->fd, "OK_STATS %zu", n) < 0) return -1;
+     return send_all(c->fd, buf, n);
  }
  
  /* ====================================================================
-  *  Per‑client thread
+  *  Admission  ---------------------------------------------------------
+  *    any request  ->  "BUSY retry_after_ms=<n>" when over a limit
+  *  See admit.h.  Where the client sends more input without waiting
+  *  for a reply (DWRITE chunk lines, PUT_PART payloads, MGET paths,
+  *  PUTMSG texts, MGETMSG ids) we cannot skip
+  *  it cheaply, so the BUSY ends the connection ("close=1").
+  * ===================================================================*/
+
+ /* 0: serve r, with *charged payload bytes reserved; 1: refused;
+  * -1: refused and the connection must close */
+ static int admission(conn_t *c, request_t *r, uint32_t ip,
+                      unsigned long long *charged)
+ {
+     *charged = 0;
+     if (strcasecmp(r->cmd, "STATS") == 0) return 0;   /* the operator's view */
+     if (strncasecmp(r->cmd, "REPL_", 5) == 0) return 0;  /* our own primary */
+
+     int inbound = strcasecmp(r->cmd, "WRITE") == 0 ||
+                   strcasecmp(r->cmd, "APPEND") == 0 ||
+                   strcasecmp(r->cmd, "PUT_PART") == 0;
+     unsigned long long size = 0;
+     int sized = inbound && req_opt_u64(r, "size", &size);
+     int trailing = strcasecmp(r->cmd, "DWRITE") == 0 ||
+                    strcasecmp(r->cmd, "PUT_PART") == 0 ||
+                    strcasecmp(r->cmd, "MGET") == 0 ||
+                    strcasecmp(r->cmd, "PUTMSG") == 0 ||
+                    strcasecmp(r->cmd, "MGETMSG") == 0;
+
+     unsigned retry = ADMIT_RETRY_MS;
+     if (admit_request(ip, &retry) && (!sized || admit_bytes(size, &retry))) {
+         *charged = sized ? size : 0;
+         return 0;
+     }
+     LOG("[Server]  -> busy, retry after %u ms\n", retry);
+     send_line(c->fd, "BUSY retry_after_ms=%u%s", retry, trailing ? " close=1" : "");
+     return trailing ? -1 : 1;
+ }
+
+ /* ====================================================================
+  *  Per‑client thread: serve requests until the client hangs up
   * ===================================================================*/
  typedef struct { int s; struct sockaddr_in a; } client_t;
  
  static void *client_thread(void *arg)
  {
-     client_t *c = (client_t*)arg;
+     client_t *cl = (client_t*)arg;
      char ip[INET_ADDRSTRLEN];
-     inet_ntop(AF_INET,&c->a.sin_addr,ip,sizeof(ip));
-     unsigned short port = ntohs(c->a.sin_port);
-     printf("[Server] Client %s:%u connected\n", ip, port);
- 
-     char buf[BUF_SIZE] = {0};
-     int  n = recv(c->s, buf, sizeof(buf)-1, 0);
-     if (n <= 0) { close(c->s); free(c); return NULL; }
-     buf[n] = '\0';
-     printf("[Server]  cmd='%s'\n", buf);
- 
-     char *cmd  = strtok(buf," \t\r\n");
-     char *arg1 = strtok(NULL," \t\r\n");
-     char *arg2 = strtok(NULL," \t\r\n");
-     char *arg3 = strtok(NULL," \t\r\n");
- 
-     if (!cmd) { close(c->s); free(c); return NULL; }
- 
-     if (strcasecmp(cmd,"WRITE")==0 && arg1 && arg2)
-         handle_write(c->s,arg1,arg2,arg3);
-     else if (strcasecmp(cmd,"GET")==0 && arg1 && arg2)
-         handle_get(c->s,arg1,arg2);
-     else if (strcasecmp(cmd,"RM")==0 && arg1)
-         handle_rm(c->s,arg1);
-     else
-         send(c->s,"ERR_BAD_ARGS",12,0);
+     inet_ntop(AF_INET,&cl->a.sin_addr,ip,sizeof(ip));
+     unsigned short port = ntohs(cl->a.sin_port);
+     LOG("[Server] Client %s:%u connected\n", ip, port);
+     stats_conn_open();
+     fair_bind(cl->a.sin_addr.s_addr);
+ 
+     conn_t *c = malloc(sizeof(conn_t));
+     conn_init(c, cl->s);
+ 
+     char line[MAX_LINE];
+     while (conn_read_line(c, line, sizeof(line)) >= 0) {
+         LOG("[Server]  cmd='%s'\n", line);
+         request_t r;
+         parse_request(line, &r);
+         if (!r.cmd) continue;
+
+         unsigned long long charged;
+         int busy = admission(c, &r, cl->a.sin_addr.s_addr, &charged);
+         if (busy < 0) break;
+         if (busy) continue;
  
-     close(c->s);
-     printf("[Server] Client %s:%u disconnected\n", ip, port);
+         /* every request waits its client's turn to start; payload
+          * chunks take further turns inside the handlers */
+         uint64_t t0 = stats_now_ns();
+         fair_pace(FAIR_REQ_COST);
+         int rc;
+         if (g_follower && is_client_write(r.cmd)) {
+             /* payloads that follow unasked cannot be skipped cheaply */
+             send_line(c->fd, "ERR_READ_ONLY_FOLLOWER");
+             rc = strcasecmp(r.cmd,"PUT_PART")==0 || strcasecmp(r.cmd,"DWRITE")==0 ||
+                  strcasecmp(r.cmd,"MPUT")==0 || strcasecmp(r.cmd,"PUTMSG")==0 ? -1 : 0;
+         }
+         else if (strcasecmp(r.cmd,"WRITE")==0 && r.nargs >= 2)
+             rc = handle_write(c, &r, 0);
+         else if (strcasecmp(r.cmd,"APPEND")==0 && r.nargs >= 2)
+             rc = handle_write(c, &r, 1);
+         else if (strcasecmp(r.cmd,"DWRITE")==0 && r.nargs >= 2)
+             rc = handle_dwrite(c, &r);
+         else if (strcasecmp(r.cmd,"GET")==0 && r.nargs >= 1)
+             rc = handle_get(c, &r);
+         else if (strcasecmp(r.cmd,"SIGS")==0 && r.nargs >= 1)
+             rc = handle_sigs(c, &r);
+         else if (strcasecmp(r.cmd,"DELTA")==0 && r.nargs >= 2)
+             rc = handle_delta(c, &r);
+         else if (strcasecmp(r.cmd,"PUT_BEGIN")==0 && r.nargs >= 2)
+             rc = handle_put_begin(c, &r);
+         else if (strcasecmp(r.cmd,"PUT_PART")==0)
+             rc = handle_put_part(c, &r);
+         else if (strcasecmp(r.cmd,"PUT_COMMIT")==0)
+             rc = handle_put_commit(c, &r, 0);
+         else if (strcasecmp(r.cmd,"PUT_ABORT")==0)
+             rc = handle_put_commit(c, &r, 1);
+         else if (strcasecmp(r.cmd,"RM")==0 && r.nargs >= 1)
+             rc = handle_rm(c, &r);
+         else if (strcasecmp(r.cmd,"MGET")==0)
+             rc = handle_mget(c, &r);
+         else if (strcasecmp(r.cmd,"MPUT")==0)
+             rc = handle_mput(c, &r);
+         else if (strcasecmp(r.cmd,"PUTMSG")==0 && r.nargs >= 1)
+             rc = handle_putmsg(c, &r);
+         else if (strcasecmp(r.cmd,"GETMSG")==0 && r.nargs >= 1)
+             rc = handle_getmsg(c, &r);
+         else if (strcasecmp(r.cmd,"MGETMSG")==0)
+             rc = handle_mgetmsg(c, &r);
+         else if (strcasecmp(r.cmd,"LS")==0)
+             rc = handle_ls(c, &r);
+         else if (strcasecmp(r.cmd,"STAT")==0)
+             rc = handle_stat(c, &r);
+         else if (strcasecmp(r.cmd,"HELLO")==0)
+             rc = handle_hello(c, &r);
+         else if (strcasecmp(r.cmd,"STATS")==0)
+             rc = handle_stats(c);
+         else if (strncasecmp(r.cmd,"REPL_",5)==0)
+             rc = handle_repl(c, &r);
+         else
+             rc = send_line(c->fd, "ERR_BAD_ARGS");
+         stats_request(stats_cmd(r.cmd), stats_now_ns() - t0);
+         admit_bytes_done(charged);
+         if (rc < 0) break;
+     }
+ 
+     close(cl->s);
+     admit_conn_done();
+     stats_conn_close();
+     LOG("[Server] Client %s:%u disconnected\n", ip, port);
+     conn_release(c);
      free(c);
+     free(cl);
      return NULL;
  }
  
  /* ====================================================================
-  *  main
+  *  Shards (rfserver -P)  ----------------------------------------------
+  *  N processes each bind the port with SO_REUSEPORT, and the kernel
+  *  spreads new connections over their accept queues.  What has to
+  *  agree across them is shared: the permission table through its log,
+  *  the upload table in shared memory, file contents and range locks
+  *  through the file system (a cache hit is checked with stat()).
+  *  Caches, statistics, admission limits and fair scheduling are per
+  *  shard; -m, -b, -r and -Q are split evenly between them.  The
+  *  parent only supervises: a shard killed by a signal is started
+  *  again, after a pause that grows while it keeps dying young, and
+  *  the others serve meanwhile.  A shard that exits by itself could
+  *  not start, and stops them all.
   * ===================================================================*/
- int main(void)
- {
-     mkdir(SERVER_DATA_DIR,0777);
+ typedef struct {
+     int                verbose, dump_secs, backlog;
+     dio_backend_t      io;
+     unsigned           max_conns;
+     unsigned long long max_bytes;
+     double             rate;
+     int                fair_slots;     /* -Q, -1 = one per CPU */
+ } options_t;
  
+ static int open_listener(int backlog)
+ {
      int lsock = socket(AF_INET,SOCK_STREAM,0);
-     if (lsock<0){perror("socket");return 1;}
+     if (lsock<0){perror("socket");return -1;}
      int opt=1; setsockopt(lsock,SOL_SOCKET,SO_REUSEADDR,&opt,sizeof(opt));
+     if (g_shards > 1 &&
+         setsockopt(lsock,SOL_SOCKET,SO_REUSEPORT,&opt,sizeof(opt))<0){
+         perror("SO_REUSEPORT"); close(lsock); return -1;}
  
      struct sockaddr_in addr={0};
-     addr.sin_family=AF_INET; addr.sin_port=htons(PORT);
+     addr.sin_family=AF_INET; addr.sin_port=htons(g_port);
      addr.sin_addr.s_addr=INADDR_ANY;
      if (bind(lsock,(struct sockaddr*)&addr,sizeof(addr))<0){
-         perror("bind"); return 1;}
-     if (listen(lsock,5)<0){perror("listen");return 1;}
-     printf("[Server] Listening on port %d …\n", PORT);
+         perror("bind"); close(lsock); return -1;}
+     /* a connection storm queues here (the kernel caps it at
+      * net.core.somaxconn) and is then turned away by admit_conn() */
+     if (listen(lsock,backlog)<0){perror("listen"); close(lsock); return -1;}
+     return lsock;
+ }
+ 
+ /* One server process: its threads, its listening socket and its
+  * accept loop.  Returns only if it cannot start. */
+ static int serve(const options_t *o, int shard, pid_t parent)
+ {
+     unsigned           max_conns = o->max_conns;
+     unsigned long long max_bytes = o->max_bytes;
+     double             rate      = o->rate;
+     unsigned           slots     = o->fair_slots >= 0 ? (unsigned)o->fair_slots
+                                    : (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+     if (g_shards > 1) {
+         /* go down with the supervisor */
+         prctl(PR_SET_PDEATHSIG, SIGTERM);
+         if (getppid() != parent) return 1;
+         if (permtable_attach() < 0) return 1;
+         stats_shard(shard, g_shards);
+         max_conns = (max_conns + g_shards - 1) / g_shards;
+         max_bytes = (max_bytes + g_shards - 1) / g_shards;
+         rate     /= g_shards;
+         if (slots) slots = (slots + g_shards - 1) / g_shards;
+     }
+ 
+     stats_init();
+     if (o->verbose) logger_init();
+     if (o->dump_secs > 0) stats_start_dump(o->dump_secs);
+     filecache_init(FILECACHE_BYTES, FILECACHE_MAX_ENTRY);
+     if (workpool_init(BATCH_THREADS) < 0) return 1;
+     diskio_init(o->io, DISKIO_DEPTH);
+     admit_init(max_conns, max_bytes, rate);
+     fair_init(slots);
+     if (msgstore_init(g_shards == 1) < 0) return 1;   /* shards share messages/ */
+     if (dircache_init(SERVER_DATA_DIR, logical_size) < 0) return 1;
+     if (g_chunked) {
+         cdc_init();
+         if (chunkstore_init(CHUNK_STORE_DIR, SERVER_DATA_DIR) < 0) return 1;
+     }
+     if (g_follower) repl_follow();
+     repl_start();
+ 
+     int lsock = open_listener(o->backlog);
+     if (lsock < 0) return 1;
+     if (g_shards > 1)
+         printf("[Server] Shard %d/%d (pid %d) listening on port %d … (disk I/O: %s%s)\n",
+                shard, g_shards, (int)getpid(), g_port, diskio_backend(),
+                seal_enabled() ? ", sealed" : "");
+     else
+         printf("[Server] Listening on port %d … (disk I/O: %s%s%s)\n", g_port,
+                diskio_backend(), seal_enabled() ? ", sealed" : "",
+                g_follower ? ", follower" : "");
+     fflush(stdout);
  
+     int opt = 1;
      while (1) {
+         struct sockaddr_in a;
+         socklen_t len = sizeof(a);
+         int s = accept(lsock,(struct sockaddr*)&a,&len);
+         if (s < 0) {
+             perror("accept");
+             if (errno == EMFILE || errno == ENFILE) usleep(10000);
+             continue;
+         }
+         /* a status line followed by a payload would otherwise wait
+          * out the peer's delayed ACK (~40 ms) under Nagle */
+         setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+         unsigned retry = ADMIT_RETRY_MS;
+         if (!admit_conn(&retry)) { admit_refuse(s, retry); continue; }
+
          client_t *c = malloc(sizeof(client_t));
-         socklen_t len = sizeof(c->a);
-         c->s = accept(lsock,(struct sockaddr*)&c->a,&len);
-         if (c->s < 0) { perror("accept"); free(c); continue; }
-         pthread_t tid; pthread_create(&tid,NULL,client_thread,c);
+         pthread_t tid;
+         if (!c) { admit_conn_done(); admit_refuse(s, retry); continue; }
+         c->s = s;
+         c->a = a;
+         if (pthread_create(&tid,NULL,client_thread,c) != 0) {
+             free(c);
+             admit_conn_done();
+             admit_refuse(s, retry);
+             continue;
+         }
          pthread_detach(tid);
      }
      return 0;
  }
- 
\ No newline at end of file
+ 
+ static pid_t spawn_shard(const options_t *o, int shard)
+ {
+     pid_t parent = getpid();
+     fflush(stdout);
+     pid_t pid = fork();
+     if (pid == 0) exit(serve(o, shard, parent));
+     if (pid < 0) perror("fork");
+     return pid;
+ }
+ 
+ static int supervise(const options_t *o)
+ {
+     pid_t    pid[SHARDS_MAX];
+     time_t   born[SHARDS_MAX];
+     unsigned pause_ms[SHARDS_MAX] = {0};
+     for (int i = 0; i < g_shards; ++i) {
+         born[i] = time(NULL);
+         if ((pid[i] = spawn_shard(o, i)) < 0) return 1;
+     }
+ 
+     for (;;) {
+         int st;
+         pid_t dead = waitpid(-1, &st, 0);
+         if (dead < 0) {
+             if (errno == EINTR) continue;
+             perror("waitpid");
+             return 1;
+         }
+         int i = 0;
+         while (i < g_shards && pid[i] != dead) ++i;
+         if (i == g_shards) continue;
+ 
+         if (WIFEXITED(st)) {
+             fprintf(stderr, "[Server] Shard %d exited (status %d); shutting down\n",
+                     i, WEXITSTATUS(st));
+             for (int j = 0; j < g_shards; ++j)
+                 if (j != i && pid[j] > 0) kill(pid[j], SIGTERM);
+             while (wait(NULL) > 0)
+                 ;
+             return 1;
+         }
+         /* dying again soon after a restart doubles the pause */
+         if (time(NULL) - born[i] < 10)
+             pause_ms[i] = pause_ms[i] ? pause_ms[i] * 2 : 100;
+         else
+             pause_ms[i] = 0;
+         if (pause_ms[i] > SHARD_BACKOFF_MS) pause_ms[i] = SHARD_BACKOFF_MS;
+         printf("[Server] Shard %d (pid %d) killed by signal %d; restarting in %u ms\n",
+                i, (int)dead, WTERMSIG(st), pause_ms[i]);
+         usleep(pause_ms[i] * 1000);
+         born[i] = time(NULL);
+         pid[i]  = spawn_shard(o, i);
+     }
+ }
+ 
+ /* ====================================================================
+  *  main
+  * ===================================================================*/
+ int main(int argc, char *argv[])
+ {
+     int ch, nfollowers = 0;
+     const char *keyfile = NULL, *dir = NULL;
+     options_t o = { .io = DIO_URING, .max_conns = ADMIT_MAX_CONNS,
+                     .max_bytes = ADMIT_MAX_BYTES, .backlog = LISTEN_BACKLOG,
+                     .fair_slots = -1 };
+     while ((ch = getopt(argc, argv, "CvZs:I:E:m:b:r:L:Q:P:p:d:FR:")) != -1) {
+         switch (ch) {
+         case 'C': g_chunked = 1; break;
+         case 'v': o.verbose = 1; break;
+         case 'Z': g_no_compress = 1; break;
+         case 's': o.dump_secs = atoi(optarg); break;
+         case 'I':
+             o.io = strcmp(optarg, "sync") == 0 ? DIO_SYNC :
+                    strcmp(optarg, "pool") == 0 ? DIO_POOL : DIO_URING;
+             break;
+         case 'E': keyfile = optarg; break;
+         case 'm': o.max_conns = (unsigned)atoi(optarg); break;
+         case 'b': o.max_bytes = strtoull(optarg, NULL, 10) << 20; break;
+         case 'r': o.rate = atof(optarg); break;
+         case 'L': o.backlog = atoi(optarg); break;
+         case 'Q': o.fair_slots = atoi(optarg) < 0 ? 0 : atoi(optarg); break;
+         case 'P':
+             g_shards = atoi(optarg);
+             if (g_shards <= 0) g_shards = (int)sysconf(_SC_NPROCESSORS_ONLN);
+             if (g_shards < 1) g_shards = 1;
+             if (g_shards > SHARDS_MAX) g_shards = SHARDS_MAX;
+             break;
+         case 'p': g_port = atoi(optarg); break;
+         case 'd': dir = optarg; break;
+         case 'F': g_follower = 1; break;
+         case 'R':
+             if (repl_add_follower(optarg) < 0) {
+                 fprintf(stderr, "-R %s: bad follower (host:port, at most %d)\n",
+                         optarg, REPL_MAX_FOLLOWERS);
+                 return 1;
+             }
+             ++nfollowers;
+             break;
+         default:
+             fprintf(stderr, "Usage: %s [-C] [-v] [-Z] [-s secs] [-I uring|pool|sync] "
+                             "[-E keyfile]\n"
+                             "          [-m conns] [-b MB] [-r req/s] [-L backlog] "
+                             "[-Q slots] [-P shards]\n"
+                             "          [-p port] [-d dir] [-F] [-R host:port]...\n"
+                             "  -C  chunked, deduplicating storage\n"
+                             "  -v  log every request (buffered, asynchronous)\n"
+                             "  -Z  refuse compressed payloads (HELLO compress=)\n"
+                             "  -s  print server statistics every secs seconds\n"
+                             "  -I  disk I/O backend (default uring, pool if unavailable)\n"
+                             "  -E  encrypt file contents at rest with this 32-byte key\n"
+                             "  -m  most open connections (default %d, 0 = no limit)\n"
+                             "  -b  most payload MB in flight (default %llu, 0 = no limit)\n"
+                             "  -r  most requests per second per client address (default off)\n"
+                             "  -L  listen backlog (default %d)\n"
+                             "  -Q  fair scheduling: payload chunks worked on at once "
+                             "(default one per CPU, 0 = off)\n"
+                             "  -P  serve from this many processes on one port "
+                             "(0 = one per CPU)\n"
+                             "  -p  port (default %d)\n"
+                             "  -d  keep server_data and the logs in this directory\n"
+                             "  -F  follower: take changes from a primary, reads only\n"
+                             "  -R  primary: stream changes to the follower at host:port\n",
+                     argv[0], ADMIT_MAX_CONNS, ADMIT_MAX_BYTES >> 20, LISTEN_BACKLOG,
+                     PORT);
+             return 1;
+         }
+     }
+ 
+     if (keyfile && g_chunked) {
+         /* chunks are shared between files: no per-file nonce */
+         fprintf(stderr, "-E cannot be combined with -C\n");
+         return 1;
+     }
+     if (g_shards > 1 && g_chunked) {
+         /* chunk reference counts live in one process's memory */
+         fprintf(stderr, "-P cannot be combined with -C\n");
+         return 1;
+     }
+     if ((nfollowers || g_follower) && g_chunked) {
+         /* chunked files would travel as manifests */
+         fprintf(stderr, "-R and -F cannot be combined with -C\n");
+         return 1;
+     }
+     if (nfollowers && (g_follower || g_shards > 1)) {
+         /* one change log, in one process */
+         fprintf(stderr, "-R cannot be combined with -F or -P\n");
+         return 1;
+     }
+     if (keyfile && seal_init(keyfile) < 0) return 1;
+     if (dir && ((mkdir(dir, 0777) < 0 && errno != EEXIST) || chdir(dir) < 0)) {
+         perror(dir);
+         return 1;
+     }
+
+     /* everything here is done once, before any shard is forked */
+     signal(SIGPIPE, SIG_IGN);               /* peers may vanish mid‑send */
+     mkdir(SERVER_DATA_DIR,0777);
+     upload_sweep(SERVER_DATA_DIR);          /* temp files of a crash */
+     if (upload_init() < 0) return 1;
+     if (permtable_init(META_LOG_PATH) < 0) return 1;
+     if (g_shards == 1) return serve(&o, 0, 0);
+ 
+     if (permtable_share() < 0) return 1;
+     printf("[Server] Starting %d shards on port %d\n", g_shards, g_port);
+     return supervise(&o);
+ }
@@ -0,0 +1,31 @@
+/* --------------------------------------------------------------------
+ *  sha256.h  –  small self-contained SHA-256 (FIPS 180-4)
+ * ------------------------------------------------------------------ */
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_LEN 32
+#define SHA256_HEX (2 * SHA256_LEN + 1)
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t bytes;
+    uint8_t  block[64];
+    size_t   used;
+} sha256_t;
+
+void sha256_init(sha256_t *s);
+void sha256_update(sha256_t *s, const void *data, size_t len);
+void sha256_final(sha256_t *s, uint8_t out[SHA256_LEN]);
+
+/* one-shot convenience */
+void sha256(const void *data, size_t len, uint8_t out[SHA256_LEN]);
+
+/* lowercase hex <-> raw digest; sha256_from_hex returns 0 on success */
+void sha256_hex(const uint8_t d[SHA256_LEN], char hex[SHA256_HEX]);
+int  sha256_from_hex(const char *hex, uint8_t d[SHA256_LEN]);
+
+#endif // SHA256_H
@@ -0,0 +1,197 @@
+/* --------------------------------------------------------------------
+ *  stats.c  –  counters, histograms and the periodic dump
+ * ------------------------------------------------------------------ */
+#include "stats.h"
+#include "lathist.h"
+#include "proto.h"
+#include "filecache.h"
+#include "dircache.h"
+#include "diskio.h"
+#include "seal.h"
+#include "crc32c.h"
+#include "admit.h"
+#include "fairq.h"
+#include "msgstore.h"
+#include "replica.h"
+
+#include <time.h>
+
+static const char *g_names[] = {
+    "WRITE", "APPEND", "DWRITE", "GET", "RM",
+    "PUT_BEGIN", "PUT_PART", "PUT_COMMIT", "PUT_ABORT", "MGET", "MPUT",
+    "LS", "STAT", "HELLO", "SIGS", "DELTA",
+    "PUTMSG", "GETMSG", "MGETMSG",
+    "STATS",
+    "OTHER"                                 /* must stay last */
+};
+#define NCMDS ((int)(sizeof(g_names) / sizeof(g_names[0])))
+
+static lathist_t g_cmd[NCMDS];
+static lathist_t g_lock_wait[2];            /* [0] shared, [1] exclusive */
+static uint64_t  g_conns_active, g_conns_total;
+static uint64_t  g_crc_stored, g_crc_computed, g_crc_mismatches;
+static uint64_t  g_start_ns;
+static int       g_shard, g_shard_count = 1;
+
+uint64_t stats_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void stats_init(void)
+{
+    g_start_ns = stats_now_ns();
+}
+
+void stats_shard(int index, int count)
+{
+    g_shard       = index;
+    g_shard_count = count;
+}
+
+int stats_cmd(const char *name)
+{
+    for (int i = 0; i < NCMDS - 1; ++i)
+        if (strcasecmp(name, g_names[i]) == 0) return i;
+    return NCMDS - 1;
+}
+
+void stats_request(int cmd, uint64_t ns)
+{
+    lathist_add(&g_cmd[cmd], ns);
+}
+
+void stats_conn_open(void)
+{
+    __atomic_add_fetch(&g_conns_active, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&g_conns_total, 1, __ATOMIC_RELAXED);
+}
+
+void stats_conn_close(void)
+{
+    __atomic_sub_fetch(&g_conns_active, 1, __ATOMIC_RELAXED);
+}
+
+void stats_lock_wait(int exclusive, uint64_t ns)
+{
+    lathist_add(&g_lock_wait[exclusive != 0], ns);
+}
+
+void stats_crc_sent(int stored)
+{
+    __atomic_add_fetch(stored ? &g_crc_stored : &g_crc_computed, 1, __ATOMIC_RELAXED);
+}
+
+void stats_crc_mismatch(void)
+{
+    __atomic_add_fetch(&g_crc_mismatches, 1, __ATOMIC_RELAXED);
+}
+
+static size_t put_hist(char *buf, size_t cap, size_t n, const char *what,
+                       const char *name, const lathist_t *live)
+{
+    lathist_t h = {0};
+    lathist_merge(&h, live);
+    if (n >= cap) return n;
+    return n + (size_t)snprintf(buf + n, cap - n,
+        "%s %s count=%llu mean_us=%.1f p50_us=%.1f p99_us=%.1f "
+        "p999_us=%.1f max_us=%.1f total_ms=%.1f\n", what, name,
+        (unsigned long long)h.count, lathist_mean(&h) / 1e3,
+        lathist_pct(&h, 0.50) / 1e3, lathist_pct(&h, 0.99) / 1e3,
+        lathist_pct(&h, 0.999) / 1e3, h.max / 1e3, h.sum / 1e6);
+}
+
+size_t stats_format(char *buf, size_t cap)
+{
+    unsigned long long in, out;
+    proto_bytes(&in, &out);
+    unsigned long long zraw, zwire;
+    proto_zbytes(&zraw, &zwire);
+    fc_stats_t fc;
+    filecache_get_stats(&fc);
+    dc_stats_t dc;
+    dircache_get_stats(&dc);
+    unsigned long long dio_ops, dio_inline;
+    unsigned dio_max;
+    diskio_get_stats(&dio_ops, &dio_inline, &dio_max);
+    admit_stats_t ad;
+    admit_get_stats(&ad);
+    fair_stats_t fq;
+    fair_get_stats(&fq);
+    msgstore_stats_t ms;
+    msgstore_get_stats(&ms);
+
+    size_t n = (size_t)snprintf(buf, cap,
+        "uptime_s %.1f\n"
+        "shard %d/%d pid=%d\n"
+        "conns_active %llu\n"
+        "conns_total %llu\n"
+        "bytes_in %llu\n"
+        "bytes_out %llu\n"
+        "compress raw_bytes=%llu wire_bytes=%llu\n"
+        "cache hits=%llu misses=%llu entries=%llu bytes=%llu evictions=%llu\n"
+        "dircache dirs=%llu entries=%llu lists=%llu scans=%llu renders=%llu "
+        "events=%llu overflows=%llu\n"
+        "diskio backend=%s ops=%llu inline=%llu max_inflight=%u\n"
+        "seal %s bytes=%llu\n"
+        "crc32c %s sent_stored=%llu sent_computed=%llu mismatches=%llu\n"
+        "admit conns=%u/%u bytes=%llu/%llu rate=%.0f refused_conns=%llu "
+        "refused_rate=%llu refused_bytes=%llu\n"
+        "fair slots=%u busy=%u clients=%u turns=%llu queued=%llu wait_ms=%.1f\n"
+        "msgcache entries=%d/%d hits=%llu misses=%llu puts=%llu\n",
+        (stats_now_ns() - g_start_ns) / 1e9,
+        g_shard, g_shard_count, (int)getpid(),
+        (unsigned long long)__atomic_load_n(&g_conns_active, __ATOMIC_RELAXED),
+        (unsigned long long)__atomic_load_n(&g_conns_total, __ATOMIC_RELAXED),
+        in, out, zraw, zwire,
+        (unsigned long long)fc.hits, (unsigned long long)fc.misses,
+        (unsigned long long)fc.entries, (unsigned long long)fc.bytes,
+        (unsigned long long)fc.evictions,
+        (unsigned long long)dc.dirs, (unsigned long long)dc.entries,
+        (unsigned long long)dc.lists, (unsigned long long)dc.scans,
+        (unsigned long long)dc.renders, (unsigned long long)dc.events,
+        (unsigned long long)dc.overflows,
+        diskio_backend(), dio_ops, dio_inline, dio_max,
+        seal_enabled() ? "on" : "off", seal_bytes(),
+        crc32c_hw() ? "sse4.2" : "table",
+        (unsigned long long)__atomic_load_n(&g_crc_stored, __ATOMIC_RELAXED),
+        (unsigned long long)__atomic_load_n(&g_crc_computed, __ATOMIC_RELAXED),
+        (unsigned long long)__atomic_load_n(&g_crc_mismatches, __ATOMIC_RELAXED),
+        ad.conns, ad.max_conns, ad.bytes, ad.max_bytes, ad.rate,
+        ad.refused_conns, ad.refused_rate, ad.refused_bytes,
+        fq.slots, fq.busy, fq.clients, fq.turns, fq.queued, fq.wait_ns / 1e6,
+        ms.cached, ms.capacity, ms.hits, ms.misses, ms.puts);
+    if (n < cap) n += repl_format(buf + n, cap - n);
+    n = put_hist(buf, cap, n, "lock_wait", "shared", &g_lock_wait[0]);
+    n = put_hist(buf, cap, n, "lock_wait", "exclusive", &g_lock_wait[1]);
+    for (int i = 0; i < NCMDS; ++i)
+        if (__atomic_load_n(&g_cmd[i].count, __ATOMIC_RELAXED))
+            n = put_hist(buf, cap, n, "cmd", g_names[i], &g_cmd[i]);
+    return n < cap ? n : cap - 1;
+}
+
+static void *dump_thread(void *arg)
+{
+    int   secs = *(int *)arg;
+    char *buf  = malloc(16384);
+    if (!buf) return NULL;
+    for (;;) {
+        sleep((unsigned)secs);
+        size_t n = stats_format(buf, 16384);
+        printf("[Server] ---- stats ----\n%.*s", (int)n, buf);
+        fflush(stdout);
+    }
+    return NULL;
+}
+
+void stats_start_dump(int secs)
+{
+    static int period;
+    period = secs;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, dump_thread, &period) == 0)
+        pthread_detach(tid);
+}
+
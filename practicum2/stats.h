@@ -0,0 +1,50 @@
+/* --------------------------------------------------------------------
+ *  stats.h  –  in-process server metrics (STATS command)
+ *
+ *  Lock-free counters and per-command latency histograms, updated with
+ *  relaxed atomics from every client thread.  stats_format() renders
+ *  them as "key value" text lines for STATS and for the periodic dump
+ *  (rfserver -s <secs>).
+ * ------------------------------------------------------------------ */
+#ifndef STATS_H
+#define STATS_H
+
+#include "common.h"
+#include <stdint.h>
+
+/* Start the uptime clock. */
+void     stats_init(void);
+
+/* This process is shard index of count (rfserver -P). */
+void     stats_shard(int index, int count);
+
+/* Index of a request name in the per-command table (unknown names
+ * share the last slot). */
+int      stats_cmd(const char *name);
+
+/* one finished request: command index and service time */
+void     stats_request(int cmd, uint64_t ns);
+
+void     stats_conn_open(void);
+void     stats_conn_close(void);
+
+/* time a caller spent blocked on a file lock (0 if uncontended) */
+void     stats_lock_wait(int exclusive, uint64_t ns);
+
+/* a CRC line sent after a GET payload: the file's stored sum, or
+ * one taken over the bytes as they went out */
+void     stats_crc_sent(int stored);
+
+/* an upload whose CRC line did not match the bytes that arrived */
+void     stats_crc_mismatch(void);
+
+uint64_t stats_now_ns(void);
+
+/* Render every metric into buf; returns the length (truncated to
+ * cap - 1 like snprintf). */
+size_t   stats_format(char *buf, size_t cap);
+
+/* Print stats_format() to stdout every `secs` seconds. */
+void     stats_start_dump(int secs);
+
+#endif // STATS_H
@@ -0,0 +1,291 @@
+/* --------------------------------------------------------------------
+ *  upload.c  –  table of in-flight parallel uploads
+ * ------------------------------------------------------------------ */
+#define _GNU_SOURCE                        /* nftw(), MAP_ANONYMOUS */
+#include "upload.h"
+#include "logger.h"
+#include "permtable.h"
+#include "seal.h"
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/mman.h>
+
+/* one slot per upload (id 0 = free), shared by every shard process;
+ * the mutex is robust so a shard that dies holding it does not wedge
+ * the others */
+typedef struct {
+    pthread_mutex_t lock;
+    upload_t        slot[UPLOAD_SLOTS];
+} upload_table_t;
+
+static upload_table_t *g_tab;
+
+int upload_init(void)
+{
+    g_tab = mmap(NULL, sizeof(*g_tab), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (g_tab == MAP_FAILED) { g_tab = NULL; perror("upload: mmap"); return -1; }
+    pthread_mutexattr_t a;
+    pthread_mutexattr_init(&a);
+    pthread_mutexattr_setpshared(&a, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&a, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&g_tab->lock, &a);
+    pthread_mutexattr_destroy(&a);
+    return 0;
+}
+
+static void tab_lock(void)
+{
+    if (pthread_mutex_lock(&g_tab->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&g_tab->lock);
+}
+
+static void tab_unlock(void)
+{
+    pthread_mutex_unlock(&g_tab->lock);
+}
+
+/* caller holds the table lock */
+static upload_t *tab_find(uint64_t id)
+{
+    for (int i = 0; i < UPLOAD_SLOTS; ++i)
+        if (g_tab->slot[i].id == id) return &g_tab->slot[i];
+    return NULL;
+}
+
+static upload_t *copy_of(const upload_t *u)
+{
+    upload_t *c = malloc(sizeof(*c));
+    if (c) *c = *u;
+    return c;
+}
+
+uint64_t upload_new_id(void)
+{
+    static uint64_t seq;
+    uint64_t x = (uint64_t)time(NULL) << 20 ^ (uint64_t)getpid() << 40;
+    x += __atomic_add_fetch(&seq, 1, __ATOMIC_RELAXED);
+    x ^= x >> 33; x *= 0xff51afd7ed558ccdULL; x ^= x >> 33;
+    return x ? x : 1;
+}
+
+void upload_tmp_path(char *out, size_t cap, const char *full,
+                     const char *tag, uint64_t id)
+{
+    /* hidden temp file in the target's directory, so the final
+     * rename() never crosses a file system */
+    const char *slash = strrchr(full, '/');
+    int dirlen = slash ? (int)(slash - full) + 1 : 0;
+    snprintf(out, cap, "%.*s.%s.%s.%016llx", dirlen, full, full + dirlen,
+             tag, (unsigned long long)id);
+}
+
+upload_t *upload_begin(const char *remote, const char *full,
+                       unsigned long long size, int perm_first)
+{
+    upload_t u = {0};
+    u.id   = upload_new_id();
+    u.size = size;
+    u.perm_first = perm_first;
+    u.last_active = time(NULL);
+    snprintf(u.remote, sizeof(u.remote), "%s", remote);
+
+    upload_tmp_path(u.tmp, sizeof(u.tmp), full, "upload", u.id);
+
+    int fd = open(u.tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd < 0) { perror("upload: open"); return NULL; }
+    /* nonce first, while the file is still empty */
+    if (seal_attach(fd) < 0) {
+        perror("upload: seal");
+        close(fd); unlink(u.tmp);
+        return NULL;
+    }
+    /* reserve the space up front; ranges land in place */
+    int rc = posix_fallocate(fd, 0, (off_t)size);
+    if (rc != 0 && rc != EOPNOTSUPP && rc != EINVAL)
+        fprintf(stderr, "upload: fallocate: %s\n", strerror(rc));
+    if (ftruncate(fd, (off_t)size) < 0) perror("upload: ftruncate");
+    close(fd);
+
+    tab_lock();
+    upload_t *s = tab_find(0);
+    if (s) *s = u;
+    tab_unlock();
+    if (!s) {
+        fprintf(stderr, "upload: all %d slots in use\n", UPLOAD_SLOTS);
+        unlink(u.tmp);
+        return NULL;
+    }
+    return copy_of(&u);
+}
+
+upload_t *upload_get(uint64_t id)
+{
+    upload_t *c = NULL;
+    tab_lock();
+    upload_t *u = id ? tab_find(id) : NULL;
+    if (u) {
+        u->last_active = time(NULL);
+        c = copy_of(u);
+    }
+    tab_unlock();
+    return c;
+}
+
+void upload_release(upload_t *u)
+{
+    free(u);
+}
+
+void upload_touch(uint64_t id)
+{
+    tab_lock();
+    upload_t *u = id ? tab_find(id) : NULL;
+    if (u) u->last_active = time(NULL);
+    tab_unlock();
+}
+
+static int overlaps(const upload_range_t *r, int n,
+                    unsigned long long off, unsigned long long end)
+{
+    for (int i = 0; i < n; ++i)
+        if (off < r[i].end && r[i].off < end) return 1;
+    return 0;
+}
+
+int upload_claim(uint64_t id, unsigned long long off, unsigned long long n)
+{
+    unsigned long long end = off + n;
+    int rc = -1;
+    tab_lock();
+    upload_t *u = id ? tab_find(id) : NULL;
+    if (u) {
+        for (int i = 0; i < u->ndone; ++i)
+            if (u->done[i].off <= off && end <= u->done[i].end) rc = 1;
+        if (n == 0) rc = 1;
+        /* each claim leaves room for its range in done[] when it lands */
+        if (rc != 1 && !overlaps(u->done, u->ndone, off, end) &&
+            !overlaps(u->busy, u->nbusy, off, end) &&
+            u->nbusy < UPLOAD_PARTS && u->ndone + u->nbusy < UPLOAD_RANGES) {
+            u->busy[u->nbusy++] = (upload_range_t){ off, end };
+            rc = 0;
+        }
+    }
+    tab_unlock();
+    return rc;
+}
+
+/* caller holds the table lock; claim made room for the new range */
+static void add_done(upload_t *u, unsigned long long off, unsigned long long end)
+{
+    int i = 0;
+    while (i < u->ndone && u->done[i].end < off) ++i;
+    if (i < u->ndone && u->done[i].off <= end) {
+        /* touches done[i] (they never overlap); maybe done[i + 1] too */
+        if (off < u->done[i].off) u->done[i].off = off;
+        if (end > u->done[i].end) u->done[i].end = end;
+        if (i + 1 < u->ndone && u->done[i + 1].off == u->done[i].end) {
+            u->done[i].end = u->done[i + 1].end;
+            memmove(&u->done[i + 1], &u->done[i + 2],
+                    (size_t)(u->ndone - i - 2) * sizeof(u->done[0]));
+            u->ndone--;
+        }
+        return;
+    }
+    memmove(&u->done[i + 1], &u->done[i], (size_t)(u->ndone - i) * sizeof(u->done[0]));
+    u->done[i] = (upload_range_t){ off, end };
+    u->ndone++;
+}
+
+void upload_settle(uint64_t id, unsigned long long off,
+                   unsigned long long n, int ok)
+{
+    tab_lock();
+    upload_t *u = id ? tab_find(id) : NULL;
+    if (u) u->last_active = time(NULL);
+    for (int i = 0; u && i < u->nbusy; ++i) {
+        if (u->busy[i].off != off || u->busy[i].end != off + n) continue;
+        u->busy[i] = u->busy[--u->nbusy];
+        if (ok) {
+            add_done(u, off, off + n);
+            u->received += n;
+        }
+        break;
+    }
+    tab_unlock();
+}
+
+int upload_complete(const upload_t *u)
+{
+    if (u->nbusy) return 0;
+    if (u->size == 0) return 1;
+    return u->ndone == 1 && u->done[0].off == 0 && u->done[0].end == u->size;
+}
+
+upload_t *upload_take(uint64_t id)
+{
+    upload_t *c = NULL;
+    tab_lock();
+    upload_t *u = id ? tab_find(id) : NULL;
+    if (u) {
+        c = copy_of(u);
+        u->id = 0;                          /* slot is free again */
+    }
+    tab_unlock();
+    return c;
+}
+
+void upload_expire(time_t max_idle)
+{
+    time_t   now = time(NULL);
+    upload_t dead[16];
+    int      n;
+
+    do {
+        n = 0;
+        tab_lock();
+        for (int i = 0; i < UPLOAD_SLOTS && n < 16; ++i) {
+            upload_t *u = &g_tab->slot[i];
+            if (u->id && now - u->last_active > max_idle) {
+                dead[n++] = *u;
+                u->id = 0;
+            }
+        }
+        tab_unlock();
+
+        for (int i = 0; i < n; ++i) {
+            LOG("[Server] Expiring idle upload of '%s'\n", dead[i].remote);
+            unlink(dead[i].tmp);
+            if (dead[i].perm_first) permtable_remove(dead[i].remote);
+        }
+    } while (n == 16);
+}
+
+/* ".<base>.upload.<16 hex>" or ".<base>.write.<16 hex>" */
+int upload_is_tmp(const char *base)
+{
+    size_t n = strlen(base);
+    if (base[0] != '.' || n < 1 + 1 + 7 + 16) return 0;   /* ".b.write.<hex>" */
+    for (size_t i = n - 16; i < n; ++i)
+        if (!isxdigit((unsigned char)base[i])) return 0;
+    const char *end = base + n - 16;        /* just past the tag's dot */
+    return strncmp(end - 8, ".upload.", 8) == 0 ||
+           strncmp(end - 7, ".write.", 7) == 0;
+}
+
+static int sweep_tmp(const char *path, const struct stat *sb,
+                     int type, struct FTW *ftw)
+{
+    (void)sb;
+    if (type == FTW_F && upload_is_tmp(path + ftw->base)) {
+        printf("[Server] Removing stale temp file '%s'\n", path);
+        unlink(path);
+    }
+    return 0;
+}
+
+void upload_sweep(const char *data_dir)
+{
+    nftw(data_dir, sweep_tmp, 32, FTW_PHYS);
+}
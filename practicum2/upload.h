@@ -0,0 +1,91 @@
+/* --------------------------------------------------------------------
+ *  upload.h  –  in-flight multi-stream uploads (PUT_BEGIN/PART/COMMIT)
+ *               and the hidden temp files behind atomic replaces
+ *
+ *  A parallel upload streams its ranges into a hidden temp file next
+ *  to the target; PUT_COMMIT renames it into place in one step, so
+ *  readers see either the old file or the complete new one.
+ *
+ *  The table of uploads is a fixed array in shared memory, set up by
+ *  upload_init() before rfserver -P forks its shard processes: the
+ *  parts of one upload may land on any of them.  Lookups hand back a
+ *  private copy of the entry.
+ * ------------------------------------------------------------------ */
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include "common.h"
+#include <stdint.h>
+#include <time.h>
+
+typedef struct {
+    unsigned long long  off, end;       /* [off, end) */
+} upload_range_t;
+
+typedef struct upload {
+    uint64_t            id;
+    char                remote[BUF_SIZE];
+    char                tmp[BUF_SIZE + 64];
+    unsigned long long  size;
+    unsigned long long  received;       /* bytes of all parts */
+    time_t              last_active;
+    int                 perm_first;     /* PUT_BEGIN created the path's permission */
+    int                 ndone;
+    upload_range_t      done[UPLOAD_RANGES];    /* received; sorted, merged */
+    int                 nbusy;
+    upload_range_t      busy[UPLOAD_PARTS];     /* parts being written */
+} upload_t;
+
+/* Hidden temp path ".<base>.<tag>.<id>" beside full, for content that
+ * is published later with rename(). */
+void upload_tmp_path(char *out, size_t cap, const char *full,
+                     const char *tag, uint64_t id);
+
+uint64_t upload_new_id(void);
+
+/* Map the shared upload table (before any fork).  0 or -1. */
+int upload_init(void);
+
+/* Is base (a file name without directory) one of our temp files? */
+int upload_is_tmp(const char *base);
+
+/* Delete temp files a crash left below data_dir (call at start-up). */
+void upload_sweep(const char *data_dir);
+
+/* Register a new upload of `size` bytes for remote (full path `full`)
+ * and create its temp file.  perm_first: this upload created remote's
+ * permission entry, to be removed again if it never commits.  NULL on
+ * failure or when all UPLOAD_SLOTS are taken.  Every upload_t handed
+ * out is a copy; free it with upload_release(). */
+upload_t *upload_begin(const char *remote, const char *full,
+                       unsigned long long size, int perm_first);
+
+/* Copy of upload id, or NULL. */
+upload_t *upload_get(uint64_t id);
+void      upload_release(upload_t *u);
+
+/* Mark upload id as still in use, so upload_expire() leaves it alone
+ * while a long part is arriving. */
+void      upload_touch(uint64_t id);
+
+/* Reserve [off, off + n) of upload id for a part about to be written.
+ * 0 when reserved; 1 if all of it was received already (a retried
+ * part: nothing to write); -1 if it overlaps bytes received or being
+ * written, or the upload is too fragmented to track another range. */
+int       upload_claim(uint64_t id, unsigned long long off, unsigned long long n);
+
+/* Drop the claim on [off, off + n); ok counts its bytes as received. */
+void      upload_settle(uint64_t id, unsigned long long off,
+                        unsigned long long n, int ok);
+
+/* Has every byte of u been received, with no part still being written? */
+int       upload_complete(const upload_t *u);
+
+/* Remove id from the table (commit/abort) and return its last state. */
+upload_t *upload_take(uint64_t id);
+
+/* Abort uploads idle for longer than max_idle seconds (and drop the
+ * permission entries they created). */
+void upload_expire(time_t max_idle);
+
+#endif // UPLOAD_H
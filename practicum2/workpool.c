@@ -0,0 +1,56 @@
+/* --------------------------------------------------------------------
+ *  workpool.c  –  FIFO job queue served by a fixed set of threads
+ * ------------------------------------------------------------------ */
+#include "workpool.h"
+#include "common.h"
+
+typedef struct job {
+    void      (*fn)(void *);
+    void       *arg;
+    struct job *next;
+} job_t;
+
+static job_t          *g_head, *g_tail;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  g_more = PTHREAD_COND_INITIALIZER;
+
+static void *worker(void *unused)
+{
+    (void)unused;
+    for (;;) {
+        pthread_mutex_lock(&g_lock);
+        while (!g_head) pthread_cond_wait(&g_more, &g_lock);
+        job_t *j = g_head;
+        g_head = j->next;
+        if (!g_head) g_tail = NULL;
+        pthread_mutex_unlock(&g_lock);
+
+        j->fn(j->arg);
+        free(j);
+    }
+    return NULL;
+}
+
+int workpool_init(int n)
+{
+    for (int i = 0; i < n; ++i) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker, NULL) != 0) return -1;
+        pthread_detach(tid);
+    }
+    return 0;
+}
+
+void workpool_submit(void (*fn)(void *), void *arg)
+{
+    job_t *j = malloc(sizeof(*j));
+    if (!j) { fn(arg); return; }            /* degrade to inline */
+    j->fn   = fn;
+    j->arg  = arg;
+    j->next = NULL;
+    pthread_mutex_lock(&g_lock);
+    if (g_tail) g_tail->next = j; else g_head = j;
+    g_tail = j;
+    pthread_cond_signal(&g_more);
+    pthread_mutex_unlock(&g_lock);
+}
@@ -0,0 +1,18 @@
+/* --------------------------------------------------------------------
+ *  workpool.h  –  shared pool of I/O worker threads
+ *
+ *  Batch commands (MGET/MPUT) hand their per-file disk work to these
+ *  threads, so one request keeps several reads or writes in flight
+ *  while its client thread stays on the socket.  Jobs must not wait
+ *  for other jobs; callers track completion of their own jobs.
+ * ------------------------------------------------------------------ */
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+/* Start n worker threads (call once). */
+int  workpool_init(int n);
+
+/* Queue fn(arg) for a worker; never blocks. */
+void workpool_submit(void (*fn)(void *), void *arg);
+
+#endif // WORKPOOL_H
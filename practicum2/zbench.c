@@ -0,0 +1,205 @@
+/* --------------------------------------------------------------------
+ *  zbench.c  –  payload compression: codec speed and effective
+ *               transfer rate with and without "HELLO compress=lz"
+ *
+ *  For every input file: compression ratio and lz speed in memory,
+ *  then a WRITE and <reps> GETs of it against a running rfserver,
+ *  once plain and once compressed, reported as raw MB/s.
+ *
+ *  The interesting case is a slow link.  Shape the loopback with tc
+ *  (see README), or let -b pace this client's socket to MB/s of wire
+ *  bytes where tc is unavailable: TCP flow control then holds the
+ *  server to the same rate.
+ *
+ *  usage: zbench [-n reps] [-b wire_MB/s] file...
+ * ------------------------------------------------------------------ */
+#include "proto.h"
+#include "lz.h"
+
+#include <netinet/tcp.h>
+#include <time.h>
+
+static int    g_reps = 3;
+static double g_rate = 0;               /* -b: wire bytes/s, 0 = unpaced */
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* sleep until `bytes` wire bytes since t0 fit under g_rate */
+static void pace(double t0, unsigned long long bytes)
+{
+    if (g_rate <= 0) return;
+    double ahead = t0 + bytes / g_rate - now_sec();
+    if (ahead > 0) {
+        struct timespec ts = { (time_t)ahead, (long)((ahead - (time_t)ahead) * 1e9) };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static unsigned long long wire_bytes(void)
+{
+    unsigned long long in, out;
+    proto_bytes(&in, &out);
+    return in + out;
+}
+
+static int connect_to(conn_t *c, int compress)
+{
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0) return -1;
+    struct sockaddr_in a = {0};
+    a.sin_family = AF_INET;
+    a.sin_port   = htons(PORT);
+    inet_pton(AF_INET, "127.0.0.1", &a.sin_addr);
+    int one = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (g_rate > 0) {
+        /* a small window keeps the pacing honest */
+        int win = 64 * 1024;
+        setsockopt(s, SOL_SOCKET, SO_RCVBUF, &win, sizeof(win));
+        setsockopt(s, SOL_SOCKET, SO_SNDBUF, &win, sizeof(win));
+    }
+    if (connect(s, (struct sockaddr *)&a, sizeof(a)) < 0) { close(s); return -1; }
+    conn_init(c, s);
+    if (!compress) return 0;
+
+    char line[MAX_LINE];
+    if (send_line(s, "HELLO compress=lz") < 0 ||
+        conn_read_line(c, line, sizeof(line)) < 0 ||
+        strcmp(line, "HELLO_OK compress=lz") != 0 || conn_compress(c) < 0) {
+        fprintf(stderr, "zbench: server declined compression\n");
+        close(s);
+        return -1;
+    }
+    return 0;
+}
+
+/* WRITE data as remote; raw MB/s, or -1 */
+static double bench_write(conn_t *c, const char *remote, const char *data, size_t n)
+{
+    char line[MAX_LINE];
+    double t0 = now_sec();
+    unsigned long long w0 = wire_bytes();
+    if (send_line(c->fd, "WRITE zbench %s size=%zu", remote, n) < 0 ||
+        conn_read_line(c, line, sizeof(line)) < 0 ||
+        strcmp(line, "OK_READY_TO_RECEIVE") != 0)
+        return -1;
+    for (size_t off = 0; off < n; off += XFER_BUF) {
+        size_t k = n - off < XFER_BUF ? n - off : XFER_BUF;
+        if (send_payload(c, data + off, k) < 0) return -1;
+        pace(t0, wire_bytes() - w0);
+    }
+    if (conn_read_line(c, line, sizeof(line)) < 0 || strncmp(line, "WRITE_OK", 8) != 0)
+        return -1;
+    return n / (now_sec() - t0) / 1e6;
+}
+
+/* GET remote g_reps times; raw MB/s, or -1 */
+static double bench_get(conn_t *c, const char *remote, char *buf, size_t n)
+{
+    char line[MAX_LINE];
+    double t0 = now_sec();
+    unsigned long long w0 = wire_bytes();
+    for (int i = 0; i < g_reps; ++i) {
+        if (send_line(c->fd, "GET %s -", remote) < 0 ||
+            conn_read_line(c, line, sizeof(line)) < 0 ||
+            strncmp(line, "OK_SENDING_FILE", 15) != 0)
+            return -1;
+        for (size_t got = 0; got < n; ) {
+            ssize_t k = conn_read_payload(c, buf + got, n - got);
+            if (k <= 0) return -1;
+            got += (size_t)k;
+            pace(t0, wire_bytes() - w0);
+        }
+    }
+    return (double)n * g_reps / (now_sec() - t0) / 1e6;
+}
+
+static int bench_file(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) { perror(path); return -1; }
+    fseek(fp, 0, SEEK_END);
+    size_t n = (size_t)ftell(fp);
+    rewind(fp);
+    char *data = malloc(n + 1), *back = malloc(n + 1);
+    char *z = malloc(LZ_MAX_BLOCK + 1024);
+    if (!data || !back || !z || fread(data, 1, n, fp) != n) {
+        fprintf(stderr, "zbench: cannot read %s\n", path);
+        fclose(fp);
+        free(data); free(back); free(z);
+        return -1;
+    }
+    fclose(fp);
+
+    /* codec alone, block by block as on the wire */
+    size_t packed = 0;
+    double tc = 0, td = 0;
+    for (size_t off = 0; off < n; off += LZ_MAX_BLOCK) {
+        size_t k = n - off < LZ_MAX_BLOCK ? n - off : LZ_MAX_BLOCK;
+        double t0 = now_sec();
+        size_t w = lz_compress(data + off, k, z, k - k / 16);
+        double t1 = now_sec();
+        if (w && lz_decompress(z, w, back + off, k) < 0) {
+            fprintf(stderr, "zbench: round trip failed in %s\n", path);
+            return -1;
+        }
+        td += now_sec() - t1;
+        tc += t1 - t0;
+        packed += (w ? w : k) + 8;
+    }
+
+    const char *base = strrchr(path, '/');
+    char remote[BUF_SIZE];
+    snprintf(remote, sizeof(remote), "zb_%s", base ? base + 1 : path);
+
+    double mb[2][2];                        /* [compress][write, get] */
+    for (int zc = 0; zc < 2; ++zc) {
+        conn_t c;
+        if (connect_to(&c, zc) < 0) {
+            fprintf(stderr, "zbench: cannot reach rfserver on port %d\n", PORT);
+            return -1;
+        }
+        mb[zc][0] = bench_write(&c, remote, data, n);
+        mb[zc][1] = bench_get(&c, remote, back, n);
+        send_line(c.fd, "RM %s", remote);
+        close(c.fd);
+        conn_release(&c);
+    }
+    printf("%-24.24s %10zu %6.2fx %8.0f %8.0f   %8.1f %8.1f   %8.1f %8.1f\n",
+           base ? base + 1 : path, n, (double)n / (packed ? packed : 1),
+           n / (tc > 0 ? tc : 1e-9) / 1e6, n / (td > 0 ? td : 1e-9) / 1e6,
+           mb[0][0], mb[1][0], mb[0][1], mb[1][1]);
+    free(data); free(back); free(z);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int ch;
+    while ((ch = getopt(argc, argv, "n:b:")) != -1) {
+        switch (ch) {
+        case 'n': g_reps = atoi(optarg); break;
+        case 'b': g_rate = atof(optarg) * 1e6; break;
+        default:
+            fprintf(stderr, "usage: %s [-n reps] [-b wire_MB/s] file...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || g_reps < 1) {
+        fprintf(stderr, "usage: %s [-n reps] [-b wire_MB/s] file...\n", argv[0]);
+        return 1;
+    }
+    if (g_rate > 0) printf("client paced to %.1f MB/s of wire bytes\n", g_rate / 1e6);
+    else            printf("unpaced (shape the link with tc for a slow-link run)\n");
+    printf("%-24s %10s %7s %8s %8s   %8s %8s   %8s %8s\n", "file", "bytes",
+           "ratio", "lz MB/s", "unlz", "WRITE", "WRITE -z", "GET", "GET -z");
+    int rc = 0;
+    for (int i = optind; i < argc; ++i)
+        if (bench_file(argv[i]) < 0) rc = 1;
+    return rc;
+}
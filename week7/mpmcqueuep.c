@@ -0,0 +1,280 @@
+/*
+ * mpmcqueuep.c
+ * Lock-free bounded MPMC queue (per-slot sequence numbers) with a
+ * sleeping slow path.
+ *
+ * enq_pos and deq_pos count slots ever claimed by producers / consumers.
+ * Slot i % size starts with seq = 2i.  A producer at pos may fill the
+ * slot when seq == 2pos: it claims pos with a CAS on enq_pos, stores the
+ * value, then releases seq = 2pos + 1.  A consumer at pos may empty it
+ * when seq == 2pos + 1, and hands it to the producer of the next lap
+ * with seq = 2(pos + size).  (The usual pos / pos + 1 numbering cannot
+ * tell full from empty when size is 1.)  seq below what a side expects
+ * means full / empty; above it means another thread got there first
+ * and the side reloads its position.  Positions are 64-bit so they
+ * never wrap and the queue holds exactly capacity items (slot is a
+ * mask when capacity is a power of two, a modulo otherwise).
+ */
+
+ #include <stdio.h>
+ #include <stdlib.h>
+ #include <pthread.h>
+ #include <sched.h>
+ #include <stdatomic.h>
+ #include <unistd.h>
+ #ifdef __linux__
+ #include <sys/syscall.h>
+ #include <linux/membarrier.h>
+ #endif
+ #include "mpmcqueuep.h"
+
+ #define CACHE_LINE 64
+ #define SPIN_TRIES  200  // failed tries before yielding
+                          // (none on one CPU: nobody else can run)
+ #define YIELD_TRIES 4    // sched_yield()s before sleeping
+
+ typedef struct {
+     _Atomic unsigned long long seq;
+     int value;
+ } cell_t;
+
+ // Threads asleep on one condition.  pending counts signals sent that
+ // no sleeper has woken up for yet, so a waker signals only while
+ // waiters > pending instead of on every item until the sleeper runs.
+ typedef struct {
+     _Atomic int waiters;
+     _Atomic int pending;
+ } waitcount_t;
+
+ struct mpmcqueue {
+     // each position on its own line: producers hammer one, consumers
+     // the other
+     _Alignas(CACHE_LINE) _Atomic unsigned long long enq_pos;
+     _Alignas(CACHE_LINE) _Atomic unsigned long long deq_pos;
+
+     // read by every put and get, written only on the sleeping path
+     _Alignas(CACHE_LINE) cell_t* cells;
+     unsigned long long size;
+     unsigned long long mask;       // size - 1 if size is a power of two, else 0
+     int spin;                      // failed tries before yielding (0 on one CPU)
+     int asym;                      // membarrier() stands in for the waker's fence
+     waitcount_t put_wait;          // producers asleep (full)
+     waitcount_t get_wait;          // consumers asleep (empty)
+
+     pthread_mutex_t mutex;
+     pthread_cond_t  not_full;
+     pthread_cond_t  not_empty;
+ };
+
+ static inline void cpu_relax(void) {
+ #if defined(__x86_64__) || defined(__i386__)
+     __builtin_ia32_pause();
+ #elif defined(__aarch64__)
+     __asm__ __volatile__("yield");
+ #endif
+ }
+
+ // As in spscqueuep.c: the sleeper pays for the store/load fence with
+ // membarrier() so the waker, which runs on every put and get, needs
+ // only a compiler barrier.
+ static int g_asym;
+ static pthread_once_t g_asym_once = PTHREAD_ONCE_INIT;
+
+ static void asym_register(void) {
+ #if defined(__linux__) && defined(__NR_membarrier)
+     g_asym = syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+ #endif
+ }
+
+ static void sleeper_fence(mpmcqueue_t* mq) {
+     atomic_thread_fence(memory_order_seq_cst);
+ #if defined(__linux__) && defined(__NR_membarrier)
+     if (mq->asym) syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+ #endif
+ }
+
+ static void waker_fence(mpmcqueue_t* mq) {
+     if (mq->asym) atomic_signal_fence(memory_order_seq_cst);
+     else          atomic_thread_fence(memory_order_seq_cst);
+ }
+
+ mpmcqueue_t* mpmcqueueinit(int capacity) {
+     if (capacity < 1) return NULL;
+
+     mpmcqueue_t* mq = (mpmcqueue_t*)aligned_alloc(CACHE_LINE, sizeof(mpmcqueue_t));
+     if (!mq) return NULL;
+     mq->cells = (cell_t*)malloc(sizeof(cell_t) * capacity);
+     if (!mq->cells) {
+         free(mq);
+         return NULL;
+     }
+     for (int i = 0; i < capacity; i++) {
+         atomic_init(&mq->cells[i].seq, 2ULL * i);
+     }
+     atomic_init(&mq->enq_pos, 0);
+     atomic_init(&mq->deq_pos, 0);
+     mq->size = (unsigned long long)capacity;
+     mq->mask = (capacity & (capacity - 1)) == 0 ? mq->size - 1 : 0;
+     mq->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_TRIES : 0;
+     pthread_once(&g_asym_once, asym_register);
+     mq->asym = g_asym;
+     atomic_init(&mq->put_wait.waiters, 0);
+     atomic_init(&mq->put_wait.pending, 0);
+     atomic_init(&mq->get_wait.waiters, 0);
+     atomic_init(&mq->get_wait.pending, 0);
+
+     pthread_mutex_init(&mq->mutex, NULL);
+     pthread_cond_init(&mq->not_full, NULL);
+     pthread_cond_init(&mq->not_empty, NULL);
+     return mq;
+ }
+
+ static inline cell_t* cell_at(mpmcqueue_t* mq, unsigned long long pos) {
+     return &mq->cells[mq->mask ? pos & mq->mask : pos % mq->size];
+ }
+
+ // Put without blocking; 0 if the queue is full
+ static int try_put(mpmcqueue_t* mq, int value) {
+     unsigned long long pos = atomic_load_explicit(&mq->enq_pos, memory_order_relaxed);
+     cell_t* cell;
+     for (;;) {
+         cell = cell_at(mq, pos);
+         unsigned long long seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+         long long dif = (long long)(seq - 2 * pos);
+         if (dif == 0) {
+             // on failure the CAS reloads pos for the next try
+             if (atomic_compare_exchange_weak_explicit(&mq->enq_pos, &pos, pos + 1,
+                                                       memory_order_relaxed,
+                                                       memory_order_relaxed)) break;
+         } else if (dif < 0) {
+             return 0;   // slot not yet emptied from the previous lap
+         } else {
+             pos = atomic_load_explicit(&mq->enq_pos, memory_order_relaxed);
+         }
+     }
+     cell->value = value;
+     atomic_store_explicit(&cell->seq, 2 * pos + 1, memory_order_release);
+     return 1;
+ }
+
+ // Get without blocking; 0 if the queue is empty
+ static int try_get(mpmcqueue_t* mq, int* value) {
+     unsigned long long pos = atomic_load_explicit(&mq->deq_pos, memory_order_relaxed);
+     cell_t* cell;
+     for (;;) {
+         cell = cell_at(mq, pos);
+         unsigned long long seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+         long long dif = (long long)(seq - (2 * pos + 1));
+         if (dif == 0) {
+             if (atomic_compare_exchange_weak_explicit(&mq->deq_pos, &pos, pos + 1,
+                                                       memory_order_relaxed,
+                                                       memory_order_relaxed)) break;
+         } else if (dif < 0) {
+             return 0;   // slot not yet filled
+         } else {
+             pos = atomic_load_explicit(&mq->deq_pos, memory_order_relaxed);
+         }
+     }
+     *value = cell->value;
+     atomic_store_explicit(&cell->seq, 2 * (pos + mq->size), memory_order_release);
+     return 1;
+ }
+
+ // Would a put / get find nothing to do right now?
+ static int is_full(mpmcqueue_t* mq) {
+     unsigned long long pos = atomic_load_explicit(&mq->enq_pos, memory_order_relaxed);
+     unsigned long long seq = atomic_load_explicit(&cell_at(mq, pos)->seq, memory_order_relaxed);
+     return (long long)(seq - 2 * pos) < 0;
+ }
+
+ static int is_empty(mpmcqueue_t* mq) {
+     unsigned long long pos = atomic_load_explicit(&mq->deq_pos, memory_order_relaxed);
+     unsigned long long seq = atomic_load_explicit(&cell_at(mq, pos)->seq, memory_order_relaxed);
+     return (long long)(seq - (2 * pos + 1)) < 0;
+ }
+
+ // Sleep while blocked(mq).  The sleeper counts itself in before it
+ // checks the queue, and a waker publishes its slot before it reads the
+ // count, each with a fence in between, so no wakeup is lost.  A thread
+ // woken by a signal takes it off pending before checking again, which
+ // makes it count as unsignalled if it has to go back to sleep.
+ static void park(mpmcqueue_t* mq, waitcount_t* wc, pthread_cond_t* cond,
+                  int (*blocked)(mpmcqueue_t*)) {
+     pthread_mutex_lock(&mq->mutex);
+     atomic_fetch_add_explicit(&wc->waiters, 1, memory_order_relaxed);
+     for (;;) {
+         sleeper_fence(mq);
+         if (!blocked(mq)) break;
+         pthread_cond_wait(cond, &mq->mutex);
+         if (atomic_load_explicit(&wc->pending, memory_order_relaxed) > 0) {
+             atomic_fetch_sub_explicit(&wc->pending, 1, memory_order_relaxed);
+         }
+     }
+     atomic_fetch_sub_explicit(&wc->waiters, 1, memory_order_relaxed);
+     pthread_mutex_unlock(&mq->mutex);
+ }
+
+ // Wake one sleeper on the other side, if any has no signal on its way.
+ // Called after publishing a slot.
+ static void unpark(mpmcqueue_t* mq, waitcount_t* wc, pthread_cond_t* cond) {
+     waker_fence(mq);
+     if (atomic_load_explicit(&wc->waiters, memory_order_relaxed) >
+         atomic_load_explicit(&wc->pending, memory_order_relaxed)) {
+         // every counted sleeper holds the mutex until it is inside cond_wait
+         pthread_mutex_lock(&mq->mutex);
+         if (atomic_load_explicit(&wc->waiters, memory_order_relaxed) >
+             atomic_load_explicit(&wc->pending, memory_order_relaxed)) {
+             atomic_fetch_add_explicit(&wc->pending, 1, memory_order_relaxed);
+             pthread_cond_signal(cond);
+         }
+         pthread_mutex_unlock(&mq->mutex);
+     }
+ }
+
+ void mpmcput(mpmcqueue_t* mq, int value) {
+     int tries = 0;
+     while (!try_put(mq, value)) {
+         if (++tries < mq->spin) {
+             cpu_relax();
+         } else if (tries < mq->spin + YIELD_TRIES) {
+             sched_yield();   // let consumers drain a batch
+         } else {
+             park(mq, &mq->put_wait, &mq->not_full, is_full);
+         }
+     }
+     unpark(mq, &mq->get_wait, &mq->not_empty);
+ }
+
+ int mpmcget(mpmcqueue_t* mq) {
+     int value;
+     int tries = 0;
+     while (!try_get(mq, &value)) {
+         if (++tries < mq->spin) {
+             cpu_relax();
+         } else if (tries < mq->spin + YIELD_TRIES) {
+             sched_yield();   // let producers fill a batch
+         } else {
+             park(mq, &mq->get_wait, &mq->not_empty, is_empty);
+         }
+     }
+     unpark(mq, &mq->put_wait, &mq->not_full);
+     return value;
+ }
+
+ #ifdef MPMC_AS_PQUEUE
+ // Drop-in for pqueuep.c + queuep.c: pqueue_t stays opaque to callers,
+ // so it can simply be an mpmcqueue_t.
+ #include "pqueuep.h"
+
+ pqueue_t* pqueueinit(int capacity) {
+     return (pqueue_t*)mpmcqueueinit(capacity);
+ }
+
+ void pput(pqueue_t* pq, int value) {
+     mpmcput((mpmcqueue_t*)pq, value);
+ }
+
+ int pget(pqueue_t* pq) {
+     return mpmcget((mpmcqueue_t*)pq);
+ }
+ #endif
@@ -0,0 +1,32 @@
+/*
+ * mpmcqueuep.h
+ * Interface for a lock-free bounded multi-producer / multi-consumer queue.
+ *
+ * Same contract as pqueue_t: any number of threads may put and get,
+ * put blocks while the queue is full and get while it is empty.  Each
+ * slot carries a sequence number (Dmitry Vyukov's bounded MPMC queue),
+ * so a put or get is one compare-and-swap on a shared position plus
+ * acquire/release on its own slot, and never takes a lock while the
+ * queue is neither full nor empty.  A thread that has to wait spins
+ * briefly, then sleeps on a condition variable.
+ *
+ * Built with -DMPMC_AS_PQUEUE, mpmcqueuep.c also provides pqueueinit /
+ * pput / pget from pqueuep.h, so it can replace pqueuep.c + queuep.c
+ * in a program without changing the program (see pqueuepmain_mpmc).
+ */
+
+ #ifndef MPMCQUEUEP_H
+ #define MPMCQUEUEP_H
+
+ typedef struct mpmcqueue mpmcqueue_t;
+
+ // Initialize a queue that holds at most capacity items
+ mpmcqueue_t* mpmcqueueinit(int capacity);
+
+ // Put an integer into the queue (blocks if full)
+ void mpmcput(mpmcqueue_t* mq, int value);
+
+ // Get an integer from the queue (blocks if empty)
+ int mpmcget(mpmcqueue_t* mq);
+
+ #endif
@@ -0,0 +1,285 @@
+/*
+ * qbench.c
+ * Throughput of the bounded queues: producer threads hand <items>
+ * integers to consumer threads through each queue in turn, and the
+ * consumers check that every item arrives exactly once and that each
+ * producer's items arrive in order.
+ *
+ *   pqueue   mutex + one condition variable (pqueuep.c)
+ *   spsc     lock-free single-producer/single-consumer ring (spscqueuep.c)
+ *   mpmc     lock-free multi-producer/multi-consumer queue (mpmcqueuep.c)
+ *
+ * Compile and run:
+ *   make qbench
+ *   ./qbench [-n items] [-c capacity] [-r rounds]      1 producer -> 1 consumer
+ *   ./qbench -t 1,2,4,8,16,32,64 [-n ...] [-c ...] [-r ...]
+ *
+ * -t runs pqueue and mpmc at each total thread count: half producers,
+ * half consumers, and 1 meaning one thread that puts then gets.
+ *
+ * On a 1-CPU VM, 10M items: capacity 1024, pqueue 87-118 ns/item and
+ * spsc 11 ns/item; capacity 15 (pqueuepmain's), 540-720 vs. 130.
+ * With one CPU the two threads take turns, so the gain is the missing
+ * lock and wakeup per item, and filling/draining a batch per turn;
+ * on separate cores the padded indices keep the sides from sharing
+ * a cache line as well.
+ *
+ * mpmc comes in at about 3x pqueue there (two compare-and-swaps per
+ * item, where spsc has none).
+ *
+ * Scaling on the same VM, -n 2000000, Mitems/s:
+ *
+ *              capacity 1024        capacity 15
+ *   threads   pqueue    mpmc      pqueue    mpmc
+ *      1        11.0    22.8         8.8    16.2
+ *      2         5.1    13.8         0.8     3.2
+ *      4         4.6    15.0         0.6     3.2
+ *      8         4.5    13.6         0.5     2.6
+ *     16         4.2    11.1         0.4     2.4
+ *     32         3.2    11.4         0.3     2.1
+ *     64         3.0     9.6         0.3     2.3
+ *
+ * i.e. 2-3.6x at capacity 1024, and at capacity 15 4x growing to 7x
+ * with the thread count.  Every thread is time-sliced on the one core, so
+ * this shows what preemption and handoff cost each design (a preempted
+ * mutex holder stalls every other thread; a preempted mpmc thread
+ * stalls only the one slot it claimed), not cross-core contention on
+ * the mutex; rerun on a many-core machine for that.
+ */
+
+ #include <stdio.h>
+ #include <stdlib.h>
+ #include <string.h>
+ #include <unistd.h>
+ #include <pthread.h>
+ #include <stdatomic.h>
+ #include <time.h>
+
+ #include "pqueuep.h"
+ #include "spscqueuep.h"
+ #include "mpmcqueuep.h"
+
+ #define MAX_THREADS 1024
+
+ // One queue implementation behind a common face
+ typedef struct {
+     const char* name;
+     int   multi;     // safe with several producers / consumers
+     void* (*init)(int capacity);
+     void  (*put)(void* q, int value);
+     int   (*get)(void* q);
+ } qimpl_t;
+
+ static void* p_init(int capacity)    { return pqueueinit(capacity); }
+ static void  p_put(void* q, int v)   { pput((pqueue_t*)q, v); }
+ static int   p_get(void* q)          { return pget((pqueue_t*)q); }
+ static void* s_init(int capacity)    { return spscqueueinit(capacity); }
+ static void  s_put(void* q, int v)   { spscput((spscqueue_t*)q, v); }
+ static int   s_get(void* q)          { return spscget((spscqueue_t*)q); }
+ static void* m_init(int capacity)    { return mpmcqueueinit(capacity); }
+ static void  m_put(void* q, int v)   { mpmcput((mpmcqueue_t*)q, v); }
+ static int   m_get(void* q)          { return mpmcget((mpmcqueue_t*)q); }
+
+ static const qimpl_t impls[] = {
+     { "pqueue", 1, p_init, p_put, p_get },
+     { "spsc",   0, s_init, s_put, s_get },
+     { "mpmc",   1, m_init, m_put, m_get },
+ };
+
+ // Producer p puts values i * nprod + p for i = 0, 1, ...
+ typedef struct {
+     const qimpl_t* impl;
+     void* q;
+     int   nprod;
+     int   ncons;
+     int   per_prod;                // items each producer puts
+     int   total;                   // nprod * per_prod
+     _Atomic unsigned char* seen;   // seen[v]: value v already came out
+     _Atomic int errors;            // items duplicated or out of order
+ } run_t;
+
+ typedef struct {
+     run_t* r;
+     int    id;
+ } worker_t;
+
+ static double now_sec(void) {
+     struct timespec ts;
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+     return ts.tv_sec + ts.tv_nsec / 1e9;
+ }
+
+ static void* producer(void* arg) {
+     worker_t* w = (worker_t*)arg;
+     run_t* r = w->r;
+     for (int i = 0; i < r->per_prod; i++) {
+         r->impl->put(r->q, i * r->nprod + w->id);
+     }
+     return NULL;
+ }
+
+ static void* consumer(void* arg) {
+     worker_t* w = (worker_t*)arg;
+     run_t* r = w->r;
+     int n = r->total / r->ncons + (w->id < r->total % r->ncons);
+     int* last = (int*)malloc(sizeof(int) * r->nprod);   // last i seen per producer
+     int errors = 0;
+     for (int p = 0; p < r->nprod; p++) last[p] = -1;
+     for (int k = 0; k < n; k++) {
+         int v = r->impl->get(r->q);
+         // plain load/store rather than an exchange: a locked instruction
+         // per item would cost as much as some of the queues being timed
+         if (v < 0 || v >= r->total ||
+             atomic_load_explicit(&r->seen[v], memory_order_relaxed)) {
+             errors++;
+             continue;
+         }
+         atomic_store_explicit(&r->seen[v], 1, memory_order_relaxed);
+         int p = v % r->nprod, i = v / r->nprod;
+         if (i <= last[p]) errors++;
+         last[p] = i;
+     }
+     free(last);
+     atomic_fetch_add(&r->errors, errors);
+     return NULL;
+ }
+
+ // One thread alternately puts and gets
+ static void* solo(void* arg) {
+     worker_t* w = (worker_t*)arg;
+     run_t* r = w->r;
+     int errors = 0;
+     for (int i = 0; i < r->total; i++) {
+         r->impl->put(r->q, i);
+         if (r->impl->get(r->q) != i) errors++;
+     }
+     atomic_fetch_add(&r->errors, errors);
+     return NULL;
+ }
+
+ // Seconds for one run with nthreads threads in all, or -1 if the items
+ // came out wrong
+ static double run_once(const qimpl_t* impl, int items, int capacity, int nthreads) {
+     run_t r;
+     memset(&r, 0, sizeof(r));
+     r.impl = impl;
+     r.q = impl->init(capacity);
+     if (!r.q) return -1;
+     r.nprod = nthreads > 1 ? nthreads / 2 : 1;
+     r.ncons = nthreads > 1 ? nthreads - r.nprod : 0;
+     r.per_prod = items / r.nprod;
+     r.total = r.per_prod * r.nprod;
+     r.seen = (_Atomic unsigned char*)calloc(r.total, 1);
+     if (!r.seen) return -1;
+     atomic_init(&r.errors, 0);
+
+     pthread_t tids[MAX_THREADS];
+     worker_t ws[MAX_THREADS];
+     double t0 = now_sec();
+     if (nthreads == 1) {
+         ws[0] = (worker_t){ &r, 0 };
+         pthread_create(&tids[0], NULL, solo, &ws[0]);
+     } else {
+         for (int c = 0; c < r.ncons; c++) {
+             ws[c] = (worker_t){ &r, c };
+             pthread_create(&tids[c], NULL, consumer, &ws[c]);
+         }
+         for (int p = 0; p < r.nprod; p++) {
+             ws[r.ncons + p] = (worker_t){ &r, p };
+             pthread_create(&tids[r.ncons + p], NULL, producer, &ws[r.ncons + p]);
+         }
+     }
+     for (int t = 0; t < nthreads; t++) {
+         pthread_join(tids[t], NULL);
+     }
+     double dt = now_sec() - t0;
+     free((void*)r.seen);
+     // the queues have no destroy call; one leaked queue per run is fine here
+     return atomic_load(&r.errors) ? -1 : dt;
+ }
+
+ // Best time of rounds runs; exits if any run goes wrong
+ static double best_of(const qimpl_t* impl, int items, int capacity, int nthreads,
+                       int rounds) {
+     double best = 1e9;
+     for (int i = 0; i < rounds; i++) {
+         double dt = run_once(impl, items, capacity, nthreads);
+         if (dt < 0) {
+             fprintf(stderr, "%s, %d threads: items lost, duplicated or out of order\n",
+                     impl->name, nthreads);
+             exit(1);
+         }
+         if (dt < best) best = dt;
+     }
+     return best;
+ }
+
+ int main(int argc, char* argv[]) {
+     int items = 10000000, capacity = 1024, rounds = 3;
+     int threads[64], nlevels = 0;
+     int ch;
+     while ((ch = getopt(argc, argv, "n:c:r:t:")) != -1) {
+         switch (ch) {
+         case 'n': items    = atoi(optarg); break;
+         case 'c': capacity = atoi(optarg); break;
+         case 'r': rounds   = atoi(optarg); break;
+         case 't':
+             for (char* s = strtok(optarg, ","); s && nlevels < 64; s = strtok(NULL, ",")) {
+                 threads[nlevels++] = atoi(s);
+             }
+             break;
+         default:
+             fprintf(stderr, "usage: %s [-n items] [-c capacity] [-r rounds] [-t n,n,...]\n",
+                     argv[0]);
+             return 1;
+         }
+     }
+     if (items < 1 || capacity < 1 || rounds < 1) {
+         fprintf(stderr, "items, capacity and rounds must be positive\n");
+         return 1;
+     }
+     for (int l = 0; l < nlevels; l++) {
+         if (threads[l] < 1 || threads[l] > MAX_THREADS || threads[l] / 2 > items) {
+             fprintf(stderr, "thread counts must be 1..%d and at most 2 * items\n",
+                     MAX_THREADS);
+             return 1;
+         }
+     }
+
+     if (nlevels == 0) {
+         printf("1 producer -> 1 consumer, %d items, capacity %d, best of %d (%ld CPUs)\n",
+                items, capacity, rounds, sysconf(_SC_NPROCESSORS_ONLN));
+         printf("%-8s %10s %12s %10s\n", "queue", "best s", "Mitems/s", "ns/item");
+         double base = 0;
+         for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+             double best = best_of(&impls[k], items, capacity, 2, rounds);
+             if (k == 0) base = best;
+             printf("%-8s %10.3f %12.2f %10.1f   (%.1fx)\n", impls[k].name, best,
+                    items / best / 1e6, best * 1e9 / items, base / best);
+         }
+         return 0;
+     }
+
+     // Scaling: every multi-producer/multi-consumer queue at each thread count
+     printf("P producers -> P consumers, %d items, capacity %d, best of %d (%ld CPUs)\n",
+            items, capacity, rounds, sysconf(_SC_NPROCESSORS_ONLN));
+     printf("%-8s", "threads");
+     for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+         if (impls[k].multi) printf(" %12s", impls[k].name);
+     }
+     printf("   Mitems/s\n");
+     for (int l = 0; l < nlevels; l++) {
+         double base = 0, last = 0;
+         printf("%-8d", threads[l]);
+         for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+             if (!impls[k].multi) continue;
+             double best = best_of(&impls[k], items, capacity, threads[l], rounds);
+             if (base == 0) base = best;
+             last = best;
+             printf(" %12.2f", items / best / 1e6);
+             fflush(stdout);
+         }
+         printf("   (%.1fx)\n", base / last);
+     }
+     return 0;
+ }
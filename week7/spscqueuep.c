@@ -0,0 +1,201 @@
+/*
+ * spscqueuep.c
+ * Lock-free SPSC ring buffer with a sleeping slow path.
+ *
+ * head and tail count items ever taken / ever put (they wrap at 2^32,
+ * which the unsigned arithmetic absorbs).  The producer alone writes
+ * tail, the consumer alone writes head, and each lives on its own
+ * cache line together with that side's private copy of the other
+ * index, so a put or get normally reads no line the other side is
+ * writing.  The ring itself is rounded up to a power of two so a slot
+ * is (index & mask); capacity still limits how many items it holds.
+ */
+
+ #include <stdio.h>
+ #include <stdlib.h>
+ #include <pthread.h>
+ #include <sched.h>
+ #include <stdatomic.h>
+ #include <unistd.h>
+ #ifdef __linux__
+ #include <sys/syscall.h>
+ #include <linux/membarrier.h>
+ #endif
+ #include "spscqueuep.h"
+
+ #define CACHE_LINE 64
+ #define SPIN_TRIES  200  // polls of the other index before yielding
+                          // (none on one CPU: the other side cannot run)
+ #define YIELD_TRIES 4    // sched_yield()s before sleeping
+
+ struct spscqueue {
+     // producer's line; the consumer's flag is here because every put
+     // reads it, while only a consumer going to sleep writes it
+     _Alignas(CACHE_LINE) _Atomic unsigned tail;
+     unsigned head_cache;           // last head the producer saw
+     _Atomic int cons_waiting;      // consumer asleep (empty)
+
+     // consumer's line
+     _Alignas(CACHE_LINE) _Atomic unsigned head;
+     unsigned tail_cache;           // last tail the consumer saw
+     _Atomic int prod_waiting;      // producer asleep (full)
+
+     // read-only after init, and the sleeping slow path
+     _Alignas(CACHE_LINE) int* data;
+     unsigned mask;
+     unsigned capacity;
+     int spin;                      // polls before yielding (0 on one CPU)
+     int asym;                      // membarrier() stands in for the waker's fence
+     pthread_mutex_t mutex;
+     pthread_cond_t  not_full;
+     pthread_cond_t  not_empty;
+ };
+
+ static inline void cpu_relax(void) {
+ #if defined(__x86_64__) || defined(__i386__)
+     __builtin_ia32_pause();
+ #elif defined(__aarch64__)
+     __asm__ __volatile__("yield");
+ #endif
+ }
+
+ // A sleeper and a waker must each put a full fence between their store
+ // (flag / index) and their load (index / flag).  The waker runs on
+ // every put and get, the sleeper rarely, so where the kernel allows
+ // the sleeper issues membarrier(), which fences every running thread
+ // of the process, and the waker needs only a compiler barrier.
+ static int g_asym;
+ static pthread_once_t g_asym_once = PTHREAD_ONCE_INIT;
+
+ static void asym_register(void) {
+ #if defined(__linux__) && defined(__NR_membarrier)
+     g_asym = syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0;
+ #endif
+ }
+
+ static void sleeper_fence(spscqueue_t* sq) {
+     atomic_thread_fence(memory_order_seq_cst);
+ #if defined(__linux__) && defined(__NR_membarrier)
+     if (sq->asym) syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
+ #endif
+ }
+
+ static void waker_fence(spscqueue_t* sq) {
+     if (sq->asym) atomic_signal_fence(memory_order_seq_cst);
+     else          atomic_thread_fence(memory_order_seq_cst);
+ }
+
+ spscqueue_t* spscqueueinit(int capacity) {
+     if (capacity < 1) return NULL;
+     unsigned size = 1;
+     while (size < (unsigned)capacity) size <<= 1;
+
+     spscqueue_t* sq = (spscqueue_t*)aligned_alloc(CACHE_LINE, sizeof(spscqueue_t));
+     if (!sq) return NULL;
+     sq->data = (int*)malloc(sizeof(int) * size);
+     if (!sq->data) {
+         free(sq);
+         return NULL;
+     }
+     atomic_init(&sq->tail, 0);
+     atomic_init(&sq->head, 0);
+     atomic_init(&sq->prod_waiting, 0);
+     atomic_init(&sq->cons_waiting, 0);
+     sq->head_cache = 0;
+     sq->tail_cache = 0;
+     sq->mask = size - 1;
+     sq->capacity = (unsigned)capacity;
+     sq->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_TRIES : 0;
+     pthread_once(&g_asym_once, asym_register);
+     sq->asym = g_asym;
+
+     pthread_mutex_init(&sq->mutex, NULL);
+     pthread_cond_init(&sq->not_full, NULL);
+     pthread_cond_init(&sq->not_empty, NULL);
+     return sq;
+ }
+
+ // Sleep until *index moves past stale.  The flag is raised before the
+ // index is checked again, and the other side publishes its index
+ // before it looks at the flag, each with a fence in between, so one
+ // of the two always sees the other: no wakeup is lost.  The waker
+ // clears the flag, so it signals once, not on every item until this
+ // thread gets to run; it is raised again on each spurious wakeup.
+ static void park(spscqueue_t* sq, _Atomic int* waiting, _Atomic unsigned* index,
+                  unsigned stale, pthread_cond_t* cond) {
+     pthread_mutex_lock(&sq->mutex);
+     for (;;) {
+         atomic_store_explicit(waiting, 1, memory_order_relaxed);
+         sleeper_fence(sq);
+         if (atomic_load_explicit(index, memory_order_relaxed) != stale) break;
+         pthread_cond_wait(cond, &sq->mutex);
+     }
+     atomic_store_explicit(waiting, 0, memory_order_relaxed);
+     pthread_mutex_unlock(&sq->mutex);
+ }
+
+ // Wake the other side if it went to sleep.  Called after publishing.
+ static void unpark(spscqueue_t* sq, _Atomic int* waiting, pthread_cond_t* cond) {
+     waker_fence(sq);
+     if (atomic_load_explicit(waiting, memory_order_relaxed) &&
+         atomic_exchange_explicit(waiting, 0, memory_order_relaxed)) {
+         // the sleeper holds the mutex until it is inside cond_wait
+         pthread_mutex_lock(&sq->mutex);
+         pthread_cond_signal(cond);
+         pthread_mutex_unlock(&sq->mutex);
+     }
+ }
+
+ void spscput(spscqueue_t* sq, int value) {
+     unsigned tail = atomic_load_explicit(&sq->tail, memory_order_relaxed);
+
+     // Wait while full, going back to the shared head only when the
+     // cached copy says so
+     if (tail - sq->head_cache >= sq->capacity) {
+         int tries = 0;
+         for (;;) {
+             sq->head_cache = atomic_load_explicit(&sq->head, memory_order_acquire);
+             if (tail - sq->head_cache < sq->capacity) break;
+             if (++tries < sq->spin) {
+                 cpu_relax();
+             } else if (tries < sq->spin + YIELD_TRIES) {
+                 sched_yield();   // let the other side fill/drain a batch
+             } else {
+                 park(sq, &sq->prod_waiting, &sq->head, sq->head_cache, &sq->not_full);
+             }
+         }
+     }
+
+     // Fill the slot, then publish it: the release store orders the
+     // data before the new tail the consumer will acquire
+     sq->data[tail & sq->mask] = value;
+     atomic_store_explicit(&sq->tail, tail + 1, memory_order_release);
+     unpark(sq, &sq->cons_waiting, &sq->not_empty);
+ }
+
+ int spscget(spscqueue_t* sq) {
+     unsigned head = atomic_load_explicit(&sq->head, memory_order_relaxed);
+
+     // Wait while empty
+     if (head == sq->tail_cache) {
+         int tries = 0;
+         for (;;) {
+             sq->tail_cache = atomic_load_explicit(&sq->tail, memory_order_acquire);
+             if (head != sq->tail_cache) break;
+             if (++tries < sq->spin) {
+                 cpu_relax();
+             } else if (tries < sq->spin + YIELD_TRIES) {
+                 sched_yield();   // let the other side fill/drain a batch
+             } else {
+                 park(sq, &sq->cons_waiting, &sq->tail, head, &sq->not_empty);
+             }
+         }
+     }
+
+     // Take the item, then hand the slot back to the producer
+     int value = sq->data[head & sq->mask];
+     atomic_store_explicit(&sq->head, head + 1, memory_order_release);
+     unpark(sq, &sq->prod_waiting, &sq->not_full);
+
+     return value;
+ }
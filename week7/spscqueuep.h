@@ -0,0 +1,27 @@
+/*
+ * spscqueuep.h
+ * Interface for a lock-free single-producer / single-consumer queue.
+ *
+ * Same contract as pqueue_t (pput blocks while full, pget while
+ * empty), but only ONE thread may ever put and ONE thread may ever
+ * get.  The common case touches no lock: each side publishes its index
+ * with a release store and reads the other's with an acquire load.  A
+ * side that finds the queue full/empty spins briefly, then sleeps on a
+ * condition variable until the other side wakes it.
+ */
+
+ #ifndef SPSCQUEUEP_H
+ #define SPSCQUEUEP_H
+
+ typedef struct spscqueue spscqueue_t;
+
+ // Initialize a queue that holds at most capacity items
+ spscqueue_t* spscqueueinit(int capacity);
+
+ // Put an integer into the queue (blocks if full); producer thread only
+ void spscput(spscqueue_t* sq, int value);
+
+ // Get an integer from the queue (blocks if empty); consumer thread only
+ int spscget(spscqueue_t* sq);
+
+ #endif